@@ -197,6 +197,32 @@ public:
         return first_index;
     }
 
+    // Finds the first run of at least min_length unset bits at or after start, capping the
+    // reported run at max_length. Returns the start of the run, or -1 if there is none.
+    int find_next_range_of_unset_bits(int start, int min_length, int max_length, int& found_range_size) const
+    {
+        found_range_size = 0;
+        int i = start;
+        while (i < m_size) {
+            if ((i % 8) == 0 && i + 8 <= m_size && m_data[i / 8] == 0xff) {
+                i += 8;
+                continue;
+            }
+            if (get(i)) {
+                ++i;
+                continue;
+            }
+            int range_start = i;
+            while (i < m_size && i - range_start < max_length && !get(i))
+                ++i;
+            if (i - range_start >= min_length) {
+                found_range_size = i - range_start;
+                return range_start;
+            }
+        }
+        return -1;
+    }
+
     explicit Bitmap()
         : m_size(0)
         , m_owned(true)
@@ -0,0 +1,41 @@
+#include <AK/TestSuite.h>
+
+#include <AK/Bitmap.h>
+
+TEST_CASE(find_next_range_of_unset_bits)
+{
+    auto bitmap = Bitmap::create(64, true);
+    for (int i = 3; i < 5; ++i)
+        bitmap.set(i, false);
+    for (int i = 20; i < 30; ++i)
+        bitmap.set(i, false);
+
+    int size = 0;
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(0, 1, 64, size), 3);
+    EXPECT_EQ(size, 2);
+
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(0, 3, 64, size), 20);
+    EXPECT_EQ(size, 10);
+
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(0, 3, 4, size), 20);
+    EXPECT_EQ(size, 4);
+
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(25, 1, 64, size), 25);
+    EXPECT_EQ(size, 5);
+
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(0, 11, 64, size), -1);
+    EXPECT_EQ(size, 0);
+}
+
+TEST_CASE(find_next_range_of_unset_bits_at_end)
+{
+    auto bitmap = Bitmap::create(20, true);
+    for (int i = 16; i < 20; ++i)
+        bitmap.set(i, false);
+
+    int size = 0;
+    EXPECT_EQ(bitmap.find_next_range_of_unset_bits(0, 4, 20, size), 16);
+    EXPECT_EQ(size, 4);
+}
+
+TEST_MAIN(Bitmap)
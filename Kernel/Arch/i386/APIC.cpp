@@ -28,80 +28,71 @@
 #include <AK/Types.h>
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Arch/i386/APIC.h>
+#include <Kernel/Arch/i386/PIT.h>
 #include <Kernel/IO.h>
+#include <Kernel/Scheduler.h>
+#include <Kernel/StdLib.h>
 #include <Kernel/VM/MemoryManager.h>
 
-#define IRQ_APIC_SPURIOUS 0x1f
+#define IRQ_APIC_TIMER 0xfc
+#define IRQ_APIC_SPURIOUS 0xff
 
 #define APIC_BASE_MSR 0x1b
 
+#define APIC_REG_EOI 0xb0
 #define APIC_REG_LD 0xd0
 #define APIC_REG_DF 0xe0
 #define APIC_REG_SIV 0xf0
-#define APIC_REG_ICR_LOW 0x300
-#define APIC_REG_ICR_HIGH 0x310
 #define APIC_REG_LVT_TIMER 0x320
 #define APIC_REG_LVT_THERMAL 0x330
 #define APIC_REG_LVT_PERFORMANCE_COUNTER 0x340
 #define APIC_REG_LVT_LINT0 0x350
 #define APIC_REG_LVT_LINT1 0x360
 #define APIC_REG_LVT_ERR 0x370
+#define APIC_REG_TIMER_INITIAL_COUNT 0x380
+#define APIC_REG_TIMER_CURRENT_COUNT 0x390
+#define APIC_REG_TIMER_DIVIDE 0x3e0
+
+#define APIC_TIMER_DIVIDE_BY_16 0x3
 
 extern "C" void apic_spurious_interrupt_entry();
+extern "C" void apic_timer_interrupt_entry();
+extern "C" void apic_timer_interrupt_handler(RegisterDump);
 
 asm(
     ".globl apic_spurious_interrupt_entry \n"
     "apic_spurious_interrupt_entry: \n"
     "    iret\n");
 
-namespace APIC {
-
-class ICRReg
-{
-    u32 m_reg{0};
-public:
-    enum DeliveryMode
-    {
-        Fixed = 0x0,
-        LowPriority = 0x1,
-        SMI = 0x2,
-        NMI = 0x4,
-        INIT = 0x5,
-        StartUp = 0x6,
-    };
-    enum DestinationMode
-    {
-        Physical = 0x0,
-        Logical = 0x0,
-    };
-    enum Level
-    {
-        DeAssert = 0x0,
-        Assert = 0x1
-    };
-    enum class TriggerMode
-    {
-        Edge = 0x0,
-        Level = 0x1,
-    };
-    enum DestinationShorthand
-    {
-        NoShorthand = 0x0,
-        Self = 0x1,
-        AllIncludingSelf = 0x2,
-        AllExcludingSelf = 0x3,
-    };
-
-    ICRReg(u8 vector, DeliveryMode delivery_mode, DestinationMode destination_mode, Level level, TriggerMode trigger_mode, DestinationShorthand destination):
-        m_reg(vector | (delivery_mode << 8) | (destination_mode << 11) | (level << 14) | (static_cast<u32>(trigger_mode) << 15) | (destination << 18))
-    {
-    }
+asm(
+    ".globl apic_timer_interrupt_entry \n"
+    "apic_timer_interrupt_entry: \n"
+    "    pushl $0x0\n"
+    "    pusha\n"
+    "    pushl %ds\n"
+    "    pushl %es\n"
+    "    pushl %fs\n"
+    "    pushl %gs\n"
+    "    pushl %ss\n"
+    "    mov $0x10, %ax\n"
+    "    mov %ax, %ds\n"
+    "    mov %ax, %es\n"
+    "    cld\n"
+    "    call apic_timer_interrupt_handler\n"
+    "    add $0x4, %esp\n"
+    "    popl %gs\n"
+    "    popl %fs\n"
+    "    popl %es\n"
+    "    popl %ds\n"
+    "    popa\n"
+    "    add $0x4, %esp\n"
+    "    iret\n");
 
-    u32 low() const { return m_reg; }
-    u32 high() const { return 0; }
-};
+namespace APIC {
 
 static volatile u8* g_apic_base = nullptr;
+static Region* s_apic_region;
+static u64 s_timer_counts_per_second;
 
 static PhysicalAddress get_base()
 {
@@ -129,35 +120,12 @@ static void apic_write(u32 off, u32 val)
     *reinterpret_cast<volatile u32*>(&g_apic_base[off]) = val;
 }
 
-static void apic_write_icr(const ICRReg& icr)
-{
-    apic_write(APIC_REG_ICR_HIGH, icr.high());
-    apic_write(APIC_REG_ICR_LOW, icr.low());
-}
-
 #define APIC_LVT_MASKED (1 << 15)
 #define APIC_LVT_TRIGGER_LEVEL (1 << 14)
 #define APIC_LVT(iv, dm) ((iv & 0xff) | ((dm & 0x7) << 8))
 
-asm(
-    ".globl apic_ap_start \n"
-    ".type apic_ap_start, @function \n"
-    "apic_ap_start: \n"
-    ".set begin_apic_ap_start, . \n"
-    "    jmp apic_ap_start\n" // TODO: implement
-    ".set end_apic_ap_start, . \n"
-    "\n"
-    ".globl apic_ap_start_size \n"
-    "apic_ap_start_size: \n"
-    ".word end_apic_ap_start - begin_apic_ap_start \n");
-
-extern "C" void apic_ap_start(void);
-extern "C" u16 apic_ap_start_size;
-
 bool init()
 {
-    // FIXME: This code is broken and therefore isn't called. Please map everything correctly before calling this code.
-    ASSERT_NOT_REACHED();
     if (!MSR::have())
         return false;
 
@@ -167,53 +135,113 @@ bool init()
         return false;
 
     PhysicalAddress apic_base = get_base();
-    kprintf("Initializing APIC, base: P%x\n", apic_base);
+    kprintf("APIC: Local APIC base P%x\n", apic_base.get());
     set_base(apic_base);
 
-    g_apic_base = apic_base.as_ptr();
-
-    // copy ap init code to P8000
-    memcpy(reinterpret_cast<u8*>(0x8000), reinterpret_cast<const u8*>(apic_ap_start), apic_ap_start_size);
+    s_apic_region = MM.allocate_kernel_region(apic_base, PAGE_SIZE, "Local APIC", Region::Access::Read | Region::Access::Write).leak_ptr();
+    g_apic_base = s_apic_region->vaddr().as_ptr();
     return true;
 }
 
 void enable(u32 cpu)
 {
     kprintf("Enabling local APIC for cpu #%u\n", cpu);
-    
-    // set spurious interrupt vector
-    apic_write(APIC_REG_SIV, apic_read(APIC_REG_SIV) | 0x100);
-    
+
+    // set spurious interrupt vector (and software-enable the APIC)
+    apic_write(APIC_REG_SIV, 0x100 | IRQ_APIC_SPURIOUS);
+
     // local destination mode (flat mode)
     apic_write(APIC_REG_DF, 0xf000000);
-    
+
     // set destination id (note that this limits it to 8 cpus)
     apic_write(APIC_REG_LD, (1 << cpu) << 24);
-    
+
     register_interrupt_handler(IRQ_APIC_SPURIOUS, apic_spurious_interrupt_entry);
-    
+
     apic_write(APIC_REG_LVT_TIMER, APIC_LVT(0xff, 0) | APIC_LVT_MASKED);
     apic_write(APIC_REG_LVT_THERMAL, APIC_LVT(0xff, 0) | APIC_LVT_MASKED);
     apic_write(APIC_REG_LVT_PERFORMANCE_COUNTER, APIC_LVT(0xff, 0) | APIC_LVT_MASKED);
-    apic_write(APIC_REG_LVT_LINT0, APIC_LVT(0x1f, 7) | APIC_LVT_MASKED);
+    if (cpu == 0) {
+        // The PIC still delivers our IRQs, through LINT0 (virtual wire mode.)
+        apic_write(APIC_REG_LVT_LINT0, APIC_LVT(0, 7));
+    } else {
+        apic_write(APIC_REG_LVT_LINT0, APIC_LVT(0x1f, 7) | APIC_LVT_MASKED);
+    }
     apic_write(APIC_REG_LVT_LINT1, APIC_LVT(0xff, 4) | APIC_LVT_TRIGGER_LEVEL); // nmi
     apic_write(APIC_REG_LVT_ERR, APIC_LVT(0xe3, 0) | APIC_LVT_MASKED);
-    
-    if (cpu == 0) {
-        static volatile u32 foo = 0;
-        
-        // INIT
-        apic_write_icr(ICRReg(0, ICRReg::INIT, ICRReg::Physical, ICRReg::Assert, ICRReg::TriggerMode::Edge, ICRReg::AllExcludingSelf));
-
-        for (foo = 0; foo < 0x800000; foo++); // TODO: 10 millisecond delay
+}
 
-        for (int i = 0; i < 2; i++) {
-            // SIPI
-            apic_write_icr(ICRReg(0x08, ICRReg::StartUp, ICRReg::Physical, ICRReg::Assert, ICRReg::TriggerMode::Edge, ICRReg::AllExcludingSelf)); // start execution at P8000
+// How many times the timer counts down in a second, measured against 10 ms of PIT channel 2.
+static u64 calibrate_timer()
+{
+    apic_write(APIC_REG_TIMER_DIVIDE, APIC_TIMER_DIVIDE_BY_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT(IRQ_APIC_TIMER, 0) | APIC_LVT_MASKED);
+
+    // Let channel 2 count (gate high) while keeping the PC speaker off.
+    IO::out8(0x61, (IO::in8(0x61) & ~0x02) | 0x01);
+    IO::out8(PIT_CTL, TIMER2_SELECT | WRITE_WORD | MODE_COUNTDOWN);
+    u16 pit_count = BASE_FREQUENCY / 100;
+    IO::out8(TIMER2_CTL, LSB(pit_count));
+    IO::out8(TIMER2_CTL, MSB(pit_count));
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0xffffffff);
+
+    // Channel 2's output goes high once it has counted down to zero.
+    while (!(IO::in8(0x61) & 0x20)) {
+        if (!apic_read(APIC_REG_TIMER_CURRENT_COUNT))
+            return 0;
+    }
+    u32 elapsed = 0xffffffff - apic_read(APIC_REG_TIMER_CURRENT_COUNT);
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0);
+    return (u64)elapsed * 100;
+}
 
-            for (foo = 0; foo < 0x80000; foo++); // TODO: 200 microsecond delay
-        }
+bool init_timer()
+{
+    ASSERT(g_apic_base);
+    u64 counts_per_second = calibrate_timer();
+    // Anything slower than 1 MHz wouldn't be much of an improvement over the PIT.
+    if (counts_per_second < 1000000) {
+        kprintf("APIC: Timer runs at %u Hz, not using it\n", (u32)counts_per_second);
+        return false;
     }
+    s_timer_counts_per_second = counts_per_second;
+    kprintf("APIC: Timer runs at %u kHz\n", (u32)(counts_per_second / 1000));
+
+    register_interrupt_handler(IRQ_APIC_TIMER, apic_timer_interrupt_entry);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT(IRQ_APIC_TIMER, 0));
+    return true;
 }
 
+bool has_timer()
+{
+    return s_timer_counts_per_second;
+}
+
+void arm_timer(u64 nanoseconds_from_now)
+{
+    ASSERT(has_timer());
+    // Keep the multiplication below from overflowing; the caller re-arms well before this anyway.
+    if (nanoseconds_from_now > 1000000000)
+        nanoseconds_from_now = 1000000000;
+    u64 count = nanoseconds_from_now * s_timer_counts_per_second / 1000000000;
+    if (!count)
+        count = 1;
+    if (count > 0xffffffff)
+        count = 0xffffffff;
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, (u32)count);
+}
+
+void disarm_timer()
+{
+    ASSERT(has_timer());
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0);
+}
+
+}
+
+void apic_timer_interrupt_handler(RegisterDump regs)
+{
+    clac();
+    APIC::apic_write(APIC_REG_EOI, 0);
+    Scheduler::timer_tick(regs);
 }
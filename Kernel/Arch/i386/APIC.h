@@ -30,7 +30,16 @@
 
 namespace APIC {
 
+// FIXME: Only the bootstrap processor runs. Starting the application processors needs
+//        a per-CPU current thread, TSS, GDT and run queue, IPIs for TLB shootdown and
+//        rescheduling, and spinlocks wherever an InterruptDisabler is relied on for exclusion.
 bool init();
 void enable(u32 cpu);
 
+// The local APIC timer, used in one-shot mode to interrupt at an exact time.
+bool init_timer();
+bool has_timer();
+void arm_timer(u64 nanoseconds_from_now);
+void disarm_timer();
+
 }
@@ -59,42 +59,103 @@ asm(
     "    add $0x4, %esp\n"
     "    iret\n");
 
-static u32 s_ticks_this_second;
-static u32 s_seconds_since_boot;
+// PIT input clocks counted at the start of the current period, and the length of that period.
+static u64 s_counts_at_last_interrupt;
+static u32 s_reload;
+static u64 s_last_nanoseconds;
+static bool s_drives_scheduler;
+static u64 s_tsc_frequency;
 
 void timer_interrupt_handler(RegisterDump regs)
 {
     clac();
     IRQHandlerScope scope(IRQ_TIMER);
-    if (++s_ticks_this_second >= TICKS_PER_SECOND) {
-        // FIXME: Synchronize with the RTC somehow to prevent drifting apart.
-        ++s_seconds_since_boot;
-        s_ticks_this_second = 0;
-    }
-    Scheduler::timer_tick(regs);
+    s_counts_at_last_interrupt += s_reload;
+    if (s_drives_scheduler)
+        Scheduler::timer_tick(regs);
 }
 
 namespace PIT {
 
-u32 ticks_this_second()
+static u64 counts_to_nanoseconds(u64 counts)
 {
-    return s_ticks_this_second;
+    // Split into whole seconds first so the multiplication can't overflow.
+    u64 seconds = counts / BASE_FREQUENCY;
+    u64 remainder = counts % BASE_FREQUENCY;
+    return seconds * 1000000000 + remainder * 1000000000 / BASE_FREQUENCY;
 }
 
-u32 seconds_since_boot()
+u64 nanoseconds_since_boot()
 {
-    return s_seconds_since_boot;
+    InterruptDisabler disabler;
+    u64 counts = s_counts_at_last_interrupt;
+
+    // In rate generator mode, channel 0 counts down from the reload value once per input clock,
+    // so how far it got tells us the time since the last interrupt.
+    IO::out8(PIT_CTL, TIMER0_SELECT | LATCH_COUNT);
+    u32 count = IO::in8(TIMER0_CTL);
+    count |= IO::in8(TIMER0_CTL) << 8;
+    if (!count)
+        count = 0x10000;
+    u32 elapsed = count <= s_reload ? s_reload - count : 0;
+
+    // If the counter has wrapped around but the interrupt is still pending (because interrupts
+    // are disabled), the period that just ended hasn't been accounted for yet.
+    if ((PIC::get_irr() & (1 << IRQ_TIMER)) && elapsed < s_reload / 2)
+        counts += s_reload;
+
+    u64 nanoseconds = counts_to_nanoseconds(counts + elapsed);
+    if (nanoseconds < s_last_nanoseconds)
+        return s_last_nanoseconds;
+    s_last_nanoseconds = nanoseconds;
+    return nanoseconds;
 }
 
-void initialize()
+u64 tsc_frequency()
 {
-    u16 timer_reload;
+    return s_tsc_frequency;
+}
+
+// Counts TSC ticks over 50 ms of channel 2.
+static u64 calibrate_tsc()
+{
+    CPUID features(1);
+    if (!(features.edx() & (1 << 4)))
+        return 0;
+
+    InterruptDisabler disabler;
+    // Let channel 2 count (gate high) while keeping the PC speaker off.
+    IO::out8(0x61, (IO::in8(0x61) & ~0x02) | 0x01);
+    IO::out8(PIT_CTL, TIMER2_SELECT | WRITE_WORD | MODE_COUNTDOWN);
+    u16 pit_count = BASE_FREQUENCY / 20;
+    IO::out8(TIMER2_CTL, LSB(pit_count));
+    IO::out8(TIMER2_CTL, MSB(pit_count));
+    u64 start = read_tsc();
+
+    // Channel 2's output goes high once it has counted down to zero.
+    while (!(IO::in8(0x61) & 0x20))
+        ;
+    return (read_tsc() - start) * 20;
+}
+
+void initialize(bool drive_scheduler)
+{
+    s_drives_scheduler = drive_scheduler;
+
+    // A reload value of 0 means 65536, the longest period the PIT can do (about 55 ms.)
+    u16 timer_reload = drive_scheduler ? (BASE_FREQUENCY / TICKS_PER_SECOND) : 0;
+    s_reload = timer_reload ? timer_reload : 0x10000;
 
-    IO::out8(PIT_CTL, TIMER0_SELECT | WRITE_WORD | MODE_SQUARE_WAVE);
+    s_tsc_frequency = calibrate_tsc();
+    if (s_tsc_frequency)
+        kprintf("PIT: TSC runs at %u kHz\n", (u32)(s_tsc_frequency / 1000));
 
-    timer_reload = (BASE_FREQUENCY / TICKS_PER_SECOND);
+    IO::out8(PIT_CTL, TIMER0_SELECT | WRITE_WORD | MODE_RATE);
 
-    kprintf("PIT: %u Hz, square wave (%x)\n", TICKS_PER_SECOND, timer_reload);
+    if (drive_scheduler)
+        kprintf("PIT: %u Hz, rate generator (%x)\n", TICKS_PER_SECOND, timer_reload);
+    else
+        kprintf("PIT: Keeping time only, rate generator (%x)\n", s_reload);
 
     IO::out8(TIMER0_CTL, LSB(timer_reload));
     IO::out8(TIMER0_CTL, MSB(timer_reload));
@@ -45,14 +45,22 @@
 #define MODE_RATE 0x04
 #define MODE_SQUARE_WAVE 0x06
 
+#define LATCH_COUNT 0x00
 #define WRITE_WORD 0x30
 
 #define BASE_FREQUENCY 1193182
 
 namespace PIT {
 
-void initialize();
-u32 ticks_this_second();
-u32 seconds_since_boot();
+// How finely nanoseconds_since_boot() can tell time apart: one period of the PIT's input clock.
+static constexpr u32 clock_resolution_ns = (1000000000 + BASE_FREQUENCY - 1) / BASE_FREQUENCY;
+
+// With drive_scheduler, the PIT interrupts TICKS_PER_SECOND times a second and runs the scheduler.
+// Otherwise something else does that, and the PIT only interrupts often enough to keep time.
+void initialize(bool drive_scheduler);
+u64 nanoseconds_since_boot();
+
+// Time-stamp counter ticks per second, measured against the PIT, or 0 if there's no TSC.
+u64 tsc_frequency();
 
 }
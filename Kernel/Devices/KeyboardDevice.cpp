@@ -479,6 +479,7 @@ void KeyboardDevice::key_state_changed(u8 raw, bool pressed)
     if (m_client)
         m_client->on_key_pressed(event);
     m_queue.enqueue(event);
+    notify_blockers();
 
     m_has_e0_prefix = false;
 }
@@ -54,6 +54,7 @@ public:
     virtual bool can_read(const FileDescription&) const override;
     virtual ssize_t write(FileDescription&, const u8* buffer, ssize_t) override;
     virtual bool can_write(const FileDescription&) const override { return true; }
+    virtual bool notifies_blockers() const override { return true; }
 
 private:
     // ^IRQHandler
@@ -103,14 +103,16 @@
 
 #define PCI_Mass_Storage_Class 0x1
 #define PCI_IDE_Controller_Subclass 0x1
-static Lock& s_lock()
-{
-    static Lock* lock;
-    if (!lock)
-        lock = new Lock;
 
-    return *lock;
-};
+#define BM_COMMAND 0x00
+#define BM_STATUS 0x02
+#define BM_PRDT 0x04
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08
+
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ 0x04
 
 OwnPtr<PATAChannel> PATAChannel::create(ChannelType type, bool force_pio)
 {
@@ -158,10 +160,13 @@ void PATAChannel::initialize(bool force_pio)
     }
 
     // Let's try to set up DMA transfers.
+    m_dma_buffer_pages = MM.allocate_contiguous_supervisor_physical_pages(max_dma_sector_count * 512);
+    if (m_dma_buffer_pages.is_empty()) {
+        kprintf("PATAChannel: Couldn't allocate a DMA buffer; falling back to PIO\n");
+        return;
+    }
     PCI::enable_bus_mastering(m_pci_address);
-    prdt().end_of_table = 0x8000;
     m_bus_master_base = PCI::get_BAR4(m_pci_address) & 0xfffc;
-    m_dma_buffer_page = MM.allocate_supervisor_physical_page();
     kprintf("PATAChannel: Bus master IDE: I/O @ %x\n", m_bus_master_base);
 }
 
@@ -199,6 +204,10 @@ void PATAChannel::handle_irq()
 #ifdef PATA_DEBUG
     kprintf("PATAChannel: interrupt: DRQ=%u BSY=%u DRDY=%u\n", (status & ATA_SR_DRQ) != 0, (status & ATA_SR_BSY) != 0, (status & ATA_SR_DRDY) != 0);
 #endif
+    if (m_dma_in_flight) {
+        complete_dma_batch();
+        return;
+    }
     m_irq_queue.wake_all();
 }
 
@@ -274,121 +283,211 @@ void PATAChannel::detect_disks()
 
 bool PATAChannel::ata_read_sectors_with_dma(u32 lba, u16 count, u8* outbuf, bool slave_request)
 {
-    LOCKER(s_lock());
 #ifdef PATA_DEBUG
     kprintf("%s(%u): PATAChannel::ata_read_sectors_with_dma (%u x%u) -> %p\n",
         current->process().name().characters(),
         current->pid(), lba, count, outbuf);
 #endif
+    ASSERT(count <= max_dma_sector_count);
+    PATARequest request(lba, count, outbuf, false, slave_request, true);
+    return submit_and_wait(request);
+}
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * count;
+bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf, bool slave_request)
+{
+#ifdef PATA_DEBUG
+    kprintf("%s(%u): PATAChannel::ata_write_sectors_with_dma (%u x%u) <- %p\n",
+        current->process().name().characters(),
+        current->pid(), lba, count, inbuf);
+#endif
+    ASSERT(count <= max_dma_sector_count);
+    PATARequest request(lba, count, const_cast<u8*>(inbuf), true, slave_request, true);
+    return submit_and_wait(request);
+}
 
-    ASSERT(prdt().size <= PAGE_SIZE);
+bool PATAChannel::ata_read_sectors(u32 start_sector, u16 count, u8* outbuf, bool slave_request)
+{
+    ASSERT(count <= max_pio_sector_count);
+    PATARequest request(start_sector, count, outbuf, false, slave_request, false);
+    return submit_and_wait(request);
+}
 
-    // Stop bus master
-    IO::out8(m_bus_master_base, 0);
+bool PATAChannel::ata_write_sectors(u32 start_sector, u16 count, const u8* inbuf, bool slave_request)
+{
+    ASSERT(count <= max_pio_sector_count);
+    PATARequest request(start_sector, count, const_cast<u8*>(inbuf), true, slave_request, false);
+    return submit_and_wait(request);
+}
 
-    // Write the PRDT location
-    IO::out32(m_bus_master_base + 4, m_prdt_page->paddr().get());
+void PATAChannel::wait_for_request_state(PATARequest& request, PATARequest::State state)
+{
+    InterruptDisabler disabler;
+    for (;;) {
+        // NOTE: wait_on() may return with interrupts enabled, so disable them again before checking.
+        cli();
+        if (request.state >= state)
+            return;
+        current->wait_on(request.wait_queue);
+    }
+}
 
-    // Turn on "Interrupt" and "Error" flag. The error flag should be cleared by hardware.
-    IO::out8(m_bus_master_base + 2, IO::in8(m_bus_master_base + 2) | 0x6);
+bool PATAChannel::submit_and_wait(PATARequest& request)
+{
+    {
+        InterruptDisabler disabler;
+        m_pending_requests.append(&request);
+        if (m_active_requests.is_empty())
+            dispatch_next_batch();
+    }
 
-    // Set transfer direction
-    IO::out8(m_bus_master_base, 0x8);
+    // Wait until the elevator hands us the channel.
+    wait_for_request_state(request, PATARequest::State::Active);
 
-    while (IO::in8(m_io_base + ATA_REG_STATUS) & ATA_SR_BSY)
-        ;
+    if (!request.use_dma) {
+        if (request.is_write)
+            request.success = pio_write_sectors(request.lba, request.count, request.buffer, request.is_slave);
+        else
+            request.success = pio_read_sectors(request.lba, request.count, request.buffer, request.is_slave);
+        finish_request(request);
+        return request.success;
+    }
 
-    u8 devsel = 0xe0;
-    if (slave_request)
-        devsel |= 0x10;
+    size_t size = request.count * 512;
+    if (request.is_write)
+        copy_to_dma_buffer(request.dma_buffer_offset, request.buffer, size);
 
-    IO::out8(m_control_base + ATA_CTL_CONTROL, 0);
-    IO::out8(m_io_base + ATA_REG_HDDEVSEL, devsel | (static_cast<u8>(slave_request) << 4));
-    io_delay();
+    {
+        InterruptDisabler disabler;
+        // The last request of the batch to finish setting up kicks off the transfer.
+        ASSERT(m_active_requests_not_set_up);
+        if (--m_active_requests_not_set_up == 0)
+            start_dma_batch();
+    }
 
-    IO::out8(m_io_base + ATA_REG_FEATURES, 0);
+    wait_for_request_state(request, PATARequest::State::Done);
 
-    IO::out8(m_io_base + ATA_REG_SECCOUNT0, 0);
-    IO::out8(m_io_base + ATA_REG_LBA0, 0);
-    IO::out8(m_io_base + ATA_REG_LBA1, 0);
-    IO::out8(m_io_base + ATA_REG_LBA2, 0);
+    if (request.success && !request.is_write)
+        copy_from_dma_buffer(request.dma_buffer_offset, request.buffer, size);
 
-    IO::out8(m_io_base + ATA_REG_SECCOUNT0, count);
-    IO::out8(m_io_base + ATA_REG_LBA0, (lba & 0x000000ff) >> 0);
-    IO::out8(m_io_base + ATA_REG_LBA1, (lba & 0x0000ff00) >> 8);
-    IO::out8(m_io_base + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
+    finish_request(request);
+    return request.success;
+}
 
-    for (;;) {
-        auto status = IO::in8(m_io_base + ATA_REG_STATUS);
-        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY))
-            break;
+PATARequest* PATAChannel::pick_next_request()
+{
+    // C-LOOK: serve the closest request at or after the current head position,
+    // and wrap around to the lowest LBA once we run out.
+    PATARequest* next_ahead = nullptr;
+    PATARequest* lowest = nullptr;
+    for (auto& request : m_pending_requests) {
+        if (request.lba >= m_elevator_lba && (!next_ahead || request.lba < next_ahead->lba))
+            next_ahead = &request;
+        if (!lowest || request.lba < lowest->lba)
+            lowest = &request;
     }
+    return next_ahead ? next_ahead : lowest;
+}
 
-    IO::out8(m_io_base + ATA_REG_COMMAND, ATA_CMD_READ_DMA_EXT);
-    io_delay();
-
-    // Start bus master
-    IO::out8(m_bus_master_base, 0x9);
-
-    wait_for_irq();
+void PATAChannel::dispatch_next_batch()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(m_active_requests.is_empty());
 
-    if (m_device_error)
-        return false;
+    auto* first = pick_next_request();
+    if (!first)
+        return;
 
-    memcpy(outbuf, m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), 512 * count);
+    m_pending_requests.remove(first);
+    m_active_requests.append(first);
+    first->dma_buffer_offset = 0;
+    m_active_sector_count = first->count;
+
+    if (first->use_dma) {
+        // Merge queued requests that continue right where the batch ends into the same command.
+        for (;;) {
+            PATARequest* adjacent = nullptr;
+            for (auto& request : m_pending_requests) {
+                if (request.use_dma
+                    && request.is_write == first->is_write
+                    && request.is_slave == first->is_slave
+                    && request.lba == first->lba + m_active_sector_count
+                    && m_active_sector_count + request.count <= max_dma_sector_count) {
+                    adjacent = &request;
+                    break;
+                }
+            }
+            if (!adjacent)
+                break;
+            m_pending_requests.remove(adjacent);
+            m_active_requests.append(adjacent);
+            adjacent->dma_buffer_offset = m_active_sector_count * 512;
+            m_active_sector_count += adjacent->count;
+        }
+    }
 
-    // I read somewhere that this may trigger a cache flush so let's do it.
-    IO::out8(m_bus_master_base + 2, IO::in8(m_bus_master_base + 2) | 0x6);
-    return true;
-}
+    m_elevator_lba = first->lba + m_active_sector_count;
+    m_active_requests_not_set_up = 0;
+    for (auto& request : m_active_requests) {
+        request.state = PATARequest::State::Active;
+        request.wait_queue.wake_all();
+        ++m_active_requests_not_set_up;
+    }
 
-bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf, bool slave_request)
-{
-    LOCKER(s_lock());
 #ifdef PATA_DEBUG
-    kprintf("%s(%u): PATAChannel::ata_write_sectors_with_dma (%u x%u) <- %p\n",
-        current->process().name().characters(),
-        current->pid(), lba, count, inbuf);
+    kprintf("PATAChannel: Dispatching %s batch of %u request(s), %u sector(s) @ LBA %u\n",
+        first->is_write ? "write" : "read", m_active_requests_not_set_up, m_active_sector_count, first->lba);
 #endif
+}
 
-    prdt().offset = m_dma_buffer_page->paddr();
-    prdt().size = 512 * count;
-
-    memcpy(m_dma_buffer_page->paddr().offset(0xc0000000).as_ptr(), inbuf, 512 * count);
-
-    ASSERT(prdt().size <= PAGE_SIZE);
+void PATAChannel::start_dma_batch()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto& first = *m_active_requests.head();
+    u32 lba = first.lba;
+    u16 count = m_active_sector_count;
+
+    // Fill in the scatter/gather table, one entry per DMA buffer page.
+    size_t remaining = count * 512;
+    for (size_t i = 0; remaining; ++i) {
+        auto& entry = prdt()[i];
+        entry.offset = m_dma_buffer_pages[i].paddr();
+        entry.size = min(remaining, (size_t)PAGE_SIZE);
+        remaining -= entry.size;
+        entry.end_of_table = remaining ? 0 : 0x8000;
+    }
 
     // Stop bus master
-    IO::out8(m_bus_master_base, 0);
+    IO::out8(m_bus_master_base + BM_COMMAND, 0);
 
     // Write the PRDT location
-    IO::out32(m_bus_master_base + 4, m_prdt_page->paddr().get());
+    IO::out32(m_bus_master_base + BM_PRDT, m_prdt_page->paddr().get());
 
     // Turn on "Interrupt" and "Error" flag. The error flag should be cleared by hardware.
-    IO::out8(m_bus_master_base + 2, IO::in8(m_bus_master_base + 2) | 0x6);
+    IO::out8(m_bus_master_base + BM_STATUS, IO::in8(m_bus_master_base + BM_STATUS) | BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    // Set transfer direction
+    IO::out8(m_bus_master_base + BM_COMMAND, first.is_write ? 0 : BM_COMMAND_READ);
 
     while (IO::in8(m_io_base + ATA_REG_STATUS) & ATA_SR_BSY)
         ;
 
     u8 devsel = 0xe0;
-    if (slave_request)
+    if (first.is_slave)
         devsel |= 0x10;
 
     IO::out8(m_control_base + ATA_CTL_CONTROL, 0);
-    IO::out8(m_io_base + ATA_REG_HDDEVSEL, devsel | (static_cast<u8>(slave_request) << 4));
+    IO::out8(m_io_base + ATA_REG_HDDEVSEL, devsel | (static_cast<u8>(first.is_slave) << 4));
     io_delay();
 
     IO::out8(m_io_base + ATA_REG_FEATURES, 0);
 
-    IO::out8(m_io_base + ATA_REG_SECCOUNT0, 0);
-    IO::out8(m_io_base + ATA_REG_LBA0, 0);
+    // LBA48: high order bytes first, then low order bytes.
+    IO::out8(m_io_base + ATA_REG_SECCOUNT0, (count >> 8) & 0xff);
+    IO::out8(m_io_base + ATA_REG_LBA0, (lba >> 24) & 0xff);
     IO::out8(m_io_base + ATA_REG_LBA1, 0);
     IO::out8(m_io_base + ATA_REG_LBA2, 0);
 
-    IO::out8(m_io_base + ATA_REG_SECCOUNT0, count);
+    IO::out8(m_io_base + ATA_REG_SECCOUNT0, count & 0xff);
     IO::out8(m_io_base + ATA_REG_LBA0, (lba & 0x000000ff) >> 0);
     IO::out8(m_io_base + ATA_REG_LBA1, (lba & 0x0000ff00) >> 8);
     IO::out8(m_io_base + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
@@ -399,28 +498,68 @@ bool PATAChannel::ata_write_sectors_with_dma(u32 lba, u16 count, const u8* inbuf
             break;
     }
 
-    IO::out8(m_io_base + ATA_REG_COMMAND, ATA_CMD_WRITE_DMA_EXT);
+    IO::out8(m_io_base + ATA_REG_COMMAND, first.is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
     io_delay();
 
+    m_dma_in_flight = true;
+    enable_irq();
+
     // Start bus master
-    IO::out8(m_bus_master_base, 0x1);
+    IO::out8(m_bus_master_base + BM_COMMAND, (first.is_write ? 0 : BM_COMMAND_READ) | BM_COMMAND_START);
+}
 
-    wait_for_irq();
+void PATAChannel::complete_dma_batch()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_dma_in_flight = false;
+    disable_irq();
 
-    if (m_device_error)
-        return false;
+    u8 bus_master_status = IO::in8(m_bus_master_base + BM_STATUS);
+
+    // Stop bus master
+    IO::out8(m_bus_master_base + BM_COMMAND, 0);
 
     // I read somewhere that this may trigger a cache flush so let's do it.
-    IO::out8(m_bus_master_base + 2, IO::in8(m_bus_master_base + 2) | 0x6);
-    return true;
+    IO::out8(m_bus_master_base + BM_STATUS, bus_master_status | BM_STATUS_IRQ | BM_STATUS_ERROR);
+
+    bool success = !m_device_error && !(bus_master_status & BM_STATUS_ERROR);
+    for (auto& request : m_active_requests) {
+        request.success = success;
+        request.state = PATARequest::State::Done;
+        request.wait_queue.wake_all();
+    }
 }
 
-bool PATAChannel::ata_read_sectors(u32 start_sector, u16 count, u8* outbuf, bool slave_request)
+void PATAChannel::finish_request(PATARequest& request)
+{
+    InterruptDisabler disabler;
+    m_active_requests.remove(&request);
+    if (m_active_requests.is_empty())
+        dispatch_next_batch();
+}
+
+u8* PATAChannel::dma_buffer()
+{
+    // The DMA buffer pages are physically contiguous, and supervisor pages are always mapped.
+    return m_dma_buffer_pages.first().paddr().offset(0xc0000000).as_ptr();
+}
+
+void PATAChannel::copy_to_dma_buffer(size_t offset, const u8* data, size_t size)
+{
+    ASSERT(offset + size <= (size_t)m_dma_buffer_pages.size() * PAGE_SIZE);
+    memcpy(dma_buffer() + offset, data, size);
+}
+
+void PATAChannel::copy_from_dma_buffer(size_t offset, u8* data, size_t size)
+{
+    ASSERT(offset + size <= (size_t)m_dma_buffer_pages.size() * PAGE_SIZE);
+    memcpy(data, dma_buffer() + offset, size);
+}
+
+bool PATAChannel::pio_read_sectors(u32 start_sector, u16 count, u8* outbuf, bool slave_request)
 {
-    ASSERT(count <= 256);
-    LOCKER(s_lock());
 #ifdef PATA_DEBUG
-    kprintf("%s(%u): PATAChannel::ata_read_sectors request (%u sector(s) @ %u into %p)\n",
+    kprintf("%s(%u): PATAChannel::pio_read_sectors request (%u sector(s) @ %u into %p)\n",
         current->process().name().characters(),
         current->pid(),
         count,
@@ -473,12 +612,10 @@ bool PATAChannel::ata_read_sectors(u32 start_sector, u16 count, u8* outbuf, bool
     return true;
 }
 
-bool PATAChannel::ata_write_sectors(u32 start_sector, u16 count, const u8* inbuf, bool slave_request)
+bool PATAChannel::pio_write_sectors(u32 start_sector, u16 count, const u8* inbuf, bool slave_request)
 {
-    ASSERT(count <= 256);
-    LOCKER(s_lock());
 #ifdef PATA_DEBUG
-    kprintf("%s(%u): PATAChannel::ata_write_sectors request (%u sector(s) @ %u)\n",
+    kprintf("%s(%u): PATAChannel::pio_write_sectors request (%u sector(s) @ %u)\n",
         current->process().name().characters(),
         current->pid(),
         count,
@@ -36,6 +36,8 @@
 //
 #pragma once
 
+#include <AK/InlineLinkedList.h>
+#include <AK/NonnullRefPtrVector.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefPtr.h>
 #include <Kernel/IRQHandler.h>
@@ -51,6 +53,43 @@ struct PhysicalRegionDescriptor {
     u16 end_of_table { 0 };
 };
 
+// A single transfer queued on a PATAChannel. Requests live on the stack of the
+// thread that submitted them; that thread also copies data to/from the channel's
+// DMA buffer, so user buffers are only touched from their own address space.
+struct PATARequest : public InlineLinkedListNode<PATARequest> {
+    enum class State {
+        Queued,
+        Active,
+        Done,
+    };
+
+    PATARequest(u32 lba, u16 count, u8* buffer, bool is_write, bool is_slave, bool use_dma)
+        : lba(lba)
+        , count(count)
+        , buffer(buffer)
+        , is_write(is_write)
+        , is_slave(is_slave)
+        , use_dma(use_dma)
+    {
+    }
+
+    u32 lba { 0 };
+    u16 count { 0 };
+    u8* buffer { nullptr };
+    bool is_write { false };
+    bool is_slave { false };
+    bool use_dma { false };
+
+    State state { State::Queued };
+    bool success { false };
+    size_t dma_buffer_offset { 0 };
+    WaitQueue wait_queue;
+
+    // For InlineLinkedList
+    PATARequest* m_next { nullptr };
+    PATARequest* m_prev { nullptr };
+};
+
 class PATADiskDevice;
 class PATAChannel final : public IRQHandler {
     friend class PATADiskDevice;
@@ -69,6 +108,11 @@ public:
     RefPtr<PATADiskDevice> master_device() { return m_master; };
     RefPtr<PATADiskDevice> slave_device() { return m_slave; };
 
+    // Largest transfer a single DMA command can do (one PRD entry per DMA buffer page).
+    static constexpr u16 max_dma_sector_count = 128;
+    // Largest transfer a single PIO command can do.
+    static constexpr u16 max_pio_sector_count = 256;
+
 private:
     //^ IRQHandler
     virtual void handle_irq() override;
@@ -82,6 +126,21 @@ private:
     bool ata_read_sectors(u32, u16, u8*, bool);
     bool ata_write_sectors(u32, u16, const u8*, bool);
 
+    bool submit_and_wait(PATARequest&);
+    void wait_for_request_state(PATARequest&, PATARequest::State);
+    PATARequest* pick_next_request();
+    void dispatch_next_batch();
+    void start_dma_batch();
+    void complete_dma_batch();
+    void finish_request(PATARequest&);
+
+    u8* dma_buffer();
+    void copy_to_dma_buffer(size_t offset, const u8*, size_t);
+    void copy_from_dma_buffer(size_t offset, u8*, size_t);
+
+    bool pio_read_sectors(u32, u16, u8*, bool);
+    bool pio_write_sectors(u32, u16, const u8*, bool);
+
     // Data members
     u8 m_channel_number { 0 }; // Channel number. 0 = master, 1 = slave
     u16 m_io_base { 0x1F0 };
@@ -91,12 +150,22 @@ private:
     WaitQueue m_irq_queue;
 
     PCI::Address m_pci_address;
-    PhysicalRegionDescriptor& prdt() { return *reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
+    PhysicalRegionDescriptor* prdt() { return reinterpret_cast<PhysicalRegionDescriptor*>(m_prdt_page->paddr().offset(0xc0000000).as_ptr()); }
     RefPtr<PhysicalPage> m_prdt_page;
-    RefPtr<PhysicalPage> m_dma_buffer_page;
+    NonnullRefPtrVector<PhysicalPage> m_dma_buffer_pages;
     u16 m_bus_master_base { 0 };
     Lockable<bool> m_dma_enabled;
 
+    // Requests waiting for the channel, and the batch currently owning it.
+    // A batch is either one PIO request, or one or more adjacent DMA requests
+    // merged into a single command.
+    InlineLinkedList<PATARequest> m_pending_requests;
+    InlineLinkedList<PATARequest> m_active_requests;
+    u16 m_active_sector_count { 0 };
+    u32 m_active_requests_not_set_up { 0 };
+    bool m_dma_in_flight { false };
+    u32 m_elevator_lba { 0 };
+
     RefPtr<PATADiskDevice> m_master;
     RefPtr<PATADiskDevice> m_slave;
 };
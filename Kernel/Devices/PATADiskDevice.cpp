@@ -50,9 +50,16 @@ const char* PATADiskDevice::class_name() const
 
 bool PATADiskDevice::read_blocks(unsigned index, u16 count, u8* out)
 {
-    if (m_channel.m_bus_master_base && m_channel.m_dma_enabled.resource())
-        return read_sectors_with_dma(index, count, out);
-    return read_sectors(index, count, out);
+    bool use_dma = m_channel.m_bus_master_base && m_channel.m_dma_enabled.resource();
+    u16 max_sectors_per_command = use_dma ? PATAChannel::max_dma_sector_count : PATAChannel::max_pio_sector_count;
+    for (u16 i = 0; i < count;) {
+        u16 sectors = min((u16)(count - i), max_sectors_per_command);
+        bool success = use_dma ? read_sectors_with_dma(index + i, sectors, out + i * 512) : read_sectors(index + i, sectors, out + i * 512);
+        if (!success)
+            return false;
+        i += sectors;
+    }
+    return true;
 }
 
 bool PATADiskDevice::read_block(unsigned index, u8* out) const
@@ -62,8 +69,15 @@ bool PATADiskDevice::read_block(unsigned index, u8* out) const
 
 bool PATADiskDevice::write_blocks(unsigned index, u16 count, const u8* data)
 {
-    if (m_channel.m_bus_master_base && m_channel.m_dma_enabled.resource())
-        return write_sectors_with_dma(index, count, data);
+    if (m_channel.m_bus_master_base && m_channel.m_dma_enabled.resource()) {
+        for (u16 i = 0; i < count;) {
+            u16 sectors = min((u16)(count - i), PATAChannel::max_dma_sector_count);
+            if (!write_sectors_with_dma(index + i, sectors, data + i * 512))
+                return false;
+            i += sectors;
+        }
+        return true;
+    }
     for (unsigned i = 0; i < count; ++i) {
         if (!write_sectors(index + i, 1, data + i * 512))
             return false;
@@ -125,6 +125,7 @@ void PS2MouseDevice::handle_vmmouse_absolute_pointer()
     }
     packet.is_relative = false;
     m_queue.enqueue(packet);
+    notify_blockers();
 }
 
 void PS2MouseDevice::handle_irq()
@@ -218,6 +219,7 @@ void PS2MouseDevice::parse_data_packet()
     dbgprintf("Mouse: X %d, Y %d, Z %d\n", packet.x, packet.y, packet.z);
 #endif
     m_queue.enqueue(packet);
+    notify_blockers();
 }
 
 void PS2MouseDevice::wait_then_write(u8 port, u8 data)
@@ -44,6 +44,7 @@ public:
     virtual ssize_t read(FileDescription&, u8*, ssize_t) override;
     virtual ssize_t write(FileDescription&, const u8*, ssize_t) override;
     virtual bool can_write(const FileDescription&) const override { return true; }
+    virtual bool notifies_blockers() const override { return true; }
 
 private:
     // ^IRQHandler
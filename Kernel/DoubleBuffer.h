@@ -40,6 +40,7 @@ public:
     bool is_empty() const { return m_empty; }
 
     size_t space_for_writing() const { return m_space_for_writing; }
+    size_t capacity() const { return m_capacity; }
 
 private:
     void flip();
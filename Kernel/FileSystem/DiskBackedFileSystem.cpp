@@ -24,90 +24,263 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <AK/HashFunctions.h>
+#include <AK/InlineLinkedList.h>
+#include <AK/QuickSort.h>
 #include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/Arch/i386/PIT.h>
 #include <Kernel/FileSystem/DiskBackedFileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/KBuffer.h>
 #include <Kernel/Process.h>
+#include <Kernel/Scheduler.h>
 
 //#define DBFS_DEBUG
 
-struct CacheEntry {
-    time_t timestamp { 0 };
+// Largest single request we hand to the disk device when coalescing adjacent blocks.
+static const size_t max_request_size = 64 * KB;
+
+// Dirty blocks older than this are written back by the background writeback pass.
+static const u64 dirty_expire_ticks = 5 * TICKS_PER_SECOND;
+// Above this share of dirty cache entries, writeback doesn't wait for blocks to age.
+static const size_t dirty_background_percent = 10;
+// Above this share of dirty cache entries, writers have to flush before dirtying more.
+static const size_t dirty_limit_percent = 40;
+
+struct CacheEntry : public InlineLinkedListNode<CacheEntry> {
     u32 block_index { 0 };
     u8* data { nullptr };
     bool has_data { false };
     bool is_dirty { false };
+    bool is_indexed { false };
+    u64 dirtied_at { 0 };
+
+    // For the LRU / dirty lists (InlineLinkedList)
+    CacheEntry* m_next { nullptr };
+    CacheEntry* m_prev { nullptr };
+
+    // For the block index hash chain
+    CacheEntry* m_next_in_bucket { nullptr };
 };
 
 class DiskCache {
 public:
     explicit DiskCache(DiskBackedFS& fs)
         : m_fs(fs)
+        , m_entry_count(entry_count_for(fs))
+        , m_bucket_count(bucket_count_for(m_entry_count))
         , m_cached_block_data(KBuffer::create_with_size(m_entry_count * m_fs.block_size()))
         , m_entries(KBuffer::create_with_size(m_entry_count * sizeof(CacheEntry)))
+        , m_buckets(KBuffer::create_with_size(m_bucket_count * sizeof(CacheEntry*)))
     {
+        // NOTE: KBuffer memory is zero-filled, so the entries and buckets start out in a valid empty state.
         for (size_t i = 0; i < m_entry_count; ++i) {
-            entries()[i].data = m_cached_block_data.data() + i * m_fs.block_size();
+            auto& entry = entries()[i];
+            entry.data = m_cached_block_data.data() + i * m_fs.block_size();
+            m_clean_list.append(&entry);
         }
     }
 
     ~DiskCache() {}
 
-    bool is_dirty() const { return m_dirty; }
-    void set_dirty(bool b) { m_dirty = b; }
+    bool is_dirty() const { return !m_dirty_list.is_empty(); }
 
-    CacheEntry& get(u32 block_index) const
+    CacheEntry* find(u32 block_index)
     {
-        auto now = kgettimeofday().tv_sec;
-
-        CacheEntry* oldest_clean_entry = nullptr;
-        for (size_t i = 0; i < m_entry_count; ++i) {
-            auto& entry = const_cast<CacheEntry&>(entries()[i]);
-            if (entry.block_index == block_index) {
-                entry.timestamp = now;
+        for (auto* entry = buckets()[bucket_for(block_index)]; entry; entry = entry->m_next_in_bucket) {
+            if (entry->block_index == block_index)
                 return entry;
+        }
+        return nullptr;
+    }
+
+    bool has_data(u32 block_index)
+    {
+        auto* entry = find(block_index);
+        return entry && entry->has_data;
+    }
+
+    CacheEntry& get(u32 block_index)
+    {
+        if (auto* entry = find(block_index)) {
+            ++m_hits;
+            if (!entry->is_dirty) {
+                m_clean_list.remove(entry);
+                m_clean_list.prepend(entry);
             }
-            if (!entry.is_dirty) {
-                if (!oldest_clean_entry)
-                    oldest_clean_entry = &entry;
-                else if (entry.timestamp < oldest_clean_entry->timestamp)
-                    oldest_clean_entry = &entry;
-            }
+            return *entry;
         }
-        if (!oldest_clean_entry) {
+
+        ++m_misses;
+
+        if (m_clean_list.is_empty()) {
             // Not a single clean entry! Flush writes and try again.
             // NOTE: We want to make sure we only call DiskBackedFS flush here,
             //       not some DiskBackedFS subclass flush!
             m_fs.flush_writes_impl();
-            return get(block_index);
+            ASSERT(!m_clean_list.is_empty());
         }
 
-        // Replace the oldest clean entry.
-        auto& new_entry = *oldest_clean_entry;
-        new_entry.timestamp = now;
+        // Replace the least recently used clean entry.
+        auto& new_entry = *m_clean_list.remove_tail();
+        if (new_entry.is_indexed) {
+            unindex(new_entry);
+            ++m_evictions;
+        }
         new_entry.block_index = block_index;
         new_entry.has_data = false;
         new_entry.is_dirty = false;
+        index(new_entry);
+        m_clean_list.prepend(&new_entry);
         return new_entry;
     }
 
-    const CacheEntry* entries() const { return (const CacheEntry*)m_entries.data(); }
-    CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
+    void mark_dirty(CacheEntry& entry)
+    {
+        if (entry.is_dirty)
+            return;
+        m_clean_list.remove(&entry);
+        m_dirty_list.append(&entry);
+        entry.is_dirty = true;
+        entry.dirtied_at = g_uptime;
+        ++m_dirty_count;
+    }
+
+    void mark_clean(CacheEntry& entry)
+    {
+        if (!entry.is_dirty)
+            return;
+        m_dirty_list.remove(&entry);
+        m_clean_list.prepend(&entry);
+        entry.is_dirty = false;
+        --m_dirty_count;
+        ++m_writebacks;
+    }
 
+    // Forget a block, even if it was dirty. The entry is the first to be reused.
+    void invalidate(CacheEntry& entry)
+    {
+        if (entry.is_dirty) {
+            m_dirty_list.remove(&entry);
+            entry.is_dirty = false;
+            --m_dirty_count;
+        } else {
+            m_clean_list.remove(&entry);
+        }
+        m_clean_list.append(&entry);
+        unindex(entry);
+        entry.has_data = false;
+    }
+
+    size_t entry_count() const { return m_entry_count; }
+    size_t dirty_count() const { return m_dirty_count; }
+    size_t dirty_background_count() const { return m_entry_count * dirty_background_percent / 100; }
+    size_t dirty_limit() const { return m_entry_count * dirty_limit_percent / 100; }
+
+    // Oldest dirty entries first.
     template<typename Callback>
-    void for_each_entry(Callback callback)
+    void for_each_dirty_entry(Callback callback)
     {
-        for (size_t i = 0; i < m_entry_count; ++i)
-            callback(entries()[i]);
+        for (auto* entry = m_dirty_list.head(); entry; entry = entry->next()) {
+            if (callback(*entry) == IterationDecision::Break)
+                break;
+        }
+    }
+
+    u8* writeback_buffer()
+    {
+        if (!m_writeback_buffer.has_value())
+            m_writeback_buffer = KBuffer::create_with_size(max_request_size);
+        return m_writeback_buffer.value().data();
+    }
+
+    u8* staging_buffer()
+    {
+        if (!m_staging_buffer.has_value())
+            m_staging_buffer = KBuffer::create_with_size(max_request_size);
+        return m_staging_buffer.value().data();
+    }
+
+    DiskBackedFS::CacheStatistics statistics() const
+    {
+        DiskBackedFS::CacheStatistics statistics;
+        statistics.entry_count = m_entry_count;
+        statistics.dirty_count = m_dirty_count;
+        statistics.hits = m_hits;
+        statistics.misses = m_misses;
+        statistics.evictions = m_evictions;
+        statistics.writebacks = m_writebacks;
+        return statistics;
     }
 
 private:
+    static constexpr size_t max_cache_size = 16 * MB;
+    static constexpr size_t min_entry_count = 64;
+
+    static size_t entry_count_for(const DiskBackedFS& fs)
+    {
+        // Size the cache after the device, but never spend more than max_cache_size on a single FS.
+        size_t max_entry_count = max(min_entry_count, max_cache_size / fs.block_size());
+        size_t device_block_count = fs.total_block_count();
+        if (!device_block_count)
+            return max_entry_count;
+        return min(max_entry_count, max(min_entry_count, device_block_count));
+    }
+
+    static size_t bucket_count_for(size_t entry_count)
+    {
+        size_t bucket_count = 1;
+        while (bucket_count < entry_count)
+            bucket_count <<= 1;
+        return bucket_count;
+    }
+
+    size_t bucket_for(u32 block_index) const { return int_hash(block_index) & (m_bucket_count - 1); }
+
+    CacheEntry** buckets() { return (CacheEntry**)m_buckets.data(); }
+    CacheEntry* entries() { return (CacheEntry*)m_entries.data(); }
+
+    void index(CacheEntry& entry)
+    {
+        ASSERT(!entry.is_indexed);
+        auto& bucket = buckets()[bucket_for(entry.block_index)];
+        entry.m_next_in_bucket = bucket;
+        bucket = &entry;
+        entry.is_indexed = true;
+    }
+
+    void unindex(CacheEntry& entry)
+    {
+        ASSERT(entry.is_indexed);
+        auto* link = &buckets()[bucket_for(entry.block_index)];
+        while (*link != &entry) {
+            ASSERT(*link);
+            link = &(*link)->m_next_in_bucket;
+        }
+        *link = entry.m_next_in_bucket;
+        entry.m_next_in_bucket = nullptr;
+        entry.is_indexed = false;
+    }
+
     DiskBackedFS& m_fs;
-    size_t m_entry_count { 10000 };
+    size_t m_entry_count { 0 };
+    size_t m_bucket_count { 0 };
     KBuffer m_cached_block_data;
     KBuffer m_entries;
-    bool m_dirty { false };
+    KBuffer m_buckets;
+    Optional<KBuffer> m_staging_buffer;
+    Optional<KBuffer> m_writeback_buffer;
+
+    // Clean entries, most recently used first. Eviction takes from the tail.
+    InlineLinkedList<CacheEntry> m_clean_list;
+    // Dirty entries, in the order they were first dirtied.
+    InlineLinkedList<CacheEntry> m_dirty_list;
+
+    u32 m_dirty_count { 0 };
+    u32 m_hits { 0 };
+    u32 m_misses { 0 };
+    u32 m_evictions { 0 };
+    u32 m_writebacks { 0 };
 };
 
 DiskBackedFS::DiskBackedFS(NonnullRefPtr<DiskDevice>&& device)
@@ -136,10 +309,11 @@ bool DiskBackedFS::write_block(unsigned index, const u8* data, FileDescription*
 
     auto& entry = cache().get(index);
     memcpy(entry.data, data, block_size());
-    entry.is_dirty = true;
     entry.has_data = true;
+    cache().mark_dirty(entry);
 
-    cache().set_dirty(true);
+    if (cache().dirty_count() > cache().dirty_limit())
+        throttle_dirty_blocks();
     return true;
 }
 
@@ -182,33 +356,148 @@ bool DiskBackedFS::read_block(unsigned index, u8* buffer, FileDescription* descr
 
 bool DiskBackedFS::read_blocks(unsigned index, unsigned count, u8* buffer, FileDescription* description) const
 {
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::read_blocks %u x%u\n", index, count);
+#endif
     if (!count)
         return false;
     if (count == 1)
         return read_block(index, buffer, description);
-    u8* out = buffer;
 
+    bool allow_cache = !description || !description->is_direct();
+
+    if (!allow_cache) {
+        for (unsigned i = 0; i < count; ++i)
+            const_cast<DiskBackedFS*>(this)->flush_specific_block_if_needed(index + i);
+        for (unsigned i = 0; i < count;) {
+            unsigned run_length = min(count - i, max_blocks_per_request());
+            DiskOffset base_offset = static_cast<DiskOffset>(index + i) * static_cast<DiskOffset>(block_size());
+            bool success = device().read(base_offset, run_length * block_size(), buffer + i * block_size());
+            ASSERT(success);
+            i += run_length;
+        }
+        return true;
+    }
+
+    for (unsigned i = 0; i < count;) {
+        u8* out = buffer + i * block_size();
+        if (cache().has_data(index + i)) {
+            memcpy(out, cache().get(index + i).data, block_size());
+            ++i;
+            continue;
+        }
+
+        // Coalesce the run of uncached blocks into a single device request.
+        unsigned run_length = 1;
+        while (i + run_length < count && run_length < max_blocks_per_request() && !cache().has_data(index + i + run_length))
+            ++run_length;
+
+        if (!read_uncached_run(index + i, run_length, out))
+            return false;
+        i += run_length;
+    }
+
+    return true;
+}
+
+bool DiskBackedFS::read_uncached_run(unsigned index, unsigned count, u8* buffer) const
+{
+    ASSERT(count <= max_blocks_per_request());
+    DiskOffset base_offset = static_cast<DiskOffset>(index) * static_cast<DiskOffset>(block_size());
+    if (!device().read(base_offset, count * block_size(), buffer))
+        return false;
     for (unsigned i = 0; i < count; ++i) {
-        if (!read_block(index + i, out, description))
+        auto& entry = cache().get(index + i);
+        if (entry.has_data)
+            continue;
+        memcpy(entry.data, buffer + i * block_size(), block_size());
+        entry.has_data = true;
+    }
+    return true;
+}
+
+void DiskBackedFS::prefetch_blocks(unsigned index, unsigned count) const
+{
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::prefetch_blocks %u x%u\n", index, count);
+#endif
+    for (unsigned i = 0; i < count;) {
+        if (cache().has_data(index + i)) {
+            ++i;
+            continue;
+        }
+        unsigned run_length = 1;
+        while (i + run_length < count && run_length < max_blocks_per_request() && !cache().has_data(index + i + run_length))
+            ++run_length;
+        if (!read_uncached_run(index + i, run_length, cache().staging_buffer()))
+            return;
+        i += run_length;
+    }
+}
+
+bool DiskBackedFS::read_blocks_direct(unsigned index, unsigned count, u8* buffer) const
+{
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::read_blocks_direct %u x%u\n", index, count);
+#endif
+    LOCKER(m_lock);
+    for (unsigned i = 0; i < count;) {
+        u8* out = buffer + i * block_size();
+        if (cache().has_data(index + i)) {
+            memcpy(out, cache().find(index + i)->data, block_size());
+            ++i;
+            continue;
+        }
+        unsigned run_length = 1;
+        while (i + run_length < count && run_length < max_blocks_per_request() && !cache().has_data(index + i + run_length))
+            ++run_length;
+        DiskOffset base_offset = static_cast<DiskOffset>(index + i) * static_cast<DiskOffset>(block_size());
+        if (!device().read(base_offset, run_length * block_size(), out))
             return false;
-        out += block_size();
+        i += run_length;
     }
+    return true;
+}
 
+bool DiskBackedFS::write_blocks_direct(unsigned index, unsigned count, const u8* data)
+{
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::write_blocks_direct %u x%u\n", index, count);
+#endif
+    LOCKER(m_lock);
+    for (unsigned i = 0; i < count;) {
+        unsigned run_length = min(count - i, max_blocks_per_request());
+        DiskOffset base_offset = static_cast<DiskOffset>(index + i) * static_cast<DiskOffset>(block_size());
+        if (!device().write(base_offset, run_length * block_size(), data + i * block_size()))
+            return false;
+        i += run_length;
+    }
+    if (!m_cache)
+        return true;
+    // A stale copy (even a dirty one from before the block changed hands) must not be written over this later.
+    for (unsigned i = 0; i < count; ++i) {
+        if (auto* entry = cache().find(index + i))
+            cache().invalidate(*entry);
+    }
     return true;
 }
 
+unsigned DiskBackedFS::max_blocks_per_request() const
+{
+    return max((size_t)1, max_request_size / block_size());
+}
+
 void DiskBackedFS::flush_specific_block_if_needed(unsigned index)
 {
     LOCKER(m_lock);
     if (!cache().is_dirty())
         return;
-    cache().for_each_entry([&](CacheEntry& entry) {
-        if (entry.is_dirty && entry.block_index == index) {
-            DiskOffset base_offset = static_cast<DiskOffset>(entry.block_index) * static_cast<DiskOffset>(block_size());
-            device().write(base_offset, block_size(), entry.data);
-            entry.is_dirty = false;
-        }
-    });
+    auto* entry = cache().find(index);
+    if (!entry || !entry->is_dirty)
+        return;
+    DiskOffset base_offset = static_cast<DiskOffset>(entry->block_index) * static_cast<DiskOffset>(block_size());
+    device().write(base_offset, block_size(), entry->data);
+    cache().mark_clean(*entry);
 }
 
 void DiskBackedFS::flush_writes_impl()
@@ -216,22 +505,106 @@ void DiskBackedFS::flush_writes_impl()
     LOCKER(m_lock);
     if (!cache().is_dirty())
         return;
-    u32 count = 0;
-    cache().for_each_entry([&](CacheEntry& entry) {
-        if (!entry.is_dirty)
-            return;
-        DiskOffset base_offset = static_cast<DiskOffset>(entry.block_index) * static_cast<DiskOffset>(block_size());
-        device().write(base_offset, block_size(), entry.data);
-        ++count;
-        entry.is_dirty = false;
+    Vector<u32> block_indices;
+    block_indices.ensure_capacity(cache().dirty_count());
+    cache().for_each_dirty_entry([&](auto& entry) {
+        block_indices.append(entry.block_index);
+        return IterationDecision::Continue;
     });
-    cache().set_dirty(false);
+    size_t count = write_back_blocks(block_indices);
     dbg() << class_name() << ": Flushed " << count << " blocks to disk";
 }
 
-void DiskBackedFS::flush_writes()
+void DiskBackedFS::throttle_dirty_blocks()
+{
+    // The writer went over the dirty limit. Make it write back the oldest dirty blocks
+    // itself, so readers never find the cache without clean entries to reuse.
+    LOCKER(m_lock);
+    size_t target = cache().dirty_limit() - min(cache().dirty_limit(), (size_t)max_blocks_per_request());
+    if (cache().dirty_count() <= target)
+        return;
+    size_t excess = cache().dirty_count() - target;
+    Vector<u32> block_indices;
+    cache().for_each_dirty_entry([&](auto& entry) {
+        block_indices.append(entry.block_index);
+        return block_indices.size() < (int)excess ? IterationDecision::Continue : IterationDecision::Break;
+    });
+    write_back_blocks(block_indices);
+}
+
+void DiskBackedFS::writeback()
+{
+    Vector<u32> block_indices;
+    {
+        LOCKER(m_lock);
+        if (!m_cache || !cache().is_dirty())
+            return;
+        auto now = g_uptime;
+        size_t background_count = cache().dirty_background_count();
+        size_t excess = cache().dirty_count() > background_count ? cache().dirty_count() - background_count : 0;
+        cache().for_each_dirty_entry([&](auto& entry) {
+            if (!excess && now - entry.dirtied_at < dirty_expire_ticks)
+                return IterationDecision::Break;
+            block_indices.append(entry.block_index);
+            if (excess)
+                --excess;
+            return IterationDecision::Continue;
+        });
+    }
+    if (block_indices.is_empty())
+        return;
+#ifdef DBFS_DEBUG
+    dbg() << class_name() << ": Writing back " << block_indices.size() << " aged blocks";
+#endif
+    write_back_blocks(block_indices);
+}
+
+size_t DiskBackedFS::write_back_blocks(Vector<u32>& block_indices)
+{
+    // Write in block order, coalescing adjacent blocks into one device request.
+    // The lock is only held for one request at a time, so readers can get in between.
+    quick_sort(block_indices.begin(), block_indices.end(), [](u32 a, u32 b) { return a < b; });
+
+    size_t count = 0;
+    for (int i = 0; i < block_indices.size();) {
+        LOCKER(m_lock);
+        u32 first_block_index = block_indices[i];
+        u8* buffer = cache().writeback_buffer();
+        unsigned run_length = 0;
+        while (i + (int)run_length < block_indices.size() && run_length < max_blocks_per_request() && block_indices[i + run_length] == first_block_index + run_length) {
+            auto* entry = cache().find(first_block_index + run_length);
+            // Someone else may have written this block back since we looked.
+            if (!entry || !entry->is_dirty)
+                break;
+            memcpy(buffer + run_length * block_size(), entry->data, block_size());
+            ++run_length;
+        }
+        if (!run_length) {
+            ++i;
+            continue;
+        }
+        DiskOffset base_offset = static_cast<DiskOffset>(first_block_index) * static_cast<DiskOffset>(block_size());
+        device().write(base_offset, run_length * block_size(), buffer);
+        for (unsigned j = 0; j < run_length; ++j)
+            cache().mark_clean(*cache().find(first_block_index + j));
+        count += run_length;
+        i += run_length;
+    }
+    return count;
+}
+
+KResult DiskBackedFS::flush_writes()
 {
     flush_writes_impl();
+    return KSuccess;
+}
+
+DiskBackedFS::CacheStatistics DiskBackedFS::cache_statistics() const
+{
+    LOCKER(m_lock);
+    if (!m_cache)
+        return {};
+    return m_cache->statistics();
 }
 
 DiskCache& DiskBackedFS::cache() const
@@ -40,10 +40,21 @@ public:
     DiskDevice& device() { return *m_device; }
     const DiskDevice& device() const { return *m_device; }
 
-    virtual void flush_writes() override;
+    virtual KResult flush_writes() override;
+    virtual void writeback() override;
 
     void flush_writes_impl();
 
+    struct CacheStatistics {
+        u32 entry_count { 0 };
+        u32 dirty_count { 0 };
+        u32 hits { 0 };
+        u32 misses { 0 };
+        u32 evictions { 0 };
+        u32 writebacks { 0 };
+    };
+    CacheStatistics cache_statistics() const;
+
 protected:
     explicit DiskBackedFS(NonnullRefPtr<DiskDevice>&&);
 
@@ -53,8 +64,22 @@ protected:
     bool write_block(unsigned index, const u8*, FileDescription* = nullptr);
     bool write_blocks(unsigned index, unsigned count, const u8*, FileDescription* = nullptr);
 
+    // Pull blocks into the cache ahead of use, without copying them out.
+    void prefetch_blocks(unsigned index, unsigned count) const;
+
+    // For file contents that are cached elsewhere (in the page cache.)
+    // Reads don't pull blocks into the block cache, but see any pending writes to them.
+    // Writes go straight to the device and drop any copies the block cache has.
+    bool read_blocks_direct(unsigned index, unsigned count, u8* buffer) const;
+    bool write_blocks_direct(unsigned index, unsigned count, const u8*);
+
+    unsigned max_blocks_per_request() const;
+
 private:
     DiskCache& cache() const;
+    bool read_uncached_run(unsigned index, unsigned count, u8* buffer) const;
+    size_t write_back_blocks(Vector<u32>& block_indices);
+    void throttle_dirty_blocks();
     void flush_specific_block_if_needed(unsigned index);
 
     NonnullRefPtr<DiskDevice> m_device;
@@ -26,18 +26,31 @@
 
 #include <AK/Bitmap.h>
 #include <AK/BufferStream.h>
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/QuickSort.h>
 #include <AK/StdLibExtras.h>
+#include <Kernel/Arch/i386/PIT.h>
 #include <Kernel/FileSystem/Ext2FileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/ext2_fs.h>
 #include <Kernel/Process.h>
 #include <Kernel/UnixTypes.h>
+#include <Kernel/VM/InodeVMObject.h>
+#include <Kernel/VM/MemoryManager.h>
 #include <LibC/errno_numbers.h>
 
 //#define EXT2_DEBUG
 
 static const size_t max_block_size = 4096;
 static const ssize_t max_inline_symlink_length = 60;
+static const u32 initial_readahead_window = 4;
+static const size_t max_readahead_size = 128 * KB;
+static const unsigned initial_preallocation_blocks = 8;
+static const unsigned max_preallocation_blocks = 256;
+static const u64 preallocation_idle_ticks = 5 * TICKS_PER_SECOND;
+static const u64 dirty_page_expire_ticks = 5 * TICKS_PER_SECOND;
+static const size_t max_dirty_pages_per_inode = 256;
+static const size_t page_in_cluster_pages = 4;
 
 static u8 to_ext2_file_type(mode_t mode)
 {
@@ -58,6 +71,216 @@ static u8 to_ext2_file_type(mode_t mode)
     return EXT2_FT_UNKNOWN;
 }
 
+// The directory index hashes below match the ones used by Linux and e2fsprogs,
+// so that indexed directories stay readable by (and from) other implementations.
+
+static const u32 directory_index_eof_hash = 0x7fffffff;
+static const u32 directory_index_block_mask = 0x0fffffff;
+static const unsigned directory_index_root_info_offset = 24;
+static const unsigned directory_index_node_entries_offset = 8;
+
+static u32 legacy_directory_hash(const char* name, int length, bool is_unsigned)
+{
+    u32 hash0 = 0x12a3fe2d;
+    u32 hash1 = 0x37abe8f9;
+    for (int i = 0; i < length; ++i) {
+        int c = is_unsigned ? (int)(u8)name[i] : (int)(i8)name[i];
+        u32 hash = hash1 + (hash0 ^ (u32)(c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+static void string_to_hash_buffer(const char* message, int length, u32* buffer, int count, bool is_unsigned)
+{
+    u32 pad = (u32)length | ((u32)length << 8);
+    pad |= pad << 16;
+    u32 value = pad;
+
+    if (length > count * 4)
+        length = count * 4;
+    for (int i = 0; i < length; ++i) {
+        int c = is_unsigned ? (int)(u8)message[i] : (int)(i8)message[i];
+        value = (u32)c + (value << 8);
+        if ((i % 4) == 3) {
+            *buffer++ = value;
+            value = pad;
+            --count;
+        }
+    }
+    if (--count >= 0)
+        *buffer++ = value;
+    while (--count >= 0)
+        *buffer++ = pad;
+}
+
+static inline u32 rotate_left(u32 value, int shift)
+{
+    return (value << shift) | (value >> (32 - shift));
+}
+
+static void half_md4_transform(u32 buffer[4], const u32 in[8])
+{
+    u32 a = buffer[0], b = buffer[1], c = buffer[2], d = buffer[3];
+
+    auto f = [](u32 x, u32 y, u32 z) { return z ^ (x & (y ^ z)); };
+    auto g = [](u32 x, u32 y, u32 z) { return (x & y) + ((x ^ y) & z); };
+    auto h = [](u32 x, u32 y, u32 z) { return x ^ y ^ z; };
+    const u32 k2 = 013240474631;
+    const u32 k3 = 015666365641;
+
+#define ROUND(function, a, b, c, d, x, s) \
+    a = rotate_left(a + function(b, c, d) + (x), s)
+
+    ROUND(f, a, b, c, d, in[0], 3);
+    ROUND(f, d, a, b, c, in[1], 7);
+    ROUND(f, c, d, a, b, in[2], 11);
+    ROUND(f, b, c, d, a, in[3], 19);
+    ROUND(f, a, b, c, d, in[4], 3);
+    ROUND(f, d, a, b, c, in[5], 7);
+    ROUND(f, c, d, a, b, in[6], 11);
+    ROUND(f, b, c, d, a, in[7], 19);
+
+    ROUND(g, a, b, c, d, in[1] + k2, 3);
+    ROUND(g, d, a, b, c, in[3] + k2, 5);
+    ROUND(g, c, d, a, b, in[5] + k2, 9);
+    ROUND(g, b, c, d, a, in[7] + k2, 13);
+    ROUND(g, a, b, c, d, in[0] + k2, 3);
+    ROUND(g, d, a, b, c, in[2] + k2, 5);
+    ROUND(g, c, d, a, b, in[4] + k2, 9);
+    ROUND(g, b, c, d, a, in[6] + k2, 13);
+
+    ROUND(h, a, b, c, d, in[3] + k3, 3);
+    ROUND(h, d, a, b, c, in[7] + k3, 9);
+    ROUND(h, c, d, a, b, in[2] + k3, 11);
+    ROUND(h, b, c, d, a, in[6] + k3, 15);
+    ROUND(h, a, b, c, d, in[1] + k3, 3);
+    ROUND(h, d, a, b, c, in[5] + k3, 9);
+    ROUND(h, c, d, a, b, in[0] + k3, 11);
+    ROUND(h, b, c, d, a, in[4] + k3, 15);
+
+#undef ROUND
+
+    buffer[0] += a;
+    buffer[1] += b;
+    buffer[2] += c;
+    buffer[3] += d;
+}
+
+static void tea_transform(u32 buffer[4], const u32 in[4])
+{
+    u32 sum = 0;
+    u32 b0 = buffer[0], b1 = buffer[1];
+    u32 a = in[0], b = in[1], c = in[2], d = in[3];
+    for (int n = 0; n < 16; ++n) {
+        sum += 0x9e3779b9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+    buffer[0] += b0;
+    buffer[1] += b1;
+}
+
+static bool is_valid_directory_entry(const ext2_dir_entry_2& entry, size_t offset, size_t block_size)
+{
+    if (entry.rec_len < EXT2_DIR_REC_LEN(0) || (entry.rec_len % 4) != 0)
+        return false;
+    if (offset + entry.rec_len > block_size)
+        return false;
+    return EXT2_DIR_REC_LEN(entry.name_len) <= entry.rec_len;
+}
+
+static ext2_dir_entry_2* find_in_directory_block(u8* block, size_t block_size, const StringView& name)
+{
+    for (size_t offset = 0; offset < block_size;) {
+        auto& entry = *reinterpret_cast<ext2_dir_entry_2*>(block + offset);
+        if (!is_valid_directory_entry(entry, offset, block_size))
+            return nullptr;
+        if (entry.inode != 0 && name == StringView(entry.name, entry.name_len))
+            return &entry;
+        offset += entry.rec_len;
+    }
+    return nullptr;
+}
+
+static void fill_directory_entry(ext2_dir_entry_2& entry, const StringView& name, unsigned inode, u8 file_type)
+{
+    entry.inode = inode;
+    entry.name_len = name.length();
+    entry.file_type = file_type;
+    memcpy(entry.name, name.characters_without_null_termination(), name.length());
+}
+
+// Puts a new entry into the first unused record or the slack of a live record that fits it.
+static bool insert_into_directory_block(u8* block, size_t block_size, const StringView& name, unsigned inode, u8 file_type)
+{
+    size_t needed = EXT2_DIR_REC_LEN(name.length());
+    for (size_t offset = 0; offset < block_size;) {
+        auto& entry = *reinterpret_cast<ext2_dir_entry_2*>(block + offset);
+        if (!is_valid_directory_entry(entry, offset, block_size))
+            return false;
+        if (entry.inode == 0 && entry.rec_len >= needed) {
+            fill_directory_entry(entry, name, inode, file_type);
+            return true;
+        }
+        size_t used = EXT2_DIR_REC_LEN(entry.name_len);
+        if (entry.inode != 0 && entry.rec_len >= used + needed) {
+            auto& new_entry = *reinterpret_cast<ext2_dir_entry_2*>(block + offset + used);
+            new_entry.rec_len = entry.rec_len - used;
+            entry.rec_len = used;
+            fill_directory_entry(new_entry, name, inode, file_type);
+            return true;
+        }
+        offset += entry.rec_len;
+    }
+    return false;
+}
+
+// Removes an entry by folding its record into the previous one (or clearing it if it's the first).
+static bool remove_from_directory_block(u8* block, size_t block_size, const StringView& name)
+{
+    ext2_dir_entry_2* previous = nullptr;
+    for (size_t offset = 0; offset < block_size;) {
+        auto& entry = *reinterpret_cast<ext2_dir_entry_2*>(block + offset);
+        if (!is_valid_directory_entry(entry, offset, block_size))
+            return false;
+        if (entry.inode != 0 && name == StringView(entry.name, entry.name_len)) {
+            if (previous)
+                previous->rec_len += entry.rec_len;
+            else
+                entry.inode = 0;
+            return true;
+        }
+        previous = &entry;
+        offset += entry.rec_len;
+    }
+    return false;
+}
+
+// Packs the given records tightly into `destination`, with the last one spanning to the end of the block.
+static void pack_directory_block(u8* destination, size_t block_size, const Vector<const ext2_dir_entry_2*>& entries)
+{
+    memset(destination, 0, block_size);
+    size_t offset = 0;
+    ext2_dir_entry_2* last = nullptr;
+    for (auto* entry : entries) {
+        size_t length = EXT2_DIR_REC_LEN(entry->name_len);
+        memcpy(destination + offset, entry, 8 + entry->name_len);
+        last = reinterpret_cast<ext2_dir_entry_2*>(destination + offset);
+        last->rec_len = length;
+        offset += length;
+    }
+    if (last) {
+        last->rec_len += block_size - offset;
+    } else {
+        auto& empty = *reinterpret_cast<ext2_dir_entry_2*>(destination);
+        empty.rec_len = block_size;
+    }
+}
+
 NonnullRefPtr<Ext2FS> Ext2FS::create(NonnullRefPtr<DiskDevice> device)
 {
     return adopt(*new Ext2FS(move(device)));
@@ -197,11 +420,11 @@ Ext2FS::BlockListShape Ext2FS::compute_block_list_shape(unsigned blocks)
     if (!blocks_remaining)
         return shape;
 
-    dbg() << "we don't know how to compute tind ext2fs blocks yet!";
-    ASSERT_NOT_REACHED();
-
     shape.triply_indirect_blocks = min(blocks_remaining, entries_per_block * entries_per_block * entries_per_block);
     blocks_remaining -= shape.triply_indirect_blocks;
+    shape.meta_blocks += 1;
+    shape.meta_blocks += ceil_div(shape.triply_indirect_blocks, entries_per_block * entries_per_block);
+    shape.meta_blocks += ceil_div(shape.triply_indirect_blocks, entries_per_block);
     if (!blocks_remaining)
         return shape;
 
@@ -210,183 +433,122 @@ Ext2FS::BlockListShape Ext2FS::compute_block_list_shape(unsigned blocks)
     return {};
 }
 
-bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2inode, const Vector<BlockIndex>& blocks)
+bool Ext2FS::inode_has_block_list(const ext2_inode& e2inode)
 {
-    LOCKER(m_lock);
+    // Device nodes keep their device number in i_block[], and short symlinks their target.
+    if (is_character_device(e2inode.i_mode) || is_block_device(e2inode.i_mode))
+        return false;
+    if (is_symlink(e2inode.i_mode) && (ssize_t)e2inode.i_size < max_inline_symlink_length)
+        return false;
+    return true;
+}
 
-    // NOTE: There is a mismatch between i_blocks and blocks.size() since i_blocks includes meta blocks and blocks.size() does not.
-    auto old_block_count = ceil_div(e2inode.i_size, block_size());
+unsigned Ext2FS::max_block_list_size() const
+{
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    return EXT2_NDIR_BLOCKS + entries_per_block + entries_per_block * entries_per_block + entries_per_block * entries_per_block * entries_per_block;
+}
 
-    auto old_shape = compute_block_list_shape(old_block_count);
-    auto new_shape = compute_block_list_shape(blocks.size());
+bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2inode, const Vector<BlockIndex>& blocks)
+{
+    LOCKER(m_lock);
 
-    Vector<BlockIndex> new_meta_blocks;
-    if (new_shape.meta_blocks > old_shape.meta_blocks) {
-        new_meta_blocks = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
-    }
+    // NOTE: Block lists only ever grow or shrink at the end, so only the pointers between the old and
+    //       the new end need to change. i_size still holds the old size at this point.
+    bool had_block_list = inode_has_block_list(e2inode);
+    unsigned old_block_count = had_block_list ? ceil_div(e2inode.i_size, block_size()) : 0;
+    unsigned new_block_count = blocks.size();
+    if (new_block_count > max_block_list_size())
+        return false;
 
-    e2inode.i_blocks = (blocks.size() + new_shape.meta_blocks) * (block_size() / 512);
+    // An inline symlink that outgrows i_block[] has its target there, not block pointers.
+    if (!had_block_list && new_block_count)
+        memset(e2inode.i_block, 0, sizeof(e2inode.i_block));
 
-    bool inode_dirty = false;
+    unsigned first_changed = min(old_block_count, new_block_count);
+    unsigned end_changed = max(old_block_count, new_block_count);
 
-    unsigned output_block_index = 0;
-    unsigned remaining_blocks = blocks.size();
-    for (unsigned i = 0; i < new_shape.direct_blocks; ++i) {
-        if (e2inode.i_block[i] != blocks[output_block_index])
-            inode_dirty = true;
-        e2inode.i_block[i] = blocks[output_block_index];
-        ++output_block_index;
-        --remaining_blocks;
-    }
-    if (inode_dirty) {
-#ifdef EXT2_DEBUG
-        dbgprintf("Ext2FS: Writing %u direct block(s) to i_block array of inode %u\n", min(EXT2_NDIR_BLOCKS, blocks.size()), inode_index);
-        for (int i = 0; i < min(EXT2_NDIR_BLOCKS, blocks.size()); ++i)
-            dbgprintf("   + %u\n", blocks[i]);
-#endif
-        write_ext2_inode(inode_index, e2inode);
-        inode_dirty = false;
-    }
+    auto new_shape = compute_block_list_shape(new_block_count);
+    e2inode.i_blocks = (new_block_count + new_shape.meta_blocks) * (block_size() / 512);
 
-    if (!remaining_blocks)
+    if (first_changed == end_changed)
         return true;
 
-    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
-
-    bool ind_block_new = !e2inode.i_block[EXT2_IND_BLOCK];
-    if (ind_block_new) {
-        BlockIndex new_indirect_block = new_meta_blocks.take_last();
-        if (e2inode.i_block[EXT2_IND_BLOCK] != new_indirect_block)
-            inode_dirty = true;
-        e2inode.i_block[EXT2_IND_BLOCK] = new_indirect_block;
-        if (inode_dirty) {
 #ifdef EXT2_DEBUG
-            dbgprintf("Ext2FS: Adding the indirect block to i_block array of inode %u\n", inode_index);
+    dbg() << "Ext2FS: Updating block list of inode " << inode_index << " from " << old_block_count << " to " << new_block_count << " blocks";
 #endif
-            write_ext2_inode(inode_index, e2inode);
-            inode_dirty = false;
-        }
-    }
 
-    if (old_shape.indirect_blocks == new_shape.indirect_blocks) {
-        // No need to update the singly indirect block array.
-        remaining_blocks -= new_shape.indirect_blocks;
-        output_block_index += new_shape.indirect_blocks;
-    } else {
-        auto block_contents = ByteBuffer::create_uninitialized(block_size());
-        BufferStream stream(block_contents);
-        ASSERT(new_shape.indirect_blocks <= entries_per_block);
-        for (unsigned i = 0; i < new_shape.indirect_blocks; ++i) {
-            stream << blocks[output_block_index++];
-            --remaining_blocks;
-        }
-        stream.fill_to_end(0);
-        bool success = write_block(e2inode.i_block[EXT2_IND_BLOCK], block_contents.data());
-        ASSERT(success);
-    }
+    for (unsigned i = first_changed; i < min(end_changed, (unsigned)EXT2_NDIR_BLOCKS); ++i)
+        e2inode.i_block[i] = i < new_block_count ? blocks[i] : 0;
 
-    if (!remaining_blocks)
-        return true;
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned first_indirect_block = EXT2_NDIR_BLOCKS;
+    if (!update_block_array(inode_index, e2inode.i_block[EXT2_IND_BLOCK], 1, first_indirect_block, first_changed, end_changed, blocks))
+        return false;
 
-    bool dind_block_dirty = false;
+    unsigned first_doubly_indirect_block = first_indirect_block + entries_per_block;
+    if (!update_block_array(inode_index, e2inode.i_block[EXT2_DIND_BLOCK], 2, first_doubly_indirect_block, first_changed, end_changed, blocks))
+        return false;
 
-    bool dind_block_new = !e2inode.i_block[EXT2_DIND_BLOCK];
-    if (dind_block_new) {
-        BlockIndex new_dindirect_block = new_meta_blocks.take_last();
-        if (e2inode.i_block[EXT2_DIND_BLOCK] != new_dindirect_block)
-            inode_dirty = true;
-        e2inode.i_block[EXT2_DIND_BLOCK] = new_dindirect_block;
-        if (inode_dirty) {
-#ifdef EXT2_DEBUG
-            dbgprintf("Ext2FS: Adding the doubly-indirect block to i_block array of inode %u\n", inode_index);
-#endif
-            write_ext2_inode(inode_index, e2inode);
-            inode_dirty = false;
-        }
-    }
+    unsigned first_triply_indirect_block = first_doubly_indirect_block + entries_per_block * entries_per_block;
+    if (!update_block_array(inode_index, e2inode.i_block[EXT2_TIND_BLOCK], 3, first_triply_indirect_block, first_changed, end_changed, blocks))
+        return false;
 
-    if (old_shape.doubly_indirect_blocks == new_shape.doubly_indirect_blocks) {
-        // No need to update the doubly indirect block data.
-        remaining_blocks -= new_shape.doubly_indirect_blocks;
-        output_block_index += new_shape.doubly_indirect_blocks;
-    } else {
-        unsigned indirect_block_count = new_shape.doubly_indirect_blocks / entries_per_block;
-        if ((new_shape.doubly_indirect_blocks % entries_per_block) != 0)
-            indirect_block_count++;
-
-        auto dind_block_contents = ByteBuffer::create_uninitialized(block_size());
-        read_block(e2inode.i_block[EXT2_DIND_BLOCK], dind_block_contents.data());
-        if (dind_block_new) {
-            memset(dind_block_contents.data(), 0, dind_block_contents.size());
-            dind_block_dirty = true;
-        }
-        auto* dind_block_as_pointers = (unsigned*)dind_block_contents.data();
+    return true;
+}
 
-        ASSERT(indirect_block_count <= entries_per_block);
-        for (unsigned i = 0; i < indirect_block_count; ++i) {
-            bool ind_block_dirty = false;
+bool Ext2FS::update_block_array(InodeIndex inode_index, BlockIndex& array_block_index, unsigned level, unsigned first_logical_block, unsigned first_changed, unsigned end_changed, const Vector<BlockIndex>& blocks)
+{
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned span = 1;
+    for (unsigned i = 1; i < level; ++i)
+        span *= entries_per_block;
 
-            BlockIndex indirect_block_index = dind_block_as_pointers[i];
+    if (end_changed <= first_logical_block || first_changed >= first_logical_block + span * entries_per_block)
+        return true;
 
-            bool ind_block_new = !indirect_block_index;
-            if (ind_block_new) {
-                indirect_block_index = new_meta_blocks.take_last();
-                dind_block_as_pointers[i] = indirect_block_index;
-                dind_block_dirty = true;
-            }
+    bool is_needed = (unsigned)blocks.size() > first_logical_block;
+    bool is_new = !array_block_index;
+    if (is_new && !is_needed)
+        return true;
 
-            auto ind_block_contents = ByteBuffer::create_uninitialized(block_size());
-            read_block(indirect_block_index, ind_block_contents.data());
-            if (ind_block_new) {
-                memset(ind_block_contents.data(), 0, dind_block_contents.size());
-                ind_block_dirty = true;
-            }
-            auto* ind_block_as_pointers = (unsigned*)ind_block_contents.data();
-
-            unsigned entries_to_write = new_shape.doubly_indirect_blocks - (i * entries_per_block);
-            if (entries_to_write > entries_per_block)
-                entries_to_write = entries_per_block;
-
-            ASSERT(entries_to_write <= entries_per_block);
-            for (unsigned j = 0; j < entries_to_write; ++j) {
-                BlockIndex output_block = blocks[output_block_index++];
-                if (ind_block_as_pointers[j] != output_block) {
-                    ind_block_as_pointers[j] = output_block;
-                    ind_block_dirty = true;
-                }
-                --remaining_blocks;
-            }
-            for (unsigned j = entries_to_write; j < entries_per_block; ++j) {
-                if (ind_block_as_pointers[j] != 0) {
-                    ind_block_as_pointers[j] = 0;
-                    ind_block_dirty = true;
-                }
-            }
+    auto array_block = ByteBuffer::create_uninitialized(block_size());
+    if (is_new) {
+        array_block_index = allocate_blocks(group_index_from_inode(inode_index), 1).first();
+        memset(array_block.data(), 0, block_size());
+    } else if (!read_block(array_block_index, array_block.data())) {
+        return false;
+    }
 
-            if (ind_block_dirty) {
-                bool success = write_block(indirect_block_index, ind_block_contents.data());
-                ASSERT(success);
-            }
+    auto* entries = reinterpret_cast<BlockIndex*>(array_block.data());
+    unsigned first_entry = first_changed > first_logical_block ? (first_changed - first_logical_block) / span : 0;
+    unsigned end_entry = min(entries_per_block, ceil_div(end_changed - first_logical_block, span));
+    bool dirty = is_new;
+    for (unsigned i = first_entry; i < end_entry; ++i) {
+        unsigned entry_first_logical_block = first_logical_block + i * span;
+        BlockIndex new_entry;
+        if (level == 1) {
+            new_entry = entry_first_logical_block < (unsigned)blocks.size() ? blocks[entry_first_logical_block] : 0;
+        } else {
+            new_entry = entries[i];
+            if (!update_block_array(inode_index, new_entry, level - 1, entry_first_logical_block, first_changed, end_changed, blocks))
+                return false;
         }
-        for (unsigned i = indirect_block_count; i < entries_per_block; ++i) {
-            if (dind_block_as_pointers[i] != 0) {
-                dind_block_as_pointers[i] = 0;
-                dind_block_dirty = true;
-            }
-        }
-
-        if (dind_block_dirty) {
-            bool success = write_block(e2inode.i_block[EXT2_DIND_BLOCK], dind_block_contents.data());
-            ASSERT(success);
+        if (entries[i] != new_entry) {
+            entries[i] = new_entry;
+            dirty = true;
         }
     }
 
-    if (!remaining_blocks)
+    if (!is_needed) {
+        set_block_allocation_state(array_block_index, false);
+        array_block_index = 0;
         return true;
+    }
 
-    // FIXME: Implement!
-    dbg() << "we don't know how to write tind ext2fs blocks yet!";
-    ASSERT_NOT_REACHED();
+    if (dirty)
+        return write_block(array_block_index, array_block.data());
+    return true;
 }
 
 Vector<Ext2FS::BlockIndex> Ext2FS::block_list_for_inode(const ext2_inode& e2inode, bool include_block_list_blocks) const
@@ -503,7 +665,7 @@ void Ext2FS::flush_block_group_descriptor_table()
     write_blocks(first_block_of_bgdt, blocks_to_write, (const u8*)block_group_descriptors());
 }
 
-void Ext2FS::flush_writes()
+void Ext2FS::flush_cached_metadata()
 {
     LOCKER(m_lock);
     if (m_super_block_dirty) {
@@ -523,9 +685,11 @@ void Ext2FS::flush_writes()
 #endif
         }
     }
+}
 
-    DiskBackedFS::flush_writes();
-
+void Ext2FS::uncache_unused_inodes()
+{
+    LOCKER(m_lock);
     // Uncache Inodes that are only kept alive by the index-to-inode lookup cache.
     // We don't uncache Inodes that are being watched by at least one InodeWatcher.
 
@@ -534,14 +698,68 @@ void Ext2FS::flush_writes()
     //        for their (child name lookup) and (block list) caches.
     Vector<InodeIndex> unused_inodes;
     for (auto& it : m_inode_cache) {
-        if (it.value->ref_count() != 1)
+        if (!it.value)
+            continue;
+        if (!it.value->is_only_referenced_by_caches())
             continue;
         if (it.value->has_watchers())
             continue;
+        // Keep the contents of files around until memory pressure takes their pages.
+        if (it.value->m_raw_inode.i_links_count && it.value->has_cached_pages())
+            continue;
         unused_inodes.append(it.key);
     }
-    for (auto index : unused_inodes)
+    for (auto index : unused_inodes) {
+        m_inode_cache.get(index).value()->drop_page_cache();
         uncache_inode(index);
+    }
+}
+
+KResult Ext2FS::write_back_dirty_pages(bool only_expired)
+{
+    NonnullRefPtrVector<Ext2FSInode> inodes;
+    {
+        LOCKER(m_lock);
+        auto now = g_uptime;
+        for (auto& it : m_inode_cache) {
+            auto& inode = it.value;
+            if (!inode || !inode->m_page_cache || !inode->m_page_cache->dirty_page_count())
+                continue;
+            if (only_expired && now - inode->m_pages_dirtied_at < dirty_page_expire_ticks)
+                continue;
+            inodes.append(*inode);
+        }
+    }
+    // NOTE: The inode lock comes before the FS lock, so we can't hold on to the latter here.
+    KResult result = KSuccess;
+    for (auto& inode : inodes) {
+        auto inode_result = inode.write_back_dirty_pages();
+        if (inode_result.is_error() && result.is_success())
+            result = inode_result;
+    }
+    return result;
+}
+
+KResult Ext2FS::flush_writes()
+{
+    auto result = write_back_dirty_pages(false);
+    LOCKER(m_lock);
+    discard_preallocations(false);
+    flush_cached_metadata();
+    DiskBackedFS::flush_writes();
+    uncache_unused_inodes();
+    return result;
+}
+
+void Ext2FS::writeback()
+{
+    // NOTE: Metadata only goes into the block cache here; it reaches the disk once those blocks age.
+    //       Pages that fail to write back stay dirty and get retried next time.
+    (void)write_back_dirty_pages(true);
+    discard_preallocations(true);
+    flush_cached_metadata();
+    DiskBackedFS::writeback();
+    uncache_unused_inodes();
 }
 
 Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
@@ -551,6 +769,7 @@ Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
 
 Ext2FSInode::~Ext2FSInode()
 {
+    discard_preallocation();
     if (m_raw_inode.i_links_count == 0)
         fs().free_inode(*this);
 }
@@ -643,6 +862,15 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, u8* buffer, FileDes
         return nread;
     }
 
+    if (has_page_cache()) {
+        if (!description || !description->is_direct())
+            return read_bytes_from_page_cache(offset, count, buffer, description);
+        // Direct reads go to the disk, so it has to have what we've got cached first.
+        auto result = const_cast<Ext2FSInode&>(*this).write_back_dirty_pages();
+        if (result.is_error())
+            return result;
+    }
+
     Locker fs_locker(fs().m_lock);
 
     if (m_block_list.is_empty())
@@ -672,24 +900,152 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, u8* buffer, FileDes
 
     u8 block[max_block_size];
 
-    for (int bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
+    for (int bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index;) {
+        int offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
+
+        if (offset_into_block == 0 && remaining_count >= block_size) {
+            // Whole blocks go straight into the caller's buffer, with physically adjacent blocks coalesced into one request.
+            int run_length = 1;
+            int max_run_length = min(remaining_count / block_size, (int)fs().max_blocks_per_request());
+            while (bi + run_length <= last_block_logical_index
+                && run_length < max_run_length
+                && m_block_list[bi + run_length] == m_block_list[bi] + run_length)
+                ++run_length;
+            bool success = fs().read_blocks(m_block_list[bi], run_length, out, description);
+            if (!success) {
+                kprintf("ext2fs: read_bytes: read_blocks(%u, %u) failed (lbi: %u)\n", m_block_list[bi], run_length, bi);
+                return -EIO;
+            }
+            int num_bytes_read = run_length * block_size;
+            remaining_count -= num_bytes_read;
+            nread += num_bytes_read;
+            out += num_bytes_read;
+            bi += run_length;
+            continue;
+        }
+
         bool success = fs().read_block(m_block_list[bi], block, description);
         if (!success) {
             kprintf("ext2fs: read_bytes: read_block(%u) failed (lbi: %u)\n", m_block_list[bi], bi);
             return -EIO;
         }
 
-        int offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         int num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
         memcpy(out, block + offset_into_block, num_bytes_to_copy);
         remaining_count -= num_bytes_to_copy;
         nread += num_bytes_to_copy;
         out += num_bytes_to_copy;
+        ++bi;
     }
 
+    if (description && !description->is_direct())
+        do_readahead(*description, offset, nread);
+
     return nread;
 }
 
+void Ext2FSInode::do_readahead(FileDescription& description, off_t offset, ssize_t nread) const
+{
+    auto& state = description.readahead_state();
+    const int block_size = fs().block_size();
+
+    if (offset != state.next_offset || nread <= 0) {
+        // Random access; shut the window until we see sequential reads again.
+        state.window = 0;
+        state.prefetched_until = 0;
+        state.next_offset = offset + max(nread, 0);
+        return;
+    }
+    state.next_offset = offset + nread;
+
+    u32 max_window = max((unsigned)initial_readahead_window, (unsigned)(max_readahead_size / block_size));
+    state.window = state.window ? min(state.window * 2, max_window) : (u32)initial_readahead_window;
+
+    u32 next_block = ceil_div(state.next_offset, (off_t)block_size);
+    u32 window_end = min(next_block + state.window, (u32)m_block_list.size());
+
+    // Don't prefetch the same blocks again, and wait until the reader has consumed half of what we fetched last time.
+    u32 first_block = max(next_block, state.prefetched_until);
+    if (first_block >= window_end || (state.prefetched_until > next_block && state.prefetched_until - next_block > state.window / 2))
+        return;
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FS: Readahead of logical blocks " << first_block << "-" << window_end << " in inode " << identifier();
+#endif
+
+    if (has_page_cache()) {
+        u32 blocks_per_page = PAGE_SIZE / block_size;
+        u32 first_page = first_block / blocks_per_page;
+        populate_page_cache(first_page, ceil_div(window_end, blocks_per_page) - first_page);
+    } else {
+        for (u32 bi = first_block; bi < window_end;) {
+            u32 run_length = 1;
+            while (bi + run_length < window_end && m_block_list[bi + run_length] == m_block_list[bi] + run_length)
+                ++run_length;
+            fs().prefetch_blocks(m_block_list[bi], run_length);
+            bi += run_length;
+        }
+    }
+    state.prefetched_until = window_end;
+}
+
+Vector<unsigned> Ext2FSInode::allocate_data_blocks(unsigned count, unsigned goal)
+{
+    LOCKER(fs().m_lock);
+    Vector<unsigned> blocks;
+    blocks.ensure_capacity(count);
+
+    if (m_preallocation_count && m_preallocation_start == goal) {
+        unsigned taken = min(count, m_preallocation_count);
+        for (unsigned i = 0; i < taken; ++i)
+            blocks.unchecked_append(m_preallocation_start + i);
+        m_preallocation_start += taken;
+        m_preallocation_count -= taken;
+        fs().m_preallocated_block_count -= taken;
+        goal = m_preallocation_start;
+    } else {
+        discard_preallocation();
+    }
+    m_preallocation_touched_at = g_uptime;
+
+    if ((unsigned)blocks.size() == count)
+        return blocks;
+
+    blocks.append(fs().allocate_blocks(fs().group_index_from_inode(index()), count - blocks.size(), goal));
+    if (!::is_regular_file(m_raw_inode.i_mode))
+        return blocks;
+
+    // Files that keep growing at the end get a window of blocks reserved past it, doubling while they do.
+    m_preallocation_window = m_preallocation_window ? min(m_preallocation_window * 2, max_preallocation_blocks) : initial_preallocation_blocks;
+    if (fs().super_block().s_free_blocks_count < m_preallocation_window * 16)
+        return blocks;
+
+    Vector<unsigned> reserved;
+    unsigned reserved_count = fs().allocate_blocks_at(blocks.last() + 1, m_preallocation_window, reserved);
+    if (reserved_count) {
+        m_preallocation_start = reserved.first();
+        m_preallocation_count = reserved_count;
+        fs().m_preallocated_block_count += reserved_count;
+    }
+    return blocks;
+}
+
+void Ext2FSInode::discard_preallocation()
+{
+    LOCKER(fs().m_lock);
+    m_preallocation_window = 0;
+    if (!m_preallocation_count)
+        return;
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FSInode: Discarding " << m_preallocation_count << " preallocated block(s) of " << identifier();
+#endif
+    for (unsigned i = 0; i < m_preallocation_count; ++i)
+        fs().set_block_allocation_state(m_preallocation_start + i, false);
+    fs().m_preallocated_block_count -= m_preallocation_count;
+    m_preallocation_start = 0;
+    m_preallocation_count = 0;
+}
+
 KResult Ext2FSInode::resize(u64 new_size)
 {
     u64 old_size = size();
@@ -697,6 +1053,8 @@ KResult Ext2FSInode::resize(u64 new_size)
         return KSuccess;
 
     u64 block_size = fs().block_size();
+    if (ceil_div(new_size, block_size) > fs().max_block_list_size())
+        return KResult(-EFBIG);
     int blocks_needed_before = ceil_div(old_size, block_size);
     int blocks_needed_after = ceil_div(new_size, block_size);
 
@@ -707,15 +1065,19 @@ KResult Ext2FSInode::resize(u64 new_size)
 
     if (blocks_needed_after > blocks_needed_before) {
         u32 additional_blocks_needed = blocks_needed_after - blocks_needed_before;
-        if (additional_blocks_needed > fs().super_block().s_free_blocks_count)
+        if (additional_blocks_needed > fs().super_block().s_free_blocks_count + m_preallocation_count)
+            fs().discard_preallocations(false);
+        if (additional_blocks_needed > fs().super_block().s_free_blocks_count + m_preallocation_count)
             return KResult(-ENOSPC);
     }
 
     auto block_list = fs().block_list_for_inode(m_raw_inode);
     if (blocks_needed_after > blocks_needed_before) {
-        auto new_blocks = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before);
+        unsigned goal = block_list.is_empty() ? 0 : block_list.last() + 1;
+        auto new_blocks = allocate_data_blocks(blocks_needed_after - blocks_needed_before, goal);
         block_list.append(move(new_blocks));
     } else if (blocks_needed_after < blocks_needed_before) {
+        discard_preallocation();
 #ifdef EXT2_DEBUG
         dbg() << "Ext2FS: Shrinking inode " << identifier() << ". Old block list is " << block_list.size() << " entries:";
         for (auto block_index : block_list) {
@@ -736,6 +1098,10 @@ KResult Ext2FSInode::resize(u64 new_size)
     set_metadata_dirty(true);
 
     m_block_list = move(block_list);
+
+    if (new_size < old_size)
+        zero_page_cache_past(new_size);
+    inode_size_changed(old_size, new_size);
     return KSuccess;
 }
 
@@ -745,7 +1111,6 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const u8* data, Fi
     ASSERT(count >= 0);
 
     Locker inode_locker(m_lock);
-    Locker fs_locker(fs().m_lock);
 
     if (is_symlink()) {
         ASSERT(offset == 0);
@@ -761,8 +1126,12 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const u8* data, Fi
         }
     }
 
+    if (has_page_cache())
+        return write_bytes_to_page_cache(offset, count, data, description);
+
+    Locker fs_locker(fs().m_lock);
+
     const ssize_t block_size = fs().block_size();
-    u64 old_size = size();
     u64 new_size = max(static_cast<u64>(offset) + count, (u64)size());
 
     auto resize_result = resize(new_size);
@@ -837,10 +1206,315 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const u8* data, Fi
     dbg() << "Ext2FS: After write, i_size=" << m_raw_inode.i_size << ", i_blocks=" << m_raw_inode.i_blocks << " (" << m_block_list.size() << " blocks in list)";
 #endif
 
-    if (old_size != new_size)
-        inode_size_changed(old_size, new_size);
-    inode_contents_changed(offset, count, data);
-    return nwritten;
+    inode_contents_changed(offset, count, data);
+    return nwritten;
+}
+
+bool Ext2FSInode::has_page_cache() const
+{
+    return ::is_regular_file(m_raw_inode.i_mode);
+}
+
+InodeVMObject& Ext2FSInode::page_cache() const
+{
+    ASSERT(has_page_cache());
+    if (!m_page_cache)
+        m_page_cache = InodeVMObject::create_with_inode(const_cast<Ext2FSInode&>(*this));
+    return *m_page_cache;
+}
+
+KResult Ext2FSInode::page_in(size_t page_index)
+{
+    LOCKER(m_lock);
+    if (page_index >= page_cache().page_count())
+        return KResult(-EFAULT);
+    // Mappings tend to fault their way forward, so bring in a few pages past this one as well.
+    if (!populate_page_cache(page_index, page_in_cluster_pages))
+        return KResult(-EIO);
+    return KSuccess;
+}
+
+bool Ext2FSInode::populate_page_cache(size_t first_page_index, size_t page_count) const
+{
+    auto& pages = page_cache().physical_pages();
+    if (first_page_index >= pages.size())
+        return true;
+    page_count = min(page_count, pages.size() - first_page_index);
+
+    size_t max_pages_per_request = max((size_t)1, fs().max_blocks_per_request() * fs().block_size() / PAGE_SIZE);
+    for (size_t i = 0; i < page_count;) {
+        if (pages[first_page_index + i]) {
+            ++i;
+            continue;
+        }
+        size_t run_length = 1;
+        while (i + run_length < page_count && run_length < max_pages_per_request && !pages[first_page_index + i + run_length])
+            ++run_length;
+
+        auto buffer = ByteBuffer::create_uninitialized(run_length * PAGE_SIZE);
+        if (!read_pages_from_disk(first_page_index + i, run_length, buffer.data()))
+            return false;
+
+        for (size_t j = 0; j < run_length; ++j) {
+            auto page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+            if (!page)
+                return false;
+            MM.copy_to_physical_page(*page, 0, buffer.data() + j * PAGE_SIZE, PAGE_SIZE);
+            InterruptDisabler disabler;
+            pages[first_page_index + i + j] = move(page);
+        }
+        i += run_length;
+    }
+    return true;
+}
+
+bool Ext2FSInode::read_pages_from_disk(size_t first_page_index, size_t page_count, u8* buffer) const
+{
+    LOCKER(fs().m_lock);
+    if (m_block_list.is_empty())
+        m_block_list = fs().block_list_for_inode(m_raw_inode);
+
+    const size_t block_size = fs().block_size();
+    const size_t blocks_per_page = PAGE_SIZE / block_size;
+    const size_t block_list_size = m_block_list.size();
+    const size_t first_block = first_page_index * blocks_per_page;
+    const size_t block_count = page_count * blocks_per_page;
+
+    for (size_t i = 0; i < block_count;) {
+        size_t bi = first_block + i;
+        if (bi >= block_list_size) {
+            memset(buffer + i * block_size, 0, (block_count - i) * block_size);
+            break;
+        }
+        size_t run_length = 1;
+        while (i + run_length < block_count && bi + run_length < block_list_size && m_block_list[bi + run_length] == m_block_list[bi] + run_length)
+            ++run_length;
+        if (!fs().read_blocks_direct(m_block_list[bi], run_length, buffer + i * block_size)) {
+            kprintf("ext2fs: read_pages_from_disk: read_blocks_direct(%u, %u) failed (lbi: %u)\n", m_block_list[bi], run_length, bi);
+            return false;
+        }
+        i += run_length;
+    }
+
+    // Whatever lies past the end of the file reads as zeroes, both through read() and through mappings.
+    u64 first_offset = (u64)first_page_index * PAGE_SIZE;
+    size_t valid_size = size() > first_offset ? min((u64)page_count * PAGE_SIZE, size() - first_offset) : 0;
+    memset(buffer + valid_size, 0, page_count * PAGE_SIZE - valid_size);
+    return true;
+}
+
+ssize_t Ext2FSInode::read_bytes_from_page_cache(off_t offset, ssize_t count, u8* buffer, FileDescription* description) const
+{
+    if ((u64)offset >= size())
+        return 0;
+    size_t remaining_count = min((u64)count, (u64)size() - offset);
+    size_t last_page_index = (offset + remaining_count - 1) / PAGE_SIZE;
+    auto& pages = page_cache().physical_pages();
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FS: Reading up to " << count << " bytes " << offset << " bytes into inode " << identifier() << " from the page cache";
+#endif
+
+    ssize_t nread = 0;
+    while (remaining_count) {
+        size_t page_index = (offset + nread) / PAGE_SIZE;
+        size_t offset_in_page = (offset + nread) % PAGE_SIZE;
+        size_t num_bytes_to_copy = min(PAGE_SIZE - offset_in_page, remaining_count);
+
+        RefPtr<PhysicalPage> page = pages[page_index];
+        if (!page) {
+            // Bring in the rest of what we're reading along with this page.
+            if (!populate_page_cache(page_index, last_page_index - page_index + 1))
+                return nread ? nread : -EIO;
+            page = pages[page_index];
+            if (!page)
+                return nread ? nread : -ENOMEM;
+        }
+
+        MM.copy_from_physical_page(*page, offset_in_page, buffer + nread, num_bytes_to_copy);
+        remaining_count -= num_bytes_to_copy;
+        nread += num_bytes_to_copy;
+    }
+
+    if (description)
+        do_readahead(*description, offset, nread);
+    return nread;
+}
+
+ssize_t Ext2FSInode::write_bytes_to_page_cache(off_t offset, ssize_t count, const u8* data, FileDescription* description)
+{
+    u64 old_size = size();
+    u64 new_size = max(static_cast<u64>(offset) + count, old_size);
+
+    if (new_size != old_size) {
+        // Bring in the page holding the end of the file while it's still the end,
+        // so that everything past it comes in as zeroes rather than whatever is on disk.
+        if (old_size % PAGE_SIZE && !populate_page_cache(old_size / PAGE_SIZE, 1))
+            return -EIO;
+        Locker fs_locker(fs().m_lock);
+        auto resize_result = resize(new_size);
+        if (resize_result.is_error())
+            return resize_result;
+    }
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FS: Writing " << count << " bytes " << offset << " bytes into inode " << identifier() << " through the page cache";
+#endif
+
+    auto& pages = page_cache().physical_pages();
+    ssize_t nwritten = 0;
+    while (nwritten < count) {
+        u64 position = static_cast<u64>(offset) + nwritten;
+        size_t page_index = position / PAGE_SIZE;
+        size_t offset_in_page = position % PAGE_SIZE;
+        size_t num_bytes_to_copy = min(PAGE_SIZE - offset_in_page, (size_t)(count - nwritten));
+
+        RefPtr<PhysicalPage> page = pages[page_index];
+        if (!page) {
+            if (num_bytes_to_copy == PAGE_SIZE) {
+                page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::No);
+            } else if ((u64)page_index * PAGE_SIZE >= old_size) {
+                // None of this page was part of the file before.
+                page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::Yes);
+            } else {
+                if (!populate_page_cache(page_index, 1))
+                    return nwritten ? nwritten : -EIO;
+                page = pages[page_index];
+            }
+            if (!page)
+                return nwritten ? nwritten : -ENOMEM;
+        }
+
+        MM.copy_to_physical_page(*page, offset_in_page, data + nwritten, num_bytes_to_copy);
+        {
+            InterruptDisabler disabler;
+            pages[page_index] = page;
+            m_page_cache->set_page_dirty(page_index, true);
+        }
+        nwritten += num_bytes_to_copy;
+    }
+
+    if (!m_pages_dirtied_at)
+        m_pages_dirtied_at = g_uptime;
+
+    if (description && description->is_direct()) {
+        auto result = write_back_dirty_pages();
+        if (result.is_error())
+            return result;
+    } else if (m_page_cache->dirty_page_count() > max_dirty_pages_per_inode) {
+        (void)write_back_dirty_pages();
+    }
+    return nwritten;
+}
+
+void Ext2FSInode::zero_page_cache_past(u64 size)
+{
+    // The page holding the new end of the file may get exposed again if the file grows.
+    if (!m_page_cache || !(size % PAGE_SIZE))
+        return;
+    auto& pages = m_page_cache->physical_pages();
+    size_t page_index = size / PAGE_SIZE;
+    if (page_index >= pages.size() || !pages[page_index])
+        return;
+    MM.zero_physical_page_range(*pages[page_index], size % PAGE_SIZE, PAGE_SIZE - size % PAGE_SIZE);
+}
+
+KResult Ext2FSInode::write_back_dirty_pages()
+{
+    Locker inode_locker(m_lock);
+    if (!m_page_cache || !m_page_cache->dirty_page_count())
+        return KSuccess;
+    m_pages_dirtied_at = 0;
+
+    Locker fs_locker(fs().m_lock);
+    if (m_block_list.is_empty())
+        m_block_list = fs().block_list_for_inode(m_raw_inode);
+
+    const size_t block_size = fs().block_size();
+    const size_t blocks_per_page = PAGE_SIZE / block_size;
+    const size_t block_list_size = m_block_list.size();
+    const size_t max_run_length = fs().max_blocks_per_request();
+    auto buffer = ByteBuffer::create_uninitialized(max_run_length * block_size);
+    auto& pages = m_page_cache->physical_pages();
+
+    KResult result = KSuccess;
+    unsigned run_start = 0;
+    size_t run_length = 0;
+    Vector<size_t, 16> run_pages;
+    auto write_run = [&] {
+        if (!run_length)
+            return;
+        if (!fs().write_blocks_direct(run_start, run_length, buffer.data())) {
+            kprintf("ext2fs: write_back_dirty_pages: write_blocks_direct(%u, %u) failed\n", run_start, run_length);
+            // Keep what didn't make it to the disk dirty, so a later write-back tries again.
+            InterruptDisabler disabler;
+            for (auto page_index : run_pages)
+                m_page_cache->set_page_dirty(page_index, true);
+            if (!m_pages_dirtied_at)
+                m_pages_dirtied_at = g_uptime;
+            result = KResult(-EIO);
+        }
+        run_length = 0;
+        run_pages.clear();
+    };
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FS: Writing back " << m_page_cache->dirty_page_count() << " dirty pages of inode " << identifier();
+#endif
+
+    // Dirty pages go out in file order, with physically adjacent blocks coalesced into one request.
+    for (size_t page_index = 0; page_index < pages.size(); ++page_index) {
+        RefPtr<PhysicalPage> page;
+        {
+            InterruptDisabler disabler;
+            if (!m_page_cache->is_page_dirty(page_index))
+                continue;
+            page = pages[page_index];
+            ASSERT(page);
+            m_page_cache->set_page_dirty(page_index, false);
+        }
+        for (size_t i = 0; i < blocks_per_page; ++i) {
+            size_t bi = page_index * blocks_per_page + i;
+            if (bi >= block_list_size)
+                break;
+            unsigned block_index = m_block_list[bi];
+            if (run_length && (block_index != run_start + run_length || run_length == max_run_length))
+                write_run();
+            if (!run_length)
+                run_start = block_index;
+            if (run_pages.is_empty() || run_pages.last() != page_index)
+                run_pages.append(page_index);
+            MM.copy_from_physical_page(*page, i * block_size, buffer.data() + run_length * block_size, block_size);
+            ++run_length;
+        }
+    }
+    write_run();
+    return result;
+}
+
+bool Ext2FSInode::has_cached_pages() const
+{
+    if (!m_page_cache)
+        return false;
+    for (auto& page : m_page_cache->physical_pages()) {
+        if (page)
+            return true;
+    }
+    return false;
+}
+
+bool Ext2FSInode::is_only_referenced_by_caches() const
+{
+    // The inode cache holds one reference, and our page cache holds another unless it's gone already.
+    int cache_reference_count = 1;
+    if (m_page_cache && m_page_cache->ref_count() == 1)
+        ++cache_reference_count;
+    return ref_count() == cache_reference_count;
+}
+
+void Ext2FSInode::drop_page_cache()
+{
+    m_page_cache = nullptr;
 }
 
 bool Ext2FSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)> callback) const
@@ -922,6 +1596,381 @@ bool Ext2FSInode::write_directory(const Vector<FS::DirectoryEntry>& entries)
     return nwritten == directory_data.size();
 }
 
+bool Ext2FSInode::read_directory_block(unsigned logical_block, u8* buffer) const
+{
+    size_t block_size = fs().block_size();
+    return read_bytes(logical_block * block_size, block_size, buffer, nullptr) == (ssize_t)block_size;
+}
+
+bool Ext2FSInode::write_directory_block(unsigned logical_block, const u8* buffer)
+{
+    size_t block_size = fs().block_size();
+    return write_bytes(logical_block * block_size, block_size, buffer, nullptr) == (ssize_t)block_size;
+}
+
+bool Ext2FSInode::is_indexed_directory() const
+{
+    return (m_raw_inode.i_flags & EXT2_INDEX_FL) && fs().supports_directory_index();
+}
+
+void Ext2FSInode::drop_directory_index()
+{
+    // The index lives in records that look unused to a linear reader, so clearing
+    // the flag is enough to turn this back into a plain (but still valid) directory.
+    if (!(m_raw_inode.i_flags & EXT2_INDEX_FL))
+        return;
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FSInode: Dropping directory index of " << identifier();
+#endif
+    m_raw_inode.i_flags &= ~EXT2_INDEX_FL;
+    set_metadata_dirty(true);
+}
+
+bool Ext2FSInode::make_directory_index()
+{
+    size_t block_size = fs().block_size();
+    ASSERT(size() == block_size);
+
+    auto old_root = ByteBuffer::create_uninitialized(block_size);
+    if (!read_directory_block(0, old_root.data()))
+        return false;
+
+    auto& dot = *reinterpret_cast<ext2_dir_entry_2*>(old_root.data());
+    if (!is_valid_directory_entry(dot, 0, block_size) || StringView(dot.name, dot.name_len) != ".")
+        return false;
+    auto& dot_dot = *reinterpret_cast<ext2_dir_entry_2*>(old_root.data() + dot.rec_len);
+    if (!is_valid_directory_entry(dot_dot, dot.rec_len, block_size) || StringView(dot_dot.name, dot_dot.name_len) != "..")
+        return false;
+
+    Vector<const ext2_dir_entry_2*> entries;
+    for (size_t offset = dot.rec_len + dot_dot.rec_len; offset < block_size;) {
+        auto& entry = *reinterpret_cast<const ext2_dir_entry_2*>(old_root.data() + offset);
+        if (!is_valid_directory_entry(entry, offset, block_size))
+            return false;
+        if (entry.inode != 0)
+            entries.append(&entry);
+        offset += entry.rec_len;
+    }
+
+    auto leaf = ByteBuffer::create_uninitialized(block_size);
+    pack_directory_block(leaf.data(), block_size, entries);
+
+    u8 hash_version = fs().super_block().s_def_hash_version;
+    if (hash_version > EXT2_HASH_TEA)
+        hash_version = EXT2_HASH_HALF_MD4;
+
+    auto root = ByteBuffer::create_zeroed(block_size);
+    auto& new_dot = *reinterpret_cast<ext2_dir_entry_2*>(root.data());
+    fill_directory_entry(new_dot, ".", dot.inode, dot.file_type);
+    new_dot.rec_len = 12;
+    auto& new_dot_dot = *reinterpret_cast<ext2_dir_entry_2*>(root.data() + 12);
+    fill_directory_entry(new_dot_dot, "..", dot_dot.inode, dot_dot.file_type);
+    new_dot_dot.rec_len = block_size - 12;
+
+    auto& info = *reinterpret_cast<ext2_dx_root_info*>(root.data() + directory_index_root_info_offset);
+    info.hash_version = hash_version;
+    info.info_length = sizeof(ext2_dx_root_info);
+
+    unsigned entries_offset = directory_index_root_info_offset + sizeof(ext2_dx_root_info);
+    auto& countlimit = *reinterpret_cast<ext2_dx_countlimit*>(root.data() + entries_offset);
+    countlimit.limit = (block_size - entries_offset) / sizeof(ext2_dx_entry);
+    countlimit.count = 1;
+    reinterpret_cast<ext2_dx_entry*>(root.data() + entries_offset)[0].block = 1;
+
+    if (!write_directory_block(1, leaf.data()))
+        return false;
+    if (!write_directory_block(0, root.data()))
+        return false;
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FSInode: Built directory index for " << identifier() << " with " << entries.size() << " entries";
+#endif
+    m_raw_inode.i_flags |= EXT2_INDEX_FL;
+    set_metadata_dirty(true);
+    return true;
+}
+
+bool Ext2FSInode::probe_directory_index(const StringView& name, DirectoryIndexProbe& probe) const
+{
+    size_t block_size = fs().block_size();
+    auto data = ByteBuffer::create_uninitialized(block_size);
+    if (!read_directory_block(0, data.data()))
+        return false;
+
+    auto& info = *reinterpret_cast<const ext2_dx_root_info*>(data.data() + directory_index_root_info_offset);
+    if (info.reserved_zero != 0 || info.info_length != sizeof(ext2_dx_root_info))
+        return false;
+    if (info.hash_version > EXT2_HASH_TEA || info.indirect_levels > 1 || (info.unused_flags & EXT2_HASH_FLAG_INCOMPAT))
+        return false;
+
+    probe.hash_version = info.hash_version;
+    probe.hash = fs().directory_hash(name, info.hash_version);
+    probe.frames.clear();
+
+    unsigned levels = info.indirect_levels;
+    unsigned logical_block = 0;
+    unsigned entries_offset = directory_index_root_info_offset + info.info_length;
+    for (;;) {
+        DirectoryIndexFrame frame { logical_block, entries_offset, 0, move(data) };
+        auto& countlimit = frame.countlimit();
+        if (countlimit.count == 0 || countlimit.count > countlimit.limit)
+            return false;
+        if (countlimit.limit > (block_size - entries_offset) / sizeof(ext2_dx_entry))
+            return false;
+
+        // Find the last entry whose hash is not above ours. Entry 0 has no hash and covers everything below entry 1.
+        auto* entries = frame.entries();
+        int low = 1;
+        int high = countlimit.count - 1;
+        while (low <= high) {
+            int middle = (low + high) / 2;
+            if (entries[middle].hash > probe.hash) {
+                high = middle - 1;
+            } else {
+                frame.position = middle;
+                low = middle + 1;
+            }
+        }
+
+        unsigned next_block = entries[frame.position].block & directory_index_block_mask;
+        probe.frames.append(move(frame));
+        if (levels-- == 0)
+            return true;
+
+        data = ByteBuffer::create_uninitialized(block_size);
+        if (!read_directory_block(next_block, data.data()))
+            return false;
+        logical_block = next_block;
+        entries_offset = directory_index_node_entries_offset;
+    }
+}
+
+bool Ext2FSInode::advance_directory_index(DirectoryIndexProbe& probe) const
+{
+    int level = probe.frames.size() - 1;
+    while (level >= 0 && probe.frames[level].position + 1 >= probe.frames[level].countlimit().count)
+        --level;
+    if (level < 0)
+        return false;
+
+    auto& frame = probe.frames[level];
+    ++frame.position;
+
+    // A set low bit means the previous leaf was split in the middle of a run of colliding hashes.
+    u32 next_hash = frame.entries()[frame.position].hash;
+    if (!(next_hash & 1) || (next_hash & ~1u) != probe.hash)
+        return false;
+
+    for (int i = level + 1; i < probe.frames.size(); ++i) {
+        auto& parent = probe.frames[i - 1];
+        auto& child = probe.frames[i];
+        child.logical_block = parent.entries()[parent.position].block & directory_index_block_mask;
+        child.position = 0;
+        if (!read_directory_block(child.logical_block, child.data.data()))
+            return false;
+        if (child.countlimit().count == 0 || child.countlimit().count > child.countlimit().limit)
+            return false;
+    }
+    return true;
+}
+
+Optional<unsigned> Ext2FSInode::find_leaf_using_directory_index(const StringView& name, u8* leaf) const
+{
+    DirectoryIndexProbe probe;
+    if (!probe_directory_index(name, probe))
+        return {};
+
+    size_t block_size = fs().block_size();
+    for (;;) {
+        auto& frame = probe.frames.last();
+        unsigned leaf_block = frame.entries()[frame.position].block & directory_index_block_mask;
+        if (!read_directory_block(leaf_block, leaf))
+            return {};
+        if (find_in_directory_block(leaf, block_size, name))
+            return leaf_block;
+        if (!advance_directory_index(probe))
+            return 0u;
+    }
+}
+
+Optional<unsigned> Ext2FSInode::lookup_using_directory_index(const StringView& name) const
+{
+    if (!is_indexed_directory())
+        return {};
+
+    u8 leaf[max_block_size];
+
+    // "." and ".." live in the root block, outside of the hashed leaves.
+    if (name == "." || name == "..") {
+        if (!read_directory_block(0, leaf))
+            return {};
+        auto* entry = find_in_directory_block(leaf, fs().block_size(), name);
+        return entry ? entry->inode : 0u;
+    }
+
+    auto leaf_block = find_leaf_using_directory_index(name, leaf);
+    if (!leaf_block.has_value())
+        return {};
+    if (leaf_block.value() == 0)
+        return 0u;
+    return find_in_directory_block(leaf, fs().block_size(), name)->inode;
+}
+
+bool Ext2FSInode::add_entry_using_directory_index(const StringView& name, unsigned inode, u8 file_type)
+{
+    DirectoryIndexProbe probe;
+    if (!probe_directory_index(name, probe))
+        return false;
+
+    size_t block_size = fs().block_size();
+    auto& frame = probe.frames.last();
+    unsigned leaf_block = frame.entries()[frame.position].block & directory_index_block_mask;
+
+    u8 leaf[max_block_size];
+    if (!read_directory_block(leaf_block, leaf))
+        return false;
+    if (insert_into_directory_block(leaf, block_size, name, inode, file_type))
+        return write_directory_block(leaf_block, leaf);
+
+    // The leaf is full, split it in two around the median hash and index the upper half.
+    auto& countlimit = frame.countlimit();
+    if (countlimit.count >= countlimit.limit)
+        return false;
+
+    struct HashedEntry {
+        u32 hash;
+        const ext2_dir_entry_2* entry;
+    };
+    Vector<HashedEntry> hashed_entries;
+    for (size_t offset = 0; offset < block_size;) {
+        auto& entry = *reinterpret_cast<const ext2_dir_entry_2*>(leaf + offset);
+        if (!is_valid_directory_entry(entry, offset, block_size))
+            return false;
+        if (entry.inode != 0)
+            hashed_entries.append({ fs().directory_hash({ entry.name, entry.name_len }, probe.hash_version), &entry });
+        offset += entry.rec_len;
+    }
+    if (hashed_entries.size() < 2)
+        return false;
+    quick_sort(hashed_entries.begin(), hashed_entries.end(), [](auto& a, auto& b) { return a.hash < b.hash; });
+
+    int split = hashed_entries.size();
+    size_t moved_size = 0;
+    while (split > 1) {
+        size_t entry_size = EXT2_DIR_REC_LEN(hashed_entries[split - 1].entry->name_len);
+        if (moved_size + entry_size / 2 > block_size / 2)
+            break;
+        moved_size += entry_size;
+        --split;
+    }
+    if (split == hashed_entries.size())
+        --split;
+    u32 split_hash = hashed_entries[split].hash;
+    bool continued = split_hash == hashed_entries[split - 1].hash;
+
+    Vector<const ext2_dir_entry_2*> lower_entries;
+    Vector<const ext2_dir_entry_2*> upper_entries;
+    for (int i = 0; i < hashed_entries.size(); ++i)
+        (i < split ? lower_entries : upper_entries).append(hashed_entries[i].entry);
+
+    auto lower = ByteBuffer::create_uninitialized(block_size);
+    auto upper = ByteBuffer::create_uninitialized(block_size);
+    pack_directory_block(lower.data(), block_size, lower_entries);
+    pack_directory_block(upper.data(), block_size, upper_entries);
+
+    auto& target = probe.hash >= split_hash ? upper : lower;
+    if (!insert_into_directory_block(target.data(), block_size, name, inode, file_type))
+        return false;
+
+    unsigned new_block = size() / block_size;
+    if (!write_directory_block(new_block, upper.data()))
+        return false;
+    if (!write_directory_block(leaf_block, lower.data()))
+        return false;
+
+    auto* entries = frame.entries();
+    for (unsigned i = countlimit.count; i > frame.position + 1; --i)
+        entries[i] = entries[i - 1];
+    entries[frame.position + 1].hash = split_hash + continued;
+    entries[frame.position + 1].block = new_block;
+    ++countlimit.count;
+
+#ifdef EXT2_DEBUG
+    dbg() << "Ext2FSInode: Split directory index leaf " << leaf_block << " of " << identifier() << " into " << new_block << " at hash " << String::format("%x", split_hash);
+#endif
+    return write_directory_block(frame.logical_block, frame.data.data());
+}
+
+bool Ext2FSInode::add_entry_linearly(const StringView& name, unsigned inode, u8 file_type)
+{
+    // Writing entries without maintaining the index would leave it stale, so stop using it.
+    drop_directory_index();
+
+    size_t block_size = fs().block_size();
+    unsigned block_count = size() / block_size;
+    u8 block[max_block_size];
+    for (unsigned i = 0; i < block_count; ++i) {
+        if (!read_directory_block(i, block))
+            return false;
+        if (insert_into_directory_block(block, block_size, name, inode, file_type))
+            return write_directory_block(i, block);
+    }
+
+    if (block_count == 1 && fs().supports_directory_index() && make_directory_index()) {
+        if (add_entry_using_directory_index(name, inode, file_type))
+            return true;
+        drop_directory_index();
+    }
+
+    memset(block, 0, block_size);
+    auto& entry = *reinterpret_cast<ext2_dir_entry_2*>(block);
+    fill_directory_entry(entry, name, inode, file_type);
+    entry.rec_len = block_size;
+    return write_directory_block(size() / block_size, block);
+}
+
+bool Ext2FSInode::remove_entry(const StringView& name)
+{
+    size_t block_size = fs().block_size();
+    u8 block[max_block_size];
+
+    if (name == "." || name == "..")
+        drop_directory_index();
+
+    if (is_indexed_directory()) {
+        auto leaf_block = find_leaf_using_directory_index(name, block);
+        if (leaf_block.has_value()) {
+            if (leaf_block.value() == 0)
+                return false;
+            remove_from_directory_block(block, block_size, name);
+            return write_directory_block(leaf_block.value(), block);
+        }
+        drop_directory_index();
+    }
+
+    unsigned block_count = size() / block_size;
+    for (unsigned i = 0; i < block_count; ++i) {
+        if (!read_directory_block(i, block))
+            return false;
+        if (remove_from_directory_block(block, block_size, name))
+            return write_directory_block(i, block);
+    }
+    return false;
+}
+
+unsigned Ext2FSInode::find_child(const StringView& name) const
+{
+    auto indexed_result = lookup_using_directory_index(name);
+    if (indexed_result.has_value())
+        return indexed_result.value();
+
+    populate_lookup_cache();
+    auto it = m_lookup_cache.find(name.hash(), [&](auto& entry) { return entry.key == name; });
+    if (it == m_lookup_cache.end())
+        return 0;
+    return (*it).value;
+}
+
 KResult Ext2FSInode::add_child(InodeIdentifier child_id, const StringView& name, mode_t mode)
 {
     LOCKER(m_lock);
@@ -934,29 +1983,30 @@ KResult Ext2FSInode::add_child(InodeIdentifier child_id, const StringView& name,
     dbg() << "Ext2FSInode::add_child(): Adding inode " << child_id.index() << " with name '" << name << " and mode " << mode << " to directory " << index();
 #endif
 
-    Vector<FS::DirectoryEntry> entries;
-    bool name_already_exists = false;
-    traverse_as_directory([&](auto& entry) {
-        if (name == entry.name) {
-            name_already_exists = true;
-            return false;
-        }
-        entries.append(entry);
-        return true;
-    });
-    if (name_already_exists) {
+    if (find_child(name)) {
         dbg() << "Ext2FSInode::add_child(): Name '" << name << "' already exists in inode " << index();
         return KResult(-EEXIST);
     }
 
+    u8 file_type = to_ext2_file_type(mode);
+    bool success = false;
+    if (is_indexed_directory())
+        success = add_entry_using_directory_index(name, child_id.index(), file_type);
+    if (!success)
+        success = add_entry_linearly(name, child_id.index(), file_type);
+    if (!success) {
+        // FIXME: Tell apart a full disk from an I/O error.
+        return KResult(-EIO);
+    }
+
     auto child_inode = fs().get_inode(child_id);
     if (child_inode)
         child_inode->increment_link_count();
 
-    entries.empend(name.characters_without_null_termination(), name.length(), child_id, to_ext2_file_type(mode));
-    bool success = write_directory(entries);
-    if (success)
+    set_metadata_dirty(true);
+    if (!m_lookup_cache.is_empty())
         m_lookup_cache.set(name, child_id.index());
+    did_add_child(name);
     return KSuccess;
 }
 
@@ -968,10 +2018,9 @@ KResult Ext2FSInode::remove_child(const StringView& name)
 #endif
     ASSERT(is_directory());
 
-    auto it = m_lookup_cache.find(name);
-    if (it == m_lookup_cache.end())
+    auto child_inode_index = find_child(name);
+    if (!child_inode_index)
         return KResult(-ENOENT);
-    auto child_inode_index = (*it).value;
 
     InodeIdentifier child_id { fsid(), child_inode_index };
 
@@ -979,26 +2028,69 @@ KResult Ext2FSInode::remove_child(const StringView& name)
     dbg() << "Ext2FSInode::remove_child(): Removing '" << name << "' in directory " << index();
 #endif
 
-    Vector<FS::DirectoryEntry> entries;
-    traverse_as_directory([&](auto& entry) {
-        if (name != entry.name)
-            entries.append(entry);
-        return true;
-    });
-
-    bool success = write_directory(entries);
-    if (!success) {
-        // FIXME: Plumb error from write_directory().
+    if (!remove_entry(name)) {
+        // FIXME: Plumb the actual error from the directory block I/O.
         return KResult(-EIO);
     }
 
+    set_metadata_dirty(true);
     m_lookup_cache.remove(name);
+    did_remove_child(name);
 
     auto child_inode = fs().get_inode(child_id);
     child_inode->decrement_link_count();
     return KSuccess;
 }
 
+bool Ext2FS::supports_directory_index() const
+{
+    return super_block().s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+}
+
+u32 Ext2FS::directory_hash(const StringView& name, u8 hash_version) const
+{
+    bool is_unsigned = super_block().s_flags & EXT2_FLAGS_UNSIGNED_HASH;
+    const char* characters = name.characters_without_null_termination();
+    int length = name.length();
+
+    u32 buffer[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    for (int i = 0; i < 4; ++i) {
+        if (super_block().s_hash_seed[i] == 0)
+            continue;
+        memcpy(buffer, super_block().s_hash_seed, sizeof(buffer));
+        break;
+    }
+
+    u32 hash = 0;
+    u32 in[8];
+    switch (hash_version) {
+    case EXT2_HASH_LEGACY:
+        hash = legacy_directory_hash(characters, length, is_unsigned);
+        break;
+    case EXT2_HASH_HALF_MD4:
+        for (const char* p = characters; length > 0; length -= 32, p += 32) {
+            string_to_hash_buffer(p, length, in, 8, is_unsigned);
+            half_md4_transform(buffer, in);
+        }
+        hash = buffer[1];
+        break;
+    case EXT2_HASH_TEA:
+        for (const char* p = characters; length > 0; length -= 16, p += 16) {
+            string_to_hash_buffer(p, length, in, 4, is_unsigned);
+            tea_transform(buffer, in);
+        }
+        hash = buffer[0];
+        break;
+    default:
+        ASSERT_NOT_REACHED();
+    }
+
+    hash &= ~1u;
+    if (hash == (directory_index_eof_hash << 1))
+        hash = (directory_index_eof_hash - 1) << 1;
+    return hash;
+}
+
 unsigned Ext2FS::inodes_per_block() const
 {
     return EXT2_INODES_PER_BLOCK(&super_block());
@@ -1066,67 +2158,157 @@ Ext2FS::BlockIndex Ext2FS::allocate_block(GroupIndex preferred_group_index)
     return block_index;
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, int count)
+Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(GroupIndex preferred_group_index, int count, BlockIndex goal)
 {
     LOCKER(m_lock);
 #ifdef EXT2_DEBUG
-    dbgprintf("Ext2FS: allocate_blocks(preferred group: %u, count: %u)\n", preferred_group_index, count);
+    dbgprintf("Ext2FS: allocate_blocks(preferred group: %u, count: %u, goal: %u)\n", preferred_group_index, count, goal);
 #endif
     if (count == 0)
         return {};
 
     Vector<BlockIndex> blocks;
-#ifdef EXT2_DEBUG
-    dbg() << "Ext2FS: allocate_blocks:";
-#endif
     blocks.ensure_capacity(count);
 
-    bool found_a_group = false;
-    GroupIndex group_index = preferred_group_index;
-
-    if (!group_descriptor(preferred_group_index).bg_free_blocks_count) {
-        group_index = 1;
+    unsigned start_bit = 0;
+    if (goal && goal >= first_block_index() && goal < super_block().s_blocks_count) {
+        // Continuing right where the caller left off keeps the file contiguous.
+        allocate_blocks_at(goal, count, blocks);
+        preferred_group_index = group_index_from_block_index(goal);
+        start_bit = goal - first_block_of_group(preferred_group_index);
     }
+    if (preferred_group_index == 0 || preferred_group_index > m_block_group_count)
+        preferred_group_index = 1;
 
     while (blocks.size() < count) {
-        if (group_descriptor(group_index).bg_free_blocks_count) {
-            found_a_group = true;
-        } else {
-            if (group_index == preferred_group_index)
-                group_index = 1;
-            for (; group_index < m_block_group_count; ++group_index) {
-                if (group_descriptor(group_index).bg_free_blocks_count) {
-                    found_a_group = true;
-                    break;
-                }
-            }
-        }
-        ASSERT(found_a_group);
-        auto& bgd = group_descriptor(group_index);
-        auto& cached_bitmap = get_bitmap_block(bgd.bg_block_bitmap);
-
-        int blocks_in_group = min(blocks_per_group(), super_block().s_blocks_count);
-        auto block_bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group);
+        unsigned remaining = count - blocks.size();
+        // Prefer a single run that fits everything, and only settle for pieces once there is none left.
+        if (allocate_first_fit(preferred_group_index, start_bit, remaining, remaining, blocks))
+            continue;
+        bool found_anything = allocate_first_fit(preferred_group_index, start_bit, 1, remaining, blocks);
+        ASSERT(found_anything);
+    }
 
-        BlockIndex first_block_in_group = (group_index - 1) * blocks_per_group() + first_block_index();
-        int free_region_size = 0;
-        int first_unset_bit_index = block_bitmap.find_longest_range_of_unset_bits(count - blocks.size(), free_region_size);
-        ASSERT(first_unset_bit_index != -1);
 #ifdef EXT2_DEBUG
-        dbg() << "Ext2FS: allocating free region of size: " << free_region_size << "[" << group_index << "]";
+    for (auto block_index : blocks)
+        dbg() << "  allocated > " << block_index;
 #endif
-        for (int i = 0; i < free_region_size; ++i) {
-            BlockIndex block_index = (unsigned)(first_unset_bit_index + i) + first_block_in_group;
-            set_block_allocation_state(block_index, true);
-            blocks.unchecked_append(block_index);
+    ASSERT(blocks.size() == count);
+    return blocks;
+}
+
+unsigned Ext2FS::allocate_blocks_at(BlockIndex first_block, unsigned max_count, Vector<BlockIndex>& blocks)
+{
+    LOCKER(m_lock);
+    if (first_block < first_block_index() || first_block >= super_block().s_blocks_count)
+        return 0;
+
+    GroupIndex group_index = group_index_from_block_index(first_block);
+    unsigned bit_index = first_block - first_block_of_group(group_index);
+    auto& cached_bitmap = get_bitmap_block(group_descriptor(group_index).bg_block_bitmap);
+    auto bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group(group_index));
+
+    int found_count = 0;
+    if (bitmap.find_next_range_of_unset_bits(bit_index, 1, max_count, found_count) != (int)bit_index)
+        return 0;
+    allocate_block_range(group_index, bit_index, found_count, blocks);
+    return found_count;
+}
+
+bool Ext2FS::allocate_first_fit(GroupIndex preferred_group_index, unsigned start_bit, unsigned min_count, unsigned max_count, Vector<BlockIndex>& blocks)
+{
+    // Visit every group once starting at the preferred one, then give the part of it before start_bit a chance.
+    for (unsigned i = 0; i <= m_block_group_count; ++i) {
+        if (i == m_block_group_count && start_bit == 0)
+            break;
+        GroupIndex group_index = (preferred_group_index - 1 + i) % m_block_group_count + 1;
+        unsigned group_size = blocks_in_group(group_index);
+        unsigned wanted = min(min_count, group_size);
+        if (group_descriptor(group_index).bg_free_blocks_count < wanted)
+            continue;
+
+        auto& cached_bitmap = get_bitmap_block(group_descriptor(group_index).bg_block_bitmap);
+        auto bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), group_size);
+        int search_start = (i == 0 && start_bit < group_size) ? start_bit : 0;
+        int found_count = 0;
+        int first_bit = bitmap.find_next_range_of_unset_bits(search_start, wanted, max_count, found_count);
+        if (first_bit == -1)
+            continue;
+        allocate_block_range(group_index, first_bit, found_count, blocks);
+        return true;
+    }
+    return false;
+}
+
+void Ext2FS::allocate_block_range(GroupIndex group_index, unsigned first_bit, unsigned count, Vector<BlockIndex>& blocks)
+{
+    LOCKER(m_lock);
+    auto& bgd = const_cast<ext2_group_desc&>(group_descriptor(group_index));
+    auto& cached_bitmap = get_bitmap_block(bgd.bg_block_bitmap);
+    auto bitmap = cached_bitmap.bitmap(blocks_per_group());
+    BlockIndex first_block = first_block_of_group(group_index) + first_bit;
+
 #ifdef EXT2_DEBUG
-            dbg() << "  allocated > " << block_index;
+    dbg() << "Ext2FS: Allocating " << count << " block(s) at " << first_block << " in group " << group_index;
 #endif
-        }
+
+    for (unsigned i = 0; i < count; ++i) {
+        ASSERT(!bitmap.get(first_bit + i));
+        bitmap.set(first_bit + i, true);
+        blocks.append(first_block + i);
     }
+    cached_bitmap.dirty = true;
 
-    ASSERT(blocks.size() == count);
-    return blocks;
+    ASSERT(m_super_block.s_free_blocks_count >= count);
+    m_super_block.s_free_blocks_count -= count;
+    m_super_block_dirty = true;
+    bgd.bg_free_blocks_count -= count;
+    m_block_group_descriptors_dirty = true;
+
+    m_allocated_block_count += count;
+    ++m_allocated_extent_count;
+}
+
+void Ext2FS::discard_preallocations(bool only_idle)
+{
+    LOCKER(m_lock);
+    if (!m_preallocated_block_count)
+        return;
+    for (auto& it : m_inode_cache) {
+        if (!it.value || !it.value->m_preallocation_count)
+            continue;
+        auto& inode = *it.value;
+        if (only_idle && g_uptime - inode.m_preallocation_touched_at < preallocation_idle_ticks)
+            continue;
+        inode.discard_preallocation();
+    }
+}
+
+Ext2FS::FragmentationReport Ext2FS::fragmentation_report() const
+{
+    LOCKER(m_lock);
+    FragmentationReport report;
+    report.preallocated_block_count = m_preallocated_block_count;
+    report.allocated_block_count = m_allocated_block_count;
+    report.allocated_extent_count = m_allocated_extent_count;
+
+    auto& mutable_this = const_cast<Ext2FS&>(*this);
+    for (GroupIndex group_index = 1; group_index <= m_block_group_count; ++group_index) {
+        auto& cached_bitmap = mutable_this.get_bitmap_block(group_descriptor(group_index).bg_block_bitmap);
+        auto bitmap = Bitmap::wrap(cached_bitmap.buffer.data(), blocks_in_group(group_index));
+        int extent_size = 0;
+        for (int bit = bitmap.find_next_range_of_unset_bits(0, 1, bitmap.size(), extent_size); bit != -1;
+             bit = bitmap.find_next_range_of_unset_bits(bit + extent_size, 1, bitmap.size(), extent_size)) {
+            report.free_block_count += extent_size;
+            ++report.free_extent_count;
+            report.largest_free_extent = max(report.largest_free_extent, (unsigned)extent_size);
+            unsigned bucket = 0;
+            while ((2u << bucket) <= (unsigned)extent_size && bucket + 1 < FragmentationReport::histogram_size)
+                ++bucket;
+            ++report.free_extent_histogram[bucket];
+        }
+    }
+    return report;
 }
 
 unsigned Ext2FS::find_a_free_inode(GroupIndex preferred_group, off_t expected_size)
@@ -1202,7 +2384,17 @@ Ext2FS::GroupIndex Ext2FS::group_index_from_block_index(BlockIndex block_index)
 {
     if (!block_index)
         return 0;
-    return (block_index - 1) / blocks_per_group() + 1;
+    return (block_index - first_block_index()) / blocks_per_group() + 1;
+}
+
+Ext2FS::BlockIndex Ext2FS::first_block_of_group(GroupIndex group_index) const
+{
+    return (group_index - 1) * blocks_per_group() + first_block_index();
+}
+
+unsigned Ext2FS::blocks_in_group(GroupIndex group_index) const
+{
+    return min(blocks_per_group(), super_block().s_blocks_count - first_block_of_group(group_index));
 }
 
 unsigned Ext2FS::group_index_from_inode(unsigned inode) const
@@ -1404,6 +2596,8 @@ RefPtr<Inode> Ext2FS::create_inode(InodeIdentifier parent_id, const String& name
 #endif
 
     auto needed_blocks = ceil_div(size, block_size());
+    if ((size_t)needed_blocks > super_block().s_free_blocks_count)
+        discard_preallocations(false);
     if ((size_t)needed_blocks > super_block().s_free_blocks_count) {
         dbg() << "Ext2FS: create_inode: not enough free blocks";
         error = -ENOSPC;
@@ -1457,8 +2651,11 @@ RefPtr<Inode> Ext2FS::create_inode(InodeIdentifier parent_id, const String& name
     else if (is_block_device(mode))
         e2inode.i_block[1] = dev;
 
+    // NOTE: write_block_list_for_inode() expects i_size to still describe the old (empty) block list.
+    e2inode.i_size = 0;
     success = write_block_list_for_inode(inode_id, e2inode, blocks);
     ASSERT(success);
+    e2inode.i_size = size;
 
 #ifdef EXT2_DEBUG
     dbgprintf("Ext2FS: writing initial metadata for inode %u\n", inode_id);
@@ -1496,12 +2693,11 @@ void Ext2FSInode::populate_lookup_cache() const
 RefPtr<Inode> Ext2FSInode::lookup(StringView name)
 {
     ASSERT(is_directory());
-    populate_lookup_cache();
     LOCKER(m_lock);
-    auto it = m_lookup_cache.find(name.hash(), [&](auto& entry) { return entry.key == name; });
-    if (it != m_lookup_cache.end())
-        return fs().get_inode({ fsid(), (*it).value });
-    return {};
+    auto child_inode_index = find_child(name);
+    if (!child_inode_index)
+        return {};
+    return fs().get_inode({ fsid(), child_inode_index });
 }
 
 void Ext2FSInode::one_ref_left()
@@ -1556,9 +2752,12 @@ int Ext2FSInode::decrement_link_count()
         return -EROFS;
     ASSERT(m_raw_inode.i_links_count);
     --m_raw_inode.i_links_count;
-    if (ref_count() == 1 && m_raw_inode.i_links_count == 0)
-        fs().uncache_inode(index());
     set_metadata_dirty(true);
+    if (is_only_referenced_by_caches() && m_raw_inode.i_links_count == 0) {
+        // NOTE: This may well be the end of us.
+        drop_page_cache();
+        fs().uncache_inode(index());
+    }
     return 0;
 }
 
@@ -1635,13 +2834,21 @@ unsigned Ext2FS::free_inode_count() const
 
 KResult Ext2FS::prepare_to_unmount() const
 {
+    auto result = const_cast<Ext2FS&>(*this).write_back_dirty_pages(false);
+    if (result.is_error())
+        return result;
+
     LOCKER(m_lock);
 
     for (auto& it : m_inode_cache) {
-        if (it.value->ref_count() > 1)
+        if (it.value && !it.value->is_only_referenced_by_caches())
             return KResult(-EBUSY);
     }
 
+    for (auto& it : m_inode_cache) {
+        if (it.value)
+            it.value->drop_page_cache();
+    }
     m_inode_cache.clear();
     return KSuccess;
 }
@@ -71,10 +71,54 @@ private:
     virtual KResult chmod(mode_t) override;
     virtual KResult chown(uid_t, gid_t) override;
     virtual KResult truncate(off_t) override;
+    virtual bool has_page_cache() const override;
+    virtual KResult page_in(size_t page_index) override;
+
+    struct DirectoryIndexFrame {
+        unsigned logical_block { 0 };
+        unsigned entries_offset { 0 };
+        unsigned position { 0 };
+        ByteBuffer data;
+
+        ext2_dx_countlimit& countlimit() { return *reinterpret_cast<ext2_dx_countlimit*>(data.data() + entries_offset); }
+        ext2_dx_entry* entries() { return reinterpret_cast<ext2_dx_entry*>(data.data() + entries_offset); }
+    };
+
+    struct DirectoryIndexProbe {
+        u32 hash { 0 };
+        u8 hash_version { 0 };
+        Vector<DirectoryIndexFrame, 2> frames;
+    };
 
     bool write_directory(const Vector<FS::DirectoryEntry>&);
+    bool read_directory_block(unsigned logical_block, u8* buffer) const;
+    bool write_directory_block(unsigned logical_block, const u8* buffer);
+    bool is_indexed_directory() const;
+    void drop_directory_index();
+    bool make_directory_index();
+    bool probe_directory_index(const StringView& name, DirectoryIndexProbe&) const;
+    bool advance_directory_index(DirectoryIndexProbe&) const;
+    Optional<unsigned> find_leaf_using_directory_index(const StringView& name, u8* leaf) const;
+    Optional<unsigned> lookup_using_directory_index(const StringView& name) const;
+    bool add_entry_using_directory_index(const StringView& name, unsigned inode, u8 file_type);
+    bool add_entry_linearly(const StringView& name, unsigned inode, u8 file_type);
+    bool remove_entry(const StringView& name);
+    unsigned find_child(const StringView& name) const;
     void populate_lookup_cache() const;
+    void do_readahead(FileDescription&, off_t offset, ssize_t nread) const;
     KResult resize(u64);
+    Vector<unsigned> allocate_data_blocks(unsigned count, unsigned goal);
+    void discard_preallocation();
+    InodeVMObject& page_cache() const;
+    bool populate_page_cache(size_t first_page_index, size_t page_count) const;
+    bool read_pages_from_disk(size_t first_page_index, size_t page_count, u8* buffer) const;
+    ssize_t read_bytes_from_page_cache(off_t, ssize_t, u8* buffer, FileDescription*) const;
+    ssize_t write_bytes_to_page_cache(off_t, ssize_t, const u8* data, FileDescription*);
+    void zero_page_cache_past(u64 size);
+    KResult write_back_dirty_pages();
+    bool has_cached_pages() const;
+    bool is_only_referenced_by_caches() const;
+    void drop_page_cache();
 
     Ext2FS& fs();
     const Ext2FS& fs() const;
@@ -83,6 +127,17 @@ private:
     mutable Vector<unsigned> m_block_list;
     mutable HashMap<String, unsigned> m_lookup_cache;
     ext2_inode m_raw_inode;
+
+    // Blocks reserved right past the end of the file for a streaming writer. Guarded by the Ext2FS lock.
+    unsigned m_preallocation_start { 0 };
+    unsigned m_preallocation_count { 0 };
+    unsigned m_preallocation_window { 0 };
+    u64 m_preallocation_touched_at { 0 };
+
+    // The file contents, shared with any mappings of the file. Holding on to this keeps the pages
+    // cached after the last mapping goes away; it's dropped once the inode is otherwise unused.
+    mutable RefPtr<InodeVMObject> m_page_cache;
+    u64 m_pages_dirtied_at { 0 };
 };
 
 class Ext2FS final : public DiskBackedFS {
@@ -101,6 +156,21 @@ public:
     virtual KResult prepare_to_unmount() const override;
 
     virtual bool supports_watchers() const override { return true; }
+    virtual bool supports_name_cache() const override { return true; }
+
+    struct FragmentationReport {
+        unsigned free_block_count { 0 };
+        unsigned free_extent_count { 0 };
+        unsigned largest_free_extent { 0 };
+        unsigned preallocated_block_count { 0 };
+        unsigned allocated_block_count { 0 };
+        unsigned allocated_extent_count { 0 };
+        // Free extents bucketed by size: [1], [2, 4), [4, 8), ... with the last bucket open-ended.
+        static constexpr unsigned histogram_size = 16;
+        unsigned free_extent_histogram[histogram_size] {};
+    };
+
+    FragmentationReport fragmentation_report() const;
 
 private:
     typedef unsigned BlockIndex;
@@ -118,6 +188,9 @@ private:
     unsigned blocks_per_group() const;
     unsigned inode_size() const;
 
+    bool supports_directory_index() const;
+    u32 directory_hash(const StringView& name, u8 hash_version) const;
+
     bool write_ext2_inode(InodeIndex, const ext2_inode&);
     bool read_block_containing_inode(InodeIndex inode, BlockIndex& block_index, unsigned& offset, u8* buffer) const;
 
@@ -128,23 +201,36 @@ private:
     virtual RefPtr<Inode> create_inode(InodeIdentifier parent_inode, const String& name, mode_t, off_t size, dev_t, uid_t, gid_t, int& error) override;
     virtual RefPtr<Inode> create_directory(InodeIdentifier parent_inode, const String& name, mode_t, uid_t, gid_t, int& error) override;
     virtual RefPtr<Inode> get_inode(InodeIdentifier) const override;
-    virtual void flush_writes() override;
+    virtual KResult flush_writes() override;
+    virtual void writeback() override;
+    KResult write_back_dirty_pages(bool only_expired);
 
     BlockIndex first_block_index() const;
+    BlockIndex first_block_of_group(GroupIndex) const;
+    unsigned blocks_in_group(GroupIndex) const;
     InodeIndex find_a_free_inode(GroupIndex preferred_group, off_t expected_size);
-    Vector<BlockIndex> allocate_blocks(GroupIndex preferred_group_index, int count);
+    Vector<BlockIndex> allocate_blocks(GroupIndex preferred_group_index, int count, BlockIndex goal = 0);
     BlockIndex allocate_block(GroupIndex preferred_group_index);
+    unsigned allocate_blocks_at(BlockIndex first_block, unsigned max_count, Vector<BlockIndex>&);
+    bool allocate_first_fit(GroupIndex preferred_group_index, unsigned start_bit, unsigned min_count, unsigned max_count, Vector<BlockIndex>&);
+    void allocate_block_range(GroupIndex, unsigned first_bit, unsigned count, Vector<BlockIndex>&);
+    void discard_preallocations(bool only_idle);
     GroupIndex group_index_from_inode(InodeIndex) const;
     GroupIndex group_index_from_block_index(BlockIndex) const;
 
     Vector<BlockIndex> block_list_for_inode(const ext2_inode&, bool include_block_list_blocks = false) const;
     bool write_block_list_for_inode(InodeIndex, ext2_inode&, const Vector<BlockIndex>&);
+    static bool inode_has_block_list(const ext2_inode&);
+    unsigned max_block_list_size() const;
+    bool update_block_array(InodeIndex, BlockIndex& array_block_index, unsigned level, unsigned first_logical_block, unsigned first_changed, unsigned end_changed, const Vector<BlockIndex>&);
 
     bool get_inode_allocation_state(InodeIndex) const;
     bool set_inode_allocation_state(InodeIndex, bool);
     bool set_block_allocation_state(BlockIndex, bool);
 
     void uncache_inode(InodeIndex);
+    void uncache_unused_inodes();
+    void flush_cached_metadata();
     void free_inode(Ext2FSInode&);
 
     struct BlockListShape {
@@ -164,6 +250,10 @@ private:
 
     mutable HashMap<InodeIndex, RefPtr<Ext2FSInode>> m_inode_cache;
 
+    unsigned m_preallocated_block_count { 0 };
+    unsigned m_allocated_block_count { 0 };
+    unsigned m_allocated_extent_count { 0 };
+
     bool m_super_block_dirty { false };
     bool m_block_group_descriptors_dirty { false };
 
@@ -101,6 +101,8 @@ void FIFO::detach(Direction direction)
         ASSERT(m_writers);
         --m_writers;
     }
+    // Readers see EOF and writers get EPIPE once the other end is gone.
+    notify_blockers();
 }
 
 bool FIFO::can_read(const FileDescription&) const
@@ -124,6 +126,8 @@ ssize_t FIFO::read(FileDescription&, u8* buffer, ssize_t size)
 #ifdef FIFO_DEBUG
     dbgprintf("   -> read (%c) %u\n", buffer[0], nread);
 #endif
+    if (nread > 0)
+        notify_blockers();
     return nread;
 }
 
@@ -136,7 +140,10 @@ ssize_t FIFO::write(FileDescription&, const u8* buffer, ssize_t size)
 #ifdef FIFO_DEBUG
     dbgprintf("fifo: write(%p, %u)\n", buffer, size);
 #endif
-    return m_buffer.write(buffer, size);
+    ssize_t nwritten = m_buffer.write(buffer, size);
+    if (nwritten > 0)
+        notify_blockers();
+    return nwritten;
 }
 
 String FIFO::absolute_path(const FileDescription&) const
@@ -59,6 +59,7 @@ private:
     virtual String absolute_path(const FileDescription&) const override;
     virtual const char* class_name() const override { return "FIFO"; }
     virtual bool is_fifo() const override { return true; }
+    virtual bool notifies_blockers() const override { return true; }
 
     explicit FIFO(uid_t);
 
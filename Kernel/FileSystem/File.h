@@ -33,10 +33,12 @@
 #include <Kernel/KResult.h>
 #include <Kernel/UnixTypes.h>
 #include <Kernel/VM/VirtualAddress.h>
+#include <Kernel/WaitQueue.h>
 
 class FileDescription;
 class Process;
 class Region;
+class Thread;
 
 // File is the base class for anything that can be referenced by a FileDescription.
 //
@@ -64,6 +66,14 @@ class Region;
 //   - Optional. If unimplemented, mmap() on this File will fail with -ENODEV.
 //   - Called by mmap() when userspace wants to memory-map this File somewhere.
 //   - Should create a Region in the Process and return it if successful.
+//
+// notifies_blockers() and notify_blockers()
+//
+//   - Threads blocked on a File (in read, write, accept, connect or select) are normally
+//     re-checked by the scheduler on every pass.
+//   - A File that calls notify_blockers() whenever can_read()/can_write() (or the socket
+//     accept/connect state) may have become true can return true from notifies_blockers().
+//     Threads blocked on it then watch its wait_queue() and sleep until notified.
 
 class File : public RefCounted<File> {
 public:
@@ -99,6 +109,13 @@ public:
     virtual bool is_character_device() const { return false; }
     virtual bool is_socket() const { return false; }
 
+    virtual bool notifies_blockers() const { return false; }
+    void notify_blockers() { m_wait_queue.wake_all(); }
+    WaitQueue& wait_queue() { return m_wait_queue; }
+
 protected:
     File();
+
+private:
+    WaitQueue m_wait_queue;
 };
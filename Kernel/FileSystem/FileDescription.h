@@ -134,6 +134,14 @@ public:
 
     off_t offset() const { return m_current_offset; }
 
+    // Sequential readahead state, maintained by the file system when reading through this description.
+    struct ReadaheadState {
+        off_t next_offset { 0 };
+        u32 window { 0 };
+        u32 prefetched_until { 0 };
+    };
+    ReadaheadState& readahead_state() { return m_readahead_state; }
+
     KResult chown(uid_t, gid_t);
 
 private:
@@ -149,6 +157,8 @@ private:
 
     Optional<KBuffer> m_generator_cache;
 
+    ReadaheadState m_readahead_state;
+
     u32 m_file_flags { 0 };
 
     bool m_readable { false };
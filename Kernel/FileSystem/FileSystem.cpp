@@ -82,7 +82,27 @@ FS::DirectoryEntry::DirectoryEntry(const char* n, size_t nl, InodeIdentifier i,
     name[nl] = '\0';
 }
 
-void FS::sync()
+KResult FS::sync()
+{
+    Inode::sync();
+
+    NonnullRefPtrVector<FS, 32> fses;
+    {
+        InterruptDisabler disabler;
+        for (auto& it : all_fses())
+            fses.append(*it.value);
+    }
+
+    KResult result = KSuccess;
+    for (auto& fs : fses) {
+        auto fs_result = fs.flush_writes();
+        if (fs_result.is_error() && result.is_success())
+            result = fs_result;
+    }
+    return result;
+}
+
+void FS::writeback_all()
 {
     Inode::sync();
 
@@ -94,7 +114,7 @@ void FS::sync()
     }
 
     for (auto& fs : fses)
-        fs.flush_writes();
+        fs.writeback();
 }
 
 void FS::lock_all()
@@ -57,13 +57,15 @@ public:
 
     unsigned fsid() const { return m_fsid; }
     static FS* from_fsid(u32);
-    static void sync();
+    static KResult sync();
+    static void writeback_all();
     static void lock_all();
 
     virtual bool initialize() = 0;
     virtual const char* class_name() const = 0;
     virtual InodeIdentifier root_inode() const = 0;
     virtual bool supports_watchers() const { return false; }
+    virtual bool supports_name_cache() const { return false; }
 
     bool is_readonly() const { return m_readonly; }
 
@@ -89,7 +91,10 @@ public:
 
     virtual RefPtr<Inode> get_inode(InodeIdentifier) const = 0;
 
-    virtual void flush_writes() {}
+    virtual KResult flush_writes() { return KSuccess; }
+
+    // Write back data that has been dirty for a while, without forcing everything out like flush_writes().
+    virtual void writeback() {}
 
     int block_size() const { return m_block_size; }
 
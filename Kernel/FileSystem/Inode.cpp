@@ -136,6 +136,16 @@ void Inode::inode_size_changed(size_t old_size, size_t new_size)
         m_vmobject->inode_size_changed({}, old_size, new_size);
 }
 
+void Inode::did_add_child(const StringView& name)
+{
+    VFS::the().name_cache().invalidate(identifier(), name);
+}
+
+void Inode::did_remove_child(const StringView& name)
+{
+    VFS::the().name_cache().invalidate(identifier(), name);
+}
+
 int Inode::set_atime(time_t)
 {
     return -ENOTIMPL;
@@ -105,6 +105,11 @@ public:
     InodeVMObject* vmobject() { return m_vmobject.ptr(); }
     const InodeVMObject* vmobject() const { return m_vmobject.ptr(); }
 
+    // Inodes with a page cache keep their contents in their InodeVMObject's pages,
+    // and bring those pages in themselves when a mapping faults on them.
+    virtual bool has_page_cache() const { return false; }
+    virtual KResult page_in(size_t) { return KResult(-ENOTSUP); }
+
     static void sync();
 
     bool has_watchers() const { return !m_watchers.is_empty(); }
@@ -121,6 +126,8 @@ protected:
     void set_metadata_dirty(bool);
     void inode_contents_changed(off_t, ssize_t, const u8*);
     void inode_size_changed(size_t old_size, size_t new_size);
+    void did_add_child(const StringView& name);
+    void did_remove_child(const StringView& name);
 
     mutable Lock m_lock { "Inode" };
 
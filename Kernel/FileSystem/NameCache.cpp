@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/HashFunctions.h>
+#include <Kernel/FileSystem/NameCache.h>
+
+//#define NAME_CACHE_DEBUG
+
+static const u32 max_entry_count = 1024;
+static const u32 bucket_count = 256;
+
+NameCache::NameCache()
+{
+    m_buckets = new Entry*[bucket_count];
+    for (u32 i = 0; i < bucket_count; ++i)
+        m_buckets[i] = nullptr;
+}
+
+NameCache::~NameCache()
+{
+    while (auto* entry = m_lru_list.remove_head())
+        delete entry;
+    delete[] m_buckets;
+}
+
+unsigned NameCache::hash_for(InodeIdentifier parent_id, const StringView& name)
+{
+    return pair_int_hash(pair_int_hash(parent_id.fsid(), parent_id.index()), name.hash());
+}
+
+NameCache::Entry* NameCache::find(InodeIdentifier parent_id, const StringView& name, unsigned hash)
+{
+    for (auto* entry = m_buckets[hash % bucket_count]; entry; entry = entry->m_next_in_bucket) {
+        if (entry->hash == hash && entry->parent_id == parent_id && entry->name == name)
+            return entry;
+    }
+    return nullptr;
+}
+
+void NameCache::index(Entry& entry)
+{
+    auto& bucket = m_buckets[entry.hash % bucket_count];
+    entry.m_next_in_bucket = bucket;
+    bucket = &entry;
+}
+
+void NameCache::unindex(Entry& entry)
+{
+    auto** link = &m_buckets[entry.hash % bucket_count];
+    while (*link != &entry) {
+        ASSERT(*link);
+        link = &(*link)->m_next_in_bucket;
+    }
+    *link = entry.m_next_in_bucket;
+    entry.m_next_in_bucket = nullptr;
+}
+
+void NameCache::remove(Entry& entry)
+{
+    unindex(entry);
+    m_lru_list.remove(&entry);
+    --m_entry_count;
+    delete &entry;
+}
+
+bool NameCache::lookup(InodeIdentifier parent_id, const StringView& name, InodeIdentifier& child_id)
+{
+    LOCKER(m_lock);
+    auto* entry = find(parent_id, name, hash_for(parent_id, name));
+    if (!entry) {
+        ++m_misses;
+        return false;
+    }
+    m_lru_list.remove(entry);
+    m_lru_list.prepend(entry);
+    child_id = entry->child_id;
+    if (child_id.is_valid())
+        ++m_hits;
+    else
+        ++m_negative_hits;
+    return true;
+}
+
+void NameCache::add(InodeIdentifier parent_id, const StringView& name, InodeIdentifier child_id, u32 generation)
+{
+    LOCKER(m_lock);
+    if (generation != m_generation)
+        return;
+
+    unsigned hash = hash_for(parent_id, name);
+    if (auto* existing_entry = find(parent_id, name, hash)) {
+        existing_entry->child_id = child_id;
+        return;
+    }
+
+    Entry* entry;
+    if (m_entry_count < max_entry_count) {
+        entry = new Entry;
+        ++m_entry_count;
+    } else {
+        // Recycle the least recently used entry.
+        entry = m_lru_list.remove_tail();
+        unindex(*entry);
+    }
+    entry->parent_id = parent_id;
+    entry->child_id = child_id;
+    entry->name = name;
+    entry->hash = hash;
+    index(*entry);
+    m_lru_list.prepend(entry);
+
+#ifdef NAME_CACHE_DEBUG
+    dbg() << "NameCache: Added " << parent_id << "/" << name << " -> " << child_id;
+#endif
+}
+
+void NameCache::invalidate(InodeIdentifier parent_id, const StringView& name)
+{
+    LOCKER(m_lock);
+    // Bump the generation even if nothing is cached, so that a lookup racing with us doesn't add a stale result.
+    ++m_generation;
+    auto* entry = find(parent_id, name, hash_for(parent_id, name));
+    if (!entry)
+        return;
+#ifdef NAME_CACHE_DEBUG
+    dbg() << "NameCache: Invalidated " << parent_id << "/" << name;
+#endif
+    ++m_invalidations;
+    remove(*entry);
+}
+
+void NameCache::invalidate_fs(u32 fsid)
+{
+    LOCKER(m_lock);
+    ++m_generation;
+    for (auto* entry = m_lru_list.head(); entry;) {
+        auto* next = entry->next();
+        if (entry->parent_id.fsid() == fsid) {
+            ++m_invalidations;
+            remove(*entry);
+        }
+        entry = next;
+    }
+}
+
+NameCache::Statistics NameCache::statistics() const
+{
+    LOCKER(m_lock);
+    Statistics statistics;
+    statistics.entry_count = m_entry_count;
+    for (auto* entry = m_lru_list.head(); entry; entry = entry->next()) {
+        if (!entry->child_id.is_valid())
+            ++statistics.negative_entry_count;
+    }
+    statistics.hits = m_hits;
+    statistics.negative_hits = m_negative_hits;
+    statistics.misses = m_misses;
+    statistics.invalidations = m_invalidations;
+    return statistics;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <AK/InlineLinkedList.h>
+#include <AK/String.h>
+#include <AK/StringView.h>
+#include <Kernel/FileSystem/InodeIdentifier.h>
+#include <Kernel/Lock.h>
+
+// Caches the result of looking up a name in a directory, including the fact that it doesn't exist.
+// Entries are keyed by (parent directory, name) and are dropped by the directory inode whenever
+// that name is added or removed.
+class NameCache {
+public:
+    struct Statistics {
+        u32 entry_count { 0 };
+        u32 negative_entry_count { 0 };
+        u32 hits { 0 };
+        u32 negative_hits { 0 };
+        u32 misses { 0 };
+        u32 invalidations { 0 };
+    };
+
+    NameCache();
+    ~NameCache();
+
+    // Returns true if the name is cached. child_id is left invalid if the name is known not to exist.
+    bool lookup(InodeIdentifier parent_id, const StringView& name, InodeIdentifier& child_id);
+
+    // Results computed while the generation was different from what it is now are not added.
+    u32 generation() const { return m_generation; }
+    void add(InodeIdentifier parent_id, const StringView& name, InodeIdentifier child_id, u32 generation);
+
+    void invalidate(InodeIdentifier parent_id, const StringView& name);
+    void invalidate_fs(u32 fsid);
+
+    Statistics statistics() const;
+
+private:
+    struct Entry : public InlineLinkedListNode<Entry> {
+        InodeIdentifier parent_id;
+        InodeIdentifier child_id;
+        String name;
+        unsigned hash { 0 };
+
+        // For the LRU list (InlineLinkedList)
+        Entry* m_next { nullptr };
+        Entry* m_prev { nullptr };
+
+        // For the hash chain
+        Entry* m_next_in_bucket { nullptr };
+    };
+
+    static unsigned hash_for(InodeIdentifier parent_id, const StringView& name);
+    Entry* find(InodeIdentifier parent_id, const StringView& name, unsigned hash);
+    void index(Entry&);
+    void unindex(Entry&);
+    void remove(Entry&);
+
+    mutable Lock m_lock { "NameCache" };
+    Entry** m_buckets { nullptr };
+    InlineLinkedList<Entry> m_lru_list;
+    u32 m_entry_count { 0 };
+    u32 m_generation { 0 };
+
+    u32 m_hits { 0 };
+    u32 m_negative_hits { 0 };
+    u32 m_misses { 0 };
+    u32 m_invalidations { 0 };
+};
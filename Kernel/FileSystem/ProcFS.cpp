@@ -37,6 +37,7 @@
 #include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/FileSystem/Custody.h>
 #include <Kernel/FileSystem/DiskBackedFileSystem.h>
+#include <Kernel/FileSystem/Ext2FileSystem.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/FileSystem/VirtualFileSystem.h>
 #include <Kernel/Heap/kmalloc.h>
@@ -72,6 +73,9 @@ enum ProcFileType {
     FI_Root_mm,
     FI_Root_mounts,
     FI_Root_df,
+    FI_Root_fragmentation,
+    FI_Root_namecache,
+    FI_Root_kmalloc,
     FI_Root_all,
     FI_Root_memstat,
     FI_Root_cpuinfo,
@@ -306,6 +310,7 @@ Optional<KBuffer> procfs$pid_vm(InodeIdentifier identifier)
         region_object.add("size", (u32)region.size());
         region_object.add("amount_resident", (u32)region.amount_resident());
         region_object.add("amount_dirty", (u32)region.amount_dirty());
+        region_object.add("amount_zero_mapped", (u32)region.amount_zero_mapped());
         region_object.add("cow_pages", region.cow_pages());
         region_object.add("name", region.name());
     }
@@ -439,6 +444,27 @@ Optional<KBuffer> procfs$net_adapters(InodeIdentifier)
         obj.add("bytes_in", adapter.bytes_in());
         obj.add("packets_out", adapter.packets_out());
         obj.add("bytes_out", adapter.bytes_out());
+        obj.add("packets_received_in_place", adapter.packets_received_in_place());
+        obj.add("packets_copied_in", adapter.packets_copied_in());
+        obj.add("packet_buffers", adapter.packet_buffers());
+        obj.add("packet_buffers_free", adapter.packet_buffers_free());
+        obj.add("packet_buffer_pool_misses", adapter.packet_buffer_pool_misses());
+        if (adapter.rx_ring_size()) {
+            obj.add("rx_ring_size", adapter.rx_ring_size());
+            obj.add("tx_ring_size", adapter.tx_ring_size());
+        }
+        obj.add("interrupts", adapter.interrupts());
+        obj.add("checksum_errors", adapter.checksum_errors());
+        auto offloads = obj.add_array("offloads");
+        if (adapter.has_offload(NetworkAdapter::IPv4ChecksumOffload))
+            offloads.add("ipv4_checksum");
+        if (adapter.has_offload(NetworkAdapter::TCPChecksumOffload))
+            offloads.add("tcp_checksum");
+        if (adapter.has_offload(NetworkAdapter::TCPSegmentationOffload))
+            offloads.add("tcp_segmentation");
+        offloads.finish();
+        if (adapter.interrupts())
+            obj.add("packets_per_interrupt", (adapter.packets_in() + adapter.packets_out()) / adapter.interrupts());
         obj.add("link_up", adapter.link_up());
         obj.add("mtu", adapter.mtu());
     });
@@ -477,6 +503,23 @@ Optional<KBuffer> procfs$net_tcp(InodeIdentifier)
         obj.add("bytes_in", socket.bytes_in());
         obj.add("packets_out", socket.packets_out());
         obj.add("bytes_out", socket.bytes_out());
+        obj.add("bytes_copied_to_user", socket.bytes_copied_to_user());
+        obj.add("retransmissions", socket.retransmissions());
+        obj.add("congestion_window", socket.congestion_window());
+        obj.add("send_window", socket.send_window());
+        obj.add("smoothed_rtt_us", socket.smoothed_rtt_us());
+        if (socket.state() == TCPSocket::State::Listen) {
+            obj.add("backlog", socket.listen_backlog());
+            obj.add("syn_queue", socket.syn_queue_length());
+            obj.add("accept_queue", socket.accept_queue_length());
+            obj.add("syns_received", socket.syns_received());
+            obj.add("syns_dropped", socket.syns_dropped());
+            obj.add("syn_cookies_sent", socket.syn_cookies_sent());
+            obj.add("syn_cookies_accepted", socket.syn_cookies_accepted());
+            obj.add("connections_established", socket.connections_established());
+            obj.add("accept_queue_overflows", socket.accept_queue_overflows());
+            obj.add("half_open_connections_expired", socket.half_open_connections_expired());
+        }
     });
     array.finish();
     return builder.build();
@@ -492,6 +535,7 @@ Optional<KBuffer> procfs$net_udp(InodeIdentifier)
         obj.add("local_port", socket.local_port());
         obj.add("peer_address", socket.peer_address().to_string());
         obj.add("peer_port", socket.peer_port());
+        obj.add("bytes_copied_to_user", socket.bytes_copied_to_user());
     });
     array.finish();
     return builder.build();
@@ -706,15 +750,95 @@ Optional<KBuffer> procfs$df(InodeIdentifier)
         fs_object.add("readonly", fs.is_readonly());
         fs_object.add("mount_flags", mount.flags());
 
-        if (fs.is_disk_backed())
-            fs_object.add("device", static_cast<const DiskBackedFS&>(fs).device().absolute_path());
-        else
+        if (fs.is_disk_backed()) {
+            auto& disk_backed_fs = static_cast<const DiskBackedFS&>(fs);
+            fs_object.add("device", disk_backed_fs.device().absolute_path());
+            auto cache_statistics = disk_backed_fs.cache_statistics();
+            fs_object.add("cache_entry_count", cache_statistics.entry_count);
+            fs_object.add("cache_dirty_count", cache_statistics.dirty_count);
+            fs_object.add("cache_hits", cache_statistics.hits);
+            fs_object.add("cache_misses", cache_statistics.misses);
+            fs_object.add("cache_evictions", cache_statistics.evictions);
+            fs_object.add("cache_writebacks", cache_statistics.writebacks);
+        } else
             fs_object.add("device", fs.class_name());
     });
     array.finish();
     return builder.build();
 }
 
+Optional<KBuffer> procfs$fragmentation(InodeIdentifier)
+{
+    // FIXME: This is obviously racy against the VFS mounts changing.
+    KBufferBuilder builder;
+    JsonArraySerializer array { builder };
+    VFS::the().for_each_mount([&array](auto& mount) {
+        auto& fs = mount.guest_fs();
+        if (String(fs.class_name()) != "Ext2FS")
+            return;
+        auto report = static_cast<const Ext2FS&>(fs).fragmentation_report();
+        auto fs_object = array.add_object();
+        fs_object.add("mount_point", mount.absolute_path());
+        fs_object.add("block_size", fs.block_size());
+        fs_object.add("total_block_count", fs.total_block_count());
+        fs_object.add("free_block_count", report.free_block_count);
+        fs_object.add("free_extent_count", report.free_extent_count);
+        fs_object.add("largest_free_extent", report.largest_free_extent);
+        fs_object.add("preallocated_block_count", report.preallocated_block_count);
+        fs_object.add("allocated_block_count", report.allocated_block_count);
+        fs_object.add("allocated_extent_count", report.allocated_extent_count);
+        auto histogram_array = fs_object.add_array("free_extent_histogram");
+        for (auto count : report.free_extent_histogram)
+            histogram_array.add(count);
+        histogram_array.finish();
+    });
+    array.finish();
+    return builder.build();
+}
+
+Optional<KBuffer> procfs$namecache(InodeIdentifier)
+{
+    auto statistics = VFS::the().name_cache().statistics();
+    KBufferBuilder builder;
+    JsonObjectSerializer<KBufferBuilder> json { builder };
+    json.add("entry_count", statistics.entry_count);
+    json.add("negative_entry_count", statistics.negative_entry_count);
+    json.add("hits", statistics.hits);
+    json.add("negative_hits", statistics.negative_hits);
+    json.add("misses", statistics.misses);
+    json.add("invalidations", statistics.invalidations);
+    json.finish();
+    return builder.build();
+}
+
+Optional<KBuffer> procfs$kmalloc(InodeIdentifier)
+{
+    auto statistics = kmalloc_statistics();
+    KBufferBuilder builder;
+    JsonObjectSerializer<KBufferBuilder> json { builder };
+    json.add("region_count", statistics.region_count);
+    json.add("total_pages", statistics.total_pages);
+    json.add("free_pages", statistics.free_pages);
+    json.add("expansion_count", statistics.expansion_count);
+    json.add("large_allocation_count", statistics.large_allocation_count);
+    json.add("large_allocation_pages", statistics.large_allocation_pages);
+    json.add("eternal_allocated", (u32)kmalloc_sum_eternal);
+    json.add("kmalloc_call_count", g_kmalloc_call_count);
+    json.add("kfree_call_count", g_kfree_call_count);
+    auto slabs_array = json.add_array("slabs");
+    slab_alloc_stats([&slabs_array](size_t slab_size, size_t span_count, size_t num_allocated, size_t num_free) {
+        auto slab_object = slabs_array.add_object();
+        slab_object.add("size", slab_size);
+        slab_object.add("spans", span_count);
+        slab_object.add("allocated", num_allocated);
+        slab_object.add("free", num_free);
+        slab_object.finish();
+    });
+    slabs_array.finish();
+    json.finish();
+    return builder.build();
+}
+
 Optional<KBuffer> procfs$cpuinfo(InodeIdentifier)
 {
     KBufferBuilder builder;
@@ -790,9 +914,16 @@ Optional<KBuffer> procfs$memstat(InodeIdentifier)
     json.add("user_physical_available", MM.user_physical_pages() - MM.user_physical_pages_used());
     json.add("super_physical_allocated", MM.super_physical_pages_used());
     json.add("super_physical_available", MM.super_physical_pages() - MM.super_physical_pages_used());
+    json.add("user_physical_zeroed", MM.user_physical_zeroed_pages());
+    json.add("user_physical_zeroed_hits", MM.user_physical_zeroed_page_hits());
+    json.add("user_physical_zeroed_misses", MM.user_physical_zeroed_page_misses());
+    for (unsigned order = 0; order <= PhysicalRegion::max_order; ++order) {
+        json.add(String::format("user_physical_free_order_%u", order), MM.user_physical_free_blocks_at_order(order));
+        json.add(String::format("super_physical_free_order_%u", order), MM.super_physical_free_blocks_at_order(order));
+    }
     json.add("kmalloc_call_count", g_kmalloc_call_count);
     json.add("kfree_call_count", g_kfree_call_count);
-    slab_alloc_stats([&json](size_t slab_size, size_t num_allocated, size_t num_free) {
+    slab_alloc_stats([&json](size_t slab_size, size_t, size_t num_allocated, size_t num_free) {
         auto prefix = String::format("slab_%zu", slab_size);
         json.add(String::format("%s_num_allocated", prefix.characters()), (u32)num_allocated);
         json.add(String::format("%s_num_free", prefix.characters()), (u32)num_free);
@@ -849,6 +980,7 @@ Optional<KBuffer> procfs$all(InodeIdentifier)
         process_object.add("amount_dirty_private", (u32)process.amount_dirty_private());
         process_object.add("amount_clean_inode", (u32)process.amount_clean_inode());
         process_object.add("amount_shared", (u32)process.amount_shared());
+        process_object.add("amount_zero_mapped", (u32)process.amount_zero_mapped());
         process_object.add("amount_purgeable_volatile", (u32)process.amount_purgeable_volatile());
         process_object.add("amount_purgeable_nonvolatile", (u32)process.amount_purgeable_nonvolatile());
         process_object.add("icon_id", process.icon_id());
@@ -865,6 +997,7 @@ Optional<KBuffer> procfs$all(InodeIdentifier)
             thread_object.add("syscall_count", thread.syscall_count());
             thread_object.add("inode_faults", thread.inode_faults());
             thread_object.add("zero_faults", thread.zero_faults());
+            thread_object.add("zero_page_maps", thread.zero_page_maps());
             thread_object.add("cow_faults", thread.cow_faults());
             thread_object.add("file_read_bytes", thread.file_read_bytes());
             thread_object.add("file_write_bytes", thread.file_write_bytes());
@@ -1579,6 +1712,9 @@ ProcFS::ProcFS()
     m_entries[FI_Root_mm] = { "mm", FI_Root_mm, true, procfs$mm };
     m_entries[FI_Root_mounts] = { "mounts", FI_Root_mounts, false, procfs$mounts };
     m_entries[FI_Root_df] = { "df", FI_Root_df, false, procfs$df };
+    m_entries[FI_Root_fragmentation] = { "fragmentation", FI_Root_fragmentation, false, procfs$fragmentation };
+    m_entries[FI_Root_namecache] = { "namecache", FI_Root_namecache, false, procfs$namecache };
+    m_entries[FI_Root_kmalloc] = { "kmalloc", FI_Root_kmalloc, false, procfs$kmalloc };
     m_entries[FI_Root_all] = { "all", FI_Root_all, false, procfs$all };
     m_entries[FI_Root_memstat] = { "memstat", FI_Root_memstat, false, procfs$memstat };
     m_entries[FI_Root_cpuinfo] = { "cpuinfo", FI_Root_cpuinfo, false, procfs$cpuinfo };
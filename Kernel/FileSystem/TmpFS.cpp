@@ -301,6 +301,7 @@ KResult TmpFSInode::add_child(InodeIdentifier child_id, const StringView& name,
     m_children.set(owned_name, { entry, move(child) });
     set_metadata_dirty(true);
     set_metadata_dirty(false);
+    did_add_child(name);
     return KSuccess;
 }
 
@@ -318,6 +319,7 @@ KResult TmpFSInode::remove_child(const StringView& name)
     m_children.remove(it);
     set_metadata_dirty(true);
     set_metadata_dirty(false);
+    did_remove_child(name);
     return KSuccess;
 }
 
@@ -99,6 +99,7 @@ KResult VFS::unmount(InodeIdentifier guest_inode_id)
                 return result;
             }
             dbg() << "VFS: found fs " << mount.guest_fs().fsid() << " at mount index " << i << "! Unmounting...";
+            m_name_cache.invalidate_fs(mount.guest_fs().fsid());
             m_mounts.unstable_remove(i);
             return KSuccess;
         }
@@ -694,9 +695,9 @@ void VFS::for_each_mount(Function<void(const Mount&)> callback) const
     }
 }
 
-void VFS::sync()
+KResult VFS::sync()
 {
-    FS::sync();
+    return FS::sync();
 }
 
 Custody& VFS::root_custody()
@@ -772,6 +773,25 @@ KResult VFS::validate_path_against_process_veil(StringView path, int options)
     return KSuccess;
 }
 
+RefPtr<Inode> VFS::lookup_child(Inode& parent, const StringView& name)
+{
+    if (!parent.fs().supports_name_cache())
+        return parent.lookup(name);
+
+    InodeIdentifier child_id;
+    if (m_name_cache.lookup(parent.identifier(), name, child_id)) {
+        if (!child_id.is_valid())
+            return nullptr;
+        if (auto child_inode = get_inode(child_id))
+            return child_inode;
+    }
+
+    auto generation = m_name_cache.generation();
+    auto child_inode = parent.lookup(name);
+    m_name_cache.add(parent.identifier(), name, child_inode ? child_inode->identifier() : InodeIdentifier(), generation);
+    return child_inode;
+}
+
 KResultOr<NonnullRefPtr<Custody>> VFS::resolve_path(StringView path, Custody& base, RefPtr<Custody>* out_parent, int options, int symlink_recursion_level)
 {
     auto result = validate_path_against_process_veil(path, options);
@@ -811,7 +831,7 @@ KResultOr<NonnullRefPtr<Custody>> VFS::resolve_path(StringView path, Custody& ba
         }
 
         // Okay, let's look up this part.
-        auto child_inode = parent.inode().lookup(part);
+        auto child_inode = lookup_child(parent.inode(), part);
         if (!child_inode) {
             if (out_parent) {
                 // ENOENT with a non-null parent custody signals to caller that
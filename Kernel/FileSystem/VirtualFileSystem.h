@@ -36,6 +36,7 @@
 #include <Kernel/FileSystem/FileSystem.h>
 #include <Kernel/FileSystem/InodeIdentifier.h>
 #include <Kernel/FileSystem/InodeMetadata.h>
+#include <Kernel/FileSystem/NameCache.h>
 #include <Kernel/KResult.h>
 
 
@@ -132,9 +133,10 @@ public:
 
     InodeIdentifier root_inode_id() const;
 
-    void sync();
+    KResult sync();
 
     Custody& root_custody();
+    NameCache& name_cache() { return m_name_cache; }
     KResultOr<NonnullRefPtr<Custody>> resolve_path(StringView path, Custody& base, RefPtr<Custody>* out_parent = nullptr, int options = 0, int symlink_recursion_level = 0);
 
 private:
@@ -144,6 +146,7 @@ private:
     KResult validate_path_against_process_veil(StringView path, int options);
 
     RefPtr<Inode> get_inode(InodeIdentifier);
+    RefPtr<Inode> lookup_child(Inode& parent, const StringView& name);
 
     bool is_vfs_root(InodeIdentifier) const;
 
@@ -158,4 +161,6 @@ private:
     Vector<Mount> m_mounts;
 
     RefPtr<Custody> m_root_custody;
+
+    NameCache m_name_cache;
 };
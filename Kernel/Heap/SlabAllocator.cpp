@@ -25,138 +25,247 @@
  */
 
 #include <AK/Assertions.h>
+#include <Kernel/Arch/i386/CPU.h>
 #include <Kernel/Heap/SlabAllocator.h>
 #include <Kernel/Heap/kmalloc.h>
-#include <Kernel/VM/Region.h>
+#include <Kernel/StdLib.h>
+
+// Every size class carves its objects out of spans: a few pages from kmalloc_pages()
+// with a SlabSpan header at the start. Since the header sits at the base of the page
+// allocation, any object can find its span (and thus its size class) in O(1).
+
+static constexpr u32 slab_span_magic = 0x51ab5ba0;
+static constexpr size_t slab_span_header_size = 32;
+
+class SlabAllocator;
+
+struct FreeSlab {
+    FreeSlab* next;
+};
+
+struct SlabSpan {
+    u32 magic;
+    u32 page_count;
+    SlabSpan* next;
+    SlabSpan* prev;
+    FreeSlab* freelist;
+    SlabAllocator* allocator;
+    u16 object_count;
+    u16 free_count;
+
+    u8* objects() { return (u8*)this + slab_span_header_size; }
+};
+
+static_assert(sizeof(SlabSpan) <= slab_span_header_size);
 
-template<size_t templated_slab_size>
 class SlabAllocator {
 public:
-    SlabAllocator() {}
-
-    void init(size_t size)
+    void init(size_t slab_size)
     {
-        m_base = kmalloc_eternal(size);
-        m_end = (u8*)m_base + size;
-        FreeSlab* slabs = (FreeSlab*)m_base;
-        size_t slab_count = size / templated_slab_size;
-        for (size_t i = 1; i < slab_count; ++i) {
-            slabs[i].next = &slabs[i - 1];
-        }
-        slabs[0].next = nullptr;
-        m_freelist = &slabs[slab_count - 1];
+        m_slab_size = slab_size;
+        if (slab_size <= 512)
+            m_span_page_count = 1;
+        else if (slab_size <= 1024)
+            m_span_page_count = 2;
+        else
+            m_span_page_count = 4;
+        m_objects_per_span = (m_span_page_count * PAGE_SIZE - slab_span_header_size) / slab_size;
+        m_partial_spans = nullptr;
+        m_empty_span = nullptr;
+        m_span_count = 0;
         m_num_allocated = 0;
-        m_num_free = slab_count;
+        m_num_free = 0;
     }
 
-    constexpr size_t slab_size() const { return templated_slab_size; }
+    size_t slab_size() const { return m_slab_size; }
 
     void* alloc()
     {
         InterruptDisabler disabler;
-        if (!m_freelist)
-            return kmalloc(slab_size());
-        ASSERT(m_freelist);
-        void* ptr = m_freelist;
-        m_freelist = m_freelist->next;
+        if (!m_partial_spans) {
+            SlabSpan* span = m_empty_span;
+            if (span)
+                m_empty_span = nullptr;
+            else
+                span = create_span();
+            link_partial(*span);
+        }
+
+        auto& span = *m_partial_spans;
+        FreeSlab* slab = span.freelist;
+        ASSERT(slab);
+        span.freelist = slab->next;
+        if (--span.free_count == 0)
+            unlink_partial(span);
         ++m_num_allocated;
         --m_num_free;
 #ifdef SANITIZE_KMALLOC
-        memset(ptr, SLAB_ALLOC_SCRUB_BYTE, slab_size());
+        memset(slab, SLAB_ALLOC_SCRUB_BYTE, m_slab_size);
 #endif
-        return ptr;
+        return slab;
     }
 
-    void dealloc(void* ptr)
+    void dealloc(void* ptr, SlabSpan& span)
     {
         InterruptDisabler disabler;
         ASSERT(ptr);
-        if (ptr < m_base || ptr >= m_end) {
-            kfree(ptr);
-            return;
-        }
-        ((FreeSlab*)ptr)->next = m_freelist;
+        ASSERT(span.allocator == this);
 #ifdef SANITIZE_KMALLOC
-        if (slab_size() > sizeof(FreeSlab*))
-            memset(((FreeSlab*)ptr)->padding, SLAB_DEALLOC_SCRUB_BYTE, sizeof(FreeSlab::padding));
+        memset(ptr, SLAB_DEALLOC_SCRUB_BYTE, m_slab_size);
 #endif
-        m_freelist = (FreeSlab*)ptr;
-        ++m_num_allocated;
-        --m_num_free;
+        auto* slab = (FreeSlab*)ptr;
+        slab->next = span.freelist;
+        span.freelist = slab;
+        if (span.free_count++ == 0)
+            link_partial(span);
+        --m_num_allocated;
+        ++m_num_free;
+
+        if (span.free_count < span.object_count)
+            return;
+
+        // Keep one empty span around so that an alloc/free pair at a span boundary
+        // doesn't keep going back to the page allocator.
+        unlink_partial(span);
+        if (!m_empty_span) {
+            m_empty_span = &span;
+            return;
+        }
+        destroy_span(span);
     }
 
+    size_t span_count() const { return m_span_count; }
     size_t num_allocated() const { return m_num_allocated; }
     size_t num_free() const { return m_num_free; }
 
 private:
-    struct FreeSlab {
-        FreeSlab* next { nullptr };
-        char padding[templated_slab_size - sizeof(FreeSlab*)];
-    };
+    SlabSpan* create_span()
+    {
+        auto* span = (SlabSpan*)kmalloc_pages(m_span_page_count);
+        span->magic = slab_span_magic;
+        span->page_count = m_span_page_count;
+        span->next = nullptr;
+        span->prev = nullptr;
+        span->allocator = this;
+        span->object_count = m_objects_per_span;
+        span->free_count = m_objects_per_span;
+
+        // Thread the freelist front to back so that fresh allocations walk the span in address order.
+        u8* objects = span->objects();
+        for (size_t i = 0; i < m_objects_per_span - 1; ++i)
+            ((FreeSlab*)(objects + i * m_slab_size))->next = (FreeSlab*)(objects + (i + 1) * m_slab_size);
+        ((FreeSlab*)(objects + (m_objects_per_span - 1) * m_slab_size))->next = nullptr;
+        span->freelist = (FreeSlab*)objects;
+
+        ++m_span_count;
+        m_num_free += m_objects_per_span;
+        return span;
+    }
+
+    void destroy_span(SlabSpan& span)
+    {
+        ASSERT(span.free_count == span.object_count);
+        span.magic = 0;
+        --m_span_count;
+        m_num_free -= span.object_count;
+        kfree_pages(&span, span.page_count);
+    }
+
+    void link_partial(SlabSpan& span)
+    {
+        span.prev = nullptr;
+        span.next = m_partial_spans;
+        if (m_partial_spans)
+            m_partial_spans->prev = &span;
+        m_partial_spans = &span;
+    }
+
+    void unlink_partial(SlabSpan& span)
+    {
+        if (span.prev)
+            span.prev->next = span.next;
+        else
+            m_partial_spans = span.next;
+        if (span.next)
+            span.next->prev = span.prev;
+        span.next = nullptr;
+        span.prev = nullptr;
+    }
 
     // NOTE: These are not default-initialized to prevent an init-time constructor from overwriting them
-    FreeSlab* m_freelist;
+    size_t m_slab_size;
+    size_t m_span_page_count;
+    size_t m_objects_per_span;
+    SlabSpan* m_partial_spans;
+    SlabSpan* m_empty_span;
+    size_t m_span_count;
     size_t m_num_allocated;
     size_t m_num_free;
-    void* m_base;
-    void* m_end;
-
-    static_assert(sizeof(FreeSlab) == templated_slab_size);
 };
 
-static SlabAllocator<8> s_slab_allocator_8;
-static SlabAllocator<16> s_slab_allocator_16;
-static SlabAllocator<32> s_slab_allocator_32;
-static SlabAllocator<48> s_slab_allocator_48;
+static constexpr size_t s_slab_sizes[] = { 8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048 };
+static constexpr size_t slab_class_count = sizeof(s_slab_sizes) / sizeof(s_slab_sizes[0]);
+static_assert(s_slab_sizes[slab_class_count - 1] == slab_max_size);
+
+static SlabAllocator s_slab_allocators[slab_class_count];
 
-static_assert(sizeof(Region) <= s_slab_allocator_48.slab_size());
+// Maps (size + 7) / 8 to the smallest size class that fits.
+static u8 s_size_class_for_granule[slab_max_size / 8 + 1];
 
-template<typename Callback>
-void for_each_allocator(Callback callback)
+void slab_alloc_init()
 {
-    callback(s_slab_allocator_8);
-    callback(s_slab_allocator_16);
-    callback(s_slab_allocator_32);
-    callback(s_slab_allocator_48);
+    size_t size_class = 0;
+    for (size_t granule = 0; granule <= slab_max_size / 8; ++granule) {
+        while (s_slab_sizes[size_class] < granule * 8)
+            ++size_class;
+        s_size_class_for_granule[granule] = size_class;
+    }
+    for (size_t i = 0; i < slab_class_count; ++i)
+        s_slab_allocators[i].init(s_slab_sizes[i]);
 }
 
-void slab_alloc_init()
+static SlabAllocator& allocator_for_size(size_t slab_size)
+{
+    ASSERT(slab_size <= slab_max_size);
+    return s_slab_allocators[s_size_class_for_granule[(slab_size + 7) / 8]];
+}
+
+size_t slab_size_class(size_t slab_size)
 {
-    s_slab_allocator_8.init(384 * KB);
-    s_slab_allocator_16.init(128 * KB);
-    s_slab_allocator_32.init(128 * KB);
-    s_slab_allocator_48.init(128 * KB);
+    return allocator_for_size(slab_size).slab_size();
+}
+
+static SlabSpan* span_for(const void* ptr)
+{
+    auto* span = (SlabSpan*)kmalloc_pages_base(ptr);
+    if (!span || span->magic != slab_span_magic)
+        return nullptr;
+    return span;
 }
 
 void* slab_alloc(size_t slab_size)
 {
-    if (slab_size <= 8)
-        return s_slab_allocator_8.alloc();
-    if (slab_size <= 16)
-        return s_slab_allocator_16.alloc();
-    if (slab_size <= 32)
-        return s_slab_allocator_32.alloc();
-    if (slab_size <= 48)
-        return s_slab_allocator_48.alloc();
-    ASSERT_NOT_REACHED();
+    return allocator_for_size(slab_size).alloc();
 }
 
 void slab_dealloc(void* ptr, size_t slab_size)
 {
-    if (slab_size <= 8)
-        return s_slab_allocator_8.dealloc(ptr);
-    if (slab_size <= 16)
-        return s_slab_allocator_16.dealloc(ptr);
-    if (slab_size <= 32)
-        return s_slab_allocator_32.dealloc(ptr);
-    if (slab_size <= 48)
-        return s_slab_allocator_48.dealloc(ptr);
-    ASSERT_NOT_REACHED();
+    auto* span = span_for(ptr);
+    ASSERT(span);
+    ASSERT(span->allocator->slab_size() >= slab_size);
+    span->allocator->dealloc(ptr, *span);
+}
+
+size_t slab_allocation_size(const void* ptr)
+{
+    auto* span = span_for(ptr);
+    if (!span)
+        return 0;
+    return span->allocator->slab_size();
 }
 
-void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free)> callback)
+void slab_alloc_stats(Function<void(size_t slab_size, size_t span_count, size_t allocated, size_t free)> callback)
 {
-    for_each_allocator([&](auto& allocator) {
-        callback(allocator.slab_size(), allocator.num_allocated(), allocator.num_free());
-    });
+    for (auto& allocator : s_slab_allocators)
+        callback(allocator.slab_size(), allocator.span_count(), allocator.num_allocated(), allocator.num_free());
 }
@@ -32,10 +32,18 @@
 #define SLAB_ALLOC_SCRUB_BYTE 0xab
 #define SLAB_DEALLOC_SCRUB_BYTE 0xbc
 
+// Size classes run from 8 bytes up to this; kmalloc() hands anything larger to whole pages.
+static constexpr size_t slab_max_size = 2048;
+
 void* slab_alloc(size_t slab_size);
 void slab_dealloc(void*, size_t slab_size);
 void slab_alloc_init();
-void slab_alloc_stats(Function<void(size_t slab_size, size_t allocated, size_t free)>);
+void slab_alloc_stats(Function<void(size_t slab_size, size_t span_count, size_t allocated, size_t free)>);
+
+// The size class that slab_alloc() rounds slab_size up to.
+size_t slab_size_class(size_t slab_size);
+// The size class of the slab that ptr was handed out from, or 0 if it didn't come from a slab.
+size_t slab_allocation_size(const void* ptr);
 
 #define MAKE_SLAB_ALLOCATED(type)                                        \
 public:                                                                  \
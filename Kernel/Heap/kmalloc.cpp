@@ -25,35 +25,74 @@
  */
 
 /*
- * Really really *really* Q&D malloc() and free() implementations
- * just to get going. Don't ever let anyone see this shit. :^)
+ * The kernel heap is a set of page-granular regions. Small allocations are
+ * served by the size-class slabs in SlabAllocator.cpp, which carve up pages
+ * from here; anything larger than the biggest size class gets whole pages.
  */
 
 #include <AK/Assertions.h>
+#include <AK/Bitmap.h>
+#include <AK/Optional.h>
 #include <AK/Types.h>
 #include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/Heap/SlabAllocator.h>
+#include <Kernel/Heap/kmalloc.h>
 #include <Kernel/KSyms.h>
 #include <Kernel/Process.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/StdLib.h>
-#include <Kernel/Heap/kmalloc.h>
+#include <Kernel/VM/MemoryManager.h>
 
 #define SANITIZE_KMALLOC
 
-struct [[gnu::packed]] allocation_t
-{
-    size_t start;
-    size_t nchunk;
-};
-
 #define BASE_PHYSICAL (0xc0000000 + (4 * MB))
-#define CHUNK_SIZE 8
 #define POOL_SIZE (3 * MB)
 
 #define ETERNAL_BASE_PHYSICAL (0xc0000000 + (2 * MB))
 #define ETERNAL_RANGE_SIZE (2 * MB)
 
-static u8 alloc_map[POOL_SIZE / CHUNK_SIZE / 8];
+static constexpr size_t initial_page_count = POOL_SIZE / PAGE_SIZE;
+static constexpr size_t max_heap_regions = 32;
+
+// Once MM is up, the heap grows by this much at a time. syncd tops it up whenever
+// free pages drop below the low watermark, so allocating threads rarely have to.
+static constexpr size_t heap_expansion_size = 4 * MB;
+static constexpr size_t heap_low_watermark_pages = (1 * MB) / PAGE_SIZE;
+// Growing the heap allocates kernel objects of its own, so expand synchronously
+// while there are still this many pages left for it to use.
+static constexpr size_t heap_reserve_pages = 16;
+
+// The allocation map has an entry for each page. Free pages are marked page_is_free, the first
+// page of an allocation holds its page count and flags, and the others hold the first page's index.
+static constexpr u16 page_is_free = 0xffff;
+static constexpr u16 page_starts_allocation = 0x8000;
+static constexpr u16 page_starts_large_allocation = 0x4000;
+static constexpr u16 allocation_page_count_mask = 0x3fff;
+static constexpr size_t max_region_page_count = allocation_page_count_mask;
+
+struct HeapRegion {
+    u8* base;
+    size_t page_count;
+    size_t free_page_count;
+    u8* page_bitmap;
+    u16* allocation_map;
+
+    bool contains(const void* ptr) const { return ptr >= base && ptr < base + page_count * PAGE_SIZE; }
+    Bitmap bitmap() { return Bitmap::wrap(page_bitmap, page_count); }
+};
+
+// NOTE: These live in BSS and are set up by kmalloc_init(), before any global constructors run.
+static u8 s_initial_page_bitmap[initial_page_count / 8];
+static u16 s_initial_allocation_map[initial_page_count];
+static HeapRegion s_regions[max_heap_regions];
+static size_t s_region_count;
+static size_t s_total_pages;
+static size_t s_free_pages;
+static size_t s_expansion_count;
+static size_t s_large_allocation_count;
+static size_t s_large_allocation_pages;
+static bool s_can_expand;
+static bool s_expanding;
 
 volatile size_t sum_alloc = 0;
 volatile size_t sum_free = POOL_SIZE;
@@ -66,19 +105,220 @@ bool g_dump_kmalloc_stacks;
 static u8* s_next_eternal_ptr;
 static u8* s_end_of_eternal_range;
 
+static void add_region(u8* base, size_t page_count, u8* page_bitmap, u16* allocation_map)
+{
+    ASSERT(s_region_count < max_heap_regions);
+    ASSERT(page_count <= max_region_page_count);
+    auto& region = s_regions[s_region_count++];
+    region.base = base;
+    region.page_count = page_count;
+    region.free_page_count = page_count;
+    region.page_bitmap = page_bitmap;
+    region.allocation_map = allocation_map;
+    memset(page_bitmap, 0, (page_count + 7) / 8);
+    for (size_t i = 0; i < page_count; ++i)
+        allocation_map[i] = page_is_free;
+    s_total_pages += page_count;
+    s_free_pages += page_count;
+    sum_free = s_free_pages * PAGE_SIZE;
+}
+
 void kmalloc_init()
 {
-    memset(&alloc_map, 0, sizeof(alloc_map));
     memset((void*)BASE_PHYSICAL, 0, POOL_SIZE);
 
     kmalloc_sum_eternal = 0;
     sum_alloc = 0;
-    sum_free = POOL_SIZE;
+
+    s_region_count = 0;
+    s_total_pages = 0;
+    s_free_pages = 0;
+    s_expansion_count = 0;
+    s_large_allocation_count = 0;
+    s_large_allocation_pages = 0;
+    s_can_expand = false;
+    s_expanding = false;
+    add_region((u8*)BASE_PHYSICAL, initial_page_count, s_initial_page_bitmap, s_initial_allocation_map);
 
     s_next_eternal_ptr = (u8*)ETERNAL_BASE_PHYSICAL;
     s_end_of_eternal_range = s_next_eternal_ptr + ETERNAL_RANGE_SIZE;
 }
 
+void kmalloc_enable_expansion()
+{
+    s_can_expand = true;
+}
+
+static bool expand_heap(size_t minimum_page_count)
+{
+    if (!s_can_expand || s_expanding || s_region_count == max_heap_regions)
+        return false;
+    s_expanding = true;
+
+    // The region's page bitmap and allocation map go in its first pages.
+    size_t size = max(heap_expansion_size, PAGE_ROUND_UP((minimum_page_count + 1) * PAGE_SIZE));
+    size_t page_count = size / PAGE_SIZE;
+    size_t metadata_size = (page_count + 7) / 8 + page_count * sizeof(u16);
+    size_t metadata_page_count = PAGE_ROUND_UP(metadata_size) / PAGE_SIZE;
+    if (page_count > max_region_page_count) {
+        s_expanding = false;
+        return false;
+    }
+
+    auto region = MM.allocate_kernel_region((page_count + metadata_page_count) * PAGE_SIZE, "kmalloc", Region::Access::Read | Region::Access::Write, false, true);
+    if (!region) {
+        s_expanding = false;
+        return false;
+    }
+    // Heap regions are never handed back to MM.
+    u8* base = region.leak_ptr()->vaddr().as_ptr();
+    auto* allocation_map = (u16*)base;
+    auto* page_bitmap = base + page_count * sizeof(u16);
+    add_region(base + metadata_page_count * PAGE_SIZE, page_count, page_bitmap, allocation_map);
+    ++s_expansion_count;
+    s_expanding = false;
+    return true;
+}
+
+void kmalloc_expand_if_needed()
+{
+    InterruptDisabler disabler;
+    if (s_free_pages < heap_low_watermark_pages)
+        expand_heap(0);
+}
+
+static void* allocate_pages_from(HeapRegion& region, size_t page_count, bool is_large_allocation)
+{
+    if (region.free_page_count < page_count)
+        return nullptr;
+    auto bitmap = region.bitmap();
+    int found_range_size = 0;
+    int first_page = bitmap.find_next_range_of_unset_bits(0, page_count, page_count, found_range_size);
+    if (first_page < 0)
+        return nullptr;
+    for (size_t i = first_page; i < first_page + page_count; ++i) {
+        bitmap.set(i, true);
+        region.allocation_map[i] = first_page;
+    }
+    region.allocation_map[first_page] = page_starts_allocation | (is_large_allocation ? page_starts_large_allocation : 0) | page_count;
+    region.free_page_count -= page_count;
+    s_free_pages -= page_count;
+    sum_free = s_free_pages * PAGE_SIZE;
+    return region.base + first_page * PAGE_SIZE;
+}
+
+static void* allocate_pages(size_t page_count, bool is_large_allocation)
+{
+    ASSERT(page_count);
+    ASSERT_INTERRUPTS_DISABLED();
+
+    if (s_free_pages < page_count + heap_reserve_pages)
+        expand_heap(page_count);
+
+    for (size_t i = 0; i < s_region_count; ++i) {
+        if (auto* ptr = allocate_pages_from(s_regions[i], page_count, is_large_allocation))
+            return ptr;
+    }
+
+    if (expand_heap(page_count)) {
+        if (auto* ptr = allocate_pages_from(s_regions[s_region_count - 1], page_count, is_large_allocation))
+            return ptr;
+    }
+
+    kprintf("%s(%u) kmalloc(): PANIC! Out of memory (no run of %u free pages, %u pages free)\n", current->process().name().characters(), current->pid(), page_count, s_free_pages);
+    dump_backtrace();
+    hang();
+}
+
+void* kmalloc_pages(size_t page_count)
+{
+    InterruptDisabler disabler;
+    return allocate_pages(page_count, false);
+}
+
+static HeapRegion* region_containing(const void* ptr)
+{
+    for (size_t i = 0; i < s_region_count; ++i) {
+        if (s_regions[i].contains(ptr))
+            return &s_regions[i];
+    }
+    return nullptr;
+}
+
+static void free_pages(void* ptr, size_t page_count, bool is_large_allocation)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto* region = region_containing(ptr);
+    ASSERT(region);
+    ASSERT(!(((u8*)ptr - region->base) % PAGE_SIZE));
+    size_t first_page = ((u8*)ptr - region->base) / PAGE_SIZE;
+    ASSERT(region->allocation_map[first_page] == (page_starts_allocation | (is_large_allocation ? page_starts_large_allocation : 0) | page_count));
+    auto bitmap = region->bitmap();
+    for (size_t i = first_page; i < first_page + page_count; ++i) {
+        ASSERT(bitmap.get(i));
+        bitmap.set(i, false);
+        region->allocation_map[i] = page_is_free;
+    }
+    region->free_page_count += page_count;
+    s_free_pages += page_count;
+    sum_free = s_free_pages * PAGE_SIZE;
+}
+
+void kfree_pages(void* ptr, size_t page_count)
+{
+    InterruptDisabler disabler;
+    free_pages(ptr, page_count, false);
+}
+
+// The index of the first page of the allocation that the given page belongs to, if any.
+static Optional<size_t> allocation_first_page(const HeapRegion& region, size_t page)
+{
+    u16 entry = region.allocation_map[page];
+    if (entry == page_is_free)
+        return {};
+    if (entry & page_starts_allocation)
+        return page;
+    return entry;
+}
+
+void* kmalloc_pages_base(const void* ptr)
+{
+    InterruptDisabler disabler;
+    auto* region = region_containing(ptr);
+    if (!region)
+        return nullptr;
+    auto first_page = allocation_first_page(*region, ((const u8*)ptr - region->base) / PAGE_SIZE);
+    if (!first_page.has_value() || (region->allocation_map[first_page.value()] & page_starts_large_allocation))
+        return nullptr;
+    return region->base + first_page.value() * PAGE_SIZE;
+}
+
+// If ptr is a large allocation from kmalloc(), its size in pages. Otherwise 0.
+static size_t large_allocation_page_count(const void* ptr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto* region = region_containing(ptr);
+    if (!region || ((const u8*)ptr - region->base) % PAGE_SIZE)
+        return 0;
+    u16 entry = region->allocation_map[((const u8*)ptr - region->base) / PAGE_SIZE];
+    if (entry == page_is_free || (entry & (page_starts_allocation | page_starts_large_allocation)) != (page_starts_allocation | page_starts_large_allocation))
+        return 0;
+    return entry & allocation_page_count_mask;
+}
+
+KmallocStatistics kmalloc_statistics()
+{
+    InterruptDisabler disabler;
+    KmallocStatistics statistics;
+    statistics.region_count = s_region_count;
+    statistics.total_pages = s_total_pages;
+    statistics.free_pages = s_free_pages;
+    statistics.expansion_count = s_expansion_count;
+    statistics.large_allocation_count = s_large_allocation_count;
+    statistics.large_allocation_pages = s_large_allocation_pages;
+    return statistics;
+}
+
 void* kmalloc_eternal(size_t size)
 {
     void* ptr = s_next_eternal_ptr;
@@ -120,66 +360,25 @@ void* kmalloc_impl(size_t size)
         dump_backtrace();
     }
 
-    // We need space for the allocation_t structure at the head of the block.
-    size_t real_size = size + sizeof(allocation_t);
-
-    if (sum_free < real_size) {
-        dump_backtrace();
-        kprintf("%s(%u) kmalloc(): PANIC! Out of memory (sucks, dude)\nsum_free=%u, real_size=%u\n", current->process().name().characters(), current->pid(), sum_free, real_size);
-        hang();
-    }
-
-    size_t chunks_needed = real_size / CHUNK_SIZE;
-    if (real_size % CHUNK_SIZE)
-        ++chunks_needed;
-
-    size_t chunks_here = 0;
-    size_t first_chunk = 0;
-
-    for (size_t i = 0; i < (POOL_SIZE / CHUNK_SIZE / 8); ++i) {
-        if (alloc_map[i] == 0xff) {
-            // Skip over completely full bucket.
-            chunks_here = 0;
-            continue;
-        }
-        // FIXME: This scan can be optimized further with LZCNT.
-        for (size_t j = 0; j < 8; ++j) {
-            if (!(alloc_map[i] & (1 << j))) {
-                if (chunks_here == 0) {
-                    // Mark where potential allocation starts.
-                    first_chunk = i * 8 + j;
-                }
-
-                ++chunks_here;
-
-                if (chunks_here == chunks_needed) {
-                    auto* a = (allocation_t*)(BASE_PHYSICAL + (first_chunk * CHUNK_SIZE));
-                    u8* ptr = (u8*)a;
-                    ptr += sizeof(allocation_t);
-                    a->nchunk = chunks_needed;
-                    a->start = first_chunk;
-
-                    for (size_t k = first_chunk; k < (first_chunk + chunks_needed); ++k) {
-                        alloc_map[k / 8] |= 1 << (k % 8);
-                    }
-
-                    sum_alloc += a->nchunk * CHUNK_SIZE;
-                    sum_free -= a->nchunk * CHUNK_SIZE;
+    if (size <= slab_max_size) {
+        void* ptr = slab_alloc(size);
+        sum_alloc += slab_size_class(size);
 #ifdef SANITIZE_KMALLOC
-                    memset(ptr, KMALLOC_SCRUB_BYTE, (a->nchunk * CHUNK_SIZE) - sizeof(allocation_t));
+        memset(ptr, KMALLOC_SCRUB_BYTE, size);
 #endif
-                    return ptr;
-                }
-            } else {
-                // This is in use, so restart chunks_here counter.
-                chunks_here = 0;
-            }
-        }
+        return ptr;
     }
 
-    kprintf("%s(%u) kmalloc(): PANIC! Out of memory (no suitable block for size %u)\n", current->process().name().characters(), current->pid(), size);
-    dump_backtrace();
-    hang();
+    // Large allocations are whole, page-aligned pages. Their size is kept in the allocation map.
+    size_t page_count = PAGE_ROUND_UP(size) / PAGE_SIZE;
+    void* ptr = allocate_pages(page_count, true);
+    ++s_large_allocation_count;
+    s_large_allocation_pages += page_count;
+    sum_alloc += page_count * PAGE_SIZE;
+#ifdef SANITIZE_KMALLOC
+    memset(ptr, KMALLOC_SCRUB_BYTE, page_count * PAGE_SIZE);
+#endif
+    return ptr;
 }
 
 void kfree(void* ptr)
@@ -190,17 +389,21 @@ void kfree(void* ptr)
     InterruptDisabler disabler;
     ++g_kfree_call_count;
 
-    auto* a = (allocation_t*)((((u8*)ptr) - sizeof(allocation_t)));
-
-    for (size_t k = a->start; k < (a->start + a->nchunk); ++k)
-        alloc_map[k / 8] &= ~(1 << (k % 8));
-
-    sum_alloc -= a->nchunk * CHUNK_SIZE;
-    sum_free += a->nchunk * CHUNK_SIZE;
-
+    if (size_t page_count = large_allocation_page_count(ptr)) {
+        sum_alloc -= page_count * PAGE_SIZE;
+        --s_large_allocation_count;
+        s_large_allocation_pages -= page_count;
 #ifdef SANITIZE_KMALLOC
-    memset(a, KFREE_SCRUB_BYTE, a->nchunk * CHUNK_SIZE);
+        memset(ptr, KFREE_SCRUB_BYTE, page_count * PAGE_SIZE);
 #endif
+        free_pages(ptr, page_count, true);
+        return;
+    }
+
+    size_t slab_size = slab_allocation_size(ptr);
+    ASSERT(slab_size);
+    sum_alloc -= slab_size;
+    slab_dealloc(ptr, slab_size);
 }
 
 void* krealloc(void* ptr, size_t new_size)
@@ -210,10 +413,12 @@ void* krealloc(void* ptr, size_t new_size)
 
     InterruptDisabler disabler;
 
-    auto* a = (allocation_t*)((((u8*)ptr) - sizeof(allocation_t)));
-    size_t old_size = a->nchunk * CHUNK_SIZE;
+    size_t old_size = large_allocation_page_count(ptr) * PAGE_SIZE;
+    if (!old_size)
+        old_size = slab_allocation_size(ptr);
+    ASSERT(old_size);
 
-    if (old_size == new_size)
+    if (new_size <= old_size && (old_size <= slab_max_size || new_size > slab_max_size))
         return ptr;
 
     auto* new_ptr = kmalloc(new_size);
@@ -34,6 +34,8 @@
 #define KFREE_SCRUB_BYTE 0xaa
 
 void kmalloc_init();
+void kmalloc_enable_expansion();
+void kmalloc_expand_if_needed();
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_impl(size_t);
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_eternal(size_t);
 [[gnu::malloc, gnu::returns_nonnull, gnu::alloc_size(1)]] void* kmalloc_page_aligned(size_t);
@@ -42,6 +44,22 @@ void* krealloc(void*, size_t);
 void kfree(void*);
 void kfree_aligned(void*);
 
+// Whole pages of kernel heap. These back the slab allocator as well as large allocations.
+void* kmalloc_pages(size_t page_count);
+void kfree_pages(void*, size_t page_count);
+// The first page of the kmalloc_pages() allocation that the given address falls into.
+void* kmalloc_pages_base(const void*);
+
+struct KmallocStatistics {
+    size_t region_count { 0 };
+    size_t total_pages { 0 };
+    size_t free_pages { 0 };
+    size_t expansion_count { 0 };
+    size_t large_allocation_count { 0 };
+    size_t large_allocation_pages { 0 };
+};
+KmallocStatistics kmalloc_statistics();
+
 extern volatile size_t sum_alloc;
 extern volatile size_t sum_free;
 extern volatile size_t kmalloc_sum_eternal;
@@ -34,7 +34,19 @@
 #    include <sys/time.h>
 #endif
 
+// The kernel updates the clock on every tick. Readers copy what they need, and retry if serial
+// was odd (an update was in progress) or changed while they were reading.
 struct KernelInfoPage {
     volatile u32 serial;
     volatile struct timeval now;
+
+    // Nanoseconds since boot as of the last update, and the time-stamp counter right after it.
+    volatile u64 monotonic_ns;
+    volatile u64 tsc_at_update;
+    volatile u32 boot_time; // Seconds since the epoch.
+
+    // Converts TSC ticks since tsc_at_update to nanoseconds: (ticks * tsc_multiplier) >> tsc_shift.
+    // tsc_multiplier is 0 if the TSC can't be used, in which case readers should ask the kernel.
+    volatile u32 tsc_multiplier;
+    volatile u32 tsc_shift;
 };
@@ -25,8 +25,12 @@
  */
 
 #include <Kernel/IO.h>
+#include <Kernel/KParams.h>
 #include <Kernel/Net/E1000NetworkAdapter.h>
+#include <Kernel/Net/EthernetFrameHeader.h>
+#include <Kernel/Net/TCP.h>
 #include <Kernel/Thread.h>
+#include <Kernel/VM/MemoryManager.h>
 
 //#define E1000_DEBUG
 
@@ -34,6 +38,7 @@
 #define REG_STATUS 0x0008
 #define REG_EEPROM 0x0014
 #define REG_CTRL_EXT 0x0018
+#define REG_ITR 0x00C4             // Interrupt Throttling Rate
 #define REG_IMASK 0x00D0
 #define REG_RCTRL 0x0100
 #define REG_RXDESCLO 0x2800
@@ -51,7 +56,10 @@
 #define REG_RXDCTL 0x3828           // RX Descriptor Control
 #define REG_RADV 0x282C             // RX Int. Absolute Delay Timer
 #define REG_RSRPD 0x2C00            // RX Small Packet Detect Interrupt
+#define REG_TIDV 0x3820             // TX Interrupt Delay Value
+#define REG_TADV 0x382C             // TX Int. Absolute Delay Timer
 #define REG_TIPG 0x0410             // Transmit Inter Packet Gap
+#define REG_RXCSUM 0x5000           // RX Checksum Control
 #define ECTRL_SLU 0x40              //set link up
 #define RCTL_EN (1 << 1)            // Receiver Enable
 #define RCTL_SBP (1 << 2)           // Store Bad Packets
@@ -75,6 +83,20 @@
 #define RCTL_PMCF (1 << 23)         // Pass MAC Control Frames
 #define RCTL_SECRC (1 << 26)        // Strip Ethernet CRC
 
+// RXCSUM Register
+
+#define RXCSUM_IPOFLD (1 << 8) // IP Checksum Off-load Enable
+#define RXCSUM_TUOFLD (1 << 9) // TCP/UDP Checksum Off-load Enable
+
+// RX Descriptor Status and Errors
+
+#define RSTA_DD (1 << 0)    // Descriptor Done
+#define RSTA_IXSM (1 << 2)  // Ignore Checksum Indication
+#define RSTA_TCPCS (1 << 5) // TCP Checksum Calculated
+#define RSTA_IPCS (1 << 6)  // IP Checksum Calculated
+#define RERR_TCPE (1 << 5)  // TCP/UDP Checksum Error
+#define RERR_IPE (1 << 6)   // IP Checksum Error
+
 // Buffer Sizes
 #define RCTL_BSIZE_256 (3 << 16)
 #define RCTL_BSIZE_512 (2 << 16)
@@ -94,6 +116,24 @@
 #define CMD_VLE (1 << 6)  // VLAN Packet Enable
 #define CMD_IDE (1 << 7)  // Interrupt Delay Enable
 
+// Extended Transmit Descriptors (context and data), as the top bits of their second dword
+
+#define DTYP_CONTEXT (0 << 20)
+#define DTYP_DATA (1 << 20)
+#define TUCMD_TCP (1 << 24)  // Packet Type is TCP
+#define TUCMD_IP (1 << 25)   // Packet Type is IPv4
+#define TUCMD_TSE (1 << 26)  // TCP Segmentation Enable
+#define TUCMD_RS (1 << 27)   // Report Status
+#define TUCMD_DEXT (1 << 29) // Descriptor Extension
+#define DCMD_EOP (1 << 24)   // End of Packet
+#define DCMD_IFCS (1 << 25)  // Insert FCS
+#define DCMD_TSE (1 << 26)   // TCP Segmentation Enable
+#define DCMD_RS (1 << 27)    // Report Status
+#define DCMD_DEXT (1 << 29)  // Descriptor Extension
+#define DCMD_IDE (1U << 31)  // Interrupt Delay Enable
+#define POPTS_IXSM (1 << 0)  // Insert IP Checksum
+#define POPTS_TXSM (1 << 1)  // Insert TCP/UDP Checksum
+
 // TCTL Register
 
 #define TCTL_EN (1 << 1)      // Transmit Enable
@@ -131,6 +171,20 @@ void E1000NetworkAdapter::detect(const PCI::Address& address)
     new E1000NetworkAdapter(address, irq);
 }
 
+static size_t descriptor_count_from_kernel_params(const String& key, size_t default_count, size_t minimum_count, size_t maximum_count)
+{
+    if (!KParams::the().has(key))
+        return default_count;
+    bool ok;
+    size_t count = KParams::the().get(key).to_uint(ok);
+    if (!ok) {
+        kprintf("E1000: Ignoring invalid %s\n", key.characters());
+        return default_count;
+    }
+    // The ring lengths have to be multiples of 128 bytes, i.e of 8 descriptors.
+    return clamp(count, minimum_count, maximum_count) & ~(size_t)7;
+}
+
 E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address pci_address, u8 irq)
     : IRQHandler(irq)
     , m_pci_address(pci_address)
@@ -160,8 +214,14 @@ E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address pci_address, u8 irq)
     u32 flags = in32(REG_CTRL);
     out32(REG_CTRL, flags | ECTRL_SLU);
 
+    m_rx_descriptor_count = descriptor_count_from_kernel_params("e1000_rx_descriptors", default_descriptor_count, minimum_descriptor_count, maximum_descriptor_count);
+    m_tx_descriptor_count = descriptor_count_from_kernel_params("e1000_tx_descriptors", default_descriptor_count, minimum_descriptor_count, maximum_descriptor_count);
+    kprintf("E1000: %u RX descriptors, %u TX descriptors\n", m_rx_descriptor_count, m_tx_descriptor_count);
+
     initialize_rx_descriptors();
     initialize_tx_descriptors();
+    initialize_interrupt_throttling();
+    set_offload_capabilities(IPv4ChecksumOffload | TCPChecksumOffload | TCPSegmentationOffload);
 
     out32(REG_IMASK, 0x1f6dc);
     out32(REG_IMASK, 0xff & ~4);
@@ -176,6 +236,7 @@ E1000NetworkAdapter::~E1000NetworkAdapter()
 
 void E1000NetworkAdapter::handle_irq()
 {
+    did_interrupt();
     out32(REG_IMASK, 0x1);
 
     u32 status = in32(0xc0);
@@ -249,48 +310,58 @@ bool E1000NetworkAdapter::link_up()
 
 void E1000NetworkAdapter::initialize_rx_descriptors()
 {
-    auto ptr = (uintptr_t)kmalloc_eternal(sizeof(e1000_rx_desc) * number_of_rx_descriptors + 16);
-    // Make sure it's 16-byte aligned.
-    if (ptr % 16)
-        ptr = (ptr + 16) - (ptr % 16);
-    m_rx_descriptors = (e1000_rx_desc*)ptr;
-    for (int i = 0; i < number_of_rx_descriptors; ++i) {
+    m_rx_descriptor_pages = MM.allocate_contiguous_supervisor_physical_pages(PAGE_ROUND_UP(sizeof(e1000_rx_desc) * m_rx_descriptor_count));
+    ASSERT(!m_rx_descriptor_pages.is_empty());
+    auto rx_descriptors_address = m_rx_descriptor_pages.first().paddr();
+    m_rx_descriptors = (e1000_rx_desc*)rx_descriptors_address.offset(0xc0000000).as_ptr();
+
+    // The card DMAs frames straight into packet buffers, which are then handed up the stack
+    // as they are. Each descriptor gets a fresh buffer from the pool once its frame is taken.
+    create_packet_buffer_pool(m_rx_descriptor_count + number_of_spare_packet_buffers, rx_buffer_size);
+    m_rx_buffers.ensure_capacity(m_rx_descriptor_count);
+    for (size_t i = 0; i < m_rx_descriptor_count; ++i) {
         auto& descriptor = m_rx_descriptors[i];
-        auto addr = (uintptr_t)kmalloc_eternal(8192 + 16);
-        if (addr % 16)
-            addr = (addr + 16) - (addr % 16);
-        descriptor.addr = addr - 0xc0000000;
+        auto buffer = take_packet_buffer();
+        ASSERT(buffer);
+        descriptor.addr = buffer->physical_address().get();
         descriptor.status = 0;
+        m_rx_buffers.append(move(buffer));
     }
 
-    out32(REG_RXDESCLO, (u32)ptr - 0xc0000000);
+    out32(REG_RXDESCLO, rx_descriptors_address.get());
     out32(REG_RXDESCHI, 0);
-    out32(REG_RXDESCLEN, number_of_rx_descriptors * sizeof(e1000_rx_desc));
+    out32(REG_RXDESCLEN, m_rx_descriptor_count * sizeof(e1000_rx_desc));
     out32(REG_RXDESCHEAD, 0);
-    out32(REG_RXDESCTAIL, number_of_rx_descriptors - 1);
+    out32(REG_RXDESCTAIL, m_rx_descriptor_count - 1);
 
-    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_8192);
+    // Have the card verify IPv4 and TCP/UDP checksums, so we can drop corrupt frames for free.
+    out32(REG_RXCSUM, in32(REG_RXCSUM) | RXCSUM_IPOFLD | RXCSUM_TUOFLD);
+    out32(REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_2048);
 }
 
 void E1000NetworkAdapter::initialize_tx_descriptors()
 {
-    auto ptr = (uintptr_t)kmalloc_eternal(sizeof(e1000_tx_desc) * number_of_tx_descriptors + 16);
-    // Make sure it's 16-byte aligned.
-    if (ptr % 16)
-        ptr = (ptr + 16) - (ptr % 16);
-    m_tx_descriptors = (e1000_tx_desc*)ptr;
-    for (int i = 0; i < number_of_tx_descriptors; ++i) {
+    m_tx_descriptor_pages = MM.allocate_contiguous_supervisor_physical_pages(PAGE_ROUND_UP(sizeof(e1000_tx_desc) * m_tx_descriptor_count));
+    ASSERT(!m_tx_descriptor_pages.is_empty());
+    auto tx_descriptors_address = m_tx_descriptor_pages.first().paddr();
+    m_tx_descriptors = (e1000_tx_desc*)tx_descriptors_address.offset(0xc0000000).as_ptr();
+
+    // Each descriptor keeps its own buffer for good, frames are copied into it when sent.
+    m_tx_buffer_pool = PacketBufferPool::create("E1000 TX Buffers", m_tx_descriptor_count, tx_buffer_size);
+    ASSERT(m_tx_buffer_pool);
+    m_tx_buffers.ensure_capacity(m_tx_descriptor_count);
+    for (size_t i = 0; i < m_tx_descriptor_count; ++i) {
         auto& descriptor = m_tx_descriptors[i];
-        auto addr = (uintptr_t)kmalloc_eternal(8192 + 16);
-        if (addr % 16)
-            addr = (addr + 16) - (addr % 16);
-        descriptor.addr = addr - 0xc0000000;
+        auto buffer = m_tx_buffer_pool->take();
+        ASSERT(buffer);
+        descriptor.addr = buffer->physical_address().get();
         descriptor.cmd = 0;
+        m_tx_buffers.append(move(buffer));
     }
 
-    out32(REG_TXDESCLO, (u32)ptr - 0xc0000000);
+    out32(REG_TXDESCLO, tx_descriptors_address.get());
     out32(REG_TXDESCHI, 0);
-    out32(REG_TXDESCLEN, number_of_tx_descriptors * sizeof(e1000_tx_desc));
+    out32(REG_TXDESCLEN, m_tx_descriptor_count * sizeof(e1000_tx_desc));
     out32(REG_TXDESCHEAD, 0);
     out32(REG_TXDESCTAIL, 0);
 
@@ -298,6 +369,17 @@ void E1000NetworkAdapter::initialize_tx_descriptors()
     out32(REG_TIPG, 0x0060200A);
 }
 
+void E1000NetworkAdapter::initialize_interrupt_throttling()
+{
+    // Let frames accumulate for a little while before interrupting, and never interrupt more
+    // often than the throttling interval allows. Each interrupt then handles a batch of frames.
+    out32(REG_ITR, interrupt_throttling_interval);
+    out32(REG_RDTR, rx_interrupt_delay);
+    out32(REG_RADV, rx_interrupt_absolute_delay);
+    out32(REG_TIDV, tx_interrupt_delay);
+    out32(REG_TADV, tx_interrupt_absolute_delay);
+}
+
 void E1000NetworkAdapter::out8(u16 address, u8 data)
 {
 #ifdef E1000_DEBUG
@@ -367,56 +449,171 @@ u32 E1000NetworkAdapter::in32(u16 address)
     return IO::in32(m_io_base + address);
 }
 
-void E1000NetworkAdapter::send_raw(const u8* data, size_t length)
+void E1000NetworkAdapter::reclaim_tx_descriptors()
 {
-    disable_irq();
-    u32 tx_current = in32(REG_TXDESCTAIL);
+    ASSERT_INTERRUPTS_DISABLED();
+    while (m_tx_descriptors_in_use && (m_tx_descriptors[m_tx_clean].status & TSTA_DD)) {
+        m_tx_clean = (m_tx_clean + 1) % m_tx_descriptor_count;
+        --m_tx_descriptors_in_use;
+    }
+}
+
+void E1000NetworkAdapter::flush_transmit_batch()
+{
+    InterruptDisabler disabler;
+    if (m_tx_tail == m_tx_next)
+        return;
 #ifdef E1000_DEBUG
-    kprintf("E1000: Sending packet (%zu bytes)\n", length);
+    kprintf("E1000: Moving tx tail from %u to %u (head is at %u)\n", m_tx_tail, m_tx_next, in32(REG_TXDESCHEAD));
 #endif
-    auto& descriptor = m_tx_descriptors[tx_current];
-    ASSERT(length <= 8192);
-    auto *vptr = (void*)(descriptor.addr + 0xc0000000);
-    memcpy(vptr, data, length);
-    descriptor.length = length;
-    descriptor.status = 0;
-    descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS;
+    m_tx_tail = m_tx_next;
+    out32(REG_TXDESCTAIL, m_tx_tail);
+}
+
+size_t E1000NetworkAdapter::take_tx_descriptor()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(m_tx_descriptors_in_use < m_tx_descriptor_count - 1);
+    size_t index = m_tx_next;
+    m_tx_descriptors[index].status = 0;
+    m_tx_next = (m_tx_next + 1) % m_tx_descriptor_count;
+    ++m_tx_descriptors_in_use;
+    return index;
+}
+
+void E1000NetworkAdapter::write_tx_context(const u8* frame, size_t length, const TransmitOffload& offload)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto& ipv4 = *(const IPv4Packet*)(frame + sizeof(EthernetFrameHeader));
+    u8 ip_header_size = ipv4.internet_header_length() * sizeof(u32);
+
+    if (offload.tcp_segment_size) {
+        // Every TSO frame needs a context of its own, since it describes the frame's payload size.
+        m_tx_checksum_context = {};
+    } else {
+        ChecksumContext context { offload.ipv4_checksum, offload.tcp_checksum, ip_header_size };
+        if (m_tx_checksum_context.has_value() && m_tx_checksum_context.value() == context)
+            return;
+        m_tx_checksum_context = context;
+    }
+
+    size_t ip_header_offset = sizeof(EthernetFrameHeader);
+    size_t tcp_header_offset = ip_header_offset + ip_header_size;
+    auto& descriptor = *(e1000_tx_context_desc*)&m_tx_descriptors[take_tx_descriptor()];
+    descriptor.ipcss = ip_header_offset;
+    descriptor.ipcso = ip_header_offset + 10;
+    descriptor.ipcse = tcp_header_offset - 1;
+    descriptor.tucss = tcp_header_offset;
+    descriptor.tucso = tcp_header_offset + 16;
+    descriptor.tucse = 0;
+
+    u32 tucmd = TUCMD_DEXT | TUCMD_RS | TUCMD_IP | (offload.tcp_checksum ? TUCMD_TCP : 0);
+    u32 payload_size = 0;
+    if (offload.tcp_segment_size) {
+        auto& tcp_packet = *(const TCPPacket*)(frame + tcp_header_offset);
+        size_t header_size = tcp_header_offset + tcp_packet.header_size();
+        ASSERT(length > header_size);
+        payload_size = length - header_size;
+        tucmd |= TUCMD_TSE;
+        descriptor.hdrlen = header_size;
+        descriptor.mss = offload.tcp_segment_size;
+    } else {
+        descriptor.hdrlen = 0;
+        descriptor.mss = 0;
+    }
+    descriptor.paylen_dtyp_tucmd = payload_size | DTYP_CONTEXT | tucmd;
+}
+
+void E1000NetworkAdapter::send_raw(const u8* data, size_t length, const TransmitOffload& offload)
+{
 #ifdef E1000_DEBUG
-    kprintf("E1000: Using tx descriptor %d (head is at %d)\n", tx_current, in32(REG_TXDESCHEAD));
+    kprintf("E1000: Sending packet (%zu bytes)\n", length);
 #endif
-    tx_current = (tx_current + 1) % number_of_tx_descriptors;
-    out32(REG_TXDESCTAIL, tx_current);
-    cli();
-    enable_irq();
+    bool is_tso = offload.tcp_segment_size;
+    bool wants_offload = is_tso || offload.ipv4_checksum || offload.tcp_checksum;
+    ASSERT(length <= (is_tso ? maximum_tso_frame_size : tx_buffer_size));
+
+    // A frame larger than one TX buffer spans several data descriptors, and offloads need a context
+    // descriptor up front.
+    size_t descriptors_needed = (length + tx_buffer_size - 1) / tx_buffer_size + (wants_offload ? 1 : 0);
+
+    InterruptDisabler disabler;
     for (;;) {
-        if (descriptor.status) {
-            sti();
+        reclaim_tx_descriptors();
+        // The card takes tail == head to mean an empty ring, so one descriptor always stays unused.
+        if (m_tx_descriptors_in_use + descriptors_needed < m_tx_descriptor_count)
             break;
-        }
+        // The ring is full: let go of anything we're holding back, and wait for the card to catch up.
+        flush_transmit_batch();
         current->wait_on(m_wait_queue);
     }
-#ifdef E1000_DEBUG
-    kprintf("E1000: Sent packet, status is now %b!\n", descriptor.status);
-#endif
+
+    if (!wants_offload) {
+        size_t index = take_tx_descriptor();
+        auto& descriptor = m_tx_descriptors[index];
+        memcpy(m_tx_buffers[index]->data(), data, length);
+        // The slot may last have held a context or data descriptor, so rewrite all of it.
+        descriptor.addr = m_tx_buffers[index]->physical_address().get();
+        descriptor.length = length;
+        descriptor.cso = 0;
+        descriptor.css = 0;
+        descriptor.special = 0;
+        descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_IDE;
+    } else {
+        write_tx_context(data, length, offload);
+        u8 popts = (offload.ipv4_checksum || is_tso ? POPTS_IXSM : 0) | (offload.tcp_checksum || is_tso ? POPTS_TXSM : 0);
+        for (size_t offset = 0; offset < length;) {
+            size_t chunk_size = min(length - offset, tx_buffer_size);
+            size_t index = take_tx_descriptor();
+            auto& descriptor = *(e1000_tx_data_desc*)&m_tx_descriptors[index];
+            memcpy(m_tx_buffers[index]->data(), data + offset, chunk_size);
+            offset += chunk_size;
+            u32 dcmd = DCMD_DEXT | DCMD_IFCS | DCMD_RS | DCMD_IDE | (is_tso ? DCMD_TSE : 0) | (offset == length ? DCMD_EOP : 0);
+            descriptor.addr = m_tx_buffers[index]->physical_address().get();
+            descriptor.popts = popts;
+            descriptor.special = 0;
+            descriptor.dtalen_dtyp_dcmd = chunk_size | DTYP_DATA | dcmd;
+        }
+    }
+
+    // Outside of a batch, the frame goes out right away. Either way, we don't wait for it to be sent.
+    if (!is_batching_transmits())
+        flush_transmit_batch();
 }
 
 void E1000NetworkAdapter::receive()
 {
-    u32 rx_current;
+    // Take every frame the card has filled in, then hand the descriptors back with a single tail update.
+    u32 rx_tail = in32(REG_RXDESCTAIL);
+    bool did_receive_any = false;
     for (;;) {
-        rx_current = in32(REG_RXDESCTAIL);
-        if (rx_current == in32(REG_RXDESCHEAD))
-            return;
-        rx_current = (rx_current + 1) % number_of_rx_descriptors;
-        if (!(m_rx_descriptors[rx_current].status & 1))
+        u32 rx_current = (rx_tail + 1) % m_rx_descriptor_count;
+        auto& descriptor = m_rx_descriptors[rx_current];
+        if (!(descriptor.status & 1))
             break;
-        auto* buffer = (u8*)(m_rx_descriptors[rx_current].addr + 0xc0000000);
-        u16 length = m_rx_descriptors[rx_current].length;
+        u16 length = descriptor.length;
 #ifdef E1000_DEBUG
-        kprintf("E1000: Received 1 packet @ %p (%zu) bytes!\n", buffer, length);
+        kprintf("E1000: Received 1 packet @ %p (%zu) bytes!\n", m_rx_buffers[rx_current]->data(), length);
 #endif
-        did_receive(buffer, length);
-        m_rx_descriptors[rx_current].status = 0;
-        out32(REG_RXDESCTAIL, rx_current);
+        bool has_bad_checksum = !(descriptor.status & RSTA_IXSM)
+            && (((descriptor.status & RSTA_IPCS) && (descriptor.errors & RERR_IPE)) || ((descriptor.status & RSTA_TCPCS) && (descriptor.errors & RERR_TCPE)));
+        if (has_bad_checksum) {
+            // The card has already checked this frame for us, and it's corrupt. Give the buffer right back.
+            did_drop_bad_checksum();
+        } else if (auto replacement = take_packet_buffer()) {
+            auto packet = m_rx_buffers[rx_current].release_nonnull();
+            packet->set_size(length);
+            descriptor.addr = replacement->physical_address().get();
+            m_rx_buffers[rx_current] = move(replacement);
+            did_receive(move(packet));
+        } else {
+            // Every packet buffer is in use, so copy the frame out and let the card reuse this one.
+            did_receive(m_rx_buffers[rx_current]->data(), length);
+        }
+        descriptor.status = 0;
+        rx_tail = rx_current;
+        did_receive_any = true;
     }
+    if (did_receive_any)
+        out32(REG_RXDESCTAIL, rx_tail);
 }
@@ -26,10 +26,14 @@
 
 #pragma once
 
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/Optional.h>
 #include <AK/OwnPtr.h>
+#include <AK/Vector.h>
 #include <Kernel/IRQHandler.h>
 #include <Kernel/Net/NetworkAdapter.h>
 #include <Kernel/PCI/Access.h>
+#include <Kernel/VM/PhysicalPage.h>
 
 class E1000NetworkAdapter final : public NetworkAdapter
     , public IRQHandler {
@@ -39,11 +43,15 @@ public:
     E1000NetworkAdapter(PCI::Address, u8 irq);
     virtual ~E1000NetworkAdapter() override;
 
-    virtual void send_raw(const u8*, size_t) override;
+    virtual void send_raw(const u8*, size_t, const TransmitOffload&) override;
     virtual bool link_up() override;
 
+    virtual size_t rx_ring_size() const override { return m_rx_descriptor_count; }
+    virtual size_t tx_ring_size() const override { return m_tx_descriptor_count; }
+
 private:
     virtual void handle_irq() override;
+    virtual void flush_transmit_batch() override;
     virtual const char* class_name() const override { return "E1000NetworkAdapter"; }
 
     struct [[gnu::packed]] e1000_rx_desc
@@ -67,6 +75,42 @@ private:
         volatile uint16_t special { 0 };
     };
 
+    // Describes the checksum and segmentation work for the data descriptors that follow it.
+    struct [[gnu::packed]] e1000_tx_context_desc
+    {
+        volatile uint8_t ipcss { 0 };
+        volatile uint8_t ipcso { 0 };
+        volatile uint16_t ipcse { 0 };
+        volatile uint8_t tucss { 0 };
+        volatile uint8_t tucso { 0 };
+        volatile uint16_t tucse { 0 };
+        volatile uint32_t paylen_dtyp_tucmd { 0 };
+        volatile uint8_t status { 0 };
+        volatile uint8_t hdrlen { 0 };
+        volatile uint16_t mss { 0 };
+    };
+
+    struct [[gnu::packed]] e1000_tx_data_desc
+    {
+        volatile uint64_t addr { 0 };
+        volatile uint32_t dtalen_dtyp_dcmd { 0 };
+        volatile uint8_t status { 0 };
+        volatile uint8_t popts { 0 };
+        volatile uint16_t special { 0 };
+    };
+
+    // What the last context descriptor set up for plain checksum offload, so it can be reused.
+    struct ChecksumContext {
+        bool ipv4_checksum { false };
+        bool tcp_checksum { false };
+        u8 ip_header_size { 0 };
+
+        bool operator==(const ChecksumContext& other) const
+        {
+            return ipv4_checksum == other.ipv4_checksum && tcp_checksum == other.tcp_checksum && ip_header_size == other.ip_header_size;
+        }
+    };
+
     void detect_eeprom();
     u32 read_eeprom(u8 address);
     void read_mac_address();
@@ -76,6 +120,7 @@ private:
 
     void initialize_rx_descriptors();
     void initialize_tx_descriptors();
+    void initialize_interrupt_throttling();
 
     void out8(u16 address, u8);
     void out16(u16 address, u16);
@@ -85,6 +130,9 @@ private:
     u32 in32(u16 address);
 
     void receive();
+    void reclaim_tx_descriptors();
+    size_t take_tx_descriptor();
+    void write_tx_context(const u8* frame, size_t length, const TransmitOffload&);
 
     PCI::Address m_pci_address;
     u16 m_io_base { 0 };
@@ -94,11 +142,43 @@ private:
     bool m_has_eeprom { false };
     bool m_use_mmio { false };
 
-    static const int number_of_rx_descriptors = 32;
-    static const int number_of_tx_descriptors = 8;
-
-    e1000_rx_desc* m_rx_descriptors;
-    e1000_tx_desc* m_tx_descriptors;
+    // Ring sizes can be set with the e1000_rx_descriptors= and e1000_tx_descriptors= kernel parameters.
+    static const size_t default_descriptor_count = 256;
+    static const size_t minimum_descriptor_count = 256;
+    static const size_t maximum_descriptor_count = 4096;
+    // Received frames that may be held up the stack, on top of the buffers sitting in the RX ring.
+    static const size_t number_of_spare_packet_buffers = 256;
+    static const size_t rx_buffer_size = 2048;
+    static const size_t tx_buffer_size = 2048;
+    // A TSO frame has an IPv4 packet of up to 64 KB behind its Ethernet header, spread over several TX buffers.
+    static const size_t maximum_tso_frame_size = 14 + 0xffff;
+
+    // Interrupt moderation: the throttling interval is in 256 ns units (about 8000 interrupts/s),
+    // the RX and TX delay timers in 1.024 us units.
+    static const u32 interrupt_throttling_interval = 488;
+    static const u32 rx_interrupt_delay = 16;
+    static const u32 rx_interrupt_absolute_delay = 64;
+    static const u32 tx_interrupt_delay = 32;
+    static const u32 tx_interrupt_absolute_delay = 128;
+
+    size_t m_rx_descriptor_count { default_descriptor_count };
+    size_t m_tx_descriptor_count { default_descriptor_count };
+
+    NonnullRefPtrVector<PhysicalPage> m_rx_descriptor_pages;
+    e1000_rx_desc* m_rx_descriptors { nullptr };
+    Vector<RefPtr<PacketBuffer>> m_rx_buffers;
+
+    NonnullRefPtrVector<PhysicalPage> m_tx_descriptor_pages;
+    e1000_tx_desc* m_tx_descriptors { nullptr };
+    OwnPtr<PacketBufferPool> m_tx_buffer_pool;
+    Vector<RefPtr<PacketBuffer>> m_tx_buffers;
+    // The next descriptor to fill, the oldest one the card may still be sending from,
+    // and the tail last handed to the card (frames in between are held back by a batch.)
+    size_t m_tx_next { 0 };
+    size_t m_tx_clean { 0 };
+    size_t m_tx_tail { 0 };
+    size_t m_tx_descriptors_in_use { 0 };
+    Optional<ChecksumContext> m_tx_checksum_context;
 
     WaitQueue m_wait_queue;
 };
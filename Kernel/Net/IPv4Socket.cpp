@@ -64,14 +64,12 @@ KResultOr<NonnullRefPtr<Socket>> IPv4Socket::create(int type, int protocol)
 
 IPv4Socket::IPv4Socket(int type, int protocol)
     : Socket(AF_INET, type, protocol)
+    , m_receive_buffer_capacity(128 * KB)
 {
 #ifdef IPV4_SOCKET_DEBUG
     kprintf("%s(%u) IPv4Socket{%p} created with type=%u, protocol=%d\n", current->process().name().characters(), current->pid(), this, type, protocol);
 #endif
     m_buffer_mode = type == SOCK_STREAM ? BufferMode::Bytes : BufferMode::Packets;
-    if (m_buffer_mode == BufferMode::Bytes) {
-        m_scratch_buffer = KBuffer::create_with_size(65536);
-    }
     LOCKER(all_sockets().lock());
     all_sockets().resource().set(this);
 }
@@ -203,7 +201,7 @@ int IPv4Socket::allocate_local_port_if_needed()
     return port;
 }
 
-ssize_t IPv4Socket::sendto(FileDescription&, const void* data, size_t data_length, int flags, const sockaddr* addr, socklen_t addr_length)
+ssize_t IPv4Socket::sendto(FileDescription& description, const void* data, size_t data_length, int flags, const sockaddr* addr, socklen_t addr_length)
 {
     (void)flags;
     if (addr && addr_length != sizeof(sockaddr_in))
@@ -240,6 +238,16 @@ ssize_t IPv4Socket::sendto(FileDescription&, const void* data, size_t data_lengt
         return data_length;
     }
 
+    if (buffer_mode() == BufferMode::Bytes) {
+        // Wait for the protocol to have room for more outgoing data.
+        while (is_connected() && !can_write(description)) {
+            if (!description.is_blocking())
+                return -EAGAIN;
+            if (current->block<Thread::WriteBlocker>(description) != Thread::BlockResult::WokeNormally)
+                return -EINTR;
+        }
+    }
+
     int nsent = protocol_send(data, data_length);
     if (nsent > 0)
         current->did_ipv4_socket_write(nsent);
@@ -256,7 +264,7 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
 #endif
 
     if (buffer_mode() == BufferMode::Bytes) {
-        if (m_receive_buffer.is_empty()) {
+        if (m_receive_queue.is_empty()) {
             if (protocol_is_disconnected()) {
                 return 0;
             }
@@ -276,12 +284,11 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
             }
         }
 
-        ASSERT(!m_receive_buffer.is_empty());
-        int nreceived = m_receive_buffer.read((u8*)buffer, buffer_length);
-        if (nreceived > 0)
+        int nreceived = read_stream_data((u8*)buffer, buffer_length);
+        if (nreceived > 0) {
             current->did_ipv4_socket_read((size_t)nreceived);
-
-        m_can_read = !m_receive_buffer.is_empty();
+            protocol_did_read();
+        }
         return nreceived;
     }
 
@@ -301,11 +308,11 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
             packet = m_receive_queue.take_first();
             m_can_read = !m_receive_queue.is_empty();
 #ifdef IPV4_SOCKET_DEBUG
-            kprintf("IPv4Socket(%p): recvfrom without blocking %d bytes, packets in queue: %zu\n", this, packet.data.value().size(), m_receive_queue.size_slow());
+            kprintf("IPv4Socket(%p): recvfrom without blocking %d bytes, packets in queue: %zu\n", this, packet.ipv4_packet->payload_size(), m_receive_queue.size_slow());
 #endif
         }
     }
-    if (!packet.data.has_value()) {
+    if (!packet.buffer) {
         if (protocol_is_disconnected()) {
             kprintf("IPv4Socket{%p} is protocol-disconnected, returning 0 in recvfrom!\n", this);
             return 0;
@@ -326,11 +333,11 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
         packet = m_receive_queue.take_first();
         m_can_read = !m_receive_queue.is_empty();
 #ifdef IPV4_SOCKET_DEBUG
-        kprintf("IPv4Socket(%p): recvfrom with blocking %d bytes, packets in queue: %zu\n", this, packet.data.value().size(), m_receive_queue.size_slow());
+        kprintf("IPv4Socket(%p): recvfrom with blocking %d bytes, packets in queue: %zu\n", this, packet.ipv4_packet->payload_size(), m_receive_queue.size_slow());
 #endif
     }
-    ASSERT(packet.data.has_value());
-    auto& ipv4_packet = *(const IPv4Packet*)(packet.data.value().data());
+    ASSERT(packet.buffer);
+    auto& ipv4_packet = *packet.ipv4_packet;
 
     if (addr) {
 #ifdef IPV4_SOCKET_DEBUG
@@ -347,40 +354,68 @@ ssize_t IPv4Socket::recvfrom(FileDescription& description, void* buffer, size_t
     if (type() == SOCK_RAW) {
         ASSERT(buffer_length >= ipv4_packet.payload_size());
         memcpy(buffer, ipv4_packet.payload(), ipv4_packet.payload_size());
+        m_bytes_copied_to_user += ipv4_packet.payload_size();
         return ipv4_packet.payload_size();
     }
 
-    int nreceived = protocol_receive(packet.data.value(), buffer, buffer_length, flags);
-    if (nreceived > 0)
+    int nreceived = protocol_receive(ipv4_packet, buffer, buffer_length, flags);
+    if (nreceived > 0) {
+        m_bytes_copied_to_user += nreceived;
         current->did_ipv4_socket_read(nreceived);
+    }
     return nreceived;
 }
 
-bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, KBuffer&& packet)
+int IPv4Socket::read_stream_data(u8* buffer, size_t buffer_length)
 {
     LOCKER(lock());
-    auto packet_size = packet.size();
+    ASSERT(!m_receive_queue.is_empty());
+    size_t nread = 0;
+    while (nread < buffer_length && !m_receive_queue.is_empty()) {
+        auto& packet = m_receive_queue.first();
+        size_t chunk_size = min(buffer_length - nread, packet.stream_data_size);
+        memcpy(buffer + nread, packet.stream_data, chunk_size);
+        nread += chunk_size;
+        packet.stream_data += chunk_size;
+        packet.stream_data_size -= chunk_size;
+        if (!packet.stream_data_size)
+            m_receive_queue.take_first();
+    }
+    m_receive_buffer_size -= nread;
+    m_bytes_copied_to_user += nread;
+    m_can_read = !m_receive_queue.is_empty();
+    return nread;
+}
+
+bool IPv4Socket::did_receive(const IPv4Address& source_address, u16 source_port, PacketBuffer& packet_buffer, const IPv4Packet& ipv4_packet)
+{
+    LOCKER(lock());
+    auto packet_size = sizeof(IPv4Packet) + ipv4_packet.payload_size();
 
     if (buffer_mode() == BufferMode::Bytes) {
-        size_t space_in_receive_buffer = m_receive_buffer.space_for_writing();
-        if (packet_size > space_in_receive_buffer) {
+        size_t data_size = 0;
+        auto* data = protocol_stream_data(ipv4_packet, data_size);
+        if (data_size > receive_buffer_space()) {
             kprintf("IPv4Socket(%p): did_receive refusing packet since buffer is full.\n", this);
             ASSERT(m_can_read);
             return false;
         }
-        int nreceived = protocol_receive(packet, m_scratch_buffer.value().data(), m_scratch_buffer.value().size(), 0);
-        m_receive_buffer.write(m_scratch_buffer.value().data(), nreceived);
-        m_can_read = !m_receive_buffer.is_empty();
+        if (data_size) {
+            m_receive_queue.append({ source_address, source_port, packet_buffer, &ipv4_packet, data, data_size });
+            m_receive_buffer_size += data_size;
+        }
+        m_can_read = !m_receive_queue.is_empty();
     } else {
         // FIXME: Maybe track the number of packets so we don't have to walk the entire packet queue to count them..
         if (m_receive_queue.size_slow() > 2000) {
             kprintf("IPv4Socket(%p): did_receive refusing packet since queue is full.\n", this);
             return false;
         }
-        m_receive_queue.append({ source_address, source_port, move(packet) });
+        m_receive_queue.append({ source_address, source_port, packet_buffer, &ipv4_packet });
         m_can_read = true;
     }
     m_bytes_received += packet_size;
+    notify_blockers();
 #ifdef IPV4_SOCKET_DEBUG
     if (buffer_mode() == BufferMode::Bytes)
         kprintf("IPv4Socket(%p): did_receive %d bytes, total_received=%u\n", this, packet_size, m_bytes_received);
@@ -28,11 +28,10 @@
 
 #include <AK/HashMap.h>
 #include <AK/SinglyLinkedList.h>
-#include <Kernel/DoubleBuffer.h>
-#include <Kernel/KBuffer.h>
 #include <Kernel/Lock.h>
 #include <Kernel/Net/IPv4.h>
 #include <Kernel/Net/IPv4SocketTuple.h>
+#include <Kernel/Net/PacketBuffer.h>
 #include <Kernel/Net/Socket.h>
 
 class NetworkAdapter;
@@ -62,7 +61,8 @@ public:
 
     virtual int ioctl(FileDescription&, unsigned request, unsigned arg) override;
 
-    bool did_receive(const IPv4Address& peer_address, u16 peer_port, KBuffer&&);
+    // The socket keeps a reference to the packet buffer rather than copying the packet out of it.
+    bool did_receive(const IPv4Address& peer_address, u16 peer_port, PacketBuffer&, const IPv4Packet&);
 
     const IPv4Address& local_address() const { return m_local_address; }
     u16 local_port() const { return m_local_port; }
@@ -79,6 +79,8 @@ public:
 
     u8 ttl() const { return m_ttl; }
 
+    u32 bytes_copied_to_user() const { return m_bytes_copied_to_user; }
+
     enum class BufferMode {
         Packets,
         Bytes,
@@ -93,11 +95,21 @@ protected:
 
     virtual KResult protocol_bind() { return KSuccess; }
     virtual KResult protocol_listen() { return KSuccess; }
-    virtual int protocol_receive(const KBuffer&, void*, size_t, int) { return -ENOTIMPL; }
+    virtual int protocol_receive(const IPv4Packet&, void*, size_t, int) { return -ENOTIMPL; }
+    // Byte stream protocols point out the part of an incoming packet that belongs in the stream.
+    virtual const u8* protocol_stream_data(const IPv4Packet&, size_t& data_size) const
+    {
+        data_size = 0;
+        return nullptr;
+    }
     virtual int protocol_send(const void*, size_t) { return -ENOTIMPL; }
     virtual KResult protocol_connect(FileDescription&, ShouldBlock) { return KSuccess; }
     virtual int protocol_allocate_local_port() { return 0; }
     virtual bool protocol_is_disconnected() const { return false; }
+    virtual void protocol_did_read() {}
+
+    size_t receive_buffer_space() const { return m_receive_buffer_capacity - m_receive_buffer_size; }
+    size_t receive_buffer_capacity() const { return m_receive_buffer_capacity; }
 
     void set_local_address(IPv4Address address) { m_local_address = address; }
     void set_peer_address(IPv4Address address) { m_peer_address = address; }
@@ -111,23 +123,30 @@ private:
     struct ReceivedPacket {
         IPv4Address peer_address;
         u16 peer_port;
-        Optional<KBuffer> data;
+        RefPtr<PacketBuffer> buffer;
+        const IPv4Packet* ipv4_packet { nullptr };
+        // Byte stream sockets read the stream data in place, possibly over several reads.
+        const u8* stream_data { nullptr };
+        size_t stream_data_size { 0 };
     };
 
+    int read_stream_data(u8* buffer, size_t buffer_length);
+
     SinglyLinkedList<ReceivedPacket> m_receive_queue;
 
-    DoubleBuffer m_receive_buffer;
+    // Byte stream sockets only: how much stream data is queued, and how much we're willing to queue.
+    size_t m_receive_buffer_size { 0 };
+    size_t m_receive_buffer_capacity { 0 };
 
     u16 m_local_port { 0 };
     u16 m_peer_port { 0 };
 
     u32 m_bytes_received { 0 };
+    u32 m_bytes_copied_to_user { 0 };
 
     u8 m_ttl { 64 };
 
     bool m_can_read { false };
 
     BufferMode m_buffer_mode { BufferMode::Packets };
-
-    Optional<KBuffer> m_scratch_buffer;
 };
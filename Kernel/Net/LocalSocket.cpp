@@ -226,6 +226,8 @@ void LocalSocket::detach(FileDescription& description)
         ASSERT(m_accept_side_fd_open);
         m_accept_side_fd_open = false;
     }
+    // The other side sees EOF (or EPIPE) now.
+    notify_blockers();
 }
 
 bool LocalSocket::can_read(const FileDescription& description) const
@@ -265,8 +267,10 @@ ssize_t LocalSocket::sendto(FileDescription& description, const void* data, size
     if (!has_attached_peer(description))
         return -EPIPE;
     ssize_t nwritten = send_buffer_for(description).write((const u8*)data, data_size);
-    if (nwritten > 0)
+    if (nwritten > 0) {
         current->did_unix_socket_write(nwritten);
+        notify_blockers();
+    }
     return nwritten;
 }
 
@@ -308,8 +312,10 @@ ssize_t LocalSocket::recvfrom(FileDescription& description, void* buffer, size_t
         return 0;
     ASSERT(!buffer_for_me.is_empty());
     int nread = buffer_for_me.read((u8*)buffer, buffer_size);
-    if (nread > 0)
+    if (nread > 0) {
         current->did_unix_socket_read(nread);
+        notify_blockers();
+    }
     return nread;
 }
 
@@ -38,13 +38,17 @@ LoopbackAdapter::LoopbackAdapter()
 {
     set_interface_name("loop");
     set_mtu(65536);
+    // Frames never leave the machine, so there's nothing for checksums to protect against.
+    set_offload_capabilities(IPv4ChecksumOffload | TCPChecksumOffload);
+    // Big enough for a full-sized TCP segment; anything larger gets a standalone buffer.
+    create_packet_buffer_pool(16, 64 * KB);
 }
 
 LoopbackAdapter::~LoopbackAdapter()
 {
 }
 
-void LoopbackAdapter::send_raw(const u8* data, size_t size)
+void LoopbackAdapter::send_raw(const u8* data, size_t size, const TransmitOffload&)
 {
     dbgprintf("LoopbackAdapter: Sending %d byte(s) to myself.\n", size);
     did_receive(data, size);
@@ -35,7 +35,7 @@ public:
 
     virtual ~LoopbackAdapter() override;
 
-    virtual void send_raw(const u8*, size_t) override;
+    virtual void send_raw(const u8*, size_t, const TransmitOffload&) override;
     virtual const char* class_name() const override { return "LoopbackAdapter"; }
 
 private:
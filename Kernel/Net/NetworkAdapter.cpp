@@ -94,13 +94,18 @@ void NetworkAdapter::send(const MACAddress& destination, const ARPPacket& packet
     m_packets_out++;
     m_bytes_out += size_in_bytes;
     memcpy(eth->payload(), &packet, sizeof(ARPPacket));
-    send_raw((const u8*)eth, size_in_bytes);
+    send_raw((const u8*)eth, size_in_bytes, {});
 }
 
-void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const u8* payload, size_t payload_size, u8 ttl)
+void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, const u8* payload, size_t payload_size, u8 ttl, TransmitOffload offload)
 {
     size_t ipv4_packet_size = sizeof(IPv4Packet) + payload_size;
-    if (ipv4_packet_size > mtu()) {
+    if (offload.tcp_segment_size) {
+        // The device cuts this up into packets that fit the MTU.
+        ASSERT(has_offload(TCPSegmentationOffload));
+        ASSERT(protocol == IPv4Protocol::TCP);
+        ASSERT(ipv4_packet_size <= 0xffff);
+    } else if (ipv4_packet_size > mtu()) {
         // FIXME: Implement IP fragmentation.
         ASSERT_NOT_REACHED();
     }
@@ -120,54 +125,87 @@ void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Addr
     ipv4.set_length(sizeof(IPv4Packet) + payload_size);
     ipv4.set_ident(1);
     ipv4.set_ttl(ttl);
-    ipv4.set_checksum(ipv4.compute_checksum());
+    if (has_offload(IPv4ChecksumOffload))
+        offload.ipv4_checksum = true;
+    else
+        ipv4.set_checksum(ipv4.compute_checksum());
     m_packets_out++;
     m_bytes_out += ethernet_frame_size;
     memcpy(ipv4.payload(), payload, payload_size);
-    send_raw((const u8*)&eth, ethernet_frame_size);
+    send_raw((const u8*)&eth, ethernet_frame_size, offload);
+}
+
+void NetworkAdapter::begin_transmit_batch()
+{
+    InterruptDisabler disabler;
+    ++m_transmit_batch_depth;
+}
+
+void NetworkAdapter::end_transmit_batch()
+{
+    InterruptDisabler disabler;
+    ASSERT(m_transmit_batch_depth);
+    if (--m_transmit_batch_depth == 0)
+        flush_transmit_batch();
+}
+
+void NetworkAdapter::create_packet_buffer_pool(size_t buffer_count, size_t buffer_size)
+{
+    ASSERT(!m_packet_buffer_pool);
+    StringBuilder builder;
+    builder.appendf("%s Packet Buffers", m_name.characters());
+    m_packet_buffer_pool = PacketBufferPool::create(builder.to_string(), buffer_count, buffer_size);
+    ASSERT(m_packet_buffer_pool);
+}
+
+RefPtr<PacketBuffer> NetworkAdapter::take_packet_buffer()
+{
+    if (!m_packet_buffer_pool)
+        return nullptr;
+    return m_packet_buffer_pool->take();
+}
+
+void NetworkAdapter::did_receive(NonnullRefPtr<PacketBuffer>&& packet)
+{
+    InterruptDisabler disabler;
+    m_packets_received_in_place++;
+    enqueue_received_packet(move(packet));
 }
 
 void NetworkAdapter::did_receive(const u8* data, size_t length)
 {
     InterruptDisabler disabler;
-    m_packets_in++;
-    m_bytes_in += length;
-
-    Optional<KBuffer> buffer;
-
-    if (m_unused_packet_buffers.is_empty()) {
-        buffer = KBuffer::copy(data, length);
-    } else {
-        buffer = m_unused_packet_buffers.take_first();
-        --m_unused_packet_buffers_count;
-        if (length <= buffer.value().size()) {
-            memcpy(buffer.value().data(), data, length);
-            buffer.value().set_size(length);
-        } else {
-            buffer = KBuffer::copy(data, length);
-        }
+    RefPtr<PacketBuffer> packet;
+    if (m_packet_buffer_pool && length <= m_packet_buffer_pool->buffer_size())
+        packet = m_packet_buffer_pool->take();
+    if (!packet) {
+        m_packet_buffer_pool_misses++;
+        packet = PacketBuffer::create_unpooled(length);
     }
+    memcpy(packet->data(), data, length);
+    packet->set_size(length);
+    m_packets_copied_in++;
+    enqueue_received_packet(packet.release_nonnull());
+}
+
+void NetworkAdapter::enqueue_received_packet(NonnullRefPtr<PacketBuffer>&& packet)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_packets_in++;
+    m_bytes_in += packet->size();
 
-    m_packet_queue.append(buffer.value());
+    m_packet_queue.append(move(packet));
 
     if (on_receive)
         on_receive();
 }
 
-size_t NetworkAdapter::dequeue_packet(u8* buffer, size_t buffer_size)
+RefPtr<PacketBuffer> NetworkAdapter::dequeue_packet()
 {
     InterruptDisabler disabler;
     if (m_packet_queue.is_empty())
-        return 0;
-    auto packet = m_packet_queue.take_first();
-    size_t packet_size = packet.size();
-    ASSERT(packet_size <= buffer_size);
-    memcpy(buffer, packet.data(), packet_size);
-    if (m_unused_packet_buffers_count < 100) {
-        m_unused_packet_buffers.append(packet);
-        ++m_unused_packet_buffers_count;
-    }
-    return packet_size;
+        return nullptr;
+    return m_packet_queue.take_first();
 }
 
 void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
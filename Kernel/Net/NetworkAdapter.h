@@ -32,16 +32,45 @@
 #include <AK/Types.h>
 #include <AK/Weakable.h>
 #include <AK/WeakPtr.h>
-#include <Kernel/KBuffer.h>
 #include <Kernel/Net/ARP.h>
 #include <Kernel/Net/ICMP.h>
 #include <Kernel/Net/IPv4.h>
 #include <Kernel/Net/MACAddress.h>
+#include <Kernel/Net/PacketBuffer.h>
 
 class NetworkAdapter;
 
+// Work on an outgoing frame that the stack leaves to the device.
+struct TransmitOffload {
+    bool ipv4_checksum { false };
+    // The TCP checksum field holds the pseudo-header checksum, which the device completes.
+    bool tcp_checksum { false };
+    // If non-zero, the frame carries a TCP payload that the device splits into segments of this size.
+    u16 tcp_segment_size { 0 };
+};
+
 class NetworkAdapter : public Weakable<NetworkAdapter> {
 public:
+    // Frames sent while a batch is open may be held back by the driver, and handed to
+    // the device together once the outermost batch ends.
+    class TransmitBatch {
+    public:
+        explicit TransmitBatch(NetworkAdapter* adapter)
+            : m_adapter(adapter)
+        {
+            if (m_adapter)
+                m_adapter->begin_transmit_batch();
+        }
+        ~TransmitBatch()
+        {
+            if (m_adapter)
+                m_adapter->end_transmit_batch();
+        }
+
+    private:
+        NetworkAdapter* m_adapter { nullptr };
+    };
+
     static void for_each(Function<void(NetworkAdapter&)>);
     static WeakPtr<NetworkAdapter> from_ipv4_address(const IPv4Address&);
     static WeakPtr<NetworkAdapter> lookup_by_name(const StringView&);
@@ -49,6 +78,14 @@ public:
 
     virtual const char* class_name() const = 0;
 
+    enum OffloadCapability : u32 {
+        IPv4ChecksumOffload = 1 << 0,
+        TCPChecksumOffload = 1 << 1,
+        TCPSegmentationOffload = 1 << 2,
+    };
+    u32 offload_capabilities() const { return m_offload_capabilities; }
+    bool has_offload(OffloadCapability capability) const { return m_offload_capabilities & capability; }
+
     const String& name() const { return m_name; }
     MACAddress mac_address() { return m_mac_address; }
     IPv4Address ipv4_address() const { return m_ipv4_address; }
@@ -61,9 +98,9 @@ public:
     void set_ipv4_gateway(const IPv4Address&);
 
     void send(const MACAddress&, const ARPPacket&);
-    void send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const u8* payload, size_t payload_size, u8 ttl);
+    void send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, const u8* payload, size_t payload_size, u8 ttl, TransmitOffload = {});
 
-    size_t dequeue_packet(u8* buffer, size_t buffer_size);
+    RefPtr<PacketBuffer> dequeue_packet();
 
     bool has_queued_packets() const { return !m_packet_queue.is_empty(); }
 
@@ -75,27 +112,64 @@ public:
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
 
+    size_t packet_buffers() const { return m_packet_buffer_pool ? m_packet_buffer_pool->buffer_count() : 0; }
+    size_t packet_buffers_free() const { return m_packet_buffer_pool ? m_packet_buffer_pool->free_count() : 0; }
+    u32 packets_received_in_place() const { return m_packets_received_in_place; }
+    u32 packets_copied_in() const { return m_packets_copied_in; }
+    u32 packet_buffer_pool_misses() const { return m_packet_buffer_pool_misses; }
+
+    u32 checksum_errors() const { return m_checksum_errors; }
+    u32 interrupts() const { return m_interrupts; }
+    virtual size_t rx_ring_size() const { return 0; }
+    virtual size_t tx_ring_size() const { return 0; }
+
     Function<void()> on_receive;
 
 protected:
     NetworkAdapter();
     void set_interface_name(const StringView& basename);
     void set_mac_address(const MACAddress& mac_address) { m_mac_address = mac_address; }
-    virtual void send_raw(const u8*, size_t) = 0;
+    void set_offload_capabilities(u32 capabilities) { m_offload_capabilities = capabilities; }
+    virtual void send_raw(const u8*, size_t, const TransmitOffload&) = 0;
+
+    bool is_batching_transmits() const { return m_transmit_batch_depth; }
+    // Hands any frames held back during a batch to the device.
+    virtual void flush_transmit_batch() {}
+
+    void did_interrupt() { ++m_interrupts; }
+    void did_drop_bad_checksum() { ++m_checksum_errors; }
+
+    void create_packet_buffer_pool(size_t buffer_count, size_t buffer_size);
+    RefPtr<PacketBuffer> take_packet_buffer();
+
+    // For frames the device has already put into one of our packet buffers.
+    void did_receive(NonnullRefPtr<PacketBuffer>&&);
+    // For frames that have to be copied out of device memory first.
     void did_receive(const u8*, size_t);
 
 private:
+    void begin_transmit_batch();
+    void end_transmit_batch();
+
+    void enqueue_received_packet(NonnullRefPtr<PacketBuffer>&&);
+
     MACAddress m_mac_address;
     IPv4Address m_ipv4_address;
     IPv4Address m_ipv4_netmask;
     IPv4Address m_ipv4_gateway;
-    SinglyLinkedList<KBuffer> m_packet_queue;
-    SinglyLinkedList<KBuffer> m_unused_packet_buffers;
-    size_t m_unused_packet_buffers_count { 0 };
+    OwnPtr<PacketBufferPool> m_packet_buffer_pool;
+    SinglyLinkedList<NonnullRefPtr<PacketBuffer>> m_packet_queue;
     String m_name;
     u32 m_packets_in { 0 };
     u32 m_bytes_in { 0 };
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
+    u32 m_packets_received_in_place { 0 };
+    u32 m_packets_copied_in { 0 };
+    u32 m_packet_buffer_pool_misses { 0 };
+    u32 m_checksum_errors { 0 };
+    u32 m_interrupts { 0 };
+    u32 m_offload_capabilities { 0 };
+    u32 m_transmit_batch_depth { 0 };
     u32 m_mtu { 1500 };
 };
@@ -49,14 +49,25 @@
 //#define TCP_DEBUG
 
 static void handle_arp(const EthernetFrameHeader&, size_t frame_size);
-static void handle_ipv4(const EthernetFrameHeader&, size_t frame_size);
-static void handle_icmp(const EthernetFrameHeader&, const IPv4Packet&);
-static void handle_udp(const IPv4Packet&);
-static void handle_tcp(const IPv4Packet&);
+static void handle_ipv4(PacketBuffer&, const EthernetFrameHeader&, size_t frame_size);
+static void handle_icmp(PacketBuffer&, const EthernetFrameHeader&, const IPv4Packet&);
+static void handle_udp(PacketBuffer&, const IPv4Packet&);
+static void handle_tcp(PacketBuffer&, const IPv4Packet&);
+
+static WaitQueue* s_packet_wait_queue;
+static volatile bool s_tcp_timers_due;
+
+void NetworkTask_wake_for_tcp_timers()
+{
+    s_tcp_timers_due = true;
+    if (s_packet_wait_queue)
+        s_packet_wait_queue->wake_all();
+}
 
 void NetworkTask_main()
 {
     WaitQueue packet_wait_queue;
+    s_packet_wait_queue = &packet_wait_queue;
     u8 octet = 15;
     int pending_packets = 0;
     NetworkAdapter::for_each([&](auto& adapter) {
@@ -83,38 +94,43 @@ void NetworkTask_main()
         };
     });
 
-    auto dequeue_packet = [&pending_packets](u8* buffer, size_t buffer_size) -> size_t {
+    auto dequeue_packet = [&pending_packets]() -> RefPtr<PacketBuffer> {
         if (pending_packets == 0)
-            return 0;
-        size_t packet_size = 0;
+            return nullptr;
+        RefPtr<PacketBuffer> packet;
         NetworkAdapter::for_each([&](auto& adapter) {
-            if (packet_size || !adapter.has_queued_packets())
+            if (packet || !adapter.has_queued_packets())
                 return;
-            packet_size = adapter.dequeue_packet(buffer, buffer_size);
+            packet = adapter.dequeue_packet();
             pending_packets--;
 #ifdef NETWORK_TASK_DEBUG
-            kprintf("NetworkTask: Dequeued packet from %s (%d bytes)\n", adapter.name().characters(), packet_size);
+            kprintf("NetworkTask: Dequeued packet from %s (%d bytes)\n", adapter.name().characters(), packet->size());
 #endif
         });
-        return packet_size;
+        return packet;
     };
 
-    size_t buffer_size = 64 * KB;
-    auto buffer_region = MM.allocate_kernel_region(buffer_size, "Kernel Packet Buffer", Region::Access::Read | Region::Access::Write, false, true);
-    auto buffer = (u8*)buffer_region->vaddr().get();
-
     kprintf("NetworkTask: Enter main loop.\n");
     for (;;) {
-        size_t packet_size = dequeue_packet(buffer, buffer_size);
-        if (!packet_size) {
-            current->wait_on(packet_wait_queue);
+        if (s_tcp_timers_due) {
+            s_tcp_timers_due = false;
+            TCPSocket::for_each([](auto& socket) {
+                socket.retransmit_if_timed_out();
+            });
+        }
+        auto packet = dequeue_packet();
+        if (!packet) {
+            InterruptDisabler disabler;
+            if (!pending_packets && !s_tcp_timers_due)
+                current->wait_on(packet_wait_queue);
             continue;
         }
+        size_t packet_size = packet->size();
         if (packet_size < sizeof(EthernetFrameHeader)) {
             kprintf("NetworkTask: Packet is too small to be an Ethernet packet! (%zu)\n", packet_size);
             continue;
         }
-        auto& eth = *(const EthernetFrameHeader*)buffer;
+        auto& eth = *(const EthernetFrameHeader*)packet->data();
 #ifdef ETHERNET_DEBUG
         kprintf("NetworkTask: From %s to %s, ether_type=%w, packet_length=%u\n",
             eth.source().to_string().characters(),
@@ -125,7 +141,7 @@ void NetworkTask_main()
 
 #ifdef ETHERNET_VERY_DEBUG
         for (size_t i = 0; i < packet_size; i++) {
-            kprintf("%b", buffer[i]);
+            kprintf("%b", packet->data()[i]);
 
             switch (i % 16) {
             case 7:
@@ -148,7 +164,7 @@ void NetworkTask_main()
             handle_arp(eth, packet_size);
             break;
         case EtherType::IPv4:
-            handle_ipv4(eth, packet_size);
+            handle_ipv4(*packet, eth, packet_size);
             break;
         case EtherType::IPv6:
             // ignore
@@ -221,7 +237,7 @@ void handle_arp(const EthernetFrameHeader& eth, size_t frame_size)
     }
 }
 
-void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size)
+void handle_ipv4(PacketBuffer& packet_buffer, const EthernetFrameHeader& eth, size_t frame_size)
 {
     constexpr size_t minimum_ipv4_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet);
     if (frame_size < minimum_ipv4_frame_size) {
@@ -249,18 +265,18 @@ void handle_ipv4(const EthernetFrameHeader& eth, size_t frame_size)
 
     switch ((IPv4Protocol)packet.protocol()) {
     case IPv4Protocol::ICMP:
-        return handle_icmp(eth, packet);
+        return handle_icmp(packet_buffer, eth, packet);
     case IPv4Protocol::UDP:
-        return handle_udp(packet);
+        return handle_udp(packet_buffer, packet);
     case IPv4Protocol::TCP:
-        return handle_tcp(packet);
+        return handle_tcp(packet_buffer, packet);
     default:
         kprintf("handle_ipv4: Unhandled protocol %u\n", packet.protocol());
         break;
     }
 }
 
-void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet)
+void handle_icmp(PacketBuffer& packet_buffer, const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet)
 {
     auto& icmp_header = *static_cast<const ICMPHeader*>(ipv4_packet.payload());
 #ifdef ICMP_DEBUG
@@ -277,7 +293,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet)
             LOCKER(socket->lock());
             if (socket->protocol() != (unsigned)IPv4Protocol::ICMP)
                 continue;
-            socket->did_receive(ipv4_packet.source(), 0, KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+            socket->did_receive(ipv4_packet.source(), 0, packet_buffer, ipv4_packet);
         }
     }
 
@@ -306,7 +322,7 @@ void handle_icmp(const EthernetFrameHeader& eth, const IPv4Packet& ipv4_packet)
     }
 }
 
-void handle_udp(const IPv4Packet& ipv4_packet)
+void handle_udp(PacketBuffer& packet_buffer, const IPv4Packet& ipv4_packet)
 {
     if (ipv4_packet.payload_size() < sizeof(UDPPacket)) {
         kprintf("handle_udp: Packet too small (%u, need %zu)\n", ipv4_packet.payload_size());
@@ -337,10 +353,10 @@ void handle_udp(const IPv4Packet& ipv4_packet)
 
     ASSERT(socket->type() == SOCK_DGRAM);
     ASSERT(socket->local_port() == udp_packet.destination_port());
-    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+    socket->did_receive(ipv4_packet.source(), udp_packet.source_port(), packet_buffer, ipv4_packet);
 }
 
-void handle_tcp(const IPv4Packet& ipv4_packet)
+void handle_tcp(PacketBuffer& packet_buffer, const IPv4Packet& ipv4_packet)
 {
     if (ipv4_packet.payload_size() < sizeof(TCPPacket)) {
         kprintf("handle_tcp: IPv4 payload is too small to be a TCP packet (%u, need %zu)\n", ipv4_packet.payload_size(), sizeof(TCPPacket));
@@ -436,6 +452,18 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
 #ifdef TCP_DEBUG
             kprintf("handle_tcp: incoming connection\n");
 #endif
+            switch (socket->disposition_for_syn()) {
+            case TCPSocket::SYNDisposition::Drop:
+#ifdef TCP_DEBUG
+                kprintf("handle_tcp: accept queue is full, dropping SYN\n");
+#endif
+                return;
+            case TCPSocket::SYNDisposition::SendCookie:
+                socket->send_syn_cookie(ipv4_packet, tcp_packet);
+                return;
+            case TCPSocket::SYNDisposition::CreateClient:
+                break;
+            }
             auto& local_address = ipv4_packet.destination();
             auto& peer_address = ipv4_packet.source();
             auto client = socket->create_client(local_address, tcp_packet.destination_port(), peer_address, tcp_packet.source_port());
@@ -446,13 +474,25 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
 #ifdef TCP_DEBUG
             kprintf("handle_tcp: created new client socket with tuple %s\n", client->tuple().to_string().characters());
 #endif
-            client->set_sequence_number(1000);
+            client->process_syn_options(tcp_packet);
+            client->set_initial_sequence_number(1000);
             client->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
             client->send_tcp_packet(TCPFlags::SYN | TCPFlags::ACK);
             client->set_state(TCPSocket::State::SynReceived);
             return;
         }
         default:
+            // This may be the end of a handshake that we answered with a SYN cookie.
+            if (tcp_packet.has_ack() && !tcp_packet.has_syn() && !tcp_packet.has_rst()) {
+                if (auto client = socket->create_client_from_syn_cookie(ipv4_packet, tcp_packet)) {
+                    if (payload_size == 0)
+                        return;
+                    if (client->did_receive(ipv4_packet.source(), tcp_packet.source_port(), packet_buffer, ipv4_packet))
+                        client->set_ack_number(tcp_packet.sequence_number() + payload_size);
+                    client->send_tcp_packet(TCPFlags::ACK);
+                    return;
+                }
+            }
             kprintf("handle_tcp: unexpected flags in Listen state\n");
             // socket->send_tcp_packet(TCPFlags::RST);
             return;
@@ -593,7 +633,7 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
     case TCPSocket::State::Established:
         if (tcp_packet.has_fin()) {
             if (payload_size != 0)
-                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+                socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), packet_buffer, ipv4_packet);
 
             socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
             // TODO: We should only send a FIN packet out once we're shutting
@@ -606,7 +646,23 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
             return;
         }
 
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
+        // Pure acknowledgements have been dealt with already, and don't get acknowledged themselves.
+        if (payload_size == 0)
+            return;
+
+        // We don't keep segments that arrive out of order, so drop them and acknowledge what we
+        // have so far. The duplicate acknowledgement tells the peer to retransmit the missing one.
+        if (tcp_packet.sequence_number() != socket->ack_number()) {
+#ifdef TCP_DEBUG
+            kprintf("handle_tcp: got seq_no=%u but expected %u, dropping it\n", tcp_packet.sequence_number(), socket->ack_number());
+#endif
+            socket->send_tcp_packet(TCPFlags::ACK);
+            return;
+        }
+
+        // If there's no room for it, the peer will have to send it again once we advertise some.
+        if (socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), packet_buffer, ipv4_packet))
+            socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
 
 #ifdef TCP_DEBUG
         kprintf("Got packet with ack_no=%u, seq_no=%u, payload_size=%u, acking it with new ack_no=%u, seq_no=%u\n",
@@ -617,12 +673,6 @@ void handle_tcp(const IPv4Packet& ipv4_packet)
             socket->sequence_number());
 #endif
 
-        bool should_ack = true;
-        if (payload_size != 0) {
-            should_ack = socket->did_receive(ipv4_packet.source(), tcp_packet.source_port(), KBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
-        }
-
-        if (should_ack)
-            socket->send_tcp_packet(TCPFlags::ACK);
+        socket->send_tcp_packet(TCPFlags::ACK);
     }
 }
@@ -27,3 +27,6 @@
 #pragma once
 
 void NetworkTask_main();
+
+// Has the network task check TCP retransmission timers. Can be called from interrupt context.
+void NetworkTask_wake_for_tcp_timers();
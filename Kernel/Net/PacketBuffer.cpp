@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/Net/PacketBuffer.h>
+#include <Kernel/VM/MemoryManager.h>
+
+NonnullRefPtr<PacketBuffer> PacketBuffer::create_unpooled(size_t capacity)
+{
+    return adopt(*new PacketBuffer(KBuffer::create_with_size(capacity, Region::Access::Read | Region::Access::Write, "Packet Buffer")));
+}
+
+PacketBuffer::PacketBuffer(PacketBufferPool& pool, u8* data, size_t capacity, PhysicalAddress physical_address)
+    : m_pool(&pool)
+    , m_data(data)
+    , m_capacity(capacity)
+    , m_physical_address(physical_address)
+{
+}
+
+PacketBuffer::PacketBuffer(KBuffer&& storage)
+    : m_unpooled_storage(move(storage))
+{
+    m_data = m_unpooled_storage.value().data();
+    m_capacity = m_unpooled_storage.value().capacity();
+}
+
+void PacketBuffer::one_ref_left()
+{
+    if (m_pool)
+        m_pool->give_back(*this);
+}
+
+OwnPtr<PacketBufferPool> PacketBufferPool::create(const StringView& name, size_t buffer_count, size_t buffer_size)
+{
+    ASSERT(buffer_size <= PAGE_SIZE ? (PAGE_SIZE % buffer_size) == 0 : (buffer_size % PAGE_SIZE) == 0);
+    auto region = MM.allocate_kernel_region(PAGE_ROUND_UP(buffer_count * buffer_size), name, Region::Access::Read | Region::Access::Write, false, true);
+    if (!region)
+        return nullptr;
+    return OwnPtr<PacketBufferPool>(new PacketBufferPool(region.release_nonnull(), buffer_count, buffer_size));
+}
+
+PacketBufferPool::PacketBufferPool(NonnullOwnPtr<Region>&& region, size_t buffer_count, size_t buffer_size)
+    : m_region(move(region))
+    , m_buffer_size(buffer_size)
+{
+    m_buffers.ensure_capacity(buffer_count);
+    m_free_buffers.ensure_capacity(buffer_count);
+    for (size_t i = 0; i < buffer_count; ++i) {
+        size_t offset = i * buffer_size;
+        PhysicalAddress physical_address;
+        if (buffer_size <= PAGE_SIZE) {
+            auto& page = m_region->vmobject().physical_pages()[m_region->first_page_index() + offset / PAGE_SIZE];
+            physical_address = page->paddr().offset(offset % PAGE_SIZE);
+        }
+        m_buffers.append(adopt(*new PacketBuffer(*this, m_region->vaddr().offset(offset).as_ptr(), buffer_size, physical_address)));
+        m_free_buffers.append(&m_buffers.last());
+    }
+}
+
+PacketBufferPool::~PacketBufferPool()
+{
+    // Buffers point back at their pool, so they must all have come home by now.
+    ASSERT(free_count() == buffer_count());
+}
+
+RefPtr<PacketBuffer> PacketBufferPool::take()
+{
+    InterruptDisabler disabler;
+    if (m_free_buffers.is_empty())
+        return nullptr;
+    auto* buffer = m_free_buffers.take_last();
+    buffer->set_size(0);
+    return buffer;
+}
+
+void PacketBufferPool::give_back(PacketBuffer& buffer)
+{
+    InterruptDisabler disabler;
+    m_free_buffers.append(&buffer);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// PacketBuffer: A received network frame, handed up the stack by reference.
+//
+// Each network adapter owns a PacketBufferPool that is allocated once, up front.
+// Frames are received into buffers from that pool (straight from the device when it
+// can DMA into them), and the network task and sockets pass them along by reference.
+// The payload is then copied exactly once, out of the buffer and into userspace.
+//
+// A pooled buffer goes back to its pool when the last reference outside the pool
+// is dropped. When the pool has run dry, adapters fall back to standalone buffers.
+
+#include <AK/NonnullRefPtrVector.h>
+#include <AK/Optional.h>
+#include <AK/OwnPtr.h>
+#include <AK/RefCounted.h>
+#include <AK/RefPtr.h>
+#include <AK/StringView.h>
+#include <AK/Vector.h>
+#include <Kernel/KBuffer.h>
+#include <Kernel/VM/PhysicalAddress.h>
+
+class PacketBufferPool;
+
+class PacketBuffer : public RefCounted<PacketBuffer> {
+public:
+    static NonnullRefPtr<PacketBuffer> create_unpooled(size_t capacity);
+
+    u8* data() { return m_data; }
+    const u8* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+
+    void set_size(size_t size)
+    {
+        ASSERT(size <= m_capacity);
+        m_size = size;
+    }
+
+    // Only valid for pooled buffers no larger than a page.
+    PhysicalAddress physical_address() const { return m_physical_address; }
+
+    bool is_pooled() const { return m_pool; }
+
+    // Called by RefCounted once only the pool's own reference remains.
+    void one_ref_left();
+
+private:
+    friend class PacketBufferPool;
+
+    PacketBuffer(PacketBufferPool&, u8* data, size_t capacity, PhysicalAddress);
+    explicit PacketBuffer(KBuffer&&);
+
+    PacketBufferPool* m_pool { nullptr };
+    u8* m_data { nullptr };
+    size_t m_size { 0 };
+    size_t m_capacity { 0 };
+    PhysicalAddress m_physical_address;
+    Optional<KBuffer> m_unpooled_storage;
+};
+
+class PacketBufferPool {
+public:
+    // Buffers no larger than a page never straddle one, so devices can DMA into them.
+    static OwnPtr<PacketBufferPool> create(const StringView& name, size_t buffer_count, size_t buffer_size);
+    ~PacketBufferPool();
+
+    // Returns nullptr if every buffer is in use. Safe to call from IRQ handlers.
+    RefPtr<PacketBuffer> take();
+
+    size_t buffer_count() const { return m_buffers.size(); }
+    size_t buffer_size() const { return m_buffer_size; }
+    size_t free_count() const { return m_free_buffers.size(); }
+
+private:
+    friend class PacketBuffer;
+
+    PacketBufferPool(NonnullOwnPtr<Region>&&, size_t buffer_count, size_t buffer_size);
+    void give_back(PacketBuffer&);
+
+    NonnullOwnPtr<Region> m_region;
+    size_t m_buffer_size { 0 };
+    NonnullRefPtrVector<PacketBuffer> m_buffers;
+    Vector<PacketBuffer*> m_free_buffers;
+};
@@ -122,6 +122,8 @@
 
 #define RX_BUFFER_SIZE 32768
 #define TX_BUFFER_SIZE PACKET_SIZE_MAX
+#define PACKET_BUFFER_COUNT 128
+#define PACKET_BUFFER_SIZE 2048
 
 void RTL8139NetworkAdapter::detect(const PCI::Address& address)
 {
@@ -162,7 +164,7 @@ RTL8139NetworkAdapter::RTL8139NetworkAdapter(PCI::Address pci_address, u8 irq)
         kprintf("RTL8139: TX buffer %d: P%p\n", i, m_tx_buffer_addr[i]);
     }
 
-    m_packet_buffer = (uintptr_t)kmalloc(PACKET_SIZE_MAX);
+    create_packet_buffer_pool(PACKET_BUFFER_COUNT, PACKET_BUFFER_SIZE);
 
     reset();
 
@@ -179,6 +181,7 @@ RTL8139NetworkAdapter::~RTL8139NetworkAdapter()
 
 void RTL8139NetworkAdapter::handle_irq()
 {
+    did_interrupt();
     for (;;) {
         int status = in16(REG_ISR);
         out16(REG_ISR, status);
@@ -287,7 +290,7 @@ void RTL8139NetworkAdapter::read_mac_address()
     set_mac_address(mac);
 }
 
-void RTL8139NetworkAdapter::send_raw(const u8* data, size_t length)
+void RTL8139NetworkAdapter::send_raw(const u8* data, size_t length, const TransmitOffload&)
 {
 #ifdef RTL8139_DEBUG
     kprintf("RTL8139NetworkAdapter::send_raw length=%d\n", length);
@@ -356,13 +359,14 @@ void RTL8139NetworkAdapter::receive()
     // we never have to worry about the packet wrapping around the buffer,
     // since we set RXCFG_WRAP_INHIBIT, which allows the rtl8139 to write data
     // past the end of the alloted space.
-    memcpy((u8*)m_packet_buffer, (const u8*)(start_of_packet + 4), length - 4);
+    // the ring is shared by every packet, so this copies the frame straight out
+    // of it into one of our packet buffers.
+    did_receive(start_of_packet + 4, length - 4);
+
     // let the card know that we've read this data
     m_rx_buffer_offset = ((m_rx_buffer_offset + length + 4 + 3) & ~3) % RX_BUFFER_SIZE;
     out16(REG_CAPR, m_rx_buffer_offset - 0x10);
     m_rx_buffer_offset %= RX_BUFFER_SIZE;
-
-    did_receive((const u8*)m_packet_buffer, length - 4);
 }
 
 void RTL8139NetworkAdapter::out8(u16 address, u8 data)
@@ -41,7 +41,7 @@ public:
     RTL8139NetworkAdapter(PCI::Address, u8 irq);
     virtual ~RTL8139NetworkAdapter() override;
 
-    virtual void send_raw(const u8*, size_t) override;
+    virtual void send_raw(const u8*, size_t, const TransmitOffload&) override;
     virtual bool link_up() override { return m_link_up; }
 
 private:
@@ -67,6 +67,5 @@ private:
     u16 m_rx_buffer_offset { 0 };
     u32 m_tx_buffer_addr[RTL8139_TX_BUFFER_COUNT];
     u8 m_tx_next_buffer { 0 };
-    u32 m_packet_buffer { 0 };
     bool m_link_up { false };
 };
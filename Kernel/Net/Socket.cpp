@@ -67,6 +67,7 @@ void Socket::set_setup_state(SetupState new_setup_state)
 #endif
 
     m_setup_state = new_setup_state;
+    notify_blockers();
 }
 
 RefPtr<Socket> Socket::accept()
@@ -83,6 +84,7 @@ RefPtr<Socket> Socket::accept()
     client->m_acceptor = { process.pid(), process.uid(), process.gid() };
     client->m_connected = true;
     client->m_role = Role::Accepted;
+    client->notify_blockers();
     return client;
 }
 
@@ -95,6 +97,7 @@ KResult Socket::queue_connection_from(NonnullRefPtr<Socket> peer)
     if (m_pending.size() >= m_backlog)
         return KResult(-ECONNREFUSED);
     m_pending.append(peer);
+    notify_blockers();
     return KSuccess;
 }
 
@@ -85,7 +85,11 @@ public:
     virtual Role role(const FileDescription&) const { return m_role; }
 
     bool is_connected() const { return m_connected; }
-    void set_connected(bool connected) { m_connected = connected; }
+    void set_connected(bool connected)
+    {
+        m_connected = connected;
+        notify_blockers();
+    }
 
     bool can_accept() const { return !m_pending.is_empty(); }
     RefPtr<Socket> accept();
@@ -133,6 +137,7 @@ protected:
 
     int backlog() const { return m_backlog; }
     void set_backlog(int backlog) { m_backlog = backlog; }
+    int pending_connection_count() const { return m_pending.size(); }
 
     virtual const char* class_name() const override { return "Socket"; }
 
@@ -144,6 +149,7 @@ protected:
 
 private:
     virtual bool is_socket() const final { return true; }
+    virtual bool notifies_blockers() const override { return true; }
 
     Lock m_lock { "Socket" };
 
@@ -39,6 +39,15 @@ struct TCPFlags {
     };
 };
 
+struct TCPOptionKind {
+    enum : u8 {
+        End = 0,
+        NoOperation = 1,
+        MaximumSegmentSize = 2,
+        WindowScale = 3,
+    };
+};
+
 class [[gnu::packed]] TCPPacket
 {
 public:
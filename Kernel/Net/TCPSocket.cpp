@@ -24,23 +24,104 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/Time.h>
 #include <Kernel/Devices/RandomDevice.h>
 #include <Kernel/FileSystem/FileDescription.h>
+#include <Kernel/Arch/i386/PIT.h>
+#include <Kernel/Net/EthernetFrameHeader.h>
 #include <Kernel/Net/NetworkAdapter.h>
+#include <Kernel/Net/NetworkTask.h>
 #include <Kernel/Net/Routing.h>
 #include <Kernel/Net/TCP.h>
 #include <Kernel/Net/TCPSocket.h>
 #include <Kernel/Process.h>
 #include <Kernel/Random.h>
+#include <Kernel/TimerQueue.h>
 
 //#define TCP_SOCKET_DEBUG
 
+static const size_t send_buffer_size = 128 * KB;
+static const u8 receive_window_scale = 2;
+static const u32 maximum_congestion_window = 16 * MB;
+static const u32 initial_retransmission_timeout_us = 1000000;
+static const u32 minimum_retransmission_timeout_us = 200000;
+static const u32 maximum_retransmission_timeout_us = 60000000;
+static const int maximum_syn_ack_retransmissions = 5;
+static const int maximum_listen_backlog = 128;
+static const size_t socket_table_shard_count = 16;
+// The largest run of data that can go to the device as one TSO segment.
+static const size_t maximum_tso_payload_size = 0xffff - sizeof(IPv4Packet) - sizeof(TCPPacket);
+
+// Sequence numbers wrap around, so compare them by their distance.
+static inline bool sequence_less_than(u32 a, u32 b)
+{
+    return (i32)(a - b) < 0;
+}
+
+struct SYNOptions {
+    u16 mss { 536 };
+    bool window_scaling { false };
+    u8 window_scale { 0 };
+};
+
+static SYNOptions parse_syn_options(const TCPPacket& packet)
+{
+    SYNOptions result;
+    auto* options = (const u8*)&packet + sizeof(TCPPacket);
+    size_t options_size = packet.header_size() - sizeof(TCPPacket);
+    for (size_t i = 0; i < options_size;) {
+        u8 kind = options[i];
+        if (kind == TCPOptionKind::End)
+            break;
+        if (kind == TCPOptionKind::NoOperation) {
+            ++i;
+            continue;
+        }
+        if (i + 1 >= options_size)
+            break;
+        u8 length = options[i + 1];
+        if (length < 2 || i + length > options_size)
+            break;
+        if (kind == TCPOptionKind::MaximumSegmentSize && length == 4)
+            result.mss = max((options[i + 2] << 8) | options[i + 3], 64);
+        else if (kind == TCPOptionKind::WindowScale && length == 3) {
+            result.window_scaling = true;
+            result.window_scale = min(options[i + 2], (u8)14);
+        }
+        i += length;
+    }
+    return result;
+}
+
+static u16 local_mss_for(const NetworkAdapter& adapter)
+{
+    // Leave room for the IPv4 and TCP headers, and keep the whole frame within 64 KB.
+    u32 mtu = min(adapter.mtu(), (u32)(0xffff - sizeof(EthernetFrameHeader)));
+    return mtu - sizeof(IPv4Packet) - sizeof(TCPPacket);
+}
+
+static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& socket_table_shard(size_t index)
+{
+    static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>* s_shards;
+    if (!s_shards)
+        s_shards = new Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>[socket_table_shard_count];
+    return s_shards[index];
+}
+
 void TCPSocket::for_each(Function<void(TCPSocket&)> callback)
 {
-    LOCKER(sockets_by_tuple().lock());
-    for (auto& it : sockets_by_tuple().resource())
-        callback(*it.value);
+    // Take a reference to every socket first, so that no table lock is held while the callback
+    // runs. A socket that's on its way out may still be listed with no references left; skip it.
+    Vector<NonnullRefPtr<TCPSocket>> sockets;
+    for (size_t i = 0; i < socket_table_shard_count; ++i) {
+        auto& shard = socket_table_shard(i);
+        LOCKER(shard.lock());
+        for (auto& it : shard.resource()) {
+            if (it.value->ref_count())
+                sockets.append(*it.value);
+        }
+    }
+    for (auto& socket : sockets)
+        callback(*socket);
 }
 
 void TCPSocket::set_state(State new_state)
@@ -55,35 +136,40 @@ void TCPSocket::set_state(State new_state)
 
     if (new_state == State::Established && m_direction == Direction::Outgoing)
         m_role = Role::Connected;
+
+    notify_blockers();
+
+    // A half-open connection that fails never makes it to the accept queue; make room for another.
+    if (new_state == State::Closed && m_direction == Direction::Incoming && m_originator)
+        m_originator->forget_half_open_connection(*this);
 }
 
-Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& TCPSocket::sockets_by_tuple()
+Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& TCPSocket::sockets_by_tuple(const IPv4SocketTuple& tuple)
 {
-    static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>* s_map;
-    if (!s_map)
-        s_map = new Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>;
-    return *s_map;
+    return socket_table_shard(AK::Traits<IPv4SocketTuple>::hash(tuple) % socket_table_shard_count);
 }
 
-RefPtr<TCPSocket> TCPSocket::from_tuple(const IPv4SocketTuple& tuple)
+static RefPtr<TCPSocket> socket_with_exact_tuple(const IPv4SocketTuple& tuple)
 {
-    LOCKER(sockets_by_tuple().lock());
+    auto& table = TCPSocket::sockets_by_tuple(tuple);
+    LOCKER(table.lock());
+    auto match = table.resource().get(tuple);
+    if (match.has_value())
+        return { *match.value() };
+    return {};
+}
 
-    auto exact_match = sockets_by_tuple().resource().get(tuple);
-    if (exact_match.has_value())
-        return { *exact_match.value() };
+RefPtr<TCPSocket> TCPSocket::from_tuple(const IPv4SocketTuple& tuple)
+{
+    if (auto exact_match = socket_with_exact_tuple(tuple))
+        return exact_match;
 
     auto address_tuple = IPv4SocketTuple(tuple.local_address(), tuple.local_port(), IPv4Address(), 0);
-    auto address_match = sockets_by_tuple().resource().get(address_tuple);
-    if (address_match.has_value())
-        return { *address_match.value() };
+    if (auto address_match = socket_with_exact_tuple(address_tuple))
+        return address_match;
 
     auto wildcard_tuple = IPv4SocketTuple(IPv4Address(), tuple.local_port(), IPv4Address(), 0);
-    auto wildcard_match = sockets_by_tuple().resource().get(wildcard_tuple);
-    if (wildcard_match.has_value())
-        return { *wildcard_match.value() };
-
-    return {};
+    return socket_with_exact_tuple(wildcard_tuple);
 }
 
 RefPtr<TCPSocket> TCPSocket::from_endpoints(const IPv4Address& local_address, u16 local_port, const IPv4Address& peer_address, u16 peer_port)
@@ -95,8 +181,9 @@ RefPtr<TCPSocket> TCPSocket::create_client(const IPv4Address& new_local_address,
 {
     auto tuple = IPv4SocketTuple(new_local_address, new_local_port, new_peer_address, new_peer_port);
 
-    LOCKER(sockets_by_tuple().lock());
-    if (sockets_by_tuple().resource().contains(tuple))
+    auto& table = sockets_by_tuple(tuple);
+    LOCKER(table.lock());
+    if (table.resource().contains(tuple))
         return {};
 
     auto client = TCPSocket::create(protocol());
@@ -110,9 +197,9 @@ RefPtr<TCPSocket> TCPSocket::create_client(const IPv4Address& new_local_address,
     client->set_originator(*this);
 
     m_pending_release_for_accept.set(tuple, client);
-    sockets_by_tuple().resource().set(tuple, client);
+    table.resource().set(tuple, client);
 
-    return from_tuple(tuple);
+    return client;
 }
 
 void TCPSocket::release_to_originator()
@@ -125,18 +212,247 @@ void TCPSocket::release_for_accept(RefPtr<TCPSocket> socket)
 {
     ASSERT(m_pending_release_for_accept.contains(socket->tuple()));
     m_pending_release_for_accept.remove(socket->tuple());
-    queue_connection_from(*socket);
+    if (queue_connection_from(*socket).is_error()) {
+        // The accept queue filled up while the handshake was in flight. Refuse the connection
+        // rather than leave the peer believing it's been accepted.
+        ++m_accept_queue_overflows;
+        socket->send_tcp_packet(TCPFlags::RST);
+        socket->set_state(State::Closed);
+        return;
+    }
+    ++m_connections_established;
+}
+
+void TCPSocket::forget_half_open_connection(TCPSocket& socket)
+{
+    auto it = m_pending_release_for_accept.find(socket.tuple());
+    if (it == m_pending_release_for_accept.end() || (*it).value.ptr() != &socket)
+        return;
+    // This may well be the last reference to it.
+    NonnullRefPtr<TCPSocket> protector(socket);
+    m_pending_release_for_accept.remove(it);
+}
+
+TCPSocket::SYNDisposition TCPSocket::disposition_for_syn()
+{
+    ASSERT(m_state == State::Listen);
+    // There'd be nowhere to put the connection once it's set up, so let the peer try again later.
+    if (pending_connection_count() >= backlog()) {
+        ++m_syns_dropped;
+        return SYNDisposition::Drop;
+    }
+    if (m_pending_release_for_accept.size() >= backlog())
+        return SYNDisposition::SendCookie;
+    return SYNDisposition::CreateClient;
+}
+
+// A SYN cookie is the initial sequence number we answer a SYN with when we'd rather not keep any
+// state for it. If the peer then completes the handshake, its ACK gives us the cookie back:
+//
+//   bits 31-27: the low bits of the syn_cookie_period the cookie was made in, so that cookies expire
+//   bits 26-24: the peer's MSS, as an index into syn_cookie_mss_table
+//   bits 23-0:  a SipHash of all of the above, the connection tuple and the peer's ISN, keyed with
+//               a secret that is made up for each period and forgotten two periods later
+//
+// Options other than the MSS are lost, so these connections go without window scaling.
+static const u64 syn_cookie_period = 64 * TimeUnit::S;
+static const u16 syn_cookie_mss_table[] = { 536, 1220, 1440, 1460, 4312, 8960, 16344, 65481 };
+
+static u64 current_syn_cookie_period()
+{
+    return PIT::nanoseconds_since_boot() / syn_cookie_period;
+}
+
+// SipHash-2-4 of a message that is a whole number of u64s.
+static u64 siphash(const u64 key[2], const u64* words, size_t word_count)
+{
+    u64 v0 = key[0] ^ 0x736f6d6570736575ull;
+    u64 v1 = key[1] ^ 0x646f72616e646f6dull;
+    u64 v2 = key[0] ^ 0x6c7967656e657261ull;
+    u64 v3 = key[1] ^ 0x7465646279746573ull;
+    auto rotate_left = [](u64 value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto round = [&] {
+        v0 += v1;
+        v1 = rotate_left(v1, 13) ^ v0;
+        v0 = rotate_left(v0, 32);
+        v2 += v3;
+        v3 = rotate_left(v3, 16) ^ v2;
+        v0 += v3;
+        v3 = rotate_left(v3, 21) ^ v0;
+        v2 += v1;
+        v1 = rotate_left(v1, 17) ^ v2;
+        v2 = rotate_left(v2, 32);
+    };
+    auto compress = [&](u64 word) {
+        v3 ^= word;
+        round();
+        round();
+        v0 ^= word;
+    };
+    for (size_t i = 0; i < word_count; ++i)
+        compress(words[i]);
+    compress((u64)(word_count * sizeof(u64)) << 56);
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+        round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+struct SYNCookieSecret {
+    bool is_set { false };
+    u64 period { 0 };
+    u64 key[2] {};
+};
+
+// Secrets for the current period and the one before it, indexed by the period's lowest bit.
+static SYNCookieSecret s_syn_cookie_secrets[2];
+
+static const u64* syn_cookie_key(u64 period, bool create_if_missing)
+{
+    auto& secret = s_syn_cookie_secrets[period & 1];
+    if (!secret.is_set || secret.period != period) {
+        // Nobody has been given a cookie made with a secret for this period, so none can be valid.
+        if (!create_if_missing)
+            return nullptr;
+        get_good_random_bytes(reinterpret_cast<u8*>(secret.key), sizeof(secret.key));
+        secret.period = period;
+        secret.is_set = true;
+    }
+    return secret.key;
+}
+
+static u32 syn_cookie_hash(const u64 key[2], const IPv4SocketTuple& tuple, u32 peer_initial_sequence_number, u64 period, u32 mss_index)
+{
+    u64 words[3] = {
+        ((u64)tuple.local_address().to_u32() << 32) | tuple.peer_address().to_u32(),
+        ((u64)tuple.local_port() << 48) | ((u64)tuple.peer_port() << 32) | peer_initial_sequence_number,
+        (period << 3) | mss_index,
+    };
+    return siphash(key, words, 3) & 0xffffff;
+}
+
+static u32 make_syn_cookie(const IPv4SocketTuple& tuple, u32 peer_initial_sequence_number, u16 peer_mss, u64 period)
+{
+    u32 mss_index = 0;
+    for (u32 i = 0; i < sizeof(syn_cookie_mss_table) / sizeof(syn_cookie_mss_table[0]); ++i) {
+        if (syn_cookie_mss_table[i] <= peer_mss)
+            mss_index = i;
+    }
+    auto* key = syn_cookie_key(period, true);
+    return ((u32)(period & 0x1f) << 27) | (mss_index << 24) | syn_cookie_hash(key, tuple, peer_initial_sequence_number, period, mss_index);
+}
+
+static bool check_syn_cookie(const IPv4SocketTuple& tuple, u32 peer_initial_sequence_number, u32 cookie, u64 now, u16& peer_mss)
+{
+    // Accept cookies from this period and the one before it.
+    u32 timestamp = cookie >> 27;
+    u64 period;
+    if (timestamp == (now & 0x1f))
+        period = now;
+    else if (now && timestamp == ((now - 1) & 0x1f))
+        period = now - 1;
+    else
+        return false;
+    auto* key = syn_cookie_key(period, false);
+    if (!key)
+        return false;
+    u32 mss_index = (cookie >> 24) & 0x7;
+    if ((cookie & 0xffffff) != syn_cookie_hash(key, tuple, peer_initial_sequence_number, period, mss_index))
+        return false;
+    peer_mss = syn_cookie_mss_table[mss_index];
+    return true;
+}
+
+void TCPSocket::send_syn_cookie(const IPv4Packet& ipv4_packet, const TCPPacket& syn)
+{
+    auto routing_decision = route_to(ipv4_packet.source(), ipv4_packet.destination());
+    if (routing_decision.is_zero())
+        return;
+
+    auto tuple = IPv4SocketTuple(ipv4_packet.destination(), syn.destination_port(), ipv4_packet.source(), syn.source_port());
+    auto options = parse_syn_options(syn);
+    u64 period = current_syn_cookie_period();
+    u32 cookie = make_syn_cookie(tuple, syn.sequence_number(), options.mss, period);
+    u16 local_mss = local_mss_for(*routing_decision.adapter);
+
+    size_t options_size = 4;
+    auto buffer = ByteBuffer::create_zeroed(sizeof(TCPPacket) + options_size);
+    auto& tcp_packet = *(TCPPacket*)(buffer.data());
+    tcp_packet.set_source_port(syn.destination_port());
+    tcp_packet.set_destination_port(syn.source_port());
+    tcp_packet.set_sequence_number(cookie);
+    tcp_packet.set_ack_number(syn.sequence_number() + 1);
+    tcp_packet.set_data_offset((sizeof(TCPPacket) + options_size) / sizeof(u32));
+    tcp_packet.set_flags(TCPFlags::SYN | TCPFlags::ACK);
+    tcp_packet.set_window_size(min(receive_buffer_capacity(), (size_t)0xffff));
+    auto* option_bytes = (u8*)&tcp_packet + sizeof(TCPPacket);
+    option_bytes[0] = TCPOptionKind::MaximumSegmentSize;
+    option_bytes[1] = 4;
+    option_bytes[2] = local_mss >> 8;
+    option_bytes[3] = local_mss & 0xff;
+    TransmitOffload offload;
+    checksum_outgoing_segment(*routing_decision.adapter, ipv4_packet.destination(), ipv4_packet.source(), tcp_packet, 0, offload);
+
+    routing_decision.adapter->send_ipv4(
+        routing_decision.next_hop, ipv4_packet.source(), IPv4Protocol::TCP,
+        buffer.data(), buffer.size(), ttl(), offload);
+    ++m_syn_cookies_sent;
+    m_last_syn_cookie_period = period;
+}
+
+RefPtr<TCPSocket> TCPSocket::create_client_from_syn_cookie(const IPv4Packet& ipv4_packet, const TCPPacket& packet)
+{
+    ASSERT(m_state == State::Listen);
+    // Cookies only stay valid for two periods, so unless we've sent some since, this can't be an answer to one.
+    u64 now = current_syn_cookie_period();
+    if (!m_syn_cookies_sent || m_last_syn_cookie_period + 1 < now)
+        return {};
+
+    auto tuple = IPv4SocketTuple(ipv4_packet.destination(), packet.destination_port(), ipv4_packet.source(), packet.source_port());
+    u32 cookie = packet.ack_number() - 1;
+    u16 peer_mss = 0;
+    if (!check_syn_cookie(tuple, packet.sequence_number() - 1, cookie, now, peer_mss))
+        return {};
+
+    if (pending_connection_count() >= backlog()) {
+        ++m_accept_queue_overflows;
+        return {};
+    }
+
+    auto client = create_client(tuple.local_address(), tuple.local_port(), tuple.peer_address(), tuple.peer_port());
+    if (!client)
+        return {};
+    ++m_syn_cookies_accepted;
+
+#ifdef TCP_SOCKET_DEBUG
+    kprintf("TCPSocket: accepted SYN cookie for %s, mss=%u\n", tuple.to_string().characters(), peer_mss);
+#endif
+
+    client->set_initial_sequence_number(cookie + 1);
+    client->set_ack_number(packet.sequence_number());
+    client->m_send_mss = peer_mss;
+    client->initialize_send_state(packet.window_size());
+    client->set_state(State::Established);
+    client->set_setup_state(SetupState::Completed);
+    client->release_to_originator();
+    return client;
 }
 
 TCPSocket::TCPSocket(int protocol)
     : IPv4Socket(SOCK_STREAM, protocol)
+    , m_retransmission_timeout_us(initial_retransmission_timeout_us)
 {
 }
 
 TCPSocket::~TCPSocket()
 {
-    LOCKER(sockets_by_tuple().lock());
-    sockets_by_tuple().resource().remove(tuple());
+    if (m_retransmit_timer_id)
+        TimerQueue::the().cancel_timer(m_retransmit_timer_id);
+    auto& table = sockets_by_tuple(tuple());
+    LOCKER(table.lock());
+    auto it = table.resource().find(tuple());
+    if (it != table.resource().end() && (*it).value == this)
+        table.resource().remove(it);
 }
 
 NonnullRefPtr<TCPSocket> TCPSocket::create(int protocol)
@@ -144,145 +460,456 @@ NonnullRefPtr<TCPSocket> TCPSocket::create(int protocol)
     return adopt(*new TCPSocket(protocol));
 }
 
-int TCPSocket::protocol_receive(const KBuffer& packet_buffer, void* buffer, size_t buffer_size, int flags)
+const u8* TCPSocket::protocol_stream_data(const IPv4Packet& ipv4_packet, size_t& data_size) const
 {
-    (void)flags;
-    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.data());
     auto& tcp_packet = *static_cast<const TCPPacket*>(ipv4_packet.payload());
-    size_t payload_size = packet_buffer.size() - sizeof(IPv4Packet) - tcp_packet.header_size();
+    data_size = ipv4_packet.payload_size() - tcp_packet.header_size();
 #ifdef TCP_SOCKET_DEBUG
-    kprintf("payload_size %u, will it fit in %u?\n", payload_size, buffer_size);
+    kprintf("protocol_stream_data: %u bytes\n", data_size);
 #endif
-    ASSERT(buffer_size >= payload_size);
-    memcpy(buffer, tcp_packet.payload(), payload_size);
-    return payload_size;
+    return (const u8*)tcp_packet.payload();
 }
 
 int TCPSocket::protocol_send(const void* data, size_t data_length)
 {
-    send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, data, data_length);
-    return data_length;
+    LOCKER(m_not_acked_lock);
+    size_t room = m_queued_bytes < send_buffer_size ? send_buffer_size - m_queued_bytes : 0;
+    size_t nqueued = min(data_length, room);
+    size_t mss = effective_send_mss();
+    for (size_t offset = 0; offset < nqueued;) {
+        size_t segment_size = min(nqueued - offset, mss);
+        enqueue_segment(TCPFlags::PUSH | TCPFlags::ACK, (const u8*)data + offset, segment_size);
+        offset += segment_size;
+    }
+    send_outgoing_packets();
+    return nqueued;
+}
+
+bool TCPSocket::can_write(const FileDescription& description) const
+{
+    return IPv4Socket::can_write(description) && m_queued_bytes < send_buffer_size;
+}
+
+void TCPSocket::protocol_did_read()
+{
+    if (m_state != State::Established)
+        return;
+    // Receiver side silly window avoidance (RFC 1122): only tell the peer about the room we've
+    // made once it's worth a full segment, or half the buffer.
+    u32 threshold = min((u32)m_local_mss, (u32)receive_buffer_capacity() / 2);
+    if (receive_window() >= m_last_advertised_window + threshold)
+        send_tcp_packet(TCPFlags::ACK);
+}
+
+u32 TCPSocket::effective_send_mss() const
+{
+    return max((u16)1, min(m_send_mss, m_local_mss));
+}
+
+u32 TCPSocket::receive_window() const
+{
+    u32 window = receive_buffer_space();
+    u8 scale = m_window_scaling ? receive_window_scale : 0;
+    return min(window, (u32)0xffff << scale);
 }
 
 void TCPSocket::send_tcp_packet(u16 flags, const void* payload, size_t payload_size)
 {
-    auto buffer = ByteBuffer::create_zeroed(sizeof(TCPPacket) + payload_size);
+    if ((flags & TCPFlags::SYN) || payload_size > 0) {
+        LOCKER(m_not_acked_lock);
+        enqueue_segment(flags, payload, payload_size);
+        send_outgoing_packets();
+        return;
+    }
+
+    // Segments that don't take up sequence space aren't retransmitted.
+    send_segment(flags, m_send_next, nullptr, 0, 0);
+}
+
+void TCPSocket::enqueue_segment(u16 flags, const void* payload, size_t payload_size)
+{
+    ASSERT(m_not_acked_lock.is_locked());
+    OutgoingPacket packet { m_sequence_number, flags, payload_size ? ByteBuffer::copy(payload, payload_size) : ByteBuffer() };
+    m_sequence_number += packet.sequence_length();
+    m_queued_bytes += payload_size;
+    m_not_acked.append(move(packet));
+}
+
+void TCPSocket::send_segment(u16 flags, u32 sequence_number, const u8* payload, size_t payload_size, u16 tso_segment_size)
+{
+    auto routing_decision = route_to(peer_address(), local_address());
+    ASSERT(!routing_decision.is_zero());
+
+    // SYNs carry our MSS, and offer window scaling (which a SYN|ACK may only accept.)
+    bool is_syn = flags & TCPFlags::SYN;
+    bool offer_window_scaling = is_syn && (!(flags & TCPFlags::ACK) || m_window_scaling);
+    size_t options_size = is_syn ? (offer_window_scaling ? 8 : 4) : 0;
+
+    auto buffer = ByteBuffer::create_zeroed(sizeof(TCPPacket) + options_size + payload_size);
     auto& tcp_packet = *(TCPPacket*)(buffer.data());
     ASSERT(local_port());
     tcp_packet.set_source_port(local_port());
     tcp_packet.set_destination_port(peer_port());
-    tcp_packet.set_window_size(1024);
-    tcp_packet.set_sequence_number(m_sequence_number);
-    tcp_packet.set_data_offset(sizeof(TCPPacket) / sizeof(u32));
+    tcp_packet.set_sequence_number(sequence_number);
+    tcp_packet.set_data_offset((sizeof(TCPPacket) + options_size) / sizeof(u32));
     tcp_packet.set_flags(flags);
 
+    // The window in a SYN is never scaled.
+    u32 window = receive_window();
+    if (is_syn)
+        tcp_packet.set_window_size(min(window, (u32)0xffff));
+    else
+        tcp_packet.set_window_size(window >> (m_window_scaling ? receive_window_scale : 0));
+    m_last_advertised_window = window;
+
     if (flags & TCPFlags::ACK)
         tcp_packet.set_ack_number(m_ack_number);
 
-    if (flags & TCPFlags::SYN) {
-        ++m_sequence_number;
-    } else {
-        m_sequence_number += payload_size;
+    if (is_syn) {
+        update_local_mss(*routing_decision.adapter);
+
+        auto* options = (u8*)&tcp_packet + sizeof(TCPPacket);
+        options[0] = TCPOptionKind::MaximumSegmentSize;
+        options[1] = 4;
+        options[2] = m_local_mss >> 8;
+        options[3] = m_local_mss & 0xff;
+        if (offer_window_scaling) {
+            options[4] = TCPOptionKind::NoOperation;
+            options[5] = TCPOptionKind::WindowScale;
+            options[6] = 3;
+            options[7] = receive_window_scale;
+        }
     }
 
     memcpy(tcp_packet.payload(), payload, payload_size);
-    tcp_packet.set_checksum(compute_tcp_checksum(local_address(), peer_address(), tcp_packet, payload_size));
+    TransmitOffload offload;
+    offload.tcp_segment_size = tso_segment_size;
+    checksum_outgoing_segment(*routing_decision.adapter, local_address(), peer_address(), tcp_packet, payload_size, offload);
 
-    if (tcp_packet.has_syn() || payload_size > 0) {
-        LOCKER(m_not_acked_lock);
-        m_not_acked.append({ m_sequence_number, move(buffer), 0, {} });
-        send_outgoing_packets();
-        return;
-    }
-
-    auto routing_decision = route_to(peer_address(), local_address());
-    ASSERT(!routing_decision.is_zero());
+#ifdef TCP_SOCKET_DEBUG
+    kprintf("sending tcp packet from %s:%u to %s:%u with (%s%s%s%s) seq_no=%u, ack_no=%u, window=%u, payload_size=%u\n",
+        local_address().to_string().characters(),
+        local_port(),
+        peer_address().to_string().characters(),
+        peer_port(),
+        tcp_packet.has_syn() ? "SYN " : "",
+        tcp_packet.has_ack() ? "ACK " : "",
+        tcp_packet.has_fin() ? "FIN " : "",
+        tcp_packet.has_rst() ? "RST " : "",
+        tcp_packet.sequence_number(),
+        tcp_packet.ack_number(),
+        window,
+        payload_size);
+#endif
 
     routing_decision.adapter->send_ipv4(
         routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-        buffer.data(), buffer.size(), ttl());
+        buffer.data(), buffer.size(), ttl(), offload);
 
-    m_packets_out++;
+    m_packets_out += tso_segment_size ? (payload_size + tso_segment_size - 1) / tso_segment_size : 1;
     m_bytes_out += buffer.size();
 }
 
+void TCPSocket::update_local_mss(const NetworkAdapter& adapter)
+{
+    m_local_mss = local_mss_for(adapter);
+}
+
+void TCPSocket::transmit(OutgoingPacket& packet, u64 now)
+{
+    if (packet.tx_counter)
+        ++m_retransmissions;
+    packet.tx_time = now;
+    packet.tx_counter++;
+    send_segment(packet.flags, packet.sequence_number, packet.payload.data(), packet.payload.size(), 0);
+}
+
+void TCPSocket::transmit_run(Vector<OutgoingPacket*>& run, u64 now)
+{
+    if (run.is_empty())
+        return;
+    if (run.size() == 1) {
+        transmit(*run.first(), now);
+        run.clear();
+        return;
+    }
+
+    // Hand the whole run to the device as one segment, and let it do the segmenting.
+    size_t payload_size = 0;
+    for (auto* packet : run)
+        payload_size += packet->payload.size();
+    auto payload = ByteBuffer::create_uninitialized(payload_size);
+    size_t offset = 0;
+    for (auto* packet : run) {
+        if (packet->tx_counter)
+            ++m_retransmissions;
+        packet->tx_time = now;
+        packet->tx_counter++;
+        memcpy(payload.data() + offset, packet->payload.data(), packet->payload.size());
+        offset += packet->payload.size();
+    }
+    send_segment(TCPFlags::PUSH | TCPFlags::ACK, run.first()->sequence_number, payload.data(), payload_size, effective_send_mss());
+    run.clear();
+}
+
 void TCPSocket::send_outgoing_packets()
 {
+    LOCKER(m_not_acked_lock);
+    auto now = PIT::nanoseconds_since_boot();
+
+    // Everything that fits in the window goes out as one burst.
     auto routing_decision = route_to(peer_address(), local_address());
-    ASSERT(!routing_decision.is_zero());
+    auto* adapter = routing_decision.adapter.ptr();
+    NetworkAdapter::TransmitBatch batch(adapter);
 
-    auto now = kgettimeofday();
+    // If the device can do TSO, consecutive data segments go out as one large segment.
+    bool can_use_tso = adapter && adapter->has_offload(NetworkAdapter::TCPSegmentationOffload) && adapter->has_offload(NetworkAdapter::TCPChecksumOffload);
+    Vector<OutgoingPacket*> run;
+    size_t run_size = 0;
 
-    LOCKER(m_not_acked_lock);
+    u32 window = min(m_congestion_window, m_send_window);
     for (auto& packet : m_not_acked) {
-        timeval diff;
-        timeval_sub(packet.tx_time, now, diff);
-        if (diff.tv_sec < 1 && diff.tv_usec <= 500000)
+        if (sequence_less_than(packet.sequence_number, m_send_next))
+            continue;
+        u32 in_flight = m_send_next - m_send_unacknowledged;
+        // Nothing is known about the peer's window until it has answered our SYN.
+        bool is_syn = packet.flags & TCPFlags::SYN;
+        if (!is_syn && in_flight + packet.payload.size() > window)
+            break;
+        m_send_next = packet.sequence_number + packet.sequence_length();
+
+        bool can_join_run = can_use_tso && packet.flags == (TCPFlags::PUSH | TCPFlags::ACK) && !packet.payload.is_empty();
+        if (!can_join_run || run_size + packet.payload.size() > maximum_tso_payload_size) {
+            transmit_run(run, now);
+            run_size = 0;
+        }
+        if (!can_join_run) {
+            transmit(packet, now);
             continue;
+        }
+        run.append(&packet);
+        run_size += packet.payload.size();
+    }
+    transmit_run(run, now);
+
+    // Keep a timer running while anything is in flight, and while the peer's window is
+    // too small for what's queued (so that we probe it once the timer runs out.)
+    if (m_send_unacknowledged != m_sequence_number && !m_retransmit_deadline)
+        start_retransmit_timer();
+}
+
+void TCPSocket::start_retransmit_timer()
+{
+    m_retransmit_deadline = PIT::nanoseconds_since_boot() + (u64)m_retransmission_timeout_us * 1000;
+    if (m_retransmit_timer_id)
+        return;
+    // The timer only wakes up the network task, which checks the deadline (since it may have
+    // moved later in the meantime.)
+    auto timer = make<Timer>();
+    timer->expires = m_retransmit_deadline;
+    timer->callback = [this] {
+        m_retransmit_timer_id = 0;
+        NetworkTask_wake_for_tcp_timers();
+    };
+    m_retransmit_timer_id = TimerQueue::the().add_timer(move(timer));
+}
+
+void TCPSocket::retransmit_if_timed_out()
+{
+    LOCKER(m_not_acked_lock);
+    if (!m_retransmit_deadline)
+        return;
+
+    auto now = PIT::nanoseconds_since_boot();
+    if (now < m_retransmit_deadline) {
+        if (!m_retransmit_timer_id) {
+            u64 deadline = m_retransmit_deadline;
+            start_retransmit_timer();
+            m_retransmit_deadline = deadline;
+        }
+        return;
+    }
 
-        packet.tx_time = now;
-        packet.tx_counter++;
+    m_retransmit_deadline = 0;
+    if (m_not_acked.is_empty())
+        return;
+
+    // Don't let half-open connections that the peer never completes hang around forever.
+    if (m_state == State::SynReceived && m_direction == Direction::Incoming && m_not_acked.first().tx_counter > maximum_syn_ack_retransmissions) {
+        if (m_originator)
+            ++m_originator->m_half_open_connections_expired;
+        set_state(State::Closed);
+        return;
+    }
+
+    // The segments in flight are presumed lost: start over from the oldest one with a single
+    // segment's worth of congestion window (RFC 5681), and back off the timer (RFC 6298.)
+    u32 mss = effective_send_mss();
+    u32 in_flight = m_send_next - m_send_unacknowledged;
+    m_slow_start_threshold = max(in_flight / 2, 2 * mss);
+    m_congestion_window = mss;
+    m_in_fast_recovery = false;
+    m_duplicate_ack_count = 0;
+    m_retransmission_timeout_us = min(m_retransmission_timeout_us * 2, maximum_retransmission_timeout_us);
 
 #ifdef TCP_SOCKET_DEBUG
-        auto& tcp_packet = *(TCPPacket*)(packet.buffer.data());
-        kprintf("sending tcp packet from %s:%u to %s:%u with (%s%s%s%s) seq_no=%u, ack_no=%u, tx_counter=%u\n",
-            local_address().to_string().characters(),
-            local_port(),
-            peer_address().to_string().characters(),
-            peer_port(),
-            tcp_packet.has_syn() ? "SYN " : "",
-            tcp_packet.has_ack() ? "ACK " : "",
-            tcp_packet.has_fin() ? "FIN " : "",
-            tcp_packet.has_rst() ? "RST " : "",
-            tcp_packet.sequence_number(),
-            tcp_packet.ack_number(),
-            packet.tx_counter);
+    dbg() << "TCPSocket: retransmission timeout, resending from " << m_send_unacknowledged << ", next timeout " << m_retransmission_timeout_us << " us";
 #endif
-        routing_decision.adapter->send_ipv4(
-            routing_decision.next_hop, peer_address(), IPv4Protocol::TCP,
-            packet.buffer.data(), packet.buffer.size(), ttl());
 
-        m_packets_out++;
-        m_bytes_out += packet.buffer.size();
+    // Send the oldest segment even if the peer's window is closed, to probe it.
+    auto& oldest = m_not_acked.first();
+    transmit(oldest, now);
+    m_send_next = oldest.sequence_number + oldest.sequence_length();
+    send_outgoing_packets();
+}
+
+void TCPSocket::update_rtt(u64 sample_ns)
+{
+    u32 sample = min(sample_ns / 1000, (u64)maximum_retransmission_timeout_us);
+    if (!m_has_rtt_sample) {
+        m_smoothed_rtt_us = sample;
+        m_rtt_variance_us = sample / 2;
+        m_has_rtt_sample = true;
+    } else {
+        u32 delta = m_smoothed_rtt_us > sample ? m_smoothed_rtt_us - sample : sample - m_smoothed_rtt_us;
+        m_rtt_variance_us = (3 * m_rtt_variance_us + delta) / 4;
+        m_smoothed_rtt_us = (7 * m_smoothed_rtt_us + sample) / 8;
     }
+    // The clock granularity term is our scheduler tick.
+    u32 timeout = m_smoothed_rtt_us + max((u32)1000, 4 * m_rtt_variance_us);
+    m_retransmission_timeout_us = max(minimum_retransmission_timeout_us, min(timeout, maximum_retransmission_timeout_us));
 }
 
-void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
+void TCPSocket::process_syn_options(const TCPPacket& packet)
 {
-    if (packet.has_ack()) {
-        u32 ack_number = packet.ack_number();
+    auto options = parse_syn_options(packet);
+    m_send_mss = options.mss;
 
-#ifdef TCP_SOCKET_DEBUG
-        dbg() << "TCPSocket: receive_tcp_packet: " << ack_number;
-#endif
+    // If we sent the SYN, we offered window scaling. If we're answering one, we'll only
+    // offer it back if the peer did.
+    m_window_scaling = options.window_scaling;
+    m_send_window_scale = options.window_scaling ? options.window_scale : 0;
+    initialize_send_state(packet.window_size());
+}
 
-        int removed = 0;
-        LOCKER(m_not_acked_lock);
+void TCPSocket::initialize_send_state(u32 send_window)
+{
+    m_send_window = send_window;
+
+    // Initial window (RFC 6928.)
+    auto routing_decision = route_to(peer_address(), local_address());
+    if (!routing_decision.is_zero())
+        update_local_mss(*routing_decision.adapter);
+    u32 mss = effective_send_mss();
+    m_congestion_window = min(10 * mss, max(2 * mss, (u32)14600));
+}
+
+void TCPSocket::process_ack(const TCPPacket& packet, size_t payload_size)
+{
+    LOCKER(m_not_acked_lock);
+    u32 ack_number = packet.ack_number();
+    u32 window = packet.has_syn() ? packet.window_size() : (u32)packet.window_size() << m_send_window_scale;
+
+    // Ignore acknowledgements for things we haven't even queued.
+    if (sequence_less_than(m_sequence_number, ack_number))
+        return;
+
+    auto now = PIT::nanoseconds_since_boot();
+    u32 mss = effective_send_mss();
+
+    if (sequence_less_than(m_send_unacknowledged, ack_number)) {
+        u32 acknowledged = ack_number - m_send_unacknowledged;
+        u64 rtt_sample = 0;
+        bool have_rtt_sample = false;
         while (!m_not_acked.is_empty()) {
-            auto& packet = m_not_acked.first();
+            auto& oldest = m_not_acked.first();
+            if (sequence_less_than(ack_number, oldest.sequence_number + oldest.sequence_length()))
+                break;
+            // Karn's algorithm: retransmitted segments can't tell us anything about the RTT.
+            if (oldest.tx_counter == 1) {
+                rtt_sample = now - oldest.tx_time;
+                have_rtt_sample = true;
+            }
+            m_queued_bytes -= oldest.payload.size();
+            m_not_acked.take_first();
+        }
+        if (have_rtt_sample)
+            update_rtt(rtt_sample);
 
-#ifdef TCP_SOCKET_DEBUG
-            dbg() << "TCPSocket: iterate: " << packet.ack_number;
-#endif
+        m_send_unacknowledged = ack_number;
+        if (sequence_less_than(m_send_next, ack_number))
+            m_send_next = ack_number;
+        m_send_window = window;
+        m_duplicate_ack_count = 0;
 
-            if (packet.ack_number <= ack_number) {
-                m_not_acked.take_first();
-                removed++;
+        if (m_in_fast_recovery) {
+            if (!sequence_less_than(ack_number, m_recover)) {
+                m_congestion_window = m_slow_start_threshold;
+                m_in_fast_recovery = false;
             } else {
-                break;
+                // A partial acknowledgement means the next segment was lost as well.
+                if (!m_not_acked.is_empty())
+                    transmit(m_not_acked.first(), now);
+                m_congestion_window = (m_congestion_window > acknowledged ? m_congestion_window - acknowledged : 0) + mss;
             }
+        } else if (m_congestion_window < m_slow_start_threshold) {
+            m_congestion_window += min(acknowledged, mss);
+        } else {
+            m_congestion_window += max((u32)1, (u32)((u64)mss * mss / m_congestion_window));
         }
+        m_congestion_window = min(m_congestion_window, maximum_congestion_window);
+
+        if (m_send_next == m_send_unacknowledged)
+            m_retransmit_deadline = 0;
+        else
+            start_retransmit_timer();
 
+        // There's room in the send queue again.
+        notify_blockers();
+    } else if (ack_number == m_send_unacknowledged) {
+        bool is_duplicate = payload_size == 0 && !packet.has_syn() && !packet.has_fin()
+            && window == m_send_window && m_send_next != m_send_unacknowledged;
+        m_send_window = window;
+        if (is_duplicate) {
+            ++m_duplicate_ack_count;
+            if (m_in_fast_recovery) {
+                // Every duplicate means another segment has left the network.
+                m_congestion_window += mss;
+            } else if (m_duplicate_ack_count == 3) {
+                // Fast retransmit, and go into fast recovery (RFC 6582.)
+                u32 in_flight = m_send_next - m_send_unacknowledged;
+                m_slow_start_threshold = max(in_flight / 2, 2 * mss);
+                transmit(m_not_acked.first(), now);
+                m_congestion_window = m_slow_start_threshold + 3 * mss;
+                m_in_fast_recovery = true;
+                m_recover = m_send_next;
 #ifdef TCP_SOCKET_DEBUG
-        dbg() << "TCPSocket: receive_tcp_packet acknowledged " << removed << " packets";
+                dbg() << "TCPSocket: fast retransmit from " << m_send_unacknowledged;
 #endif
+            }
+        }
     }
 
+    send_outgoing_packets();
+}
+
+void TCPSocket::receive_tcp_packet(const TCPPacket& packet, u16 size)
+{
+    if (packet.has_syn() && m_state == State::Listen)
+        m_syns_received++;
+
+    if (packet.has_syn() && m_state == State::SynSent)
+        process_syn_options(packet);
+
+    if (packet.has_ack())
+        process_ack(packet, size - packet.header_size());
+
     m_packets_in++;
     m_bytes_in += packet.header_size() + size;
 }
 
-NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, u16 payload_size)
+// The ones' complement sum of the pseudo-header, without the final complement.
+static u16 tcp_pseudo_header_checksum(const IPv4Address& source, const IPv4Address& destination, u16 tcp_length)
 {
     struct [[gnu::packed]] PseudoHeader
     {
@@ -293,7 +920,7 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
         NetworkOrdered<u16> payload_size;
     };
 
-    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, sizeof(TCPPacket) + payload_size };
+    PseudoHeader pseudo_header { source, destination, 0, (u8)IPv4Protocol::TCP, tcp_length };
 
     u32 checksum = 0;
     auto* w = (const NetworkOrdered<u16>*)&pseudo_header;
@@ -302,13 +929,18 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
         if (checksum > 0xffff)
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
-    w = (const NetworkOrdered<u16>*)&packet;
-    for (size_t i = 0; i < sizeof(packet) / sizeof(u16); ++i) {
+    return checksum;
+}
+
+NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, u16 payload_size)
+{
+    u32 checksum = tcp_pseudo_header_checksum(source, destination, packet.header_size() + payload_size);
+    auto* w = (const NetworkOrdered<u16>*)&packet;
+    for (size_t i = 0; i < packet.header_size() / sizeof(u16); ++i) {
         checksum += w[i];
         if (checksum > 0xffff)
             checksum = (checksum >> 16) + (checksum & 0xffff);
     }
-    ASSERT(packet.data_offset() * 4 == sizeof(TCPPacket));
     w = (const NetworkOrdered<u16>*)packet.payload();
     for (size_t i = 0; i < payload_size / sizeof(u16); ++i) {
         checksum += w[i];
@@ -324,6 +956,20 @@ NetworkOrdered<u16> TCPSocket::compute_tcp_checksum(const IPv4Address& source, c
     return ~(checksum & 0xffff);
 }
 
+void TCPSocket::checksum_outgoing_segment(const NetworkAdapter& adapter, const IPv4Address& source, const IPv4Address& destination, TCPPacket& packet, u16 payload_size, TransmitOffload& offload)
+{
+    if (!adapter.has_offload(NetworkAdapter::TCPChecksumOffload)) {
+        ASSERT(!offload.tcp_segment_size);
+        packet.set_checksum(compute_tcp_checksum(source, destination, packet, payload_size));
+        return;
+    }
+    // The device sums up the segment itself, starting from the pseudo-header we leave in the
+    // checksum field. With TSO, it also adds in the length of each segment it cuts out.
+    u16 tcp_length = offload.tcp_segment_size ? 0 : packet.header_size() + payload_size;
+    packet.set_checksum(tcp_pseudo_header_checksum(source, destination, tcp_length));
+    offload.tcp_checksum = true;
+}
+
 KResult TCPSocket::protocol_bind()
 {
     if (has_specific_local_address() && !m_adapter) {
@@ -337,10 +983,13 @@ KResult TCPSocket::protocol_bind()
 
 KResult TCPSocket::protocol_listen()
 {
-    LOCKER(sockets_by_tuple().lock());
-    if (sockets_by_tuple().resource().contains(tuple()))
+    auto& table = sockets_by_tuple(tuple());
+    LOCKER(table.lock());
+    if (table.resource().contains(tuple()))
         return KResult(-EADDRINUSE);
-    sockets_by_tuple().resource().set(tuple(), this);
+    table.resource().set(tuple(), this);
+    // The backlog bounds both the SYN queue and the accept queue.
+    set_backlog(clamp(backlog(), 1, maximum_listen_backlog));
     set_direction(Direction::Passive);
     set_state(State::Listen);
     set_setup_state(SetupState::Completed);
@@ -357,7 +1006,7 @@ KResult TCPSocket::protocol_connect(FileDescription& description, ShouldBlock sh
 
     allocate_local_port_if_needed();
 
-    m_sequence_number = get_good_random<u32>();
+    set_initial_sequence_number(get_good_random<u32>());
     m_ack_number = 0;
 
     set_setup_state(SetupState::InProgress);
@@ -387,14 +1036,15 @@ int TCPSocket::protocol_allocate_local_port()
     static const u16 ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
     u16 first_scan_port = first_ephemeral_port + get_good_random<u16>() % ephemeral_port_range_size;
 
-    LOCKER(sockets_by_tuple().lock());
     for (u16 port = first_scan_port;;) {
         IPv4SocketTuple proposed_tuple(local_address(), port, peer_address(), peer_port());
 
-        auto it = sockets_by_tuple().resource().find(proposed_tuple);
-        if (it == sockets_by_tuple().resource().end()) {
+        auto& table = sockets_by_tuple(proposed_tuple);
+        LOCKER(table.lock());
+        auto it = table.resource().find(proposed_tuple);
+        if (it == table.resource().end()) {
             set_local_port(port);
-            sockets_by_tuple().resource().set(proposed_tuple, this);
+            table.resource().set(proposed_tuple, this);
             return port;
         }
         ++port;
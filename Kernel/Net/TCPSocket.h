@@ -31,6 +31,7 @@
 #include <AK/SinglyLinkedList.h>
 #include <AK/WeakPtr.h>
 #include <Kernel/Net/IPv4Socket.h>
+#include <Kernel/Net/TCP.h>
 
 class TCPSocket final : public IPv4Socket
     , public Weakable<TCPSocket> {
@@ -139,19 +140,49 @@ public:
     void set_error(Error error) { m_error = error; }
 
     void set_ack_number(u32 n) { m_ack_number = n; }
-    void set_sequence_number(u32 n) { m_sequence_number = n; }
+    void set_initial_sequence_number(u32 n)
+    {
+        m_sequence_number = n;
+        m_send_next = n;
+        m_send_unacknowledged = n;
+    }
     u32 ack_number() const { return m_ack_number; }
     u32 sequence_number() const { return m_sequence_number; }
     u32 packets_in() const { return m_packets_in; }
     u32 bytes_in() const { return m_bytes_in; }
     u32 packets_out() const { return m_packets_out; }
     u32 bytes_out() const { return m_bytes_out; }
+    u32 retransmissions() const { return m_retransmissions; }
+    u32 congestion_window() const { return m_congestion_window; }
+    u32 send_window() const { return m_send_window; }
+    u32 smoothed_rtt_us() const { return m_smoothed_rtt_us; }
+
+    // Listening sockets only: how many connections are half-open or waiting for accept(), and
+    // what has happened to incoming connection attempts.
+    int listen_backlog() const { return backlog(); }
+    size_t syn_queue_length() const { return m_pending_release_for_accept.size(); }
+    size_t accept_queue_length() const { return pending_connection_count(); }
+    u32 syns_received() const { return m_syns_received; }
+    u32 syns_dropped() const { return m_syns_dropped; }
+    u32 syn_cookies_sent() const { return m_syn_cookies_sent; }
+    u32 syn_cookies_accepted() const { return m_syn_cookies_accepted; }
+    u32 connections_established() const { return m_connections_established; }
+    u32 accept_queue_overflows() const { return m_accept_queue_overflows; }
+    u32 half_open_connections_expired() const { return m_half_open_connections_expired; }
 
     void send_tcp_packet(u16 flags, const void* = nullptr, size_t = 0);
     void send_outgoing_packets();
     void receive_tcp_packet(const TCPPacket&, u16 size);
+    void process_syn_options(const TCPPacket&);
+
+    // Called by the network task once a retransmission timer may have run out.
+    void retransmit_if_timed_out();
+
+    virtual bool can_write(const FileDescription&) const override;
 
-    static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& sockets_by_tuple();
+    // Sockets are spread over several independently locked tables by tuple, so lookups for
+    // unrelated connections don't all contend for one lock.
+    static Lockable<HashMap<IPv4SocketTuple, TCPSocket*>>& sockets_by_tuple(const IPv4SocketTuple&);
     static RefPtr<TCPSocket> from_tuple(const IPv4SocketTuple& tuple);
     static RefPtr<TCPSocket> from_endpoints(const IPv4Address& local_address, u16 local_port, const IPv4Address& peer_address, u16 peer_port);
 
@@ -161,6 +192,17 @@ public:
     void release_to_originator();
     void release_for_accept(RefPtr<TCPSocket>);
 
+    // Decides what a listening socket does with an incoming SYN. Connections that have nowhere
+    // to go are dropped, and once the SYN queue is full they're answered with a SYN cookie.
+    enum class SYNDisposition {
+        CreateClient,
+        SendCookie,
+        Drop,
+    };
+    SYNDisposition disposition_for_syn();
+    void send_syn_cookie(const IPv4Packet&, const TCPPacket&);
+    RefPtr<TCPSocket> create_client_from_syn_cookie(const IPv4Packet&, const TCPPacket&);
+
 protected:
     void set_direction(Direction direction) { m_direction = direction; }
 
@@ -169,35 +211,94 @@ private:
     virtual const char* class_name() const override { return "TCPSocket"; }
 
     static NetworkOrdered<u16> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, u16 payload_size);
+    static void checksum_outgoing_segment(const NetworkAdapter&, const IPv4Address& source, const IPv4Address& destination, TCPPacket&, u16 payload_size, TransmitOffload&);
 
-    virtual int protocol_receive(const KBuffer&, void* buffer, size_t buffer_size, int flags) override;
+    virtual const u8* protocol_stream_data(const IPv4Packet&, size_t& data_size) const override;
     virtual int protocol_send(const void*, size_t) override;
     virtual KResult protocol_connect(FileDescription&, ShouldBlock) override;
     virtual int protocol_allocate_local_port() override;
     virtual bool protocol_is_disconnected() const override;
     virtual KResult protocol_bind() override;
     virtual KResult protocol_listen() override;
+    virtual void protocol_did_read() override;
+
+    struct OutgoingPacket {
+        u32 sequence_number;
+        u16 flags;
+        ByteBuffer payload;
+        int tx_counter { 0 };
+        u64 tx_time { 0 };
+
+        u32 sequence_length() const { return payload.size() + ((flags & TCPFlags::SYN) ? 1 : 0); }
+    };
+
+    void enqueue_segment(u16 flags, const void* payload, size_t payload_size);
+    void send_segment(u16 flags, u32 sequence_number, const u8* payload, size_t payload_size, u16 tso_segment_size);
+    void transmit(OutgoingPacket&, u64 now);
+    void transmit_run(Vector<OutgoingPacket*>&, u64 now);
+    void update_local_mss(const NetworkAdapter&);
+    void initialize_send_state(u32 send_window);
+    void forget_half_open_connection(TCPSocket&);
+    void process_ack(const TCPPacket&, size_t payload_size);
+    void update_rtt(u64 sample_ns);
+    void start_retransmit_timer();
+    u32 effective_send_mss() const;
+    u32 receive_window() const;
 
     WeakPtr<TCPSocket> m_originator;
     HashMap<IPv4SocketTuple, NonnullRefPtr<TCPSocket>> m_pending_release_for_accept;
     Direction m_direction { Direction::Unspecified };
     Error m_error { Error::None };
     WeakPtr<NetworkAdapter> m_adapter;
+    // m_sequence_number is where the next queued byte goes. Everything before m_send_next has
+    // been sent, and everything before m_send_unacknowledged has been acknowledged too.
     u32 m_sequence_number { 0 };
+    u32 m_send_next { 0 };
+    u32 m_send_unacknowledged { 0 };
     u32 m_ack_number { 0 };
     State m_state { State::Closed };
     u32 m_packets_in { 0 };
     u32 m_bytes_in { 0 };
     u32 m_packets_out { 0 };
     u32 m_bytes_out { 0 };
+    u32 m_retransmissions { 0 };
 
-    struct OutgoingPacket {
-        u32 ack_number;
-        ByteBuffer buffer;
-        int tx_counter { 0 };
-        timeval tx_time;
-    };
+    u32 m_syns_received { 0 };
+    u32 m_syns_dropped { 0 };
+    u32 m_syn_cookies_sent { 0 };
+    u32 m_syn_cookies_accepted { 0 };
+    u64 m_last_syn_cookie_period { 0 };
+    u32 m_connections_established { 0 };
+    u32 m_accept_queue_overflows { 0 };
+    u32 m_half_open_connections_expired { 0 };
+
+    // Flow control: what the peer told us it has room for, and the largest segments it takes.
+    // Window scale shifts are only used if both sides offered them in their SYN.
+    u32 m_send_window { 0 };
+    u16 m_send_mss { 536 };
+    u16 m_local_mss { 536 };
+    u8 m_send_window_scale { 0 };
+    bool m_window_scaling { false };
+    u32 m_last_advertised_window { 0 };
+
+    // Congestion control (NewReno, RFC 5681 and RFC 6582.)
+    u32 m_congestion_window { 0 };
+    u32 m_slow_start_threshold { 0xffffffff };
+    u32 m_duplicate_ack_count { 0 };
+    bool m_in_fast_recovery { false };
+    u32 m_recover { 0 };
+
+    // Retransmission timer (RFC 6298.)
+    bool m_has_rtt_sample { false };
+    u32 m_smoothed_rtt_us { 0 };
+    u32 m_rtt_variance_us { 0 };
+    u32 m_retransmission_timeout_us;
+    u64 m_retransmit_deadline { 0 };
+    u64 m_retransmit_timer_id { 0 };
 
+    // Segments that have been queued but not yet acknowledged, oldest first.
+    // Those before m_send_next are in flight.
     Lock m_not_acked_lock { "TCPSocket unacked packets" };
     SinglyLinkedList<OutgoingPacket> m_not_acked;
+    size_t m_queued_bytes { 0 };
 };
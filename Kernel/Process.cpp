@@ -66,6 +66,7 @@
 #include <Kernel/Syscall.h>
 #include <Kernel/TTY/MasterPTY.h>
 #include <Kernel/Thread.h>
+#include <Kernel/TimerQueue.h>
 #include <Kernel/VM/InodeVMObject.h>
 #include <Kernel/VM/PurgeableVMObject.h>
 #include <LibC/errno_numbers.h>
@@ -113,11 +114,50 @@ void Process::initialize()
     create_kernel_info_page();
 }
 
-void Process::update_info_page_timestamp(const timeval& tv)
+// Userspace extrapolates from the last update with the TSC, which may run ahead of the PIT.
+// Never give it a time before what it could have extrapolated at the given TSC value.
+static u64 clamp_to_info_page_clock(u64 nanoseconds_since_boot, u64 tsc)
 {
     auto* info_page = (KernelInfoPage*)s_info_page_address_for_kernel.as_ptr();
+    if (!info_page->tsc_multiplier || !info_page->tsc_at_update)
+        return nanoseconds_since_boot;
+    // LibC asks us instead once the TSC has moved on too far, so this has to keep up with the most it could have seen.
+    u64 ticks = tsc > info_page->tsc_at_update ? min(tsc - info_page->tsc_at_update, (u64)0xffffffff) : 0;
+    u64 extrapolated = info_page->monotonic_ns + ((ticks * info_page->tsc_multiplier) >> info_page->tsc_shift);
+    return max(nanoseconds_since_boot, extrapolated);
+}
+
+static u64 info_page_clock_now()
+{
+    InterruptDisabler disabler;
+    u64 nanoseconds_since_boot = PIT::nanoseconds_since_boot();
+    return PIT::tsc_frequency() ? clamp_to_info_page_clock(nanoseconds_since_boot, read_tsc()) : nanoseconds_since_boot;
+}
+
+void Process::update_info_page_clock(u64 nanoseconds_since_boot)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto* info_page = (KernelInfoPage*)s_info_page_address_for_kernel.as_ptr();
+
     info_page->serial++;
+    asm volatile("" ::: "memory");
+
+    // Readers are locked out now, so none of them can extrapolate from the old values past this TSC.
+    u64 tsc = 0;
+    if (PIT::tsc_frequency()) {
+        tsc = read_tsc();
+        nanoseconds_since_boot = clamp_to_info_page_clock(nanoseconds_since_boot, tsc);
+    }
+
+    timeval tv;
+    tv.tv_sec = info_page->boot_time + nanoseconds_since_boot / 1000000000;
+    tv.tv_usec = (nanoseconds_since_boot % 1000000000) / 1000;
+
     const_cast<timeval&>(info_page->now) = tv;
+    info_page->monotonic_ns = nanoseconds_since_boot;
+    info_page->tsc_at_update = tsc;
+    asm volatile("" ::: "memory");
+    info_page->serial++;
 }
 
 Vector<pid_t> Process::all_pids()
@@ -234,13 +274,38 @@ bool Process::deallocate_region(Region& region)
     InterruptDisabler disabler;
     if (m_region_lookup_cache.region == &region)
         m_region_lookup_cache.region = nullptr;
-    for (int i = 0; i < m_regions.size(); ++i) {
-        if (&m_regions[i] == &region) {
-            m_regions.remove(i);
-            return true;
-        }
+    size_t index = region_index_after(region.vaddr());
+    if (index == 0 || &m_regions[index - 1] != &region)
+        return false;
+    m_regions.remove(index - 1);
+    return true;
+}
+
+size_t Process::region_index_after(VirtualAddress vaddr) const
+{
+    // m_regions is sorted by base address and regions never overlap, so the only region
+    // that can contain vaddr is the one right before this index.
+    size_t low = 0;
+    size_t high = m_regions.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (m_regions[middle].vaddr() <= vaddr)
+            low = middle + 1;
+        else
+            high = middle;
     }
-    return false;
+    return low;
+}
+
+Region* Process::region_containing(VirtualAddress vaddr)
+{
+    size_t index = region_index_after(vaddr);
+    if (index == 0)
+        return nullptr;
+    auto& region = m_regions[index - 1];
+    if (!region.contains(vaddr))
+        return nullptr;
+    return &region;
 }
 
 Region* Process::region_from_range(const Range& range)
@@ -249,23 +314,20 @@ Region* Process::region_from_range(const Range& range)
         return m_region_lookup_cache.region;
 
     size_t size = PAGE_ROUND_UP(range.size());
-    for (auto& region : m_regions) {
-        if (region.vaddr() == range.base() && region.size() == size) {
-            m_region_lookup_cache.range = range;
-            m_region_lookup_cache.region = &region;
-            return &region;
-        }
-    }
-    return nullptr;
+    auto* region = region_containing(range.base());
+    if (!region || region->vaddr() != range.base() || region->size() != size)
+        return nullptr;
+    m_region_lookup_cache.range = range;
+    m_region_lookup_cache.region = region;
+    return region;
 }
 
 Region* Process::region_containing(const Range& range)
 {
-    for (auto& region : m_regions) {
-        if (region.contains(range))
-            return &region;
-    }
-    return nullptr;
+    auto* region = region_containing(range.base());
+    if (!region || !region->contains(range))
+        return nullptr;
+    return region;
 }
 
 int Process::sys$set_mmap_name(const Syscall::SC_set_mmap_name_params* user_params)
@@ -688,13 +750,19 @@ pid_t Process::sys$fork(RegisterDump& regs)
 #ifdef FORK_DEBUG
         dbg() << "fork: cloning Region{" << &region << "} '" << region.name() << "' @ " << region.vaddr();
 #endif
+        // The child's page tables are filled in lazily as it faults, which is
+        // very little work if all it does is exec.
         auto& child_region = child->add_region(region.clone());
-        child_region.map(child->page_directory());
+        child_region.set_page_directory(child->page_directory());
 
         if (&region == m_master_tls_region)
             child->m_master_tls_region = &child_region;
     }
 
+    // Cloning write-protected our own mappings without flushing them one at a time.
+    // Reloading CR3 gets rid of all the stale (non-global) user entries at once.
+    MM.enter_process_paging_scope(*this);
+
     child->m_extra_gids = m_extra_gids;
 
     auto& child_tss = child_first_thread->m_tss;
@@ -715,6 +783,15 @@ pid_t Process::sys$fork(RegisterDump& regs)
     child_tss.gs = regs.gs;
     child_tss.ss = regs.userspace_ss;
 
+    // A signal can get dispatched to the child before it has run and faulted anything in, and the
+    // scheduler can't take page faults. Have the pages a signal frame would go on ready for writing.
+    VirtualAddress signal_frame_base(regs.userspace_esp - Thread::max_signal_frame_size);
+    for (auto page = signal_frame_base.page_base(); page < VirtualAddress(regs.userspace_esp); page = page.offset(PAGE_SIZE)) {
+        auto* region = MM.region_from_vaddr(*child, page);
+        if (region && region->is_user_accessible())
+            region->prepare_page_for_write(region->page_index_from_address(page));
+    }
+
 #ifdef FORK_DEBUG
     dbgprintf("fork: child will begin executing at %w:%x with stack %w:%x, kstack %w:%x\n", child_tss.cs, child_tss.eip, child_tss.ss, child_tss.esp, child_tss.ss0, child_tss.esp0);
 #endif
@@ -816,10 +893,14 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     OwnPtr<ELFLoader> loader;
     {
         ArmedScopeGuard rollback_regions_guard([&]() {
-            ASSERT(&current->process() == this);
             m_page_directory = move(old_page_directory);
+            // Get off the half-built page directory before its regions go away.
+            // posix_spawn() execs a child that isn't running yet, so we go back to the caller's instead.
+            if (&current->process() == this)
+                MM.enter_process_paging_scope(*this);
+            else
+                MM.enter_process_paging_scope(current->process());
             m_regions = move(old_regions);
-            MM.enter_process_paging_scope(*this);
         });
 
         loader = make<ELFLoader>(region->vaddr().as_ptr(), loader_metadata.size);
@@ -913,10 +994,6 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
             m_egid = main_program_metadata.gid;
     }
 
-    current->set_default_signal_dispositions();
-    current->m_signal_mask = 0;
-    current->m_pending_signals = 0;
-
     m_futex_queues.clear();
 
     for (int i = 0; i < m_fds.size(); ++i) {
@@ -939,6 +1016,10 @@ int Process::do_exec(NonnullRefPtr<FileDescription> main_program_description, Ve
     }
     ASSERT(new_main_thread);
 
+    new_main_thread->set_default_signal_dispositions();
+    new_main_thread->m_signal_mask = 0;
+    new_main_thread->m_pending_signals = 0;
+
     // NOTE: We create the new stack before disabling interrupts since it will zero-fault
     //       and we don't want to deal with faults after this point.
     u32 new_userspace_esp = new_main_thread->make_userspace_stack_for_main_thread(move(arguments), move(environment));
@@ -1188,29 +1269,12 @@ int Process::sys$execve(const Syscall::SC_execve_params* user_params)
         path = path_arg.value();
     }
 
-    auto copy_user_strings = [&](const auto& list, auto& output) {
-        if (!list.length)
-            return true;
-        if (!validate_read_typed(list.strings, list.length))
-            return false;
-        Vector<Syscall::StringArgument, 32> strings;
-        strings.resize(list.length);
-        copy_from_user(strings.data(), list.strings, list.length * sizeof(Syscall::StringArgument));
-        for (size_t i = 0; i < list.length; ++i) {
-            auto string = validate_and_copy_string_from_user(strings[i]);
-            if (string.is_null())
-                return false;
-            output.append(move(string));
-        }
-        return true;
-    };
-
     Vector<String> arguments;
-    if (!copy_user_strings(params.arguments, arguments))
+    if (!validate_and_copy_strings_from_user(params.arguments, arguments))
         return -EFAULT;
 
     Vector<String> environment;
-    if (!copy_user_strings(params.environment, environment))
+    if (!validate_and_copy_strings_from_user(params.environment, environment))
         return -EFAULT;
 
     int rc = exec(move(path), move(arguments), move(environment));
@@ -1218,6 +1282,182 @@ int Process::sys$execve(const Syscall::SC_execve_params* user_params)
     return rc;
 }
 
+pid_t Process::sys$posix_spawn(const Syscall::SC_posix_spawn_params* user_params)
+{
+    REQUIRE_PROMISE(proc);
+    REQUIRE_PROMISE(exec);
+    Syscall::SC_posix_spawn_params params;
+    if (!validate_read_and_copy_typed(&params, user_params))
+        return -EFAULT;
+
+    if (params.arguments.length > ARG_MAX || params.environment.length > ARG_MAX || params.file_action_count > ARG_MAX)
+        return -E2BIG;
+
+    String path;
+    {
+        auto path_arg = get_syscall_path_argument(params.path);
+        if (path_arg.is_error())
+            return path_arg.error();
+        path = path_arg.value();
+    }
+
+    Vector<String> arguments;
+    if (!validate_and_copy_strings_from_user(params.arguments, arguments))
+        return -EFAULT;
+
+    Vector<String> environment;
+    if (!validate_and_copy_strings_from_user(params.environment, environment))
+        return -EFAULT;
+
+    Vector<Syscall::SC_posix_spawn_file_action> file_actions;
+    Vector<String> file_action_paths;
+    if (params.file_action_count) {
+        if (!validate_read_typed(params.file_actions, params.file_action_count))
+            return -EFAULT;
+        file_actions.resize(params.file_action_count);
+        copy_from_user(file_actions.data(), params.file_actions, params.file_action_count * sizeof(Syscall::SC_posix_spawn_file_action));
+    }
+    for (auto& action : file_actions) {
+        if (action.fd < 0 || action.fd >= m_max_open_file_descriptors)
+            return -EBADF;
+        String action_path;
+        switch (action.type) {
+        case Syscall::SpawnFileActionType::Close:
+            break;
+        case Syscall::SpawnFileActionType::Dup2:
+            if (action.new_fd < 0 || action.new_fd >= m_max_open_file_descriptors)
+                return -EBADF;
+            break;
+        case Syscall::SpawnFileActionType::Open: {
+            if (action.options & (O_NOFOLLOW_NOERROR | O_UNLINK_INTERNAL))
+                return -EINVAL;
+            if (action.options & O_WRONLY)
+                REQUIRE_PROMISE(wpath);
+            else if (action.options & O_RDONLY)
+                REQUIRE_PROMISE(rpath);
+            if (action.options & O_CREAT)
+                REQUIRE_PROMISE(cpath);
+            auto path_arg = get_syscall_path_argument(action.path);
+            if (path_arg.is_error())
+                return path_arg.error();
+            action_path = path_arg.value();
+            break;
+        }
+        default:
+            return -EINVAL;
+        }
+        file_action_paths.append(move(action_path));
+    }
+
+    // The child starts out as a copy of us, minus the address space: that is built
+    // directly from the executable, which saves cloning (and tearing down) ours like fork() would.
+    Thread* child_first_thread = nullptr;
+    auto* child = new Process(child_first_thread, m_name, m_uid, m_gid, m_pid, m_ring, m_cwd, nullptr, m_tty);
+    child->m_root_directory = m_root_directory;
+    child->m_root_directory_relative_to_global_root = m_root_directory_relative_to_global_root;
+    child->m_promises = m_promises;
+    child->m_execpromises = m_execpromises;
+    child->m_veil_state = m_veil_state;
+    child->m_unveiled_paths = m_unveiled_paths;
+    child->m_fds = m_fds;
+    child->m_sid = m_sid;
+    child->m_pgid = m_pgid;
+    child->m_umask = m_umask;
+    child->m_extra_gids = m_extra_gids;
+    if (!(params.flags & POSIX_SPAWN_RESETIDS)) {
+        child->m_euid = m_euid;
+        child->m_egid = m_egid;
+    }
+
+    auto fail = [&](int error) {
+        delete child_first_thread;
+        delete child;
+        return error;
+    };
+
+    for (int i = 0; i < file_actions.size(); ++i) {
+        auto& action = file_actions[i];
+        switch (action.type) {
+        case Syscall::SpawnFileActionType::Close:
+            // Closing something that isn't open is not an error, same as on other systems.
+            child->m_fds[action.fd] = {};
+            break;
+        case Syscall::SpawnFileActionType::Dup2: {
+            auto description = child->file_description(action.fd);
+            if (!description)
+                return fail(-EBADF);
+            child->m_fds[action.new_fd].set(*description);
+            break;
+        }
+        case Syscall::SpawnFileActionType::Open: {
+            auto result = VFS::the().open(file_action_paths[i], action.options, (action.mode & 04777) & ~child->umask(), child->current_directory());
+            if (result.is_error())
+                return fail(result.error());
+            auto description = result.value();
+            u32 fd_flags = (action.options & O_CLOEXEC) ? FD_CLOEXEC : 0;
+            child->m_fds[action.fd].set(move(description), fd_flags);
+            break;
+        }
+        }
+    }
+
+    if (params.flags & POSIX_SPAWN_SETSID) {
+        child->m_sid = child->m_pid;
+        child->m_pgid = child->m_pid;
+        child->m_tty = nullptr;
+    }
+
+    if (params.flags & POSIX_SPAWN_SETPGROUP) {
+        if (params.pgroup < 0)
+            return fail(-EINVAL);
+        if (params.pgroup == 0) {
+            child->m_pgid = child->m_pid;
+        } else {
+            InterruptDisabler disabler;
+            auto* group_leader = Process::from_pid(params.pgroup);
+            if (!group_leader || group_leader->sid() != child->m_sid)
+                return fail(-EPERM);
+            child->m_pgid = params.pgroup;
+        }
+    }
+
+    RefPtr<TTY> tty;
+    if (params.flags & POSIX_SPAWN_TCSETPGROUP) {
+        auto description = child->file_description(params.tty_fd);
+        if (!description)
+            return fail(-EBADF);
+        if (!description->is_tty())
+            return fail(-ENOTTY);
+        tty = description->tty();
+    }
+
+    int rc;
+    {
+        // exec() switches to the child's page directory to populate it; come back to ours afterwards.
+        ProcessPagingScope paging_scope(*this);
+        rc = child->exec(move(path), move(arguments), move(environment));
+    }
+    if (rc < 0)
+        return fail(rc);
+
+    // exec() cleared the signal mask, but a spawned child inherits ours unless asked otherwise.
+    if (params.flags & POSIX_SPAWN_SETSIGMASK)
+        child_first_thread->m_signal_mask = params.sigmask;
+    else
+        child_first_thread->m_signal_mask = current->m_signal_mask;
+
+    {
+        InterruptDisabler disabler;
+        if (tty)
+            tty->set_pgid(child->m_pgid);
+        g_processes->prepend(child);
+    }
+#ifdef TASK_DEBUG
+    kprintf("Process %u (%s) spawned from %u @ %p\n", child->pid(), child->name().characters(), m_pid, child_first_thread->tss().eip);
+#endif
+    return child->pid();
+}
+
 Process* Process::create_user_process(Thread*& first_thread, const String& path, uid_t uid, gid_t gid, pid_t parent_pid, int& error, Vector<String>&& arguments, Vector<String>&& environment, TTY* tty)
 {
     // FIXME: Don't split() the path twice (sys$spawn also does it...)
@@ -1317,6 +1557,8 @@ Process::Process(Thread*& first_thread, const String& name, uid_t uid, gid_t gid
 Process::~Process()
 {
     ASSERT(thread_count() == 0);
+    if (m_alarm_timer_id)
+        TimerQueue::the().cancel_timer(m_alarm_timer_id);
 }
 
 void Process::dump_regions()
@@ -1412,6 +1654,18 @@ void create_kernel_info_page()
     s_info_page_address_for_userspace = info_page_region_for_userspace->vaddr();
     s_info_page_address_for_kernel = info_page_region_for_kernel->vaddr();
     memset(s_info_page_address_for_kernel.as_ptr(), 0, PAGE_SIZE);
+
+    auto* info_page = (KernelInfoPage*)s_info_page_address_for_kernel.as_ptr();
+    info_page->boot_time = RTC::boot_time();
+
+    // Undershoot the TSC's rate a little, so that the time userspace extrapolates between
+    // updates doesn't get ahead of the PIT and jump backwards on the next one.
+    u64 tsc_frequency = PIT::tsc_frequency();
+    if (tsc_frequency >= 10000000) {
+        tsc_frequency += tsc_frequency / 512;
+        info_page->tsc_shift = 24;
+        info_page->tsc_multiplier = (1000000000ull << 24) / tsc_frequency;
+    }
 }
 
 int Process::sys$sigreturn(RegisterDump& registers)
@@ -1428,6 +1682,11 @@ int Process::sys$sigreturn(RegisterDump& registers)
 
     current->m_signal_mask = *stack_ptr;
     stack_ptr++;
+    {
+        InterruptDisabler disabler;
+        if (current->has_unmasked_pending_signals())
+            Scheduler::queue_signal_dispatch(*current);
+    }
 
     //pop edi, esi, ebp, esp, ebx, edx, ecx and eax
     memcpy(&registers.edi, stack_ptr, 8 * sizeof(uintptr_t));
@@ -1853,6 +2112,24 @@ String Process::validate_and_copy_string_from_user(const Syscall::StringArgument
     return validate_and_copy_string_from_user(string.characters, string.length);
 }
 
+bool Process::validate_and_copy_strings_from_user(const Syscall::StringListArgument& list, Vector<String>& output)
+{
+    if (!list.length)
+        return true;
+    if (!validate_read_typed(list.strings, list.length))
+        return false;
+    Vector<Syscall::StringArgument, 32> strings;
+    strings.resize(list.length);
+    copy_from_user(strings.data(), list.strings, list.length * sizeof(Syscall::StringArgument));
+    for (size_t i = 0; i < list.length; ++i) {
+        auto string = validate_and_copy_string_from_user(strings[i]);
+        if (string.is_null())
+            return false;
+        output.append(move(string));
+    }
+    return true;
+}
+
 int Process::sys$readlink(const Syscall::SC_readlink_params* user_params)
 {
     REQUIRE_PROMISE(rpath);
@@ -2072,15 +2349,26 @@ int Process::sys$setgid(gid_t gid)
 unsigned Process::sys$alarm(unsigned seconds)
 {
     REQUIRE_PROMISE(stdio);
+    InterruptDisabler disabler;
     unsigned previous_alarm_remaining = 0;
-    if (m_alarm_deadline && m_alarm_deadline > g_uptime) {
-        previous_alarm_remaining = (m_alarm_deadline - g_uptime) / TICKS_PER_SECOND;
+    if (m_alarm_timer_id) {
+        auto now = PIT::nanoseconds_since_boot();
+        if (m_alarm_deadline > now)
+            previous_alarm_remaining = (m_alarm_deadline - now + TimeUnit::S - 1) / TimeUnit::S;
+        TimerQueue::the().cancel_timer(m_alarm_timer_id);
+        m_alarm_timer_id = 0;
     }
-    if (!seconds) {
-        m_alarm_deadline = 0;
+    if (!seconds)
         return previous_alarm_remaining;
-    }
-    m_alarm_deadline = g_uptime + seconds * TICKS_PER_SECOND;
+    auto timer = make<Timer>();
+    m_alarm_deadline = PIT::nanoseconds_since_boot() + seconds * TimeUnit::S;
+    timer->expires = m_alarm_deadline;
+    timer->callback = [this] {
+        m_alarm_timer_id = 0;
+        if (!is_dead())
+            send_signal(SIGALRM, nullptr);
+    };
+    m_alarm_timer_id = TimerQueue::the().add_timer(move(timer));
     return previous_alarm_remaining;
 }
 
@@ -2184,8 +2472,8 @@ int Process::sys$usleep(useconds_t usec)
     REQUIRE_PROMISE(stdio);
     if (!usec)
         return 0;
-    u64 wakeup_time = current->sleep(usec / 1000);
-    if (wakeup_time > g_uptime)
+    u64 wakeup_time = current->sleep((u64)usec * TimeUnit::US);
+    if (wakeup_time > PIT::nanoseconds_since_boot())
         return -EINTR;
     return 0;
 }
@@ -2195,11 +2483,10 @@ int Process::sys$sleep(unsigned seconds)
     REQUIRE_PROMISE(stdio);
     if (!seconds)
         return 0;
-    u64 wakeup_time = current->sleep(seconds * TICKS_PER_SECOND);
-    if (wakeup_time > g_uptime) {
-        u32 ticks_left_until_original_wakeup_time = wakeup_time - g_uptime;
-        return ticks_left_until_original_wakeup_time / TICKS_PER_SECOND;
-    }
+    u64 wakeup_time = current->sleep((u64)seconds * TimeUnit::S);
+    auto now = PIT::nanoseconds_since_boot();
+    if (wakeup_time > now)
+        return (wakeup_time - now + TimeUnit::S - 1) / TimeUnit::S;
     return 0;
 }
 
@@ -2297,6 +2584,13 @@ siginfo_t Process::reap(Process& process)
 #endif
         ASSERT(process.is_dead());
         g_processes->remove(&process);
+
+        // Children that have already died are left without anyone to wait() for them.
+        process.for_each_child([](Process& child) {
+            if (child.is_dead())
+                Scheduler::reap_orphan(child);
+            return IterationDecision::Continue;
+        });
     }
     delete &process;
     return siginfo;
@@ -2582,6 +2876,9 @@ int Process::sys$sigprocmask(int how, const sigset_t* set, sigset_t* old_set)
         default:
             return -EINVAL;
         }
+        InterruptDisabler disabler;
+        if (current->has_unmasked_pending_signals())
+            Scheduler::queue_signal_dispatch(*current);
     }
     return 0;
 }
@@ -2727,10 +3024,10 @@ int Process::sys$select(const Syscall::SC_select_params* params)
     if (nfds < 0)
         return -EINVAL;
 
-    timeval computed_timeout;
+    u64 deadline = 0;
     bool select_has_timeout = false;
     if (timeout && (timeout->tv_sec || timeout->tv_usec)) {
-        timeval_add(kgettimeofday(), *timeout, computed_timeout);
+        deadline = PIT::nanoseconds_since_boot() + (u64)timeout->tv_sec * TimeUnit::S + (u64)timeout->tv_usec * TimeUnit::US;
         select_has_timeout = true;
     }
 
@@ -2765,7 +3062,7 @@ int Process::sys$select(const Syscall::SC_select_params* params)
 #endif
 
     if (!timeout || select_has_timeout) {
-        if (current->block<Thread::SelectBlocker>(computed_timeout, select_has_timeout, rfds, wfds, efds) != Thread::BlockResult::WokeNormally)
+        if (current->block<Thread::SelectBlocker>(deadline, select_has_timeout, rfds, wfds, efds) != Thread::BlockResult::WokeNormally)
             return -EINTR;
     }
 
@@ -2806,18 +3103,10 @@ int Process::sys$poll(pollfd* fds, int nfds, int timeout)
             wfds.append(fds[i].fd);
     }
 
-    timeval actual_timeout;
+    u64 deadline = 0;
     bool has_timeout = false;
     if (timeout >= 0) {
-        // poll is in ms, we want s/us.
-        struct timeval tvtimeout;
-        tvtimeout.tv_sec = 0;
-        while (timeout >= 1000) {
-            tvtimeout.tv_sec += 1;
-            timeout -= 1000;
-        }
-        tvtimeout.tv_usec = timeout * 1000;
-        timeval_add(kgettimeofday(), tvtimeout, actual_timeout);
+        deadline = PIT::nanoseconds_since_boot() + (u64)timeout * TimeUnit::MS;
         has_timeout = true;
     }
 
@@ -2826,7 +3115,7 @@ int Process::sys$poll(pollfd* fds, int nfds, int timeout)
 #endif
 
     if (has_timeout || timeout < 0) {
-        if (current->block<Thread::SelectBlocker>(actual_timeout, has_timeout, rfds, wfds, Thread::SelectBlocker::FDVector()) != Thread::BlockResult::WokeNormally)
+        if (current->block<Thread::SelectBlocker>(deadline, has_timeout, rfds, wfds, Thread::SelectBlocker::FDVector()) != Thread::BlockResult::WokeNormally)
             return -EINTR;
     }
 
@@ -2996,9 +3285,12 @@ void Process::finalize()
                 parent_thread->send_signal(SIGCHLD, this);
             }
         }
-    }
 
-    m_dead = true;
+        m_dead = true;
+
+        if (!m_ppid || !Process::from_pid(m_ppid))
+            Scheduler::reap_orphan(*this);
+    }
 }
 
 void Process::die()
@@ -3080,6 +3372,15 @@ size_t Process::amount_shared() const
     return amount;
 }
 
+size_t Process::amount_zero_mapped() const
+{
+    size_t amount = 0;
+    for (auto& region : m_regions) {
+        amount += region.amount_zero_mapped();
+    }
+    return amount;
+}
+
 size_t Process::amount_purgeable_volatile() const
 {
     size_t amount = 0;
@@ -4172,15 +4473,45 @@ int Process::sys$clock_gettime(clockid_t clock_id, timespec* ts)
         return -EFAULT;
 
     SmapDisabler disabler;
+    switch (clock_id) {
+    case CLOCK_MONOTONIC: {
+        // Same clock as LibC reads from the info page, which falls back to us.
+        auto now = info_page_clock_now();
+        ts->tv_sec = now / TimeUnit::S;
+        ts->tv_nsec = now % TimeUnit::S;
+        break;
+    }
+    case CLOCK_REALTIME: {
+        auto now = info_page_clock_now();
+        ts->tv_sec = RTC::boot_time() + now / TimeUnit::S;
+        ts->tv_nsec = now % TimeUnit::S;
+        break;
+    }
+    default:
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int Process::sys$clock_getres(clockid_t clock_id, timespec* ts)
+{
+    REQUIRE_PROMISE(stdio);
+    if (ts && !validate_write_typed(ts))
+        return -EFAULT;
+
     switch (clock_id) {
     case CLOCK_MONOTONIC:
-        ts->tv_sec = g_uptime / TICKS_PER_SECOND;
-        ts->tv_nsec = (g_uptime % TICKS_PER_SECOND) * 1000000;
+    case CLOCK_REALTIME:
         break;
     default:
         return -EINVAL;
     }
 
+    if (ts) {
+        timespec resolution { 0, PIT::clock_resolution_ns };
+        copy_to_user(ts, &resolution);
+    }
     return 0;
 }
 
@@ -4203,26 +4534,28 @@ int Process::sys$clock_nanosleep(const Syscall::SC_clock_nanosleep_params* user_
 
     bool is_absolute = params.flags & TIMER_ABSTIME;
 
+    if (requested_sleep.tv_sec < 0 || requested_sleep.tv_nsec < 0 || requested_sleep.tv_nsec >= (long)TimeUnit::S)
+        return -EINVAL;
+
     switch (params.clock_id) {
     case CLOCK_MONOTONIC: {
         u64 wakeup_time;
+        u64 requested_ns = (u64)requested_sleep.tv_sec * TimeUnit::S + requested_sleep.tv_nsec;
         if (is_absolute) {
-            u64 time_to_wake = (requested_sleep.tv_sec * 1000 + requested_sleep.tv_nsec / 1000000);
-            wakeup_time = current->sleep_until(time_to_wake);
+            wakeup_time = current->sleep_until(requested_ns);
         } else {
-            u32 ticks_to_sleep = (requested_sleep.tv_sec * 1000 + requested_sleep.tv_nsec / 1000000);
-            if (!ticks_to_sleep)
+            if (!requested_ns)
                 return 0;
-            wakeup_time = current->sleep(ticks_to_sleep);
+            wakeup_time = current->sleep(requested_ns);
         }
-        if (wakeup_time > g_uptime) {
-            u32 ticks_left = wakeup_time - g_uptime;
+        auto now = PIT::nanoseconds_since_boot();
+        if (wakeup_time > now) {
+            u64 ns_left = wakeup_time - now;
             if (!is_absolute && params.remaining_sleep) {
                 timespec remaining_sleep;
                 memset(&remaining_sleep, 0, sizeof(timespec));
-                remaining_sleep.tv_sec = ticks_left / TICKS_PER_SECOND;
-                ticks_left -= remaining_sleep.tv_sec * TICKS_PER_SECOND;
-                remaining_sleep.tv_nsec = ticks_left * 1000000;
+                remaining_sleep.tv_sec = ns_left / TimeUnit::S;
+                remaining_sleep.tv_nsec = ns_left % TimeUnit::S;
                 copy_to_user(params.remaining_sleep, &remaining_sleep);
             }
             return -EINTR;
@@ -4237,8 +4570,20 @@ int Process::sys$clock_nanosleep(const Syscall::SC_clock_nanosleep_params* user_
 int Process::sys$sync()
 {
     REQUIRE_PROMISE(stdio);
-    VFS::the().sync();
-    return 0;
+    return VFS::the().sync();
+}
+
+int Process::sys$fsync(int fd)
+{
+    REQUIRE_PROMISE(stdio);
+    auto description = file_description(fd);
+    if (!description)
+        return -EBADF;
+    auto* inode = description->inode();
+    if (!inode)
+        return 0;
+    // FIXME: This writes back everything on the file system, not just what belongs to this file.
+    return inode->fs().flush_writes();
 }
 
 int Process::sys$yield()
@@ -4251,9 +4596,9 @@ int Process::sys$yield()
 int Process::sys$beep()
 {
     PCSpeaker::tone_on(440);
-    u64 wakeup_time = current->sleep(100);
+    u64 wakeup_time = current->sleep(100 * TimeUnit::MS);
     PCSpeaker::tone_off();
-    if (wakeup_time > g_uptime)
+    if (wakeup_time > PIT::nanoseconds_since_boot())
         return -EINTR;
     return 0;
 }
@@ -4530,6 +4875,10 @@ int Process::sys$set_process_boost(pid_t pid, int amount)
     if (!is_superuser() && process->uid() != euid())
         return -EPERM;
     process->m_priority_boost = amount;
+    process->for_each_thread([](Thread& thread) {
+        Scheduler::update_state_for_thread(thread);
+        return IterationDecision::Continue;
+    });
     return 0;
 }
 
@@ -4637,7 +4986,7 @@ int Process::sys$pledge(const Syscall::SC_pledge_params* user_params)
 Region& Process::add_region(NonnullOwnPtr<Region> region)
 {
     auto* ptr = region.ptr();
-    m_regions.append(move(region));
+    m_regions.insert(region_index_after(ptr->vaddr()), move(region));
     return *ptr;
 }
 
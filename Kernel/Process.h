@@ -134,7 +134,7 @@ public:
 
     static Process* from_pid(pid_t);
 
-    static void update_info_page_timestamp(const timeval&);
+    static void update_info_page_clock(u64 nanoseconds_since_boot);
 
     const String& name() const { return m_name; }
     pid_t pid() const { return m_pid; }
@@ -168,6 +168,7 @@ public:
 
     int sys$yield();
     int sys$sync();
+    int sys$fsync(int fd);
     int sys$beep();
     int sys$get_process_name(char* buffer, int buffer_size);
     int sys$watch_file(const char* path, size_t path_length);
@@ -218,6 +219,7 @@ public:
     int sys$usleep(useconds_t usec);
     int sys$gettimeofday(timeval*);
     int sys$clock_gettime(clockid_t, timespec*);
+    int sys$clock_getres(clockid_t, timespec*);
     int sys$clock_nanosleep(const Syscall::SC_clock_nanosleep_params*);
     int sys$gethostname(char*, ssize_t);
     int sys$uname(utsname*);
@@ -303,6 +305,7 @@ public:
     int sys$pledge(const Syscall::SC_pledge_params*);
     int sys$unveil(const Syscall::SC_unveil_params*);
     int sys$perf_event(int type, uintptr_t arg1, uintptr_t arg2);
+    pid_t sys$posix_spawn(const Syscall::SC_posix_spawn_params*);
 
     template<bool sockname, typename Params>
     int get_sock_or_peer_name(const Params&);
@@ -352,6 +355,7 @@ public:
 
     String validate_and_copy_string_from_user(const char*, size_t) const;
     String validate_and_copy_string_from_user(const Syscall::StringArgument&) const;
+    bool validate_and_copy_strings_from_user(const Syscall::StringListArgument&, Vector<String>&);
 
     Custody& current_directory();
     Custody* executable() { return m_executable.ptr(); }
@@ -364,6 +368,7 @@ public:
     size_t amount_virtual() const;
     size_t amount_resident() const;
     size_t amount_shared() const;
+    size_t amount_zero_mapped() const;
     size_t amount_purgeable_volatile() const;
     size_t amount_purgeable_nonvolatile() const;
 
@@ -479,7 +484,10 @@ private:
 
     Region* region_from_range(const Range&);
     Region* region_containing(const Range&);
+    Region* region_containing(VirtualAddress);
+    size_t region_index_after(VirtualAddress) const;
 
+    // Sorted by base address.
     NonnullOwnPtrVector<Region> m_regions;
     struct RegionLookupCache {
         Range range;
@@ -502,6 +510,7 @@ private:
     Lock m_big_lock { "Process" };
 
     u64 m_alarm_deadline { 0 };
+    u64 m_alarm_timer_id { 0 };
 
     int m_icon_id { -1 };
 
@@ -642,7 +651,7 @@ inline const LogStream& operator<<(const LogStream& stream, const Process& proce
 
 inline u32 Thread::effective_priority() const
 {
-    return m_priority + m_process.priority_boost() + m_priority_boost + m_extra_priority;
+    return m_priority + m_process.priority_boost() + m_priority_boost;
 }
 
 #define REQUIRE_NO_PROMISES                       \
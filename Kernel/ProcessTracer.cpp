@@ -40,6 +40,7 @@ void ProcessTracer::did_syscall(u32 function, u32 arg1, u32 arg2, u32 arg3, u32
 {
     CallData data = { function, arg1, arg2, arg3, result };
     m_calls.enqueue(data);
+    notify_blockers();
 }
 
 int ProcessTracer::read(FileDescription&, u8* buffer, int buffer_size)
@@ -24,15 +24,15 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/QuickSort.h>
 #include <AK/TemporaryChange.h>
+#include <Kernel/Arch/i386/APIC.h>
 #include <Kernel/Arch/i386/PIT.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/Process.h>
 #include <Kernel/Profiling.h>
-#include <Kernel/RTC.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/TimerQueue.h>
+#include <Kernel/VM/MemoryManager.h>
 
 //#define LOG_EVERY_CONTEXT_SWITCH
 //#define SCHEDULER_DEBUG
@@ -48,12 +48,44 @@ void Scheduler::init_thread(Thread& thread)
 void Scheduler::update_state_for_thread(Thread& thread)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& list = g_scheduler_data->thread_list_for_state(thread.state());
+    auto& data = *g_scheduler_data;
+
+    if (!Thread::is_runnable_state(thread.state())) {
+        auto* list = &data.m_nonrunnable_threads;
+        if (thread.state() == Thread::Blocked)
+            list = thread.m_blocker->needs_polling() ? &data.m_polled_threads : &data.m_waiting_threads;
+        else if (thread.state() == Thread::Skip1SchedulerPass || thread.state() == Thread::Skip0SchedulerPasses)
+            list = &data.m_polled_threads;
+        if (!list->contains(thread))
+            list->append(thread);
+        return;
+    }
 
-    if (list.contains(thread))
+    // Runnable <-> Running keeps the thread where it is. Otherwise it just woke up,
+    // or its priority changed and it has to move to another level.
+    if (data.is_queued_at_own_level(thread))
         return;
+    if (data.m_polled_threads.contains(thread) || data.m_waiting_threads.contains(thread) || data.m_nonrunnable_threads.contains(thread)) {
+        thread.m_runnable_since = g_uptime;
+        // The idle thread may have stopped the tick, so make sure it gets out of the way.
+        Scheduler::stop_idling();
+    }
+    data.enqueue_runnable(thread);
+}
 
-    list.append(thread);
+void Scheduler::queue_signal_dispatch(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto& list = g_scheduler_data->m_threads_with_pending_signals;
+    if (!list.contains(thread))
+        list.append(thread);
+}
+
+void Scheduler::reap_orphan(Process& process)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(process.is_dead());
+    g_scheduler_data->m_orphans_to_reap.append(process.pid());
 }
 
 static u32 time_slice_for(const Thread& thread)
@@ -64,6 +96,14 @@ static u32 time_slice_for(const Thread& thread)
     return 10;
 }
 
+static constexpr u64 nanoseconds_per_tick = 1000000000 / TICKS_PER_SECOND;
+
+static bool s_should_stop_idling = false;
+
+// A waiting thread gains one level of priority for every this many ticks it has gone without running.
+// This replaces bumping every passed-over runnable thread on every scheduler pass.
+static constexpr u64 aging_ticks_per_level = 10;
+
 Thread* current;
 Thread* g_finalizer;
 Thread* g_colonel;
@@ -84,6 +124,34 @@ bool Scheduler::is_active()
     return s_active;
 }
 
+Thread::Blocker::~Blocker()
+{
+    if (m_timeout_timer_id)
+        TimerQueue::the().cancel_timer(m_timeout_timer_id);
+}
+
+void Thread::Blocker::set_timeout(u64 deadline)
+{
+    ASSERT(!m_timeout_timer_id);
+    if (deadline <= PIT::nanoseconds_since_boot()) {
+        m_timed_out = true;
+        return;
+    }
+
+    auto& thread = *current;
+    auto timer = make<Timer>();
+    timer->expires = deadline;
+    timer->callback = [this, &thread] {
+        m_timeout_timer_id = 0;
+        m_timed_out = true;
+        if (thread.state() == Thread::Blocked && thread.m_blocker == this) {
+            thread.unblock();
+            Scheduler::stop_idling();
+        }
+    };
+    m_timeout_timer_id = TimerQueue::the().add_timer(move(timer));
+}
+
 Thread::JoinBlocker::JoinBlocker(Thread& joinee, void*& joinee_exit_value)
     : m_joinee(joinee)
     , m_joinee_exit_value(joinee_exit_value)
@@ -100,6 +168,13 @@ bool Thread::JoinBlocker::should_unblock(Thread& joiner, time_t, long)
 
 Thread::FileDescriptionBlocker::FileDescriptionBlocker(const FileDescription& description)
     : m_blocked_description(description)
+{
+    auto& file = m_blocked_description->file();
+    if (file.notifies_blockers())
+        m_watcher = make<WaitQueueWatcher>(file.wait_queue(), *current);
+}
+
+Thread::FileDescriptionBlocker::~FileDescriptionBlocker()
 {
 }
 
@@ -136,23 +211,15 @@ Thread::WriteBlocker::WriteBlocker(const FileDescription& description)
     if (description.is_socket()) {
         auto& socket = *description.socket();
         if (socket.has_send_timeout()) {
-            timeval deadline = kgettimeofday();
-            deadline.tv_sec += socket.send_timeout().tv_sec;
-            deadline.tv_usec += socket.send_timeout().tv_usec;
-            deadline.tv_sec += (socket.send_timeout().tv_usec / 1000000) * 1;
-            deadline.tv_usec %= 1000000;
-            m_deadline = deadline;
+            auto& timeout = socket.send_timeout();
+            set_timeout(PIT::nanoseconds_since_boot() + (u64)timeout.tv_sec * 1000000000 + (u64)timeout.tv_usec * 1000);
         }
     }
 }
 
-bool Thread::WriteBlocker::should_unblock(Thread&, time_t now_sec, long now_usec)
+bool Thread::WriteBlocker::should_unblock(Thread&, time_t, long)
 {
-    if (m_deadline.has_value()) {
-        bool timed_out = now_sec > m_deadline.value().tv_sec || (now_sec == m_deadline.value().tv_sec && now_usec >= m_deadline.value().tv_usec);
-        return timed_out || blocked_description().can_write();
-    }
-    return blocked_description().can_write();
+    return timed_out() || blocked_description().can_write();
 }
 
 Thread::ReadBlocker::ReadBlocker(const FileDescription& description)
@@ -161,23 +228,15 @@ Thread::ReadBlocker::ReadBlocker(const FileDescription& description)
     if (description.is_socket()) {
         auto& socket = *description.socket();
         if (socket.has_receive_timeout()) {
-            timeval deadline = kgettimeofday();
-            deadline.tv_sec += socket.receive_timeout().tv_sec;
-            deadline.tv_usec += socket.receive_timeout().tv_usec;
-            deadline.tv_sec += (socket.receive_timeout().tv_usec / 1000000) * 1;
-            deadline.tv_usec %= 1000000;
-            m_deadline = deadline;
+            auto& timeout = socket.receive_timeout();
+            set_timeout(PIT::nanoseconds_since_boot() + (u64)timeout.tv_sec * 1000000000 + (u64)timeout.tv_usec * 1000);
         }
     }
 }
 
-bool Thread::ReadBlocker::should_unblock(Thread&, time_t now_sec, long now_usec)
+bool Thread::ReadBlocker::should_unblock(Thread&, time_t, long)
 {
-    if (m_deadline.has_value()) {
-        bool timed_out = now_sec > m_deadline.value().tv_sec || (now_sec == m_deadline.value().tv_sec && now_usec >= m_deadline.value().tv_usec);
-        return timed_out || blocked_description().can_read();
-    }
-    return blocked_description().can_read();
+    return timed_out() || blocked_description().can_read();
 }
 
 Thread::ConditionBlocker::ConditionBlocker(const char* state_string, Function<bool()>&& condition)
@@ -193,30 +252,51 @@ bool Thread::ConditionBlocker::should_unblock(Thread&, time_t, long)
 }
 
 Thread::SleepBlocker::SleepBlocker(u64 wakeup_time)
-    : m_wakeup_time(wakeup_time)
 {
+    set_timeout(wakeup_time);
 }
 
 bool Thread::SleepBlocker::should_unblock(Thread&, time_t, long)
 {
-    return m_wakeup_time <= g_uptime;
+    return timed_out();
 }
 
-Thread::SelectBlocker::SelectBlocker(const timeval& tv, bool select_has_timeout, const FDVector& read_fds, const FDVector& write_fds, const FDVector& except_fds)
-    : m_select_timeout(tv)
-    , m_select_has_timeout(select_has_timeout)
+Thread::SelectBlocker::SelectBlocker(u64 deadline, bool select_has_timeout, const FDVector& read_fds, const FDVector& write_fds, const FDVector& except_fds)
+    : m_select_has_timeout(select_has_timeout)
     , m_select_read_fds(read_fds)
     , m_select_write_fds(write_fds)
     , m_select_exceptional_fds(except_fds)
 {
+    if (m_select_has_timeout)
+        set_timeout(deadline);
+    register_with_files(read_fds);
+    register_with_files(write_fds);
 }
 
-bool Thread::SelectBlocker::should_unblock(Thread& thread, time_t now_sec, long now_usec)
+void Thread::SelectBlocker::register_with_files(const FDVector& fds)
 {
-    if (m_select_has_timeout) {
-        if (now_sec > m_select_timeout.tv_sec || (now_sec == m_select_timeout.tv_sec && now_usec >= m_select_timeout.tv_usec))
-            return true;
+    auto& process = current->process();
+    for (int fd : fds) {
+        if (!process.m_fds[fd])
+            continue;
+        auto& description = *process.m_fds[fd].description;
+        if (!description.file().notifies_blockers()) {
+            m_has_unregistered_fds = true;
+            continue;
+        }
+        m_watchers.append(make<WaitQueueWatcher>(description.file().wait_queue(), *current));
+        m_registered_descriptions.append(description);
     }
+}
+
+Thread::SelectBlocker::~SelectBlocker()
+{
+}
+
+bool Thread::SelectBlocker::should_unblock(Thread& thread, time_t, long)
+{
+    if (m_select_has_timeout && timed_out())
+        return true;
 
     auto& process = thread.process();
     for (int fd : m_select_read_fds) {
@@ -308,6 +388,13 @@ void Thread::consider_unblock(time_t now_sec, long now_usec)
     }
 }
 
+void Thread::consider_unblock_now()
+{
+    timeval now;
+    kgettimeofday(now);
+    consider_unblock(now.tv_sec, now.tv_usec);
+}
+
 bool Scheduler::pick_next()
 {
     ASSERT_INTERRUPTS_DISABLED();
@@ -330,56 +417,69 @@ bool Scheduler::pick_next()
     auto now_usec = now.tv_usec;
 
     // Check and unblock threads whose wait conditions have been met.
-    Scheduler::for_each_nonrunnable([&](Thread& thread) {
-        thread.consider_unblock(now_sec, now_usec);
-        return IterationDecision::Continue;
-    });
-
-    Process::for_each([&](Process& process) {
-        if (process.is_dead()) {
-            if (current->pid() != process.pid() && (!process.ppid() || !Process::from_pid(process.ppid()))) {
-                auto name = process.name();
-                auto pid = process.pid();
-                auto exit_status = Process::reap(process);
-                dbgprintf("reaped unparented process %s(%u), exit status: %u\n", name.characters(), pid, exit_status);
-            }
-            return IterationDecision::Continue;
+    auto consider_unblocking = [&](SchedulerData::ThreadList& list) {
+        for (auto it = list.begin(); it != list.end();) {
+            auto& thread = *it;
+            it = ++it;
+            thread.consider_unblock(now_sec, now_usec);
         }
-        if (process.m_alarm_deadline && g_uptime > process.m_alarm_deadline) {
-            process.m_alarm_deadline = 0;
-            process.send_signal(SIGALRM, nullptr);
+    };
+    consider_unblocking(g_scheduler_data->m_polled_threads);
+
+    // Reap the dead processes that nobody is going to wait() for.
+    auto& orphans = g_scheduler_data->m_orphans_to_reap;
+    for (int i = 0; i < orphans.size();) {
+        auto* process = Process::from_pid(orphans[i]);
+        // It may have been reaped some other way since, or its pid may have been reused.
+        if (!process || !process->is_dead()) {
+            orphans.remove(i);
+            continue;
         }
-        return IterationDecision::Continue;
-    });
+        if (current->pid() == process->pid()) {
+            ++i;
+            continue;
+        }
+        orphans.remove(i);
+        auto name = process->name();
+        auto pid = process->pid();
+        auto exit_status = Process::reap(*process);
+        dbgprintf("reaped unparented process %s(%u), exit status: %u\n", name.characters(), pid, exit_status);
+    }
 
-    // Dispatch any pending signals.
-    // FIXME: Do we really need this to be a separate pass over the process list?
-    Thread::for_each_living([](Thread& thread) -> IterationDecision {
-        if (!thread.has_unmasked_pending_signals())
-            return IterationDecision::Continue;
+    // Dispatch any pending signals. Only threads that have been sent one need looking at.
+    auto& threads_with_pending_signals = g_scheduler_data->m_threads_with_pending_signals;
+    for (auto it = threads_with_pending_signals.begin(); it != threads_with_pending_signals.end();) {
+        auto& thread = *it;
+        it = ++it;
+        if (!thread.has_unmasked_pending_signals() || thread.state() == Thread::Dead || thread.state() == Thread::Dying) {
+            threads_with_pending_signals.remove(thread);
+            continue;
+        }
         // FIXME: It would be nice if the Scheduler didn't have to worry about who is "current"
         //        For now, avoid dispatching signals to "current" and do it in a scheduling pass
         //        while some other process is interrupted. Otherwise a mess will be made.
         if (&thread == current)
-            return IterationDecision::Continue;
+            continue;
         // We know how to interrupt blocked processes, but if they are just executing
         // at some random point in the kernel, let them continue.
         // Before returning to userspace from a syscall, we will block a thread if it has any
         // pending unmasked signals, allowing it to be dispatched then.
         if (thread.in_kernel() && !thread.is_blocked() && !thread.is_stopped())
-            return IterationDecision::Continue;
+            continue;
         // NOTE: dispatch_one_pending_signal() may unblock the process.
         bool was_blocked = thread.is_blocked();
-        if (thread.dispatch_one_pending_signal() == ShouldUnblockThread::No)
-            return IterationDecision::Continue;
+        auto should_unblock = thread.dispatch_one_pending_signal();
+        if (!thread.has_unmasked_pending_signals())
+            threads_with_pending_signals.remove(thread);
+        if (should_unblock == ShouldUnblockThread::No)
+            continue;
         if (was_blocked) {
             dbgprintf("Unblock %s(%u) due to signal\n", thread.process().name().characters(), thread.pid());
             ASSERT(thread.m_blocker != nullptr);
             thread.m_blocker->set_interrupted_by_signal();
             thread.unblock();
         }
-        return IterationDecision::Continue;
-    });
+    }
 
 #ifdef SCHEDULER_RUNNABLE_DEBUG
     dbgprintf("Non-runnables:\n");
@@ -395,28 +495,26 @@ bool Scheduler::pick_next()
     });
 #endif
 
-    Vector<Thread*, 128> sorted_runnables;
-    for_each_runnable([&sorted_runnables](auto& thread) {
-        sorted_runnables.append(&thread);
-        return IterationDecision::Continue;
-    });
-    quick_sort(sorted_runnables.begin(), sorted_runnables.end(), [](auto& a, auto& b) { return a->effective_priority() >= b->effective_priority(); });
-
+    // Each queue is FIFO, so its first schedulable thread is the one that has waited the longest
+    // at that level. Compare those heads by level plus aging; this costs one step per non-empty
+    // level no matter how many threads there are.
     Thread* thread_to_schedule = nullptr;
-
-    for (auto* thread : sorted_runnables) {
-        if (thread->process().is_being_inspected())
-            continue;
-
-        ASSERT(thread->state() == Thread::Runnable || thread->state() == Thread::Running);
-
-        if (!thread_to_schedule) {
-            thread->m_extra_priority = 0;
-            thread_to_schedule = thread;
-        } else {
-            thread->m_extra_priority++;
+    u64 best_score = 0;
+    g_scheduler_data->for_each_nonempty_level([&](u32 level, auto& queue) {
+        for (auto& thread : queue) {
+            if (thread.process().is_being_inspected())
+                continue;
+            ASSERT(thread.state() == Thread::Runnable || thread.state() == Thread::Running);
+            u64 waited = thread.state() == Thread::Running ? 0 : g_uptime - thread.m_runnable_since;
+            u64 score = level + waited / aging_ticks_per_level;
+            if (!thread_to_schedule || score > best_score) {
+                thread_to_schedule = &thread;
+                best_score = score;
+            }
+            break;
         }
-    }
+        return IterationDecision::Continue;
+    });
 
     if (!thread_to_schedule)
         thread_to_schedule = g_colonel;
@@ -483,19 +581,49 @@ void Scheduler::switch_now()
         "ljmp *(%%eax)\n" ::"a"(&current->far_ptr()));
 }
 
+// Whether anything needs the scheduler to look at it on every tick.
+// If not, the idle thread can stop the tick and sleep until the next timer.
+static bool has_threads_needing_ticks()
+{
+    // Signals and orphans the scheduler couldn't deal with yet get another look on the next pass.
+    auto& data = *g_scheduler_data;
+    return !data.m_polled_threads.is_empty() || !data.m_threads_with_pending_signals.is_empty() || !data.m_orphans_to_reap.is_empty();
+}
+
+static void program_event_timer()
+{
+    if (!APIC::has_timer())
+        return;
+    bool can_stop_ticking = current == g_colonel && !s_should_stop_idling && !has_threads_needing_ticks();
+    u64 next_tick = can_stop_ticking ? 0 : PIT::nanoseconds_since_boot() + nanoseconds_per_tick;
+    TimerQueue::the().program_event_timer(next_tick);
+}
+
 bool Scheduler::context_switch(Thread& thread)
 {
     thread.set_ticks_left(time_slice_for(thread));
     thread.did_schedule();
 
-    if (current == &thread)
+    // Round-robin: the chosen thread goes to the back of its level.
+    if (Thread::is_runnable_state(thread.state()) && thread.process().pid() != 0)
+        g_scheduler_data->enqueue_runnable(thread);
+
+    if (current == &thread) {
+        program_event_timer();
         return false;
+    }
+
+    // We may not have ticked in a while, so bring userspace's clock up to date.
+    if (current == g_colonel)
+        Process::update_info_page_clock(PIT::nanoseconds_since_boot());
 
     if (current) {
         // If the last process hasn't blocked (still marked as running),
         // mark it as runnable for the next round.
-        if (current->state() == Thread::Running)
+        if (current->state() == Thread::Running) {
             current->set_state(Thread::Runnable);
+            current->m_runnable_since = g_uptime;
+        }
 
         asm volatile("fxsave %0"
                      : "=m"(current->fpu_state()));
@@ -535,6 +663,8 @@ bool Scheduler::context_switch(Thread& thread)
 
     auto& descriptor = get_gdt_entry(thread.selector());
     descriptor.type = 11; // Busy TSS
+
+    program_event_timer();
     return true;
 }
 
@@ -589,17 +719,21 @@ void Scheduler::initialize()
 
 void Scheduler::timer_tick(RegisterDump& regs)
 {
-    if (!current)
+    if (!current) {
+        // Keep the event timer going until the scheduler takes over.
+        TimerQueue::the().program_event_timer(PIT::nanoseconds_since_boot() + nanoseconds_per_tick);
         return;
+    }
 
-    ++g_uptime;
+    // We may get called between ticks as well, to run a timer that expires before the next tick.
+    auto now = PIT::nanoseconds_since_boot();
+    u64 uptime = now / nanoseconds_per_tick;
+    bool is_new_tick = uptime != g_uptime;
+    g_uptime = uptime;
 
-    timeval tv;
-    tv.tv_sec = RTC::boot_time() + PIT::seconds_since_boot();
-    tv.tv_usec = PIT::ticks_this_second() * 1000;
-    Process::update_info_page_timestamp(tv);
+    Process::update_info_page_clock(now);
 
-    if (current->process().is_profiling()) {
+    if (is_new_tick && current->process().is_profiling()) {
         SmapDisabler disabler;
         auto backtrace = current->raw_backtrace(regs.ebp);
         auto& sample = Profiling::next_sample_slot();
@@ -613,8 +747,10 @@ void Scheduler::timer_tick(RegisterDump& regs)
 
     TimerQueue::the().fire();
 
-    if (current->tick())
+    if (!is_new_tick || current->tick()) {
+        program_event_timer();
         return;
+    }
 
     auto& outgoing_tss = current->tss();
 
@@ -654,8 +790,6 @@ void Scheduler::timer_tick(RegisterDump& regs)
         "popf\n");
 }
 
-static bool s_should_stop_idling = false;
-
 void Scheduler::stop_idling()
 {
     if (current != g_colonel)
@@ -667,7 +801,18 @@ void Scheduler::stop_idling()
 void Scheduler::idle_loop()
 {
     for (;;) {
-        asm("hlt");
+        // Get page zeroing out of the way while there's nothing else to do,
+        // so that page faults can take an already zeroed page.
+        while (!s_should_stop_idling && MM.zero_one_idle_page())
+            ;
+        // There may not be another tick to wake us up, so don't halt if someone became runnable
+        // since we last looked. (sti takes effect after the next instruction, so nothing can slip in.)
+        asm volatile("cli");
+        if (s_should_stop_idling)
+            asm volatile("sti");
+        else
+            asm volatile("sti\n"
+                         "hlt");
         if (s_should_stop_idling) {
             s_should_stop_idling = false;
             yield();
@@ -70,6 +70,8 @@ public:
 
     static void init_thread(Thread& thread);
     static void update_state_for_thread(Thread& thread);
+    static void queue_signal_dispatch(Thread&);
+    static void reap_orphan(Process&);
 
 private:
     static void prepare_for_iret_to_new_process();
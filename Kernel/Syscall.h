@@ -177,7 +177,10 @@ typedef u32 socklen_t;
     __ENUMERATE_SYSCALL(chroot)                     \
     __ENUMERATE_SYSCALL(pledge)                     \
     __ENUMERATE_SYSCALL(unveil)                     \
-    __ENUMERATE_SYSCALL(perf_event)
+    __ENUMERATE_SYSCALL(perf_event)                 \
+    __ENUMERATE_SYSCALL(posix_spawn)                \
+    __ENUMERATE_SYSCALL(clock_getres)               \
+    __ENUMERATE_SYSCALL(fsync)
 
 namespace Syscall {
 
@@ -356,6 +359,33 @@ struct SC_execve_params {
     StringListArgument environment;
 };
 
+enum class SpawnFileActionType : int {
+    Close,
+    Dup2,
+    Open,
+};
+
+struct SC_posix_spawn_file_action {
+    SpawnFileActionType type;
+    int fd;
+    int new_fd;
+    int options;
+    u16 mode;
+    StringArgument path;
+};
+
+struct SC_posix_spawn_params {
+    StringArgument path;
+    StringListArgument arguments;
+    StringListArgument environment;
+    const SC_posix_spawn_file_action* file_actions;
+    size_t file_action_count;
+    int flags;
+    int pgroup;
+    u32 sigmask;
+    int tty_fd;
+};
+
 struct SC_readlink_params {
     StringArgument path;
     MutableBufferArgument<char, size_t> buffer;
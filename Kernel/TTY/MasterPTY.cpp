@@ -61,7 +61,11 @@ ssize_t MasterPTY::read(FileDescription&, u8* buffer, ssize_t size)
 {
     if (!m_slave && m_buffer.is_empty())
         return 0;
-    return m_buffer.read(buffer, size);
+    ssize_t nread = m_buffer.read(buffer, size);
+    // That made room for the slave to write more.
+    if (m_slave)
+        m_slave->notify_blockers();
+    return nread;
 }
 
 ssize_t MasterPTY::write(FileDescription&, const u8* buffer, ssize_t size)
@@ -91,8 +95,10 @@ void MasterPTY::notify_slave_closed(Badge<SlavePTY>)
 #endif
     // +1 ref for my MasterPTY::m_slave
     // +1 ref for FileDescription::m_device
-    if (m_slave->ref_count() == 2)
+    if (m_slave->ref_count() == 2) {
         m_slave = nullptr;
+        notify_blockers();
+    }
 }
 
 ssize_t MasterPTY::on_slave_write(const u8* data, ssize_t size)
@@ -100,6 +106,7 @@ ssize_t MasterPTY::on_slave_write(const u8* data, ssize_t size)
     if (m_closed)
         return -EIO;
     m_buffer.write(data, size);
+    notify_blockers();
     return size;
 }
 
@@ -119,6 +126,7 @@ void MasterPTY::close()
         m_closed = true;
 
         m_slave->hang_up();
+        m_slave->notify_blockers();
     }
 }
 
@@ -52,6 +52,7 @@ private:
     virtual ssize_t write(FileDescription&, const u8*, ssize_t) override;
     virtual bool can_read(const FileDescription&) const override;
     virtual bool can_write(const FileDescription&) const override;
+    virtual bool notifies_blockers() const override { return true; }
     virtual void close() override;
     virtual bool is_master_pty() const override { return true; }
     virtual int ioctl(FileDescription&, unsigned request, unsigned arg) override;
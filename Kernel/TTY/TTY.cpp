@@ -158,6 +158,7 @@ void TTY::emit(u8 ch)
             //We use '\0' to delimit the end
             //of a line.
             m_input_buffer.enqueue('\0');
+            notify_blockers();
             return;
         }
         if (is_kill(ch)) {
@@ -178,6 +179,7 @@ void TTY::emit(u8 ch)
     }
     m_input_buffer.enqueue(ch);
     echo(ch);
+    notify_blockers();
 }
 
 bool TTY::can_do_backspace() const
@@ -266,6 +268,8 @@ void TTY::set_termios(const termios& t)
           << ", INLCR=" << ((m_termios.c_iflag & INLCR) != 0)
           << ", IGNCR=" << ((m_termios.c_iflag & IGNCR) != 0);
 #endif
+    // Leaving canonical mode can make buffered input readable.
+    notify_blockers();
 }
 
 int TTY::ioctl(FileDescription&, unsigned request, unsigned arg)
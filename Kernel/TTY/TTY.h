@@ -41,6 +41,7 @@ public:
     virtual ssize_t write(FileDescription&, const u8*, ssize_t) override;
     virtual bool can_read(const FileDescription&) const override;
     virtual bool can_write(const FileDescription&) const override;
+    virtual bool notifies_blockers() const override { return true; }
     virtual int ioctl(FileDescription&, unsigned request, unsigned arg) override final;
     virtual String absolute_path(const FileDescription&) const override { return tty_name(); }
 
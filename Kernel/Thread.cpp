@@ -27,6 +27,7 @@
 #include <AK/Demangle.h>
 #include <AK/StringBuilder.h>
 #include <Kernel/Arch/i386/CPU.h>
+#include <Kernel/Arch/i386/PIT.h>
 #include <Kernel/FileSystem/FileDescription.h>
 #include <Kernel/Process.h>
 #include <Kernel/Profiling.h>
@@ -144,6 +145,7 @@ Thread::~Thread()
     {
         InterruptDisabler disabler;
         thread_table().remove(this);
+        g_scheduler_data->m_threads_with_pending_signals.remove(*this);
     }
 
     if (selector())
@@ -226,22 +228,17 @@ void Thread::relock_process()
     process().big_lock().lock();
 }
 
-u64 Thread::sleep(u32 ticks)
+u64 Thread::sleep(u64 nanoseconds)
 {
     ASSERT(state() == Thread::Running);
-    u64 wakeup_time = g_uptime + ticks;
-    auto ret = current->block<Thread::SleepBlocker>(wakeup_time);
-    if (wakeup_time > g_uptime) {
-        ASSERT(ret != Thread::BlockResult::WokeNormally);
-    }
-    return wakeup_time;
+    return sleep_until(PIT::nanoseconds_since_boot() + nanoseconds);
 }
 
 u64 Thread::sleep_until(u64 wakeup_time)
 {
     ASSERT(state() == Thread::Running);
     auto ret = current->block<Thread::SleepBlocker>(wakeup_time);
-    if (wakeup_time > g_uptime)
+    if (wakeup_time > PIT::nanoseconds_since_boot())
         ASSERT(ret != Thread::BlockResult::WokeNormally);
     return wakeup_time;
 }
@@ -289,6 +286,7 @@ void Thread::finalize()
         ASSERT(m_joiner->m_joinee == this);
         static_cast<JoinBlocker*>(m_joiner->m_blocker)->set_joinee_exit_value(m_exit_value);
         m_joiner->m_joinee = nullptr;
+        m_joiner->consider_unblock_now();
         // NOTE: We clear the joiner pointer here as well, to be tidy.
         m_joiner = nullptr;
     }
@@ -348,6 +346,10 @@ void Thread::send_signal(u8 signal, [[maybe_unused]] Process* sender)
 #endif
 
     m_pending_signals |= 1 << (signal - 1);
+    Scheduler::queue_signal_dispatch(*this);
+
+    // Signals are dispatched by the scheduler, which may not be ticking while idle.
+    Scheduler::stop_idling();
 }
 
 // Certain exceptions, such as SIGSEGV and SIGILL, put a
@@ -702,6 +704,22 @@ bool Thread::is_thread(void* ptr)
     return thread_table().contains((Thread*)ptr);
 }
 
+void Thread::set_priority(u32 priority)
+{
+    InterruptDisabler disabler;
+    m_priority = priority;
+    if (m_process.pid() != 0)
+        Scheduler::update_state_for_thread(*this);
+}
+
+void Thread::set_priority_boost(u32 boost)
+{
+    InterruptDisabler disabler;
+    m_priority_boost = boost;
+    if (m_process.pid() != 0)
+        Scheduler::update_state_for_thread(*this);
+}
+
 void Thread::set_state(State new_state)
 {
     InterruptDisabler disabler;
@@ -29,6 +29,8 @@
 #include <AK/Atomic.h>
 #include <AK/Function.h>
 #include <AK/IntrusiveList.h>
+#include <AK/NonnullOwnPtrVector.h>
+#include <AK/NonnullRefPtrVector.h>
 #include <AK/OwnPtr.h>
 #include <AK/RefPtr.h>
 #include <AK/String.h>
@@ -46,6 +48,7 @@ class Process;
 class ProcessInspectionHandle;
 class Region;
 class WaitQueue;
+class WaitQueueWatcher;
 
 enum class ShouldUnblockThread {
     No = 0,
@@ -86,10 +89,10 @@ public:
     int tid() const { return m_tid; }
     int pid() const;
 
-    void set_priority(u32 p) { m_priority = p; }
+    void set_priority(u32);
     u32 priority() const { return m_priority; }
 
-    void set_priority_boost(u32 boost) { m_priority_boost = boost; }
+    void set_priority_boost(u32);
     u32 priority_boost() const { return m_priority_boost; }
 
     u32 effective_priority() const;
@@ -123,17 +126,28 @@ public:
 
     class Blocker {
     public:
-        virtual ~Blocker() {}
+        virtual ~Blocker();
         virtual bool should_unblock(Thread&, time_t now_s, long us) = 0;
         virtual const char* state_string() const = 0;
+        // Blockers that someone else wakes up (by calling consider_unblock()) when their
+        // condition may have changed return false here, and aren't polled by the scheduler.
+        virtual bool needs_polling() const { return true; }
         void set_interrupted_by_death() { m_was_interrupted_by_death = true; }
         bool was_interrupted_by_death() const { return m_was_interrupted_by_death; }
         void set_interrupted_by_signal() { m_was_interrupted_while_blocked = true; }
         bool was_interrupted_by_signal() const { return m_was_interrupted_while_blocked; }
 
+    protected:
+        // Have a timer wake the current thread at this time (in nanoseconds since boot),
+        // so the blocker doesn't need polling to notice.
+        void set_timeout(u64 deadline);
+        bool timed_out() const { return m_timed_out; }
+
     private:
         bool m_was_interrupted_while_blocked { false };
         bool m_was_interrupted_by_death { false };
+        bool m_timed_out { false };
+        u64 m_timeout_timer_id { 0 };
         friend class Thread;
     };
 
@@ -142,6 +156,7 @@ public:
         explicit JoinBlocker(Thread& joinee, void*& joinee_exit_value);
         virtual bool should_unblock(Thread&, time_t now_s, long us) override;
         virtual const char* state_string() const override { return "Joining"; }
+        virtual bool needs_polling() const override { return false; }
         void set_joinee_exit_value(void* value) { m_joinee_exit_value = value; }
 
     private:
@@ -151,13 +166,16 @@ public:
 
     class FileDescriptionBlocker : public Blocker {
     public:
+        virtual ~FileDescriptionBlocker() override;
         const FileDescription& blocked_description() const;
+        virtual bool needs_polling() const override { return !m_watcher; }
 
     protected:
         explicit FileDescriptionBlocker(const FileDescription&);
 
     private:
         NonnullRefPtr<FileDescription> m_blocked_description;
+        OwnPtr<WaitQueueWatcher> m_watcher;
     };
 
     class AcceptBlocker final : public FileDescriptionBlocker {
@@ -179,8 +197,6 @@ public:
         explicit WriteBlocker(const FileDescription&);
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Writing"; }
-    private:
-        Optional<timeval> m_deadline;
     };
 
     class ReadBlocker final : public FileDescriptionBlocker {
@@ -188,8 +204,6 @@ public:
         explicit ReadBlocker(const FileDescription&);
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Reading"; }
-    private:
-        Optional<timeval> m_deadline;
     };
 
     class ConditionBlocker final : public Blocker {
@@ -208,24 +222,28 @@ public:
         explicit SleepBlocker(u64 wakeup_time);
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Sleeping"; }
-
-    private:
-        u64 m_wakeup_time { 0 };
+        virtual bool needs_polling() const override { return false; }
     };
 
     class SelectBlocker final : public Blocker {
     public:
         typedef Vector<int, FD_SETSIZE> FDVector;
-        SelectBlocker(const timeval& tv, bool select_has_timeout, const FDVector& read_fds, const FDVector& write_fds, const FDVector& except_fds);
+        SelectBlocker(u64 deadline, bool select_has_timeout, const FDVector& read_fds, const FDVector& write_fds, const FDVector& except_fds);
+        virtual ~SelectBlocker() override;
         virtual bool should_unblock(Thread&, time_t, long) override;
         virtual const char* state_string() const override { return "Selecting"; }
+        virtual bool needs_polling() const override { return m_has_unregistered_fds; }
 
     private:
-        timeval m_select_timeout;
+        void register_with_files(const FDVector&);
+
         bool m_select_has_timeout { false };
         const FDVector& m_select_read_fds;
         const FDVector& m_select_write_fds;
         const FDVector& m_select_exceptional_fds;
+        NonnullRefPtrVector<FileDescription> m_registered_descriptions;
+        NonnullOwnPtrVector<WaitQueueWatcher> m_watchers;
+        bool m_has_unregistered_fds { false };
     };
 
     class WaitBlocker final : public Blocker {
@@ -247,6 +265,7 @@ public:
 
         SemiPermanentBlocker(Reason reason);
         virtual bool should_unblock(Thread&, time_t, long) override;
+        virtual bool needs_polling() const override { return false; }
         virtual const char* state_string() const override
         {
             switch (m_reason) {
@@ -281,7 +300,8 @@ public:
 
     VirtualAddress thread_specific_data() const { return m_thread_specific_data; }
 
-    u64 sleep(u32 ticks);
+    // Both take and return nanoseconds since boot.
+    u64 sleep(u64 nanoseconds);
     u64 sleep_until(u64 wakeup_time);
 
     enum class BlockResult {
@@ -301,8 +321,13 @@ public:
         m_blocker = &t;
         set_state(Thread::Blocked);
 
+        // Nobody polls event-driven blockers, so don't sleep through a condition that's already met.
+        if (!t.needs_polling())
+            consider_unblock_now();
+
         // Yield to the scheduler, and wait for us to resume unblocked.
-        yield_without_holding_big_lock();
+        if (state() == Thread::Blocked)
+            yield_without_holding_big_lock();
 
         // We should no longer be blocked once we woke up
         ASSERT(state() != Thread::Blocked);
@@ -349,11 +374,14 @@ public:
     void send_urgent_signal_to_self(u8 signal);
     void send_signal(u8 signal, Process* sender);
     void consider_unblock(time_t now_sec, long now_usec);
+    void consider_unblock_now();
 
     void set_dump_backtrace_on_finalization() { m_dump_backtrace_on_finalization = true; }
 
     ShouldUnblockThread dispatch_one_pending_signal();
     ShouldUnblockThread dispatch_signal(u8 signal);
+    // dispatch_signal() pushes this much (at most) below the userspace stack pointer.
+    static constexpr u32 max_signal_frame_size = 14 * sizeof(u32) + 15;
     bool has_unmasked_pending_signals() const;
     void terminate_due_to_signal(u8 signal);
     bool should_ignore_signal(u8 signal) const;
@@ -374,6 +402,8 @@ public:
     void did_inode_fault() { ++m_inode_faults; }
     unsigned zero_faults() const { return m_zero_faults; }
     void did_zero_fault() { ++m_zero_faults; }
+    unsigned zero_page_maps() const { return m_zero_page_maps; }
+    void did_zero_page_map() { ++m_zero_page_maps; }
     unsigned cow_faults() const { return m_cow_faults; }
     void did_cow_fault() { ++m_cow_faults; }
 
@@ -436,9 +466,11 @@ public:
 private:
     IntrusiveListNode m_runnable_list_node;
     IntrusiveListNode m_wait_queue_node;
+    IntrusiveListNode m_pending_signals_list_node;
 
 private:
-    friend class SchedulerData;
+    friend struct SchedulerData;
+    friend class Scheduler;
     friend class WaitQueue;
     bool unlock_process_if_locked();
     void relock_process();
@@ -468,6 +500,7 @@ private:
     unsigned m_syscall_count { 0 };
     unsigned m_inode_faults { 0 };
     unsigned m_zero_faults { 0 };
+    unsigned m_zero_page_maps { 0 };
     unsigned m_cow_faults { 0 };
 
     unsigned m_file_read_bytes { 0 };
@@ -483,8 +516,9 @@ private:
     State m_state { Invalid };
     String m_name;
     u32 m_priority { THREAD_PRIORITY_NORMAL };
-    u32 m_extra_priority { 0 };
     u32 m_priority_boost { 0 };
+    // When this thread last started waiting in a run queue; the scheduler ages waiting threads from this.
+    u64 m_runnable_since { 0 };
 
     u8 m_stop_signal { 0 };
 
@@ -535,15 +569,59 @@ const LogStream& operator<<(const LogStream&, const Thread&);
 
 struct SchedulerData {
     typedef IntrusiveList<Thread, &Thread::m_runnable_list_node> ThreadList;
-
-    ThreadList m_runnable_threads;
+    typedef IntrusiveList<Thread, &Thread::m_pending_signals_list_node> PendingSignalsList;
+
+    // Enough for THREAD_PRIORITY_MAX plus the largest thread and process boosts.
+    static constexpr u32 priority_levels = 160;
+
+    // Runnable threads are queued by effective priority, round-robin within a level.
+    // A set bit in m_nonempty_levels means that level's queue may have threads in it;
+    // threads can leave a queue without going through us, so bits are cleared lazily.
+    ThreadList m_run_queues[priority_levels];
+    u32 m_nonempty_levels[priority_levels / 32] {};
+    // Threads the scheduler has to look at on every pass (polled blockers, Skip*SchedulerPass)
+    ThreadList m_polled_threads;
+    // Blocked threads that get woken up by whatever they're waiting for.
+    ThreadList m_waiting_threads;
+    // Threads that aren't runnable and that nothing needs to look at (stopped, queued, dying, ...)
     ThreadList m_nonrunnable_threads;
+    // Threads that may have unmasked signals for the scheduler to dispatch. Threads are put on
+    // here when sent a signal or when they unmask one, and taken off once nothing is deliverable.
+    PendingSignalsList m_threads_with_pending_signals;
+    // Dead processes that nobody is going to wait() for, to be reaped by the scheduler.
+    Vector<pid_t> m_orphans_to_reap;
+
+    static u32 level_for(const Thread& thread) { return min(thread.effective_priority(), priority_levels - 1); }
+
+    void enqueue_runnable(Thread& thread)
+    {
+        u32 level = level_for(thread);
+        m_run_queues[level].append(thread);
+        m_nonempty_levels[level / 32] |= 1u << (level % 32);
+    }
+
+    bool is_queued_at_own_level(const Thread& thread) const { return m_run_queues[level_for(thread)].contains(thread); }
 
-    ThreadList& thread_list_for_state(Thread::State state)
+    // Calls callback(level, queue) for every possibly non-empty level, highest first.
+    template<typename Callback>
+    IterationDecision for_each_nonempty_level(Callback callback)
     {
-        if (Thread::is_runnable_state(state))
-            return m_runnable_threads;
-        return m_nonrunnable_threads;
+        for (int word = priority_levels / 32 - 1; word >= 0; --word) {
+            u32 bits = m_nonempty_levels[word];
+            while (bits) {
+                u32 bit = 31 - __builtin_clz(bits);
+                bits &= ~(1u << bit);
+                u32 level = word * 32 + bit;
+                auto& queue = m_run_queues[level];
+                if (queue.is_empty()) {
+                    m_nonempty_levels[word] &= ~(1u << bit);
+                    continue;
+                }
+                if (callback(level, queue) == IterationDecision::Break)
+                    return IterationDecision::Break;
+            }
+        }
+        return IterationDecision::Continue;
     }
 };
 
@@ -551,27 +629,28 @@ template<typename Callback>
 inline IterationDecision Scheduler::for_each_runnable(Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& tl = g_scheduler_data->m_runnable_threads;
-    for (auto it = tl.begin(); it != tl.end();) {
-        auto& thread = *it;
-        it = ++it;
-        if (callback(thread) == IterationDecision::Break)
-            return IterationDecision::Break;
-    }
-
-    return IterationDecision::Continue;
+    return g_scheduler_data->for_each_nonempty_level([&](u32, auto& queue) {
+        for (auto it = queue.begin(); it != queue.end();) {
+            auto& thread = *it;
+            it = ++it;
+            if (callback(thread) == IterationDecision::Break)
+                return IterationDecision::Break;
+        }
+        return IterationDecision::Continue;
+    });
 }
 
 template<typename Callback>
 inline IterationDecision Scheduler::for_each_nonrunnable(Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    auto& tl = g_scheduler_data->m_nonrunnable_threads;
-    for (auto it = tl.begin(); it != tl.end();) {
-        auto& thread = *it;
-        it = ++it;
-        if (callback(thread) == IterationDecision::Break)
-            return IterationDecision::Break;
+    for (auto* tl : { &g_scheduler_data->m_polled_threads, &g_scheduler_data->m_waiting_threads, &g_scheduler_data->m_nonrunnable_threads }) {
+        for (auto it = tl->begin(); it != tl->end();) {
+            auto& thread = *it;
+            it = ++it;
+            if (callback(thread) == IterationDecision::Break)
+                return IterationDecision::Break;
+        }
     }
 
     return IterationDecision::Continue;
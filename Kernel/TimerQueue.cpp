@@ -27,6 +27,7 @@
 #include <AK/Function.h>
 #include <AK/NonnullOwnPtr.h>
 #include <AK/OwnPtr.h>
+#include <Kernel/Arch/i386/APIC.h>
 #include <Kernel/Scheduler.h>
 #include <Kernel/TimerQueue.h>
 
@@ -41,58 +42,132 @@ TimerQueue& TimerQueue::the()
 
 u64 TimerQueue::add_timer(NonnullOwnPtr<Timer>&& timer)
 {
-    ASSERT(timer->expires > g_uptime);
-
+    InterruptDisabler disabler;
     timer->id = ++m_timer_id_count;
-
-    auto following_timer = m_timer_queue.find([&timer](auto& other) { return other->expires > timer->expires; });
-    if (following_timer.is_end())
-        m_timer_queue.append(move(timer));
-    else
-        m_timer_queue.insert_before(following_timer, move(timer));
+    timer->heap_index = m_timer_heap.size();
+    m_timers_by_id.set(timer->id, timer.ptr());
+    u64 expires = timer->expires;
+    size_t index = timer->heap_index;
+    m_timer_heap.append(move(timer));
+    heap_sift_up(index);
 
     update_next_timer_due();
 
+    // Whatever is armed right now would go off too late for this one.
+    if (APIC::has_timer() && (!m_next_event_due || expires < m_next_event_due))
+        program_event_timer(m_next_event_due);
+
     return m_timer_id_count;
 }
 
 u64 TimerQueue::add_timer(u64 duration, TimeUnit unit, Function<void()>&& callback)
 {
     NonnullOwnPtr timer = make<Timer>();
-    timer->expires = g_uptime + duration * unit;
+    timer->expires = PIT::nanoseconds_since_boot() + duration * unit;
     timer->callback = move(callback);
     return add_timer(move(timer));
 }
 
 bool TimerQueue::cancel_timer(u64 id)
 {
-    auto it = m_timer_queue.find([id](auto& timer) { return timer->id == id; });
-    if (it.is_end())
+    InterruptDisabler disabler;
+    auto it = m_timers_by_id.find(id);
+    if (it == m_timers_by_id.end())
         return false;
-    m_timer_queue.remove(it);
+    heap_take((*it).value->heap_index);
     update_next_timer_due();
     return true;
 }
 
 void TimerQueue::fire()
 {
-    if (m_timer_queue.is_empty())
+    if (m_timer_heap.is_empty())
         return;
 
-    ASSERT(m_next_timer_due == m_timer_queue.first()->expires);
+    ASSERT(m_next_timer_due == m_timer_heap.first()->expires);
 
-    while (!m_timer_queue.is_empty() && g_uptime > m_timer_queue.first()->expires) {
-        auto timer = m_timer_queue.take_first();
+    auto now = PIT::nanoseconds_since_boot();
+    while (!m_timer_heap.is_empty() && m_timer_heap.first()->expires <= now) {
+        auto timer = heap_take(0);
         timer->callback();
     }
 
     update_next_timer_due();
 }
 
+void TimerQueue::program_event_timer(u64 next_tick)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!APIC::has_timer())
+        return;
+
+    u64 next_event = next_tick;
+    if (m_next_timer_due && (!next_event || m_next_timer_due < next_event))
+        next_event = m_next_timer_due;
+    m_next_event_due = next_event;
+
+    if (!next_event) {
+        APIC::disarm_timer();
+        return;
+    }
+    auto now = PIT::nanoseconds_since_boot();
+    APIC::arm_timer(next_event > now ? next_event - now : 0);
+}
+
 void TimerQueue::update_next_timer_due()
 {
-    if (m_timer_queue.is_empty())
+    if (m_timer_heap.is_empty())
         m_next_timer_due = 0;
     else
-        m_next_timer_due = m_timer_queue.first()->expires;
+        m_next_timer_due = m_timer_heap.first()->expires;
+}
+
+void TimerQueue::heap_swap(size_t a, size_t b)
+{
+    swap(m_timer_heap[a], m_timer_heap[b]);
+    m_timer_heap[a]->heap_index = a;
+    m_timer_heap[b]->heap_index = b;
+}
+
+void TimerQueue::heap_sift_up(size_t index)
+{
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!(*m_timer_heap[index] < *m_timer_heap[parent]))
+            break;
+        heap_swap(index, parent);
+        index = parent;
+    }
+}
+
+void TimerQueue::heap_sift_down(size_t index)
+{
+    size_t size = m_timer_heap.size();
+    for (;;) {
+        size_t smallest = index;
+        size_t left = index * 2 + 1;
+        size_t right = left + 1;
+        if (left < size && *m_timer_heap[left] < *m_timer_heap[smallest])
+            smallest = left;
+        if (right < size && *m_timer_heap[right] < *m_timer_heap[smallest])
+            smallest = right;
+        if (smallest == index)
+            break;
+        heap_swap(index, smallest);
+        index = smallest;
+    }
+}
+
+NonnullOwnPtr<Timer> TimerQueue::heap_take(size_t index)
+{
+    size_t last = m_timer_heap.size() - 1;
+    if (index != last)
+        heap_swap(index, last);
+    auto timer = m_timer_heap.take_last().release_nonnull();
+    m_timers_by_id.remove(timer->id);
+    if (index < (size_t)m_timer_heap.size()) {
+        heap_sift_up(index);
+        heap_sift_down(index);
+    }
+    return timer;
 }
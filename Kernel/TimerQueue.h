@@ -27,15 +27,17 @@
 #pragma once
 
 #include <AK/Function.h>
+#include <AK/HashMap.h>
 #include <AK/NonnullOwnPtr.h>
 #include <AK/OwnPtr.h>
-#include <AK/SinglyLinkedList.h>
+#include <AK/Vector.h>
 #include <Kernel/Arch/i386/PIT.h>
 
 struct Timer {
     u64 id;
-    u64 expires;
+    u64 expires; // Nanoseconds since boot.
     Function<void()> callback;
+    size_t heap_index { 0 };
     bool operator<(const Timer& rhs) const
     {
         return expires < rhs.expires;
@@ -50,12 +52,17 @@ struct Timer {
     }
 };
 
-enum TimeUnit {
-    MS = TICKS_PER_SECOND / 1000,
-    S = TICKS_PER_SECOND,
-    M = TICKS_PER_SECOND * 60
+enum TimeUnit : u64 {
+    NS = 1,
+    US = 1000,
+    MS = 1000000,
+    S = 1000000000,
+    M = 60000000000ull,
 };
 
+// Timers are kept in a binary min-heap ordered by expiry, so adding and cancelling
+// one is O(log n) and the next one due is always at the top.
+// Timer callbacks run in interrupt context.
 class TimerQueue {
 public:
     static TimerQueue& the();
@@ -65,10 +72,22 @@ public:
     bool cancel_timer(u64 id);
     void fire();
 
+    // When the next timer is due, or 0 if there are none.
+    u64 next_timer_due() const { return m_next_timer_due; }
+
+    // Programs the one-shot event timer for next_tick (0 for no tick) or the next timer due, whichever comes first.
+    void program_event_timer(u64 next_tick);
+
 private:
     void update_next_timer_due();
+    void heap_swap(size_t, size_t);
+    void heap_sift_up(size_t);
+    void heap_sift_down(size_t);
+    NonnullOwnPtr<Timer> heap_take(size_t);
 
     u64 m_next_timer_due { 0 };
+    u64 m_next_event_due { 0 };
     u64 m_timer_id_count { 0 };
-    SinglyLinkedList<NonnullOwnPtr<Timer>> m_timer_queue;
+    Vector<OwnPtr<Timer>> m_timer_heap;
+    HashMap<u64, Timer*> m_timers_by_id;
 };
@@ -37,6 +37,13 @@
 #define WEXITED 4
 #define WCONTINUED 8
 
+#define POSIX_SPAWN_RESETIDS 0x01
+#define POSIX_SPAWN_SETPGROUP 0x02
+#define POSIX_SPAWN_SETSIGDEF 0x04
+#define POSIX_SPAWN_SETSIGMASK 0x08
+#define POSIX_SPAWN_SETSID 0x80
+#define POSIX_SPAWN_TCSETPGROUP 0x100
+
 #define R_OK 4
 #define W_OK 2
 #define X_OK 1
@@ -461,6 +468,7 @@ typedef enum {
 
 typedef int clockid_t;
 
+#define CLOCK_REALTIME 0
 #define CLOCK_MONOTONIC 1
 #define TIMER_ABSTIME 99
 
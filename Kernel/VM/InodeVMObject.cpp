@@ -76,26 +76,50 @@ size_t InodeVMObject::amount_clean() const
 
 size_t InodeVMObject::amount_dirty() const
 {
-    size_t count = 0;
-    for (int i = 0; i < m_dirty_pages.size(); ++i) {
-        if (m_dirty_pages.get(i))
-            ++count;
-    }
-    return count * PAGE_SIZE;
+    return m_dirty_page_count * PAGE_SIZE;
+}
+
+void InodeVMObject::set_page_dirty(size_t page_index, bool dirty)
+{
+    ASSERT(page_index < page_count());
+    if (m_dirty_pages.get(page_index) == dirty)
+        return;
+    m_dirty_pages.set(page_index, dirty);
+    if (dirty)
+        ++m_dirty_page_count;
+    else
+        --m_dirty_page_count;
 }
 
 void InodeVMObject::inode_size_changed(Badge<Inode>, size_t old_size, size_t new_size)
 {
+#ifdef MM_DEBUG
     dbgprintf("VMObject::inode_size_changed: {%u:%u} %u -> %u\n",
         m_inode->fsid(), m_inode->index(),
         old_size, new_size);
+#else
+    (void)old_size;
+#endif
 
     InterruptDisabler disabler;
 
     auto new_page_count = PAGE_ROUND_UP(new_size) / PAGE_SIZE;
     m_physical_pages.resize(new_page_count);
 
-    m_dirty_pages.grow(new_page_count, false);
+    if (new_page_count < (size_t)m_dirty_pages.size()) {
+        // Dirty pages past the new end are gone along with their physical pages.
+        auto dirty_pages = Bitmap::create(new_page_count, false);
+        m_dirty_page_count = 0;
+        for (size_t i = 0; i < new_page_count; ++i) {
+            if (m_dirty_pages.get(i)) {
+                dirty_pages.set(i, true);
+                ++m_dirty_page_count;
+            }
+        }
+        m_dirty_pages = move(dirty_pages);
+    } else {
+        m_dirty_pages.grow(new_page_count, false);
+    }
 
     // FIXME: Consolidate with inode_contents_changed() so we only do a single walk.
     for_each_region([](auto& region) {
@@ -160,6 +184,14 @@ int InodeVMObject::release_all_clean_pages()
     return release_all_clean_pages_impl();
 }
 
+int InodeVMObject::release_all_clean_pages_with_interrupts_disabled(Badge<MemoryManager>)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (m_paging_lock.is_locked())
+        return 0;
+    return release_all_clean_pages_impl();
+}
+
 int InodeVMObject::release_all_clean_pages_impl()
 {
     int count = 0;
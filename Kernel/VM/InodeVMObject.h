@@ -46,6 +46,11 @@ public:
     size_t amount_clean() const;
 
     int release_all_clean_pages();
+    int release_all_clean_pages_with_interrupts_disabled(Badge<MemoryManager>);
+
+    bool is_page_dirty(size_t page_index) const { return m_dirty_pages.get(page_index); }
+    void set_page_dirty(size_t page_index, bool);
+    size_t dirty_page_count() const { return m_dirty_page_count; }
 
     u32 writable_mappings() const;
     u32 executable_mappings() const;
@@ -64,4 +69,5 @@ private:
 
     NonnullRefPtr<Inode> m_inode;
     Bitmap m_dirty_pages;
+    size_t m_dirty_page_count { 0 };
 };
@@ -57,6 +57,9 @@ MemoryManager::MemoryManager()
 
     setup_low_identity_mapping();
     protect_kernel_image();
+
+    m_shared_zero_page = allocate_user_physical_page(ShouldZeroFill::Yes);
+    m_zeroed_user_physical_pages.ensure_capacity(zeroed_page_pool_high_watermark);
 }
 
 MemoryManager::~MemoryManager()
@@ -222,6 +225,20 @@ PageTableEntry& MemoryManager::ensure_pte(PageDirectory& page_directory, Virtual
     return quickmap_pt(PhysicalAddress((uintptr_t)pde.page_table_base()))[page_table_index];
 }
 
+PageTableEntry* MemoryManager::pte(PageDirectory& page_directory, VirtualAddress vaddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    u32 page_directory_table_index = (vaddr.get() >> 30) & 0x3;
+    u32 page_directory_index = (vaddr.get() >> 21) & 0x1ff;
+    u32 page_table_index = (vaddr.get() >> 12) & 0x1ff;
+
+    auto* pd = quickmap_pd(page_directory, page_directory_table_index);
+    PageDirectoryEntry& pde = pd[page_directory_index];
+    if (!pde.is_present())
+        return nullptr;
+    return &quickmap_pt(PhysicalAddress((uintptr_t)pde.page_table_base()))[page_table_index];
+}
+
 void MemoryManager::initialize()
 {
     s_the = new MemoryManager;
@@ -231,20 +248,32 @@ Region* MemoryManager::kernel_region_from_vaddr(VirtualAddress vaddr)
 {
     if (vaddr.get() < 0xc0000000)
         return nullptr;
-    for (auto& region : MM.m_kernel_regions) {
-        if (region.contains(vaddr))
-            return &region;
+    auto& regions = MM.m_kernel_regions_by_address;
+    size_t index = kernel_region_index_after(vaddr);
+    if (index == 0 || !regions[index - 1]->contains(vaddr))
+        return nullptr;
+    return regions[index - 1];
+}
+
+size_t MemoryManager::kernel_region_index_after(VirtualAddress vaddr)
+{
+    auto& regions = MM.m_kernel_regions_by_address;
+    size_t low = 0;
+    size_t high = regions.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (regions[middle]->vaddr() <= vaddr)
+            low = middle + 1;
+        else
+            high = middle;
     }
-    return nullptr;
+    return low;
 }
 
 Region* MemoryManager::user_region_from_vaddr(Process& process, VirtualAddress vaddr)
 {
-    // FIXME: Use a binary search tree (maybe red/black?) or some other more appropriate data structure!
-    for (auto& region : process.m_regions) {
-        if (region.contains(vaddr))
-            return &region;
-    }
+    if (auto* region = process.region_containing(vaddr))
+        return region;
     dbg() << process << " Couldn't find user region for " << vaddr;
     return nullptr;
 }
@@ -376,11 +405,52 @@ RefPtr<PhysicalPage> MemoryManager::find_free_user_physical_page()
     return page;
 }
 
+bool MemoryManager::zero_one_idle_page()
+{
+    InterruptDisabler disabler;
+    size_t pool_size = m_zeroed_user_physical_pages.size();
+    if (pool_size >= zeroed_page_pool_high_watermark)
+        m_refilling_zeroed_user_physical_pages = false;
+    else if (pool_size < zeroed_page_pool_low_watermark)
+        m_refilling_zeroed_user_physical_pages = true;
+    if (!m_refilling_zeroed_user_physical_pages)
+        return false;
+
+    // Leave the last bit of memory to the page fault path.
+    if (m_user_physical_pages - m_user_physical_pages_used - pool_size <= zeroed_page_pool_high_watermark)
+        return false;
+
+    auto page = find_free_user_physical_page();
+    if (!page)
+        return false;
+    auto* ptr = quickmap_page(*page);
+    fast_u32_fill((u32*)ptr, 0, PAGE_SIZE / sizeof(u32));
+    unquickmap_page();
+    m_zeroed_user_physical_pages.append(page.release_nonnull());
+    return true;
+}
+
 RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill should_zero_fill)
 {
     InterruptDisabler disabler;
+
+    if (should_zero_fill == ShouldZeroFill::Yes) {
+        if (!m_zeroed_user_physical_pages.is_empty()) {
+            ++m_zeroed_user_physical_page_hits;
+            ++m_user_physical_pages_used;
+            return m_zeroed_user_physical_pages.take_last();
+        }
+        ++m_zeroed_user_physical_page_misses;
+    }
+
     RefPtr<PhysicalPage> page = find_free_user_physical_page();
 
+    // Rather dip into the zeroed pages than start purging.
+    if (!page && !m_zeroed_user_physical_pages.is_empty()) {
+        ++m_user_physical_pages_used;
+        return m_zeroed_user_physical_pages.take_last();
+    }
+
     if (!page) {
         if (m_user_physical_regions.is_empty()) {
             kprintf("MM: no user physical regions available (?)\n");
@@ -400,6 +470,24 @@ RefPtr<PhysicalPage> MemoryManager::allocate_user_physical_page(ShouldZeroFill s
             return IterationDecision::Continue;
         });
 
+        if (!page) {
+            // File contents that are clean can always be read back in later.
+            for_each_vmobject([&](auto& vmobject) {
+                if (vmobject.is_inode()) {
+                    auto& inode_vmobject = static_cast<InodeVMObject&>(vmobject);
+                    int released_page_count = inode_vmobject.release_all_clean_pages_with_interrupts_disabled({});
+                    if (released_page_count) {
+                        kprintf("MM: Released %d clean pages from InodeVMObject{%p}\n", released_page_count, &inode_vmobject);
+                        // Pages still referenced elsewhere (e.g mid-copy) don't come back right away.
+                        page = find_free_user_physical_page();
+                        if (page)
+                            return IterationDecision::Break;
+                    }
+                }
+                return IterationDecision::Continue;
+            });
+        }
+
         if (!page) {
             kprintf("MM: no user physical pages available\n");
             ASSERT_NOT_REACHED();
@@ -447,8 +535,8 @@ RefPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
 
     for (auto& region : m_super_physical_regions) {
         page = region.take_free_page(true);
-        if (page.is_null())
-            continue;
+        if (!page.is_null())
+            break;
     }
 
     if (!page) {
@@ -470,6 +558,46 @@ RefPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
     return page;
 }
 
+NonnullRefPtrVector<PhysicalPage> MemoryManager::allocate_contiguous_supervisor_physical_pages(size_t size)
+{
+    ASSERT(!(size % PAGE_SIZE));
+    InterruptDisabler disabler;
+    size_t count = size / PAGE_SIZE;
+    NonnullRefPtrVector<PhysicalPage> pages;
+
+    for (auto& region : m_super_physical_regions) {
+        pages = region.take_contiguous_free_pages(count, true);
+        if (!pages.is_empty())
+            break;
+    }
+
+    if (pages.is_empty()) {
+        kprintf("MM: no %u contiguous super physical pages available\n", count);
+        return {};
+    }
+
+    for (auto& page : pages)
+        fast_u32_fill((u32*)page.paddr().offset(0xc0000000).as_ptr(), 0, PAGE_SIZE / sizeof(u32));
+    m_super_physical_pages_used += count;
+    return pages;
+}
+
+unsigned MemoryManager::user_physical_free_blocks_at_order(unsigned order) const
+{
+    unsigned count = 0;
+    for (auto& region : m_user_physical_regions)
+        count += region.free_blocks_at_order(order);
+    return count;
+}
+
+unsigned MemoryManager::super_physical_free_blocks_at_order(unsigned order) const
+{
+    unsigned count = 0;
+    for (auto& region : m_super_physical_regions)
+        count += region.free_blocks_at_order(order);
+    return count;
+}
+
 void MemoryManager::enter_process_paging_scope(Process& process)
 {
     ASSERT(current);
@@ -565,6 +693,70 @@ void MemoryManager::unquickmap_page()
     m_quickmap_in_use = false;
 }
 
+bool MemoryManager::is_resident(VirtualAddress vaddr, size_t size, bool for_writing)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto& page_directory = current ? current->process().page_directory() : kernel_page_directory();
+    for (auto page = vaddr.page_base(); page < vaddr.offset(size); page = page.offset(PAGE_SIZE)) {
+        auto* pte = this->pte(page_directory, page);
+        if (!pte || !pte->is_present() || (for_writing && !pte->is_writable()))
+            return false;
+    }
+    return true;
+}
+
+// Touch every page of a buffer, since we can't take a page fault while the quickmap is in use.
+static void fault_in_buffer(const u8* buffer, size_t size, bool for_writing)
+{
+    uintptr_t end = (uintptr_t)buffer + size;
+    for (uintptr_t address = (uintptr_t)buffer; address < end; address = (address & PAGE_MASK) + PAGE_SIZE) {
+        if (for_writing)
+            *(volatile u8*)address = 0;
+        else
+            (void)*(volatile const u8*)address;
+    }
+}
+
+void MemoryManager::copy_to_physical_page(PhysicalPage& physical_page, size_t offset, const u8* source, size_t size)
+{
+    ASSERT(offset + size <= PAGE_SIZE);
+    for (;;) {
+        fault_in_buffer(source, size, false);
+        InterruptDisabler disabler;
+        // Someone may have taken the pages away again before we got here.
+        if (!is_resident(VirtualAddress((uintptr_t)source), size, false))
+            continue;
+        u8* page_data = quickmap_page(physical_page);
+        memcpy(page_data + offset, source, size);
+        unquickmap_page();
+        return;
+    }
+}
+
+void MemoryManager::copy_from_physical_page(PhysicalPage& physical_page, size_t offset, u8* destination, size_t size)
+{
+    ASSERT(offset + size <= PAGE_SIZE);
+    for (;;) {
+        fault_in_buffer(destination, size, true);
+        InterruptDisabler disabler;
+        if (!is_resident(VirtualAddress((uintptr_t)destination), size, true))
+            continue;
+        u8* page_data = quickmap_page(physical_page);
+        memcpy(destination, page_data + offset, size);
+        unquickmap_page();
+        return;
+    }
+}
+
+void MemoryManager::zero_physical_page_range(PhysicalPage& physical_page, size_t offset, size_t size)
+{
+    ASSERT(offset + size <= PAGE_SIZE);
+    InterruptDisabler disabler;
+    u8* page_data = quickmap_page(physical_page);
+    memset(page_data + offset, 0, size);
+    unquickmap_page();
+}
+
 template<MemoryManager::AccessSpace space, MemoryManager::AccessType access_type>
 bool MemoryManager::validate_range(const Process& process, VirtualAddress base_vaddr, size_t size) const
 {
@@ -641,19 +833,25 @@ void MemoryManager::unregister_vmobject(VMObject& vmobject)
 void MemoryManager::register_region(Region& region)
 {
     InterruptDisabler disabler;
-    if (region.vaddr().get() >= 0xc0000000)
+    if (region.vaddr().get() >= 0xc0000000) {
         m_kernel_regions.append(&region);
-    else
+        m_kernel_regions_by_address.insert(kernel_region_index_after(region.vaddr()), &region);
+    } else {
         m_user_regions.append(&region);
+    }
 }
 
 void MemoryManager::unregister_region(Region& region)
 {
     InterruptDisabler disabler;
-    if (region.vaddr().get() >= 0xc0000000)
+    if (region.vaddr().get() >= 0xc0000000) {
         m_kernel_regions.remove(&region);
-    else
+        size_t index = kernel_region_index_after(region.vaddr());
+        ASSERT(index > 0 && m_kernel_regions_by_address[index - 1] == &region);
+        m_kernel_regions_by_address.remove(index - 1);
+    } else {
         m_user_regions.remove(&region);
+    }
 }
 
 void MemoryManager::dump_kernel_regions()
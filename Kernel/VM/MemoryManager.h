@@ -105,9 +105,21 @@ public:
 
     RefPtr<PhysicalPage> allocate_user_physical_page(ShouldZeroFill = ShouldZeroFill::Yes);
     RefPtr<PhysicalPage> allocate_supervisor_physical_page();
+    // Physically contiguous, zero-filled pages, e.g for DMA buffers. Returns an empty vector on failure.
+    NonnullRefPtrVector<PhysicalPage> allocate_contiguous_supervisor_physical_pages(size_t size);
     void deallocate_user_physical_page(PhysicalPage&&);
     void deallocate_supervisor_physical_page(PhysicalPage&&);
 
+    // A page of zeroes that is mapped read-only wherever anonymous memory is read before it's written.
+    PhysicalPage& shared_zero_page() { return *m_shared_zero_page; }
+    bool is_shared_zero_page(const PhysicalPage& page) const { return &page == m_shared_zero_page.ptr(); }
+
+    // Copy between part of a physical page and a buffer that may be in userspace and not paged in.
+    // The buffer must be valid; it's faulted in with interrupts enabled before the page is mapped.
+    void copy_to_physical_page(PhysicalPage&, size_t offset, const u8* source, size_t);
+    void copy_from_physical_page(PhysicalPage&, size_t offset, u8* destination, size_t);
+    void zero_physical_page_range(PhysicalPage&, size_t offset, size_t);
+
     OwnPtr<Region> allocate_kernel_region(size_t, const StringView& name, u8 access, bool user_accessible = false, bool should_commit = true, bool cacheable = true);
     OwnPtr<Region> allocate_kernel_region(PhysicalAddress, size_t, const StringView& name, u8 access, bool user_accessible = false, bool cacheable = false);
     OwnPtr<Region> allocate_kernel_region_with_vmobject(VMObject&, size_t, const StringView& name, u8 access, bool user_accessible = false, bool cacheable = false);
@@ -118,6 +130,17 @@ public:
     unsigned super_physical_pages() const { return m_super_physical_pages; }
     unsigned super_physical_pages_used() const { return m_super_physical_pages_used; }
 
+    unsigned user_physical_zeroed_pages() const { return m_zeroed_user_physical_pages.size(); }
+    unsigned user_physical_zeroed_page_hits() const { return m_zeroed_user_physical_page_hits; }
+    unsigned user_physical_zeroed_page_misses() const { return m_zeroed_user_physical_page_misses; }
+
+    // Called by the idle thread. Zeroes one free page into the pool and returns true,
+    // or returns false if the pool doesn't need topping up right now.
+    bool zero_one_idle_page();
+
+    unsigned user_physical_free_blocks_at_order(unsigned order) const;
+    unsigned super_physical_free_blocks_at_order(unsigned order) const;
+
     template<typename Callback>
     static void for_each_vmobject(Callback callback)
     {
@@ -155,12 +178,14 @@ private:
 
     static Region* user_region_from_vaddr(Process&, VirtualAddress);
     static Region* kernel_region_from_vaddr(VirtualAddress);
+    static size_t kernel_region_index_after(VirtualAddress);
 
     static Region* region_from_vaddr(VirtualAddress);
 
     RefPtr<PhysicalPage> find_free_user_physical_page();
     u8* quickmap_page(PhysicalPage&);
     void unquickmap_page();
+    bool is_resident(VirtualAddress, size_t, bool for_writing);
 
     PageDirectoryEntry* quickmap_pd(PageDirectory&, size_t pdpt_index);
     PageTableEntry* quickmap_pt(PhysicalAddress);
@@ -168,9 +193,21 @@ private:
     PageDirectory& kernel_page_directory() { return *m_kernel_page_directory; }
 
     PageTableEntry& ensure_pte(PageDirectory&, VirtualAddress);
+    // Like ensure_pte(), but returns nullptr instead of allocating a missing page table.
+    PageTableEntry* pte(PageDirectory&, VirtualAddress);
 
     RefPtr<PageDirectory> m_kernel_page_directory;
     RefPtr<PhysicalPage> m_low_page_table;
+    RefPtr<PhysicalPage> m_shared_zero_page;
+
+    // Free user pages that have already been zeroed. They are still free memory as far as
+    // accounting goes, but have been taken out of the physical regions.
+    static constexpr size_t zeroed_page_pool_low_watermark = 64;
+    static constexpr size_t zeroed_page_pool_high_watermark = 512;
+    NonnullRefPtrVector<PhysicalPage> m_zeroed_user_physical_pages;
+    bool m_refilling_zeroed_user_physical_pages { true };
+    unsigned m_zeroed_user_physical_page_hits { 0 };
+    unsigned m_zeroed_user_physical_page_misses { 0 };
 
     unsigned m_user_physical_pages { 0 };
     unsigned m_user_physical_pages_used { 0 };
@@ -182,6 +219,8 @@ private:
 
     InlineLinkedList<Region> m_user_regions;
     InlineLinkedList<Region> m_kernel_regions;
+    // The same regions, sorted by base address for lookups.
+    Vector<Region*> m_kernel_regions_by_address;
 
     InlineLinkedList<VMObject> m_vmobjects;
 
@@ -24,7 +24,6 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <AK/Bitmap.h>
 #include <AK/NonnullRefPtr.h>
 #include <AK/RefPtr.h>
 #include <Kernel/Assertions.h>
@@ -39,8 +38,11 @@ NonnullRefPtr<PhysicalRegion> PhysicalRegion::create(PhysicalAddress lower, Phys
 PhysicalRegion::PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper)
     : m_lower(lower)
     , m_upper(upper)
-    , m_bitmap(Bitmap::create())
 {
+    for (unsigned order = 0; order <= max_order; ++order) {
+        m_free_block_count[order] = 0;
+        m_first_free_block_word[order] = 0;
+    }
 }
 
 void PhysicalRegion::expand(PhysicalAddress lower, PhysicalAddress upper)
@@ -51,46 +53,150 @@ void PhysicalRegion::expand(PhysicalAddress lower, PhysicalAddress upper)
     m_upper = upper;
 }
 
+static void resize_zeroed(Vector<u32>& words, unsigned bit_count)
+{
+    words.resize((bit_count + 31) / 32);
+    for (auto& word : words)
+        word = 0;
+}
+
 unsigned PhysicalRegion::finalize_capacity()
 {
     ASSERT(!m_pages);
 
     m_pages = (m_upper.get() - m_lower.get()) / PAGE_SIZE;
-    m_bitmap.grow(m_pages, false);
+    for (unsigned order = 0; order <= max_order; ++order) {
+        unsigned block_count = (m_pages + (1u << order) - 1) >> order;
+        resize_zeroed(m_free_blocks[order], block_count);
+        resize_zeroed(m_free_block_words[order], m_free_blocks[order].size());
+    }
+
+    // Carve the region into the largest naturally aligned blocks that fit.
+    for (u32 page = 0; page < m_pages;) {
+        unsigned order = max_order;
+        while (order && ((page & ((1u << order) - 1)) || page + (1u << order) > m_pages))
+            --order;
+        push_free_block(page, order);
+        page += 1u << order;
+    }
 
     return size();
 }
 
-RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
+bool PhysicalRegion::is_free_block(u32 page, unsigned order) const
 {
-    ASSERT(m_pages);
+    u32 block = page >> order;
+    return m_free_blocks[order][block / 32] & (1u << (block % 32));
+}
 
-    if (m_used == m_pages)
-        return nullptr;
+u32 PhysicalRegion::find_free_block(unsigned order)
+{
+    auto& words = m_free_block_words[order];
+    auto& first = m_first_free_block_word[order];
+    for (; first < words.size(); ++first) {
+        if (!words[first])
+            continue;
+        u32 word_index = first * 32 + __builtin_ctz(words[first]);
+        u32 block = word_index * 32 + __builtin_ctz(m_free_blocks[order][word_index]);
+        return block << order;
+    }
+    return no_page;
+}
+
+void PhysicalRegion::push_free_block(u32 page, unsigned order)
+{
+    ASSERT(!is_free_block(page, order));
+    u32 block = page >> order;
+    m_free_blocks[order][block / 32] |= 1u << (block % 32);
+    m_free_block_words[order][block / 1024] |= 1u << ((block / 32) % 32);
+    if ((int)(block / 1024) < m_first_free_block_word[order])
+        m_first_free_block_word[order] = block / 1024;
+    ++m_free_block_count[order];
+}
 
-    // search from the last page we allocated
-    for (unsigned page = m_last; page < m_pages; page++) {
-        if (!m_bitmap.get(page)) {
-            m_bitmap.set(page, true);
-            m_used++;
-            m_last = page + 1;
-            return PhysicalPage::create(m_lower.offset(page * PAGE_SIZE), supervisor);
-        }
+void PhysicalRegion::remove_free_block(u32 page, unsigned order)
+{
+    ASSERT(is_free_block(page, order));
+    u32 block = page >> order;
+    auto& word = m_free_blocks[order][block / 32];
+    word &= ~(1u << (block % 32));
+    if (!word)
+        m_free_block_words[order][block / 1024] &= ~(1u << ((block / 32) % 32));
+    --m_free_block_count[order];
+}
+
+u32 PhysicalRegion::allocate_block(unsigned order)
+{
+    unsigned block_order = order;
+    while (block_order <= max_order && !m_free_block_count[block_order])
+        ++block_order;
+    if (block_order > max_order)
+        return no_page;
+
+    u32 page = find_free_block(block_order);
+    ASSERT(page != no_page);
+    remove_free_block(page, block_order);
+
+    // Split off the upper halves we don't need.
+    while (block_order > order) {
+        --block_order;
+        push_free_block(page + (1u << block_order), block_order);
     }
+    return page;
+}
 
-    // wrap back around to the start in case we missed something
-    for (unsigned page = 0; page < m_last; page++) {
-        if (!m_bitmap.get(page)) {
-            m_bitmap.set(page, true);
-            m_used++;
-            m_last = page + 1;
-            return PhysicalPage::create(m_lower.offset(page * PAGE_SIZE), supervisor);
-        }
+void PhysicalRegion::free_block(u32 page, unsigned order)
+{
+    // Merge with our buddy for as long as it's free too.
+    while (order < max_order) {
+        u32 buddy = page ^ (1u << order);
+        if (buddy >= m_pages || !is_free_block(buddy, order))
+            break;
+        remove_free_block(buddy, order);
+        page = min(page, buddy);
+        ++order;
     }
+    push_free_block(page, order);
+}
 
-    ASSERT_NOT_REACHED();
+RefPtr<PhysicalPage> PhysicalRegion::take_free_page(bool supervisor)
+{
+    ASSERT(m_pages);
+
+    if (m_used == m_pages)
+        return nullptr;
 
-    return nullptr;
+    u32 page = allocate_block(0);
+    ASSERT(page != no_page);
+    m_used++;
+    return PhysicalPage::create(m_lower.offset(page * PAGE_SIZE), supervisor);
+}
+
+NonnullRefPtrVector<PhysicalPage> PhysicalRegion::take_contiguous_free_pages(size_t count, bool supervisor)
+{
+    ASSERT(m_pages);
+    ASSERT(count);
+
+    unsigned order = 0;
+    while ((1u << order) < count)
+        ++order;
+    if (order > max_order || m_pages - m_used < count)
+        return {};
+
+    u32 first_page = allocate_block(order);
+    if (first_page == no_page)
+        return {};
+
+    // Give back the tail of the block that we rounded up to get.
+    for (u32 page = first_page + count; page < first_page + (1u << order); ++page)
+        free_block(page, 0);
+    m_used += count;
+
+    NonnullRefPtrVector<PhysicalPage> pages;
+    pages.ensure_capacity(count);
+    for (size_t i = 0; i < count; ++i)
+        pages.append(PhysicalPage::create(m_lower.offset((first_page + i) * PAGE_SIZE), supervisor));
+    return pages;
 }
 
 void PhysicalRegion::return_page_at(PhysicalAddress addr)
@@ -105,10 +211,10 @@ void PhysicalRegion::return_page_at(PhysicalAddress addr)
     ASSERT(local_offset >= 0);
     ASSERT((uintptr_t)local_offset < (uintptr_t)(m_pages * PAGE_SIZE));
 
-    auto page = (uintptr_t)local_offset / PAGE_SIZE;
-    if (page < m_last)
-        m_last = page;
+    u32 page = (uintptr_t)local_offset / PAGE_SIZE;
+    for (unsigned order = 0; order <= max_order; ++order)
+        ASSERT(!is_free_block(page & ~((1u << order) - 1), order));
 
-    m_bitmap.set(page, false);
+    free_block(page, 0);
     m_used--;
 }
@@ -26,15 +26,22 @@
 
 #pragma once
 
-#include <AK/Bitmap.h>
+#include <AK/NonnullRefPtrVector.h>
 #include <AK/RefCounted.h>
 #include <AK/NonnullRefPtr.h>
+#include <AK/Vector.h>
 #include <Kernel/VM/PhysicalPage.h>
 
+// Hands out the pages of one physically contiguous range with a binary buddy
+// allocator: free blocks of 2^order pages (order 0..max_order) are tracked in
+// one bitmap per order, so taking or returning a page is cheap (plus at most
+// max_order splits/merges), and runs of contiguous pages can be had for DMA.
 class PhysicalRegion : public RefCounted<PhysicalRegion> {
     AK_MAKE_ETERNAL
 
 public:
+    static constexpr unsigned max_order = 10;
+
     static NonnullRefPtr<PhysicalRegion> create(PhysicalAddress lower, PhysicalAddress upper);
     ~PhysicalRegion() {}
 
@@ -48,17 +55,40 @@ public:
     unsigned free() const { return m_pages - m_used; }
     bool contains(PhysicalPage& page) const { return page.paddr() >= m_lower && page.paddr() <= m_upper; }
 
+    unsigned free_blocks_at_order(unsigned order) const { return m_free_block_count[order]; }
+
     RefPtr<PhysicalPage> take_free_page(bool supervisor);
+    // The pages are physically contiguous, and the first one is aligned to
+    // the allocation size (rounded up to a power of two) within the region.
+    NonnullRefPtrVector<PhysicalPage> take_contiguous_free_pages(size_t count, bool supervisor);
     void return_page_at(PhysicalAddress addr);
     void return_page(PhysicalPage&& page) { return_page_at(page.paddr()); }
 
 private:
     PhysicalRegion(PhysicalAddress lower, PhysicalAddress upper);
 
+    static constexpr u32 no_page = 0xffffffff;
+
+    u32 allocate_block(unsigned order);
+    void free_block(u32 page, unsigned order);
+    bool is_free_block(u32 page, unsigned order) const;
+    u32 find_free_block(unsigned order);
+    void push_free_block(u32 page, unsigned order);
+    void remove_free_block(u32 page, unsigned order);
+
     PhysicalAddress m_lower;
     PhysicalAddress m_upper;
     unsigned m_pages { 0 };
     unsigned m_used { 0 };
-    unsigned m_last { 0 };
-    Bitmap m_bitmap;
+
+    // This metadata comes out of kmalloc before it can expand, so it has to stay small:
+    // about a quarter of a byte per page. Bit n of m_free_blocks[order] is set while
+    // the block of 2^order pages starting at page (n << order) is free, and bit n of
+    // m_free_block_words[order] is set while word n of m_free_blocks[order] is non-zero.
+    Vector<u32> m_free_blocks[max_order + 1];
+    Vector<u32> m_free_block_words[max_order + 1];
+    // No word of m_free_block_words[order] below this index is non-zero.
+    int m_first_free_block_word[max_order + 1];
+
+    unsigned m_free_block_count[max_order + 1];
 };
@@ -107,8 +107,10 @@ NonnullOwnPtr<Region> Region::clone()
         vaddr().get());
 #endif
     // Set up a COW region. The parent (this) region becomes COW as well!
+    // NOTE: The caller has to flush the TLB once it's done cloning regions.
     ensure_cow_map().fill(true);
-    remap();
+    if (is_writable())
+        write_protect_mapped_pages();
     auto clone_region = Region::create_user_accessible(m_range, m_vmobject->clone(), m_offset_in_vmobject, m_name, m_access);
     clone_region->ensure_cow_map();
     if (m_stack) {
@@ -143,7 +145,7 @@ bool Region::commit(size_t page_index)
     dbgprintf("MM: commit single page (%zu) in Region %p (VMO=%p) at V%p\n", page_index, vmobject().page_count(), this, &vmobject(), vaddr().get());
 #endif
     auto& vmobject_physical_page_entry = vmobject().physical_pages()[first_page_index() + page_index];
-    if (!vmobject_physical_page_entry.is_null())
+    if (!vmobject_physical_page_entry.is_null() && !MM.is_shared_zero_page(*vmobject_physical_page_entry))
         return true;
     auto physical_page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::Yes);
     if (!physical_page) {
@@ -176,7 +178,19 @@ size_t Region::amount_resident() const
 {
     size_t bytes = 0;
     for (size_t i = 0; i < page_count(); ++i) {
-        if (m_vmobject->physical_pages()[first_page_index() + i])
+        auto& physical_page = m_vmobject->physical_pages()[first_page_index() + i];
+        if (physical_page && !MM.is_shared_zero_page(*physical_page))
+            bytes += PAGE_SIZE;
+    }
+    return bytes;
+}
+
+size_t Region::amount_zero_mapped() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < page_count(); ++i) {
+        auto& physical_page = m_vmobject->physical_pages()[first_page_index() + i];
+        if (physical_page && MM.is_shared_zero_page(*physical_page))
             bytes += PAGE_SIZE;
     }
     return bytes;
@@ -187,7 +201,7 @@ size_t Region::amount_shared() const
     size_t bytes = 0;
     for (size_t i = 0; i < page_count(); ++i) {
         auto& physical_page = m_vmobject->physical_pages()[first_page_index() + i];
-        if (physical_page && physical_page->ref_count() > 1)
+        if (physical_page && physical_page->ref_count() > 1 && !MM.is_shared_zero_page(*physical_page))
             bytes += PAGE_SIZE;
     }
     return bytes;
@@ -260,7 +274,7 @@ void Region::map_individual_page_impl(size_t page_index)
         pte.set_cache_disabled(!m_cacheable);
         pte.set_physical_page_base(physical_page->paddr().get());
         pte.set_present(true);
-        if (should_cow(page_index))
+        if (should_cow(page_index) || MM.is_shared_zero_page(*physical_page))
             pte.set_writable(false);
         else
             pte.set_writable(is_writable());
@@ -282,17 +296,33 @@ void Region::remap_page(size_t page_index)
     map_individual_page_impl(page_index);
 }
 
+void Region::write_protect_mapped_pages()
+{
+    ASSERT(m_page_directory);
+    InterruptDisabler disabler;
+    for (size_t i = 0; i < page_count(); ++i) {
+        if (!vmobject().physical_pages()[first_page_index() + i])
+            continue;
+        auto* pte = MM.pte(*m_page_directory, vaddr().offset(i * PAGE_SIZE));
+        if (pte && pte->is_present())
+            pte->set_writable(false);
+    }
+}
+
 void Region::unmap(ShouldDeallocateVirtualMemoryRange deallocate_range)
 {
     InterruptDisabler disabler;
     ASSERT(m_page_directory);
     for (size_t i = 0; i < page_count(); ++i) {
         auto vaddr = this->vaddr().offset(i * PAGE_SIZE);
-        auto& pte = MM.ensure_pte(*m_page_directory, vaddr);
-        pte.set_physical_page_base(0);
-        pte.set_present(false);
-        pte.set_writable(false);
-        pte.set_user_allowed(false);
+        // Pages that were never mapped (e.g after a fork) may not even have a page table.
+        auto* pte = MM.pte(*m_page_directory, vaddr);
+        if (!pte || !pte->is_present())
+            continue;
+        pte->set_physical_page_base(0);
+        pte->set_present(false);
+        pte->set_writable(false);
+        pte->set_user_allowed(false);
         MM.flush_tlb(vaddr);
 #ifdef MM_DEBUG
         auto& physical_page = vmobject().physical_pages()[first_page_index() + i];
@@ -345,10 +375,10 @@ PageFaultResponse Region::handle_fault(const PageFault& fault)
 #ifdef PAGE_FAULT_DEBUG
         dbgprintf("NP(zero) fault in Region{%p}[%u]\n", this, page_index_in_region);
 #endif
-        return handle_zero_fault(page_index_in_region);
+        return handle_zero_fault(page_index_in_region, fault.access());
     }
     ASSERT(fault.type() == PageFault::Type::ProtectionViolation);
-    if (fault.access() == PageFault::Access::Write && is_writable() && should_cow(page_index_in_region)) {
+    if (fault.access() == PageFault::Access::Write && is_writable() && (should_cow(page_index_in_region) || is_mapping_shared_zero_page(page_index_in_region))) {
 #ifdef PAGE_FAULT_DEBUG
         dbgprintf("PV(cow) fault in Region{%p}[%u]\n", this, page_index_in_region);
 #endif
@@ -358,7 +388,29 @@ PageFaultResponse Region::handle_fault(const PageFault& fault)
     return PageFaultResponse::ShouldCrash;
 }
 
-PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region)
+bool Region::prepare_page_for_write(size_t page_index_in_region)
+{
+    if (!is_writable() || !vmobject().is_anonymous())
+        return false;
+    InterruptDisabler disabler;
+    auto& physical_page = vmobject().physical_pages()[first_page_index() + page_index_in_region];
+    PageFaultResponse response = PageFaultResponse::Continue;
+    if (physical_page.is_null())
+        response = handle_zero_fault(page_index_in_region, PageFault::Access::Write);
+    else if (should_cow(page_index_in_region) || MM.is_shared_zero_page(*physical_page))
+        response = handle_cow_fault(page_index_in_region);
+    else
+        remap_page(page_index_in_region);
+    return response == PageFaultResponse::Continue;
+}
+
+bool Region::is_mapping_shared_zero_page(size_t page_index_in_region) const
+{
+    auto& physical_page = vmobject().physical_pages()[first_page_index() + page_index_in_region];
+    return physical_page && MM.is_shared_zero_page(*physical_page);
+}
+
+PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region, PageFault::Access access)
 {
     ASSERT_INTERRUPTS_DISABLED();
     ASSERT(vmobject().is_anonymous());
@@ -377,6 +429,16 @@ PageFaultResponse Region::handle_zero_fault(size_t page_index_in_region)
         return PageFaultResponse::Continue;
     }
 
+    // Memory that's only ever read doesn't need a page of its own.
+    // Purgeable memory is left out, since purging it should actually free something.
+    if (access == PageFault::Access::Read && is_user_accessible() && !vmobject().is_purgeable()) {
+        if (current)
+            current->did_zero_page_map();
+        vmobject_physical_page_entry = MM.shared_zero_page();
+        remap_page(page_index_in_region);
+        return PageFaultResponse::Continue;
+    }
+
     if (current)
         current->did_zero_fault();
 
@@ -398,6 +460,29 @@ PageFaultResponse Region::handle_cow_fault(size_t page_index_in_region)
 {
     ASSERT_INTERRUPTS_DISABLED();
     auto& vmobject_physical_page_entry = vmobject().physical_pages()[first_page_index() + page_index_in_region];
+
+    if (MM.is_shared_zero_page(*vmobject_physical_page_entry)) {
+        // First write to a page that has only been read so far. Nothing to copy.
+        if (current)
+            current->did_zero_fault();
+        auto physical_page = MM.allocate_user_physical_page(MemoryManager::ShouldZeroFill::Yes);
+        if (physical_page.is_null()) {
+            kprintf("MM: handle_cow_fault was unable to allocate a physical page\n");
+            return PageFaultResponse::ShouldCrash;
+        }
+        vmobject_physical_page_entry = move(physical_page);
+        set_should_cow(page_index_in_region, false);
+        // Any other region mapping this VMObject (e.g a shared mapping) still points at the zero page.
+        size_t vmobject_page_index = first_page_index() + page_index_in_region;
+        vmobject().for_each_region([&](auto& region) {
+            if (&region == this || !region.m_page_directory)
+                return;
+            if (vmobject_page_index >= region.first_page_index() && vmobject_page_index <= region.last_page_index())
+                region.remap_page(vmobject_page_index - region.first_page_index());
+        });
+        remap_page(page_index_in_region);
+        return PageFaultResponse::Continue;
+    }
     if (vmobject_physical_page_entry->ref_count() == 1) {
 #ifdef PAGE_FAULT_DEBUG
         dbgprintf("    >> It's a COW page but nobody is sharing it anymore. Remap r/w\n");
@@ -437,6 +522,24 @@ PageFaultResponse Region::handle_inode_fault(size_t page_index_in_region)
     ASSERT_INTERRUPTS_DISABLED();
     ASSERT(vmobject().is_inode());
     auto& inode_vmobject = static_cast<InodeVMObject&>(vmobject());
+
+    if (inode_vmobject.inode().has_page_cache()) {
+        // The pages belong to the inode's page cache, so let the inode fill them; read() sees the very same pages.
+        if (current)
+            current->did_inode_fault();
+        sti();
+        auto result = inode_vmobject.inode().page_in(first_page_index() + page_index_in_region);
+        cli();
+        if (result.is_error()) {
+            kprintf("MM: handle_inode_fault had error (%d) while paging in!\n", result.error());
+            return PageFaultResponse::ShouldCrash;
+        }
+        // If the page was reclaimed again already, we'll simply fault on it once more.
+        if (inode_vmobject.physical_pages()[first_page_index() + page_index_in_region])
+            remap_page(page_index_in_region);
+        return PageFaultResponse::Continue;
+    }
+
     auto& vmobject_physical_page_entry = inode_vmobject.physical_pages()[first_page_index() + page_index_in_region];
 
     sti();
@@ -88,6 +88,9 @@ public:
     void set_user_accessible(bool b) { m_user_accessible = b; }
 
     PageFaultResponse handle_fault(const PageFault&);
+    // Gets a page of an anonymous region mapped writable ahead of time, as if it had been written to,
+    // for when it's going to be written from somewhere that can't take a page fault.
+    bool prepare_page_for_write(size_t page_index);
 
     NonnullOwnPtr<Region> clone();
 
@@ -132,6 +135,7 @@ public:
     size_t amount_resident() const;
     size_t amount_shared() const;
     size_t amount_dirty() const;
+    size_t amount_zero_mapped() const;
 
     bool should_cow(size_t page_index) const;
     void set_should_cow(size_t page_index, bool);
@@ -152,6 +156,8 @@ public:
 
     void remap();
     void remap_page(size_t index);
+    // Takes away write access from the pages that are currently mapped, without flushing the TLB.
+    void write_protect_mapped_pages();
 
     // For InlineLinkedListNode
     Region* m_next { nullptr };
@@ -175,7 +181,8 @@ private:
 
     PageFaultResponse handle_cow_fault(size_t page_index);
     PageFaultResponse handle_inode_fault(size_t page_index);
-    PageFaultResponse handle_zero_fault(size_t page_index);
+    PageFaultResponse handle_zero_fault(size_t page_index, PageFault::Access);
+    bool is_mapping_shared_zero_page(size_t page_index) const;
 
     void map_individual_page_impl(size_t page_index);
 
@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <Kernel/Process.h>
 #include <Kernel/Thread.h>
 #include <Kernel/WaitQueue.h>
 
@@ -56,9 +57,31 @@ void WaitQueue::wake_one(Atomic<bool>* lock)
 void WaitQueue::wake_all()
 {
     InterruptDisabler disabler;
-    if (m_threads.is_empty())
+    if (m_threads.is_empty() && m_watchers.is_empty())
         return;
     while (!m_threads.is_empty())
         m_threads.take_first()->wake_from_queue();
+    if (!m_watchers.is_empty()) {
+        timeval now;
+        kgettimeofday(now);
+        for (auto& watcher : m_watchers) {
+            if (watcher.m_thread.is_blocked())
+                watcher.m_thread.consider_unblock(now.tv_sec, now.tv_usec);
+        }
+    }
     Scheduler::stop_idling();
 }
+
+WaitQueueWatcher::WaitQueueWatcher(WaitQueue& queue, Thread& thread)
+    : m_thread(thread)
+{
+    InterruptDisabler disabler;
+    queue.m_watchers.append(*this);
+}
+
+WaitQueueWatcher::~WaitQueueWatcher()
+{
+    InterruptDisabler disabler;
+    if (m_node.is_in_list())
+        m_node.remove();
+}
@@ -30,6 +30,25 @@
 #include <AK/SinglyLinkedList.h>
 #include <Kernel/Thread.h>
 
+class WaitQueue;
+
+// Lets a blocked thread (in read(), select() and the like) watch a WaitQueue without
+// leaving the Blocked state: wake_all() makes its blocker re-check its condition.
+// Unlike enqueue(), one thread can watch any number of queues at once, since each
+// watcher brings its own list node.
+class WaitQueueWatcher {
+    AK_MAKE_NONCOPYABLE(WaitQueueWatcher)
+    AK_MAKE_NONMOVABLE(WaitQueueWatcher)
+public:
+    WaitQueueWatcher(WaitQueue&, Thread&);
+    ~WaitQueueWatcher();
+
+private:
+    friend class WaitQueue;
+    IntrusiveListNode m_node;
+    Thread& m_thread;
+};
+
 class WaitQueue {
 public:
     WaitQueue();
@@ -40,6 +59,9 @@ public:
     void wake_all();
 
 private:
+    friend class WaitQueueWatcher;
+
     typedef IntrusiveList<Thread, &Thread::m_wait_queue_node> ThreadList;
     ThreadList m_threads;
+    IntrusiveList<WaitQueueWatcher, &WaitQueueWatcher::m_node> m_watchers;
 };
@@ -70,6 +70,7 @@
 #include <Kernel/Random.h>
 #include <Kernel/TTY/PTYMultiplexer.h>
 #include <Kernel/TTY/VirtualConsole.h>
+#include <Kernel/TimerQueue.h>
 #include <Kernel/VM/MemoryManager.h>
 
 [[noreturn]] static void init_stage2();
@@ -77,6 +78,7 @@ static void setup_serial_debug();
 static void setup_acpi();
 static void setup_vmmouse();
 static void setup_pci();
+static bool setup_apic();
 
 VirtualConsole* tty0;
 
@@ -100,6 +102,7 @@ extern "C" [[noreturn]] void init()
     new KParams(String(reinterpret_cast<const char*>(low_physical_to_virtual(multiboot_info_ptr->cmdline))));
 
     MemoryManager::initialize();
+    kmalloc_enable_expansion();
 
     bool text_debug = KParams::the().has("text_debug");
 
@@ -145,7 +148,10 @@ extern "C" [[noreturn]] void init()
 
     setup_pci();
 
-    PIT::initialize();
+    // The PIT is always our clock source. It only needs to drive the scheduler
+    // when there's no local APIC timer to program one-shot events with.
+    bool have_apic = setup_apic();
+    PIT::initialize(!(have_apic && APIC::init_timer()));
 
     if (text_debug) {
         dbgprintf("Text mode enabled\n");
@@ -172,8 +178,12 @@ extern "C" [[noreturn]] void init()
     Thread* syncd_thread = nullptr;
     Process::create_kernel_process(syncd_thread, "syncd", [] {
         for (;;) {
-            VFS::the().sync();
-            current->sleep(1 * TICKS_PER_SECOND);
+            // Write back blocks that have been dirty for a while (or too many of them),
+            // so foreground reads don't end up paying for it.
+            FS::writeback_all();
+            // Grow the kernel heap ahead of demand rather than in the middle of an allocation.
+            kmalloc_expand_if_needed();
+            current->sleep(250 * TimeUnit::MS);
         }
     });
 
@@ -456,3 +466,22 @@ void setup_pci()
     }
     PCI::Initializer::the().dismiss();
 }
+
+bool setup_apic()
+{
+    if (KParams::the().has("apic")) {
+        auto apic = KParams::the().get("apic");
+        if (apic == "off")
+            return false;
+        if (apic != "on") {
+            kprintf("apic boot argument has an invalid value.\n");
+            hang();
+        }
+    }
+    if (!APIC::init()) {
+        kprintf("APIC: Not available, using the PIT for timer interrupts\n");
+        return false;
+    }
+    APIC::enable(0);
+    return true;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <AK/String.h>
+#include <AK/Vector.h>
+#include <Kernel/Syscall.h>
+#include <alloca.h>
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct __posix_spawn_file_actions_state {
+    Vector<Syscall::SC_posix_spawn_file_action> actions;
+    // Keeps the strings that the open actions point at alive.
+    Vector<String> paths;
+};
+
+extern "C" {
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
+{
+    if (!envp)
+        envp = environ;
+
+    size_t arg_count = 0;
+    for (size_t i = 0; argv[i]; ++i)
+        ++arg_count;
+
+    size_t env_count = 0;
+    for (size_t i = 0; envp[i]; ++i)
+        ++env_count;
+
+    auto copy_strings = [&](auto& vec, size_t count, auto& output) {
+        output.length = count;
+        for (size_t i = 0; vec[i]; ++i) {
+            output.strings[i].characters = vec[i];
+            output.strings[i].length = strlen(vec[i]);
+        }
+    };
+
+    Syscall::SC_posix_spawn_params params;
+    params.arguments.strings = (Syscall::StringArgument*)alloca(arg_count * sizeof(Syscall::StringArgument));
+    params.environment.strings = (Syscall::StringArgument*)alloca(env_count * sizeof(Syscall::StringArgument));
+
+    params.path = { path, strlen(path) };
+    copy_strings(argv, arg_count, params.arguments);
+    copy_strings(envp, env_count, params.environment);
+
+    if (file_actions && file_actions->state) {
+        params.file_actions = file_actions->state->actions.data();
+        params.file_action_count = file_actions->state->actions.size();
+    } else {
+        params.file_actions = nullptr;
+        params.file_action_count = 0;
+    }
+
+    if (attr) {
+        params.flags = attr->flags;
+        params.pgroup = attr->pgroup;
+        params.sigmask = attr->sigmask;
+        params.tty_fd = attr->tcsetpgrp_fd;
+    } else {
+        params.flags = 0;
+        params.pgroup = 0;
+        params.sigmask = 0;
+        params.tty_fd = -1;
+    }
+
+    int rc = syscall(SC_posix_spawn, &params);
+    if (rc < 0)
+        return -rc;
+    if (pid)
+        *pid = rc;
+    return 0;
+}
+
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
+{
+    if (strchr(file, '/'))
+        return posix_spawn(pid, file, file_actions, attr, argv, envp);
+
+    String path = getenv("PATH");
+    if (path.is_empty())
+        path = "/bin:/usr/bin";
+    auto parts = path.split(':');
+    // Like execvp(), keep looking past entries we can't use, and only report
+    // EACCES if one of them had the file but none of them worked.
+    bool saw_eacces = false;
+    for (auto& part : parts) {
+        auto candidate = String::format("%s/%s", part.characters(), file);
+        int rc = posix_spawn(pid, candidate.characters(), file_actions, attr, argv, envp);
+        if (rc == EACCES) {
+            saw_eacces = true;
+            continue;
+        }
+        if (rc != ENOENT && rc != ENOTDIR)
+            return rc;
+    }
+    return saw_eacces ? EACCES : ENOENT;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* file_actions)
+{
+    file_actions->state = new __posix_spawn_file_actions_state;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* file_actions)
+{
+    delete file_actions->state;
+    file_actions->state = nullptr;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* file_actions, int fd)
+{
+    if (fd < 0)
+        return EBADF;
+    Syscall::SC_posix_spawn_file_action action {};
+    action.type = Syscall::SpawnFileActionType::Close;
+    action.fd = fd;
+    file_actions->state->actions.append(action);
+    return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* file_actions, int old_fd, int new_fd)
+{
+    if (old_fd < 0 || new_fd < 0)
+        return EBADF;
+    Syscall::SC_posix_spawn_file_action action {};
+    action.type = Syscall::SpawnFileActionType::Dup2;
+    action.fd = old_fd;
+    action.new_fd = new_fd;
+    file_actions->state->actions.append(action);
+    return 0;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* file_actions, int fd, const char* path, int flags, mode_t mode)
+{
+    if (fd < 0)
+        return EBADF;
+    String path_string = path;
+    Syscall::SC_posix_spawn_file_action action {};
+    action.type = Syscall::SpawnFileActionType::Open;
+    action.fd = fd;
+    action.options = flags;
+    action.mode = mode;
+    action.path = { path_string.characters(), path_string.length() };
+    file_actions->state->actions.append(action);
+    file_actions->state->paths.append(move(path_string));
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t* attr)
+{
+    attr->flags = 0;
+    attr->pgroup = 0;
+    attr->sigdefault = 0;
+    attr->sigmask = 0;
+    attr->tcsetpgrp_fd = -1;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t*)
+{
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t* attr, short* flags)
+{
+    *flags = attr->flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags)
+{
+    if (flags & ~(POSIX_SPAWN_RESETIDS | POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSID | POSIX_SPAWN_TCSETPGROUP))
+        return EINVAL;
+    attr->flags = flags;
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* attr, pid_t* pgroup)
+{
+    *pgroup = attr->pgroup;
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t* attr, pid_t pgroup)
+{
+    attr->pgroup = pgroup;
+    return 0;
+}
+
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t* attr, sigset_t* sigdefault)
+{
+    *sigdefault = attr->sigdefault;
+    return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t* attr, const sigset_t* sigdefault)
+{
+    // Every signal disposition is reset to the default on exec anyway, so this is only kept around for getsigdefault().
+    attr->sigdefault = *sigdefault;
+    return 0;
+}
+
+int posix_spawnattr_getsigmask(const posix_spawnattr_t* attr, sigset_t* sigmask)
+{
+    *sigmask = attr->sigmask;
+    return 0;
+}
+
+int posix_spawnattr_setsigmask(posix_spawnattr_t* attr, const sigset_t* sigmask)
+{
+    attr->sigmask = *sigmask;
+    return 0;
+}
+
+int posix_spawnattr_tcsetpgrp_np(posix_spawnattr_t* attr, int fd)
+{
+    attr->tcsetpgrp_fd = fd;
+    return 0;
+}
+}
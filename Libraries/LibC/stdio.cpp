@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -582,30 +583,24 @@ FILE* popen(const char* command, const char* type)
         return nullptr;
     }
 
-    pid_t child_pid = fork();
-    if (!child_pid) {
-        if (*type == 'r') {
-            int rc = dup2(pipe_fds[1], STDOUT_FILENO);
-            if (rc < 0) {
-                perror("dup2");
-                exit(1);
-            }
-            close(pipe_fds[0]);
-            close(pipe_fds[1]);
-        } else if (*type == 'w') {
-            int rc = dup2(pipe_fds[0], STDIN_FILENO);
-            if (rc < 0) {
-                perror("dup2");
-                exit(1);
-            }
-            close(pipe_fds[0]);
-            close(pipe_fds[1]);
-        }
-
-        int rc = execl("/bin/sh", "sh", "-c", command, nullptr);
-        if (rc < 0)
-            perror("execl");
-        exit(1);
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    if (*type == 'r')
+        posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[1], STDOUT_FILENO);
+    else
+        posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&file_actions, pipe_fds[0]);
+    posix_spawn_file_actions_addclose(&file_actions, pipe_fds[1]);
+
+    pid_t child_pid;
+    const char* argv[] = { "sh", "-c", command, nullptr };
+    rc = posix_spawn(&child_pid, "/bin/sh", &file_actions, nullptr, const_cast<char**>(argv), environ);
+    posix_spawn_file_actions_destroy(&file_actions);
+    if (rc != 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        errno = rc;
+        return nullptr;
     }
 
     FILE* fp = nullptr;
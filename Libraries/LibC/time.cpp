@@ -46,16 +46,69 @@ time_t time(time_t* tloc)
     return tv.tv_sec;
 }
 
-int gettimeofday(struct timeval* __restrict__ tv, void* __restrict__)
+static volatile KernelInfoPage* kernel_info_page()
 {
     static volatile KernelInfoPage* kernel_info;
     if (!kernel_info)
         kernel_info = (volatile KernelInfoPage*)syscall(SC_get_kernel_info_page);
+    return kernel_info;
+}
+
+static inline u64 read_tsc()
+{
+    u32 lsw;
+    u32 msw;
+    asm volatile("rdtsc"
+                 : "=a"(lsw), "=d"(msw));
+    return ((u64)msw << 32) | lsw;
+}
+
+// Extrapolates from the kernel's last clock update using the TSC, without entering the kernel.
+// Returns false if the TSC can't be used, or the last update is too old to extrapolate from.
+static bool read_clock_from_kernel_info_page(u64& nanoseconds_since_boot, time_t& boot_time)
+{
+    auto* kernel_info = kernel_info_page();
+    for (;;) {
+        u32 serial = kernel_info->serial;
+        if (serial & 1)
+            continue;
+        asm volatile("" ::: "memory");
+        u32 multiplier = kernel_info->tsc_multiplier;
+        if (!multiplier)
+            return false;
+        u32 shift = kernel_info->tsc_shift;
+        u64 base = kernel_info->monotonic_ns;
+        u64 tsc_at_update = kernel_info->tsc_at_update;
+        boot_time = kernel_info->boot_time;
+        u64 tsc = read_tsc();
+        asm volatile("" ::: "memory");
+        if (serial != kernel_info->serial)
+            continue;
+
+        u64 ticks = tsc - tsc_at_update;
+        if (ticks >> 32)
+            return false;
+        nanoseconds_since_boot = base + ((ticks * multiplier) >> shift);
+        return true;
+    }
+}
+
+int gettimeofday(struct timeval* __restrict__ tv, void* __restrict__)
+{
+    u64 nanoseconds_since_boot;
+    time_t boot_time;
+    if (read_clock_from_kernel_info_page(nanoseconds_since_boot, boot_time)) {
+        tv->tv_sec = boot_time + nanoseconds_since_boot / 1000000000;
+        tv->tv_usec = (nanoseconds_since_boot % 1000000000) / 1000;
+        return 0;
+    }
 
+    // Without a usable TSC, settle for the time as of the last tick.
+    auto* kernel_info = kernel_info_page();
     for (;;) {
         auto serial = kernel_info->serial;
         *tv = const_cast<struct timeval&>(kernel_info->now);
-        if (serial == kernel_info->serial)
+        if (!(serial & 1) && serial == kernel_info->serial)
             break;
     }
     return 0;
@@ -159,6 +212,18 @@ clock_t clock()
 
 int clock_gettime(clockid_t clock_id, struct timespec* ts)
 {
+    if (clock_id == CLOCK_MONOTONIC || clock_id == CLOCK_REALTIME) {
+        u64 nanoseconds_since_boot;
+        time_t boot_time;
+        if (read_clock_from_kernel_info_page(nanoseconds_since_boot, boot_time)) {
+            ts->tv_sec = nanoseconds_since_boot / 1000000000;
+            ts->tv_nsec = nanoseconds_since_boot % 1000000000;
+            if (clock_id == CLOCK_REALTIME)
+                ts->tv_sec += boot_time;
+            return 0;
+        }
+    }
+
     int rc = syscall(SC_clock_gettime, clock_id, ts);
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
@@ -170,9 +235,10 @@ int clock_nanosleep(clockid_t clock_id, int flags, const struct timespec* reques
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
-int clock_getres(clockid_t, struct timespec*)
+int clock_getres(clockid_t clock_id, struct timespec* result)
 {
-    ASSERT_NOT_REACHED();
+    int rc = syscall(SC_clock_getres, clock_id, result);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
 struct tm* gmtime_r(const time_t*, struct tm*)
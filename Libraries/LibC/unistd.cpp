@@ -616,9 +616,8 @@ void sysbeep()
 
 int fsync(int fd)
 {
-    UNUSED_PARAM(fd);
-    dbgprintf("FIXME: Implement fsync()\n");
-    return 0;
+    int rc = syscall(SC_fsync, fd);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
 int halt()
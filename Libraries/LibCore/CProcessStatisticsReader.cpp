@@ -68,6 +68,7 @@ HashMap<pid_t, Core::ProcessStatistics> ProcessStatisticsReader::get_all()
         process.amount_virtual = process_object.get("amount_virtual").to_u32();
         process.amount_resident = process_object.get("amount_resident").to_u32();
         process.amount_shared = process_object.get("amount_shared").to_u32();
+        process.amount_zero_mapped = process_object.get("amount_zero_mapped").to_u32();
         process.amount_dirty_private = process_object.get("amount_dirty_private").to_u32();
         process.amount_clean_inode = process_object.get("amount_clean_inode").to_u32();
         process.amount_purgeable_volatile = process_object.get("amount_purgeable_volatile").to_u32();
@@ -89,6 +90,7 @@ HashMap<pid_t, Core::ProcessStatistics> ProcessStatisticsReader::get_all()
             thread.syscall_count = thread_object.get("syscall_count").to_u32();
             thread.inode_faults = thread_object.get("inode_faults").to_u32();
             thread.zero_faults = thread_object.get("zero_faults").to_u32();
+            thread.zero_page_maps = thread_object.get("zero_page_maps").to_u32();
             thread.cow_faults = thread_object.get("cow_faults").to_u32();
             thread.unix_socket_read_bytes = thread_object.get("unix_socket_read_bytes").to_u32();
             thread.unix_socket_write_bytes = thread_object.get("unix_socket_write_bytes").to_u32();
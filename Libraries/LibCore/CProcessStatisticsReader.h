@@ -39,6 +39,7 @@ struct ThreadStatistics {
     unsigned syscall_count;
     unsigned inode_faults;
     unsigned zero_faults;
+    unsigned zero_page_maps;
     unsigned cow_faults;
     unsigned unix_socket_read_bytes;
     unsigned unix_socket_write_bytes;
@@ -70,6 +71,7 @@ struct ProcessStatistics {
     size_t amount_virtual;
     size_t amount_resident;
     size_t amount_shared;
+    size_t amount_zero_mapped;
     size_t amount_dirty_private;
     size_t amount_clean_inode;
     size_t amount_purgeable_volatile;
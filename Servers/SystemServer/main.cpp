@@ -31,7 +31,9 @@
 #include <LibCore/CFile.h>
 #include <errno.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -87,18 +89,14 @@ static void check_for_test_mode()
 static void mount_all_filesystems()
 {
     dbg() << "Spawning mount -a to mount all filesystems.";
-    pid_t pid = fork();
-
-    if (pid < 0) {
-        perror("fork");
-        ASSERT_NOT_REACHED();
-    } else if (pid == 0) {
-        execl("/bin/mount", "mount", "-a", nullptr);
-        perror("exec");
+    pid_t pid;
+    const char* argv[] = { "mount", "-a", nullptr };
+    int rc = posix_spawn(&pid, "/bin/mount", nullptr, nullptr, const_cast<char**>(argv), environ);
+    if (rc != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(rc));
         ASSERT_NOT_REACHED();
-    } else {
-        wait(nullptr);
     }
+    wait(nullptr);
 }
 
 int main(int, char**)
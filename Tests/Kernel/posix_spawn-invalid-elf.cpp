@@ -0,0 +1,93 @@
+#include <LibELF/exec_elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool write_program(const char* path, const char* buffer, size_t size)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0777);
+    if (fd < 0) {
+        perror("open");
+        return false;
+    }
+    int nwritten = write(fd, buffer, size);
+    if (nwritten < 0) {
+        perror("write");
+        close(fd);
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static bool spawn_fails_with_enoexec(const char* path)
+{
+    char* argv[] = { const_cast<char*>(path), nullptr };
+    pid_t pid = -1;
+    int rc = posix_spawn(&pid, path, nullptr, nullptr, argv, nullptr);
+    if (rc != ENOEXEC) {
+        fprintf(stderr, "posix_spawn(%s) returned %d (%s), expected ENOEXEC\n", path, rc, strerror(rc));
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    char buffer[8192];
+    memset(buffer, 0, sizeof(buffer));
+
+    auto& header = *(Elf32_Ehdr*)buffer;
+    header.e_ident[EI_MAG0] = ELFMAG0;
+    header.e_ident[EI_MAG1] = ELFMAG1;
+    header.e_ident[EI_MAG2] = ELFMAG2;
+    header.e_ident[EI_MAG3] = ELFMAG3;
+    header.e_ident[EI_CLASS] = ELFCLASS32;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_ident[EI_ABIVERSION] = 0;
+    header.e_type = ET_EXEC;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf32_Ehdr);
+    header.e_machine = EM_386;
+    header.e_shentsize = sizeof(Elf32_Shdr);
+
+    header.e_phnum = 2;
+    header.e_phoff = 52;
+    header.e_phentsize = sizeof(Elf32_Phdr);
+
+    auto* ph = (Elf32_Phdr*)(&buffer[header.e_phoff]);
+    ph[0].p_vaddr = 0x20000000;
+    ph[0].p_type = PT_LOAD;
+    ph[0].p_filesz = PAGE_SIZE;
+    ph[0].p_memsz = PAGE_SIZE;
+    ph[0].p_flags = PF_R | PF_X;
+    ph[0].p_align = PAGE_SIZE;
+
+    // A second segment on top of the first one makes the ELF loader fail after exec() has
+    // already switched the child over to its new address space, which must then be rolled back.
+    ph[1] = ph[0];
+
+    header.e_entry = 0x20000000;
+
+    if (!write_program("/tmp/overlapping-segments", buffer, sizeof(buffer)))
+        return 1;
+    if (!spawn_fails_with_enoexec("/tmp/overlapping-segments"))
+        return 1;
+
+    // Same thing, but loading succeeds and the entry point is what gets rejected.
+    header.e_phnum = 1;
+    header.e_entry = 0;
+
+    if (!write_program("/tmp/zero-entry", buffer, sizeof(buffer)))
+        return 1;
+    if (!spawn_fails_with_enoexec("/tmp/zero-entry"))
+        return 1;
+
+    printf("PASS\n");
+    return 0;
+}
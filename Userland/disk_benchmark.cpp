@@ -58,11 +58,12 @@ Result average_result(const Vector<Result>& results)
 
 void exit_with_usage(int rc)
 {
-    fprintf(stderr, "Usage: disk_benchmark [-h] [-d directory] [-t time_per_benchmark] [-f file_size1,file_size2,...] [-b block_size1,block_size2,...]\n");
+    fprintf(stderr, "Usage: disk_benchmark [-h] [-c] [-d directory] [-t time_per_benchmark] [-f file_size1,file_size2,...] [-b block_size1,block_size2,...] [-r existing_file]\n");
     exit(rc);
 }
 
 Result benchmark(const String& filename, int file_size, int block_size, ByteBuffer& buffer, bool allow_cache);
+u64 read_benchmark(const String& filename, int block_size, ByteBuffer& buffer, bool allow_cache);
 
 int main(int argc, char** argv)
 {
@@ -71,9 +72,10 @@ int main(int argc, char** argv)
     Vector<int> file_sizes;
     Vector<int> block_sizes;
     bool allow_cache = false;
+    const char* read_only_file = nullptr;
 
     int opt;
-    while ((opt = getopt(argc, argv, "chd:t:f:b:")) != -1) {
+    while ((opt = getopt(argc, argv, "chd:t:f:b:r:")) != -1) {
         switch (opt) {
         case 'h':
             exit_with_usage(0);
@@ -95,6 +97,9 @@ int main(int argc, char** argv)
             for (auto size : String(optarg).split(','))
                 block_sizes.append(atoi(size.characters()));
             break;
+        case 'r':
+            read_only_file = optarg;
+            break;
         }
     }
 
@@ -105,6 +110,30 @@ int main(int argc, char** argv)
         block_sizes = { 8192, 32768, 65536 };
     }
 
+    if (read_only_file) {
+        // Sequentially read an existing file. The first pass of each block size starts out cold
+        // (unless something else already read the file) and shows the effect of readahead.
+        for (auto block_size : block_sizes) {
+            auto buffer = ByteBuffer::create_uninitialized(block_size);
+            printf("Running: file=%s block_size=%d\n", read_only_file, block_size);
+            Vector<u64> results;
+            Core::ElapsedTimer timer;
+            timer.start();
+            while (timer.elapsed() < time_per_benchmark * 1000) {
+                auto read_bps = read_benchmark(read_only_file, block_size, buffer, allow_cache);
+                if (results.is_empty())
+                    printf("First pass: read_bps=%llu\n", read_bps);
+                results.append(read_bps);
+            }
+            u64 average_read_bps = 0;
+            for (auto read_bps : results)
+                average_read_bps += read_bps;
+            average_read_bps /= results.size();
+            printf("Finished: runs=%d time=%dms read_bps=%llu\n", results.size(), timer.elapsed(), average_read_bps);
+        }
+        return 0;
+    }
+
     umask(0644);
 
     auto filename = String::format("%s/disk_benchmark.tmp", directory);
@@ -205,3 +234,39 @@ Result benchmark(const String& filename, int file_size, int block_size, ByteBuff
 
     return res;
 }
+
+u64 read_benchmark(const String& filename, int block_size, ByteBuffer& buffer, bool allow_cache)
+{
+    int flags = O_RDONLY;
+    if (!allow_cache)
+        flags |= O_DIRECT;
+
+    int fd = open(filename.characters(), flags);
+    if (fd == -1) {
+        perror("open");
+        exit(1);
+    }
+
+    Core::ElapsedTimer timer;
+    timer.start();
+    u64 nread = 0;
+    for (;;) {
+        int n = read(fd, buffer.data(), block_size);
+        if (n < 0) {
+            perror("read");
+            close(fd);
+            exit(1);
+        }
+        if (n == 0)
+            break;
+        nread += n;
+    }
+    auto elapsed = timer.elapsed();
+
+    if (close(fd) != 0) {
+        perror("close");
+        exit(1);
+    }
+
+    return (elapsed ? (nread / elapsed) : nread) * 1000;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Types.h>
+#include <getopt.h>
+#include <mman.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Measures fork()+_exit(), fork()+exec() and posix_spawn() round trips. Touching some memory in
+// the parent first shows how the cost of fork scales with the size of the address space.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: fork_benchmark [-h] [-n iterations] [-m megabytes_to_touch] [-e program]\n");
+    exit(rc);
+}
+
+static u64 now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static bool wait_for(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 200;
+    size_t megabytes = 16;
+    const char* program = "/bin/true";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:m:e:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'm':
+            megabytes = atoi(optarg);
+            break;
+        case 'e':
+            program = optarg;
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (iterations <= 0)
+        exit_with_usage(1);
+
+    size_t size = megabytes * 1024 * 1024;
+    if (size) {
+        auto* data = (u8*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        memset(data, 1, size);
+    }
+
+    u64 start = now_usec();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0)
+            _exit(0);
+        if (!wait_for(pid))
+            return 1;
+    }
+    u64 fork_exit_usec = now_usec() - start;
+
+    start = now_usec();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            execl(program, program, nullptr);
+            perror("execl");
+            _exit(1);
+        }
+        if (!wait_for(pid))
+            return 1;
+    }
+    u64 fork_exec_usec = now_usec() - start;
+
+    start = now_usec();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid;
+        const char* spawn_argv[] = { program, nullptr };
+        int rc = posix_spawn(&pid, program, nullptr, nullptr, const_cast<char**>(spawn_argv), environ);
+        if (rc != 0) {
+            fprintf(stderr, "posix_spawn: %s\n", strerror(rc));
+            return 1;
+        }
+        if (!wait_for(pid))
+            return 1;
+    }
+    u64 spawn_usec = now_usec() - start;
+
+    printf("touched_mb=%zu iterations=%d fork_exit_us=%llu fork_exec_us=%llu spawn_us=%llu\n",
+        megabytes,
+        iterations,
+        fork_exit_usec / iterations,
+        fork_exec_usec / iterations,
+        spawn_usec / iterations);
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Vector.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Measures how page fault and syscall buffer validation cost scale with the number of
+// regions in the address space. Every mapping is its own one-page region.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: mmap_benchmark [-h] [-n region_count1,region_count2,...] [-s syscalls_per_count]\n");
+    exit(rc);
+}
+
+static u64 now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int main(int argc, char** argv)
+{
+    Vector<int> region_counts;
+    int syscall_count = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:s:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            for (auto count : String(optarg).split(','))
+                region_counts.append(atoi(count.characters()));
+            break;
+        case 's':
+            syscall_count = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (region_counts.is_empty())
+        region_counts = { 16, 256, 1024, 4096 };
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) {
+        perror("open");
+        return 1;
+    }
+
+    for (auto region_count : region_counts) {
+        Vector<u8*> pages;
+        pages.ensure_capacity(region_count);
+        for (int i = 0; i < region_count; ++i) {
+            auto* page = (u8*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+            if (page == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            pages.append(page);
+        }
+
+        // First touch of each page takes a fault that has to find its region.
+        u64 start = now_usec();
+        for (auto* page : pages)
+            *page = 1;
+        u64 fault_usec = now_usec() - start;
+
+        // write() validates the source buffer against the region list on the way in.
+        start = now_usec();
+        for (int i = 0; i < syscall_count; ++i) {
+            if (write(null_fd, pages[(i * 7919) % region_count], 1) < 0) {
+                perror("write");
+                return 1;
+            }
+        }
+        u64 syscall_usec = now_usec() - start;
+
+        printf("regions=%d faults=%d fault_ns=%llu syscalls=%d syscall_ns=%llu\n",
+            region_count,
+            region_count,
+            fault_usec * 1000 / region_count,
+            syscall_count,
+            syscall_usec * 1000 / syscall_count);
+
+        for (auto* page : pages)
+            munmap(page, PAGE_SIZE);
+    }
+
+    close(null_fd);
+    return 0;
+}
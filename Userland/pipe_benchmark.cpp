@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Types.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Bounces a byte back and forth between two processes over a pair of pipes.
+// Each round trip is two blocking reads, so this measures wakeup latency.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: pipe_benchmark [-h] [-n round_trips]\n");
+    exit(rc);
+}
+
+int main(int argc, char** argv)
+{
+    int round_trips = 10000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            round_trips = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    int ping[2];
+    int pong[2];
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    if (child == 0) {
+        close(ping[1]);
+        close(pong[0]);
+        char ch;
+        while (read(ping[0], &ch, 1) == 1) {
+            if (write(pong[1], &ch, 1) != 1)
+                break;
+        }
+        _exit(0);
+    }
+
+    close(ping[0]);
+    close(pong[1]);
+
+    struct timeval start;
+    gettimeofday(&start, nullptr);
+    for (int i = 0; i < round_trips; ++i) {
+        char ch = 'x';
+        if (write(ping[1], &ch, 1) != 1 || read(pong[0], &ch, 1) != 1) {
+            perror("ping-pong");
+            return 1;
+        }
+    }
+    struct timeval end;
+    gettimeofday(&end, nullptr);
+
+    close(ping[1]);
+    waitpid(child, nullptr, 0);
+
+    u64 elapsed_usec = (u64)(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    printf("round_trips=%d time=%llums round_trip_us=%llu\n", round_trips, elapsed_usec / 1000, elapsed_usec / round_trips);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/String.h>
+#include <AK/Vector.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Measures context switch cost while a growing number of idle threads sit blocked.
+// Two threads take turns calling sched_yield(); ideally the idle ones cost nothing.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: sched_benchmark [-h] [-n idle_thread_count1,idle_thread_count2,...] [-y yields]\n");
+    exit(rc);
+}
+
+static u64 now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int s_idle_pipe[2];
+static volatile bool s_stop_yielding;
+
+static void* idle_thread(void*)
+{
+    char ch;
+    read(s_idle_pipe[0], &ch, 1);
+    return nullptr;
+}
+
+static void* yield_thread(void*)
+{
+    while (!s_stop_yielding)
+        sched_yield();
+    return nullptr;
+}
+
+int main(int argc, char** argv)
+{
+    Vector<int> idle_thread_counts;
+    int yield_count = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:y:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            for (auto count : String(optarg).split(','))
+                idle_thread_counts.append(atoi(count.characters()));
+            break;
+        case 'y':
+            yield_count = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (idle_thread_counts.is_empty())
+        idle_thread_counts = { 0, 10, 100, 1000 };
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, PTHREAD_STACK_MIN);
+
+    for (auto idle_thread_count : idle_thread_counts) {
+        if (pipe(s_idle_pipe) < 0) {
+            perror("pipe");
+            return 1;
+        }
+
+        Vector<pthread_t> idle_threads;
+        for (int i = 0; i < idle_thread_count; ++i) {
+            pthread_t thread;
+            if (pthread_create(&thread, &attributes, idle_thread, nullptr) < 0) {
+                perror("pthread_create");
+                return 1;
+            }
+            idle_threads.append(thread);
+        }
+
+        s_stop_yielding = false;
+        pthread_t yielder;
+        if (pthread_create(&yielder, &attributes, yield_thread, nullptr) < 0) {
+            perror("pthread_create");
+            return 1;
+        }
+
+        u64 start = now_usec();
+        for (int i = 0; i < yield_count; ++i)
+            sched_yield();
+        u64 elapsed_usec = now_usec() - start;
+
+        s_stop_yielding = true;
+        pthread_join(yielder, nullptr);
+
+        // Closing the write end wakes every idle thread with EOF.
+        close(s_idle_pipe[1]);
+        for (auto thread : idle_threads)
+            pthread_join(thread, nullptr);
+        close(s_idle_pipe[0]);
+
+        printf("idle_threads=%d yields=%d time=%llums yield_ns=%llu\n",
+            idle_thread_count,
+            yield_count,
+            elapsed_usec / 1000,
+            elapsed_usec * 1000 / yield_count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Types.h>
+#include <LibCore/CProcessStatisticsReader.h>
+#include <getopt.h>
+#include <mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Reads through a large anonymous mapping that's never been written, then writes
+// to a fraction of its pages, and reports how much memory that actually took.
+// Read-only pages should all share the kernel's zero page.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: sparse_benchmark [-h] [-m megabytes] [-w write_every_nth_page]\n");
+    exit(rc);
+}
+
+static u64 now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void print_memory_usage(const char* phase)
+{
+    auto all_processes = Core::ProcessStatisticsReader::get_all();
+    auto it = all_processes.find(getpid());
+    if (it == all_processes.end())
+        return;
+    printf("phase=%s resident_kb=%zu zero_mapped_kb=%zu\n", phase, it->value.amount_resident / 1024, it->value.amount_zero_mapped / 1024);
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = 64;
+    size_t write_stride = 16;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hm:w:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'm':
+            megabytes = atoi(optarg);
+            break;
+        case 'w':
+            write_stride = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (!megabytes || !write_stride)
+        exit_with_usage(1);
+
+    size_t size = megabytes * 1024 * 1024;
+    size_t page_count = size / PAGE_SIZE;
+    void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    auto* data = (volatile u8*)region;
+
+    u64 start = now_usec();
+    u32 sum = 0;
+    for (size_t i = 0; i < page_count; ++i)
+        sum += data[i * PAGE_SIZE];
+    u64 read_usec = now_usec() - start;
+    if (sum != 0) {
+        fprintf(stderr, "Fresh anonymous memory wasn't zero!\n");
+        return 1;
+    }
+    printf("read_pages=%zu read_fault_ns=%llu\n", page_count, read_usec * 1000 / page_count);
+    print_memory_usage("after_read");
+
+    start = now_usec();
+    size_t written = 0;
+    for (size_t i = 0; i < page_count; i += write_stride) {
+        data[i * PAGE_SIZE] = 1;
+        ++written;
+    }
+    u64 write_usec = now_usec() - start;
+    printf("written_pages=%zu write_fault_ns=%llu\n", written, write_usec * 1000 / written);
+    print_memory_usage("after_write");
+
+    munmap(region, size);
+    return 0;
+}
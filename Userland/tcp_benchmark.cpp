@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/StdLibExtras.h>
+#include <AK/Types.h>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Streams data from a child process to its parent over a TCP connection on the loopback
+// interface, and reports the throughput.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: tcp_benchmark [-h] [-m megabytes] [-b buffer_size] [-p port]\n");
+    exit(rc);
+}
+
+int main(int argc, char** argv)
+{
+    int megabytes = 64;
+    int buffer_size = 64 * KB;
+    int port = 8000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hm:b:p:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'm':
+            megabytes = atoi(optarg);
+            break;
+        case 'b':
+            buffer_size = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (megabytes <= 0 || buffer_size <= 0)
+        exit_with_usage(1);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    if (listen(listen_fd, 1) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    auto* buffer = (u8*)malloc(buffer_size);
+    memset(buffer, 'x', buffer_size);
+    u64 total_bytes = (u64)megabytes * MB;
+
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    if (child == 0) {
+        close(listen_fd);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+            perror("connect");
+            _exit(1);
+        }
+        for (u64 sent = 0; sent < total_bytes;) {
+            ssize_t nwritten = write(fd, buffer, min((u64)buffer_size, total_bytes - sent));
+            if (nwritten <= 0) {
+                perror("write");
+                _exit(1);
+            }
+            sent += nwritten;
+        }
+        close(fd);
+        _exit(0);
+    }
+
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+        perror("accept");
+        return 1;
+    }
+
+    struct timeval start;
+    gettimeofday(&start, nullptr);
+    u64 received = 0;
+    while (received < total_bytes) {
+        ssize_t nread = read(fd, buffer, buffer_size);
+        if (nread < 0) {
+            perror("read");
+            return 1;
+        }
+        if (nread == 0)
+            break;
+        received += nread;
+    }
+    struct timeval end;
+    gettimeofday(&end, nullptr);
+
+    close(fd);
+    close(listen_fd);
+    waitpid(child, nullptr, 0);
+
+    u64 elapsed_usec = (u64)(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    if (!elapsed_usec)
+        elapsed_usec = 1;
+    printf("bytes=%llu time=%llums throughput=%llu KB/s\n", received, elapsed_usec / 1000, received * 1000000 / elapsed_usec / KB);
+    return received == total_bytes ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2018-2020, Andreas Kling <kling@serenityos.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <AK/Types.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Measures what it costs to read the clock, and how late clock_nanosleep() wakes up
+// for a range of sleep lengths.
+
+static void exit_with_usage(int rc)
+{
+    fprintf(stderr, "Usage: timer_benchmark [-h] [-n iterations]\n");
+    exit(rc);
+}
+
+static u64 now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 100;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:")) != -1) {
+        switch (opt) {
+        case 'h':
+            exit_with_usage(0);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            exit_with_usage(1);
+        }
+    }
+
+    if (iterations <= 0)
+        exit_with_usage(1);
+
+    struct timespec resolution;
+    if (clock_getres(CLOCK_MONOTONIC, &resolution) < 0) {
+        perror("clock_getres");
+        return 1;
+    }
+    printf("CLOCK_MONOTONIC resolution: %ld ns\n", resolution.tv_nsec);
+
+    static const int clock_reads = 100000;
+    u64 start = now_nsec();
+    for (int i = 0; i < clock_reads; ++i)
+        now_nsec();
+    printf("clock_gettime: %llu ns per call\n", (now_nsec() - start) / clock_reads);
+
+    start = now_nsec();
+    for (int i = 0; i < clock_reads; ++i) {
+        struct timeval tv;
+        gettimeofday(&tv, nullptr);
+    }
+    printf("gettimeofday: %llu ns per call\n", (now_nsec() - start) / clock_reads);
+
+    static const long sleep_lengths_us[] = { 10, 50, 100, 500, 1000, 5000, 20000 };
+    for (long sleep_us : sleep_lengths_us) {
+        u64 total_late = 0;
+        u64 worst_late = 0;
+        for (int i = 0; i < iterations; ++i) {
+            struct timespec request { 0, sleep_us * 1000 };
+            u64 start = now_nsec();
+            if (clock_nanosleep(CLOCK_MONOTONIC, 0, &request, nullptr) < 0) {
+                perror("clock_nanosleep");
+                return 1;
+            }
+            u64 elapsed = now_nsec() - start;
+            u64 late = elapsed > (u64)sleep_us * 1000 ? elapsed - sleep_us * 1000 : 0;
+            total_late += late;
+            if (late > worst_late)
+                worst_late = late;
+        }
+        printf("sleep %5ld us: average %llu us late, worst %llu us late\n", sleep_us, total_late / iterations / 1000, worst_late / 1000);
+    }
+    return 0;
+}